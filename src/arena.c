@@ -0,0 +1,86 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "arena.h"
+#include "heap.h"
+
+void arena_init(arena_t *arena, u32 blk_size)
+{
+	arena->blk = NULL;
+	arena->blk_size = blk_size ? blk_size : ARENA_BLK_SIZE;
+}
+
+void *arena_push(arena_t *arena, u32 size)
+{
+	arena_blk_t *blk = arena->blk;
+
+	size = ALIGN(size, 0x10);
+
+	//Start a new block if the current one is full, large buffers get one of their own.
+	if (!blk || blk->size - blk->used < size)
+	{
+		u32 blk_size = MAX(arena->blk_size, size + sizeof(arena_blk_t));
+		blk = (arena_blk_t *)malloc(blk_size);
+		if (!blk)
+			return NULL;
+		blk->prev = arena->blk;
+		blk->size = blk_size;
+		blk->used = sizeof(arena_blk_t);
+		arena->blk = blk;
+	}
+
+	void *res = (u8 *)blk + blk->used;
+	blk->used += size;
+	return res;
+}
+
+char *arena_strdup(arena_t *arena, const char *str)
+{
+	char *res = (char *)arena_push(arena, strlen(str) + 1);
+	strcpy(res, str);
+	return res;
+}
+
+arena_mark_t arena_mark(arena_t *arena)
+{
+	arena_mark_t mark;
+	mark.blk = arena->blk;
+	mark.used = arena->blk ? arena->blk->used : 0;
+	return mark;
+}
+
+void arena_reset(arena_t *arena, arena_mark_t mark)
+{
+	//Blocks are freed newest first, which lets the heap shrink its top again.
+	while (arena->blk != mark.blk)
+	{
+		arena_blk_t *prev = arena->blk->prev;
+		free(arena->blk);
+		arena->blk = prev;
+	}
+
+	if (arena->blk)
+		arena->blk->used = mark.used;
+}
+
+void arena_free(arena_t *arena)
+{
+	arena_mark_t mark;
+	mark.blk = NULL;
+	mark.used = 0;
+	arena_reset(arena, mark);
+}
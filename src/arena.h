@@ -0,0 +1,53 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "types.h"
+
+/*! Default size of the heap blocks an arena grows by. */
+#define ARENA_BLK_SIZE 0x10000
+
+typedef struct _arena_blk_t
+{
+	struct _arena_blk_t *prev;
+	u32 size;
+	u32 used;
+	u32 res;
+} arena_blk_t;
+
+/*! Bump allocator, everything pushed is released at once by arena_reset() or arena_free(). */
+typedef struct _arena_t
+{
+	arena_blk_t *blk;
+	u32 blk_size;
+} arena_t;
+
+typedef struct _arena_mark_t
+{
+	arena_blk_t *blk;
+	u32 used;
+} arena_mark_t;
+
+void arena_init(arena_t *arena, u32 blk_size);
+void *arena_push(arena_t *arena, u32 size);
+char *arena_strdup(arena_t *arena, const char *str);
+arena_mark_t arena_mark(arena_t *arena);
+void arena_reset(arena_t *arena, arena_mark_t mark);
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "bcache.h"
+#include "heap.h"
+
+static bcache_blk_t **_bcache_bucket(bcache_t *bc, u32 blk)
+{
+	return &bc->hash[(blk * 0x9E3779B1) >> 16 & bc->hash_mask];
+}
+
+static bcache_blk_t *_bcache_lookup(bcache_t *bc, u32 blk)
+{
+	for (bcache_blk_t *b = *_bcache_bucket(bc, blk); b; b = b->hnext)
+		if (b->blk == blk)
+			return b;
+	return NULL;
+}
+
+static void _bcache_unhash(bcache_t *bc, bcache_blk_t *b)
+{
+	bcache_blk_t **pb = _bcache_bucket(bc, b->blk);
+	while (*pb != b)
+		pb = &(*pb)->hnext;
+	*pb = b->hnext;
+	b->valid = 0;
+}
+
+static void _bcache_touch(bcache_t *bc, bcache_blk_t *b)
+{
+	//Most recently used blocks are kept at the front.
+	b->lru.prev->next = b->lru.next;
+	b->lru.next->prev = b->lru.prev;
+	list_prepend(&bc->lru, &b->lru);
+}
+
+static bcache_blk_t *_bcache_evict(bcache_t *bc)
+{
+	bcache_blk_t *b = CONTAINER_OF(bc->lru.prev, bcache_blk_t, lru);
+	if (b->valid)
+		_bcache_unhash(bc, b);
+	_bcache_touch(bc, b);
+	return b;
+}
+
+static bcache_blk_t *_bcache_fill(bcache_t *bc, u32 blk, u32 num_blks)
+{
+	bcache_blk_t *fill[BCACHE_MAX_RA];
+	sdmmc_iovec_t iov[BCACHE_MAX_RA];
+
+	//Read ahead only into blocks we don't have yet and never past the end of the device.
+	u32 n = 0;
+	while (n < num_blks && (!n || !_bcache_lookup(bc, blk + n)) &&
+		(!bc->dev_sectors || (blk + n) * bc->blk_sectors < bc->dev_sectors))
+	{
+		fill[n] = _bcache_evict(bc);
+		iov[n].buf = fill[n]->data;
+		iov[n].num_sectors = bc->blk_sectors;
+		n++;
+
+		//The last block of the device may be partial, only what exists of it is read.
+		if (bc->dev_sectors && (blk + n) * bc->blk_sectors > bc->dev_sectors)
+		{
+			iov[n - 1].num_sectors = bc->dev_sectors - (blk + n - 1) * bc->blk_sectors;
+			break;
+		}
+	}
+	if (!n)
+		return NULL;
+
+	bc->stats.cmds++;
+	if (!bc->ops->readv(bc->dev, blk * bc->blk_sectors, iov, n))
+		return NULL;
+
+	for (u32 i = 0; i < n; i++)
+	{
+		bcache_blk_t **pb = _bcache_bucket(bc, blk + i);
+		fill[i]->blk = blk + i;
+		fill[i]->valid = 1;
+		fill[i]->hnext = *pb;
+		*pb = fill[i];
+	}
+	bc->stats.ra_blks += n - 1;
+
+	//The requested block has to stay the most recently used one.
+	_bcache_touch(bc, fill[0]);
+	return fill[0];
+}
+
+int bcache_init(bcache_t *bc, const bcache_ops_t *ops, void *dev, u32 dev_sectors, u32 num_blks, u32 blk_sectors, u32 max_ra)
+{
+	memset(bc, 0, sizeof(bcache_t));
+	bc->ops = ops;
+	bc->dev = dev;
+	bc->dev_sectors = dev_sectors;
+	bc->num_blks = num_blks;
+	bc->blk_sectors = blk_sectors;
+	bc->max_ra = MIN(MIN(max_ra, BCACHE_MAX_RA), num_blks / 2);
+	bc->ra = 1;
+	list_init(&bc->lru);
+
+	//One bucket per block, rounded up to a power of two.
+	u32 num_buckets = 1;
+	while (num_buckets < num_blks)
+		num_buckets <<= 1;
+	bc->hash_mask = num_buckets - 1;
+
+	bc->blks = (bcache_blk_t *)malloc(sizeof(bcache_blk_t) * num_blks);
+	bc->hash = (bcache_blk_t **)calloc(num_buckets, sizeof(bcache_blk_t *));
+	u8 *data = (u8 *)memalign(0x10, num_blks * blk_sectors * 512);
+	if (!bc->blks || !bc->hash || !data || !bc->max_ra)
+		return 0;
+
+	for (u32 i = 0; i < num_blks; i++)
+	{
+		bc->blks[i].valid = 0;
+		bc->blks[i].data = data + i * blk_sectors * 512;
+		list_append(&bc->lru, &bc->blks[i].lru);
+	}
+
+	return 1;
+}
+
+void bcache_end(bcache_t *bc)
+{
+	if (bc->blks)
+	{
+		free(bc->blks[0].data);
+		free(bc->blks);
+		free(bc->hash);
+	}
+	bc->blks = NULL;
+	bc->hash = NULL;
+}
+
+void bcache_invalidate(bcache_t *bc)
+{
+	for (u32 i = 0; i < bc->num_blks; i++)
+		bc->blks[i].valid = 0;
+	memset(bc->hash, 0, (bc->hash_mask + 1) * sizeof(bcache_blk_t *));
+	bc->ra = 1;
+	bc->next_sector = 0;
+}
+
+int bcache_read(bcache_t *bc, u32 sector, u32 num_sectors, void *buf)
+{
+	u8 *bbuf = (u8 *)buf;
+	int seq = sector == bc->next_sector;
+	bc->next_sector = sector + num_sectors;
+
+	//Runs of a block or more go straight to the caller's buffer, as we write through they can't be stale.
+	if (num_sectors >= bc->blk_sectors)
+	{
+		sdmmc_iovec_t iov;
+		iov.buf = buf;
+		iov.num_sectors = num_sectors;
+		bc->stats.bypass_sectors += num_sectors;
+		bc->stats.cmds++;
+		return bc->ops->readv(bc->dev, sector, &iov, 1);
+	}
+
+	while (num_sectors)
+	{
+		u32 blk = sector / bc->blk_sectors;
+		u32 off = sector % bc->blk_sectors;
+		u32 num = MIN(num_sectors, bc->blk_sectors - off);
+
+		bcache_blk_t *b = _bcache_lookup(bc, blk);
+		if (b)
+		{
+			bc->stats.hits++;
+			_bcache_touch(bc, b);
+		}
+		else
+		{
+			//Grow the read-ahead while misses keep following each other.
+			bc->stats.misses++;
+			bc->ra = seq ? MIN(bc->ra * 2, bc->max_ra) : 1;
+			b = _bcache_fill(bc, blk, bc->ra);
+			if (!b)
+			{
+				//Read-ahead can run into a bad sector, fall back to just the block we need.
+				bc->ra = 1;
+				b = _bcache_fill(bc, blk, 1);
+				if (!b)
+					return 0;
+			}
+		}
+
+		memcpy(bbuf, b->data + off * 512, num * 512);
+		bbuf += num * 512;
+		sector += num;
+		num_sectors -= num;
+		seq = 1;
+	}
+
+	return 1;
+}
+
+int bcache_write(bcache_t *bc, u32 sector, u32 num_sectors, const void *buf)
+{
+	bc->stats.cmds++;
+	if (!bc->ops->write(bc->dev, sector, num_sectors, buf))
+	{
+		//We don't know what made it to the device.
+		bcache_invalidate(bc);
+		return 0;
+	}
+
+	//Update whatever we have cached of the written range.
+	const u8 *bbuf = (const u8 *)buf;
+	while (num_sectors)
+	{
+		u32 blk = sector / bc->blk_sectors;
+		u32 off = sector % bc->blk_sectors;
+		u32 num = MIN(num_sectors, bc->blk_sectors - off);
+
+		bcache_blk_t *b = _bcache_lookup(bc, blk);
+		if (b)
+			memcpy(b->data + off * 512, bbuf, num * 512);
+
+		bbuf += num * 512;
+		sector += num;
+		num_sectors -= num;
+	}
+
+	return 1;
+}
+
+void bcache_get_stats(bcache_t *bc, bcache_stats_t *stats)
+{
+	memcpy(stats, &bc->stats, sizeof(bcache_stats_t));
+}
@@ -0,0 +1,77 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BCACHE_H_
+#define _BCACHE_H_
+
+#include "types.h"
+#include "list.h"
+#include "sdmmc_driver.h"
+
+/*! Most blocks a single read-ahead command fills. */
+#define BCACHE_MAX_RA 32
+
+/*! Backing device, readv has to accept the cache's own blocks and any caller buffer. */
+typedef struct _bcache_ops_t
+{
+	int (*readv)(void *dev, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov);
+	int (*write)(void *dev, u32 sector, u32 num_sectors, const void *buf);
+} bcache_ops_t;
+
+typedef struct _bcache_blk_t
+{
+	u32 blk;
+	int valid;
+	u8 *data;
+	struct _bcache_blk_t *hnext;
+	link_t lru;
+} bcache_blk_t;
+
+typedef struct _bcache_stats_t
+{
+	u32 hits;
+	u32 misses;
+	u32 ra_blks;
+	u32 bypass_sectors;
+	u32 cmds;
+} bcache_stats_t;
+
+/*! Write-through LRU cache of fixed size sector runs ("blocks"). */
+typedef struct _bcache_t
+{
+	const bcache_ops_t *ops;
+	void *dev;
+	u32 dev_sectors;
+	u32 num_blks;
+	u32 blk_sectors;
+	u32 max_ra;
+	u32 ra;
+	u32 next_sector;
+	bcache_blk_t *blks;
+	bcache_blk_t **hash;
+	u32 hash_mask;
+	link_t lru;
+	bcache_stats_t stats;
+} bcache_t;
+
+int bcache_init(bcache_t *bc, const bcache_ops_t *ops, void *dev, u32 dev_sectors, u32 num_blks, u32 blk_sectors, u32 max_ra);
+void bcache_end(bcache_t *bc);
+void bcache_invalidate(bcache_t *bc);
+int bcache_read(bcache_t *bc, u32 sector, u32 num_sectors, void *buf);
+int bcache_write(bcache_t *bc, u32 sector, u32 num_sectors, const void *buf);
+void bcache_get_stats(bcache_t *bc, bcache_stats_t *stats);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "bprof.h"
+#include "util.h"
+#include "ff.h"
+
+static bprof_tmr_t _bprof_tmr;
+static u32 _bprof_last;
+static u64 _bprof_high;
+static u32 _bprof_id;
+static bprof_evt_t _bprof_evts[BPROF_MAX_EVENTS];
+
+static char *_bprof_u64_str(char *buf, u64 val)
+{
+	//Largest u64 has 20 digits, buf is expected to hold at least 21 chars.
+	char *p = buf + 20;
+	*p = 0;
+	do
+	{
+		*--p = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+	return p;
+}
+
+void bprof_init(bprof_tmr_t tmr)
+{
+	_bprof_tmr = tmr ? tmr : get_tmr;
+	_bprof_last = _bprof_tmr();
+	_bprof_high = 0;
+	_bprof_id = 0;
+	memset(_bprof_evts, 0, sizeof(_bprof_evts));
+}
+
+u64 bprof_now()
+{
+	if (!_bprof_tmr)
+		bprof_init(NULL);
+
+	//Extend the 32-bit microsecond counter, it wraps after ~71 minutes.
+	u32 tmr = _bprof_tmr();
+	if (tmr < _bprof_last)
+		_bprof_high += 0x100000000ULL;
+	_bprof_last = tmr;
+
+	return _bprof_high | tmr;
+}
+
+u32 bprof_begin(const char *name)
+{
+	u64 now = bprof_now();
+	u32 id = ++_bprof_id;
+	bprof_evt_t *evt = &_bprof_evts[id % BPROF_MAX_EVENTS];
+
+	evt->id = id;
+	evt->start = now;
+	evt->end = 0;
+	strncpy(evt->name, name, BPROF_NAME_LEN - 1);
+	evt->name[BPROF_NAME_LEN - 1] = 0;
+
+	return id;
+}
+
+void bprof_end(u32 id)
+{
+	bprof_evt_t *evt = &_bprof_evts[id % BPROF_MAX_EVENTS];
+
+	//The event might already have been overwritten by a newer one.
+	if (evt->id == id)
+		evt->end = bprof_now();
+}
+
+u32 bprof_count()
+{
+	return MIN(_bprof_id, BPROF_MAX_EVENTS);
+}
+
+const bprof_evt_t *bprof_get(u32 idx)
+{
+	if (idx >= bprof_count())
+		return NULL;
+
+	//Index 0 is the oldest event still in the ring buffer.
+	u32 id = _bprof_id - bprof_count() + 1 + idx;
+	return &_bprof_evts[id % BPROF_MAX_EVENTS];
+}
+
+int bprof_save(const char *path)
+{
+	FIL fp;
+	char start[21], end[21], dur[21];
+
+	if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+
+	f_puts("stage,start_us,end_us,duration_us\n", &fp);
+	for (u32 i = 0; i < bprof_count(); i++)
+	{
+		const bprof_evt_t *evt = bprof_get(i);
+		u64 evt_end = evt->end ? evt->end : evt->start;
+		f_printf(&fp, "%s,%s,%s,%s\n", evt->name,
+			_bprof_u64_str(start, evt->start),
+			_bprof_u64_str(end, evt_end),
+			_bprof_u64_str(dur, evt_end - evt->start));
+	}
+
+	return f_close(&fp) == FR_OK;
+}
@@ -0,0 +1,45 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BPROF_H_
+#define _BPROF_H_
+
+#include "types.h"
+
+/*! Number of events kept in the ring buffer. */
+#define BPROF_MAX_EVENTS 64
+#define BPROF_NAME_LEN 32
+
+/*! Microsecond timer source, defaults to get_tmr(). */
+typedef u32 (*bprof_tmr_t)();
+
+typedef struct _bprof_evt_t
+{
+	u32 id;
+	u64 start;
+	u64 end;
+	char name[BPROF_NAME_LEN];
+} bprof_evt_t;
+
+void bprof_init(bprof_tmr_t tmr);
+u64 bprof_now();
+u32 bprof_begin(const char *name);
+void bprof_end(u32 id);
+u32 bprof_count();
+const bprof_evt_t *bprof_get(u32 idx);
+int bprof_save(const char *path);
+
+#endif
@@ -20,6 +20,7 @@
 #include "i2c.h"
 #include "pmc.h"
 #include "max77620.h"
+#include "sched.h"
 
 #include "di.inl"
 
@@ -29,7 +30,7 @@ static void _display_dsi_wait(u32 timeout, u32 off, u32 mask)
 {
 	u32 end = TMR(0x10) + timeout;
 	while (TMR(0x10) < end && DSI(off) & mask)
-		;
+		sched_yield();
 	sleep(5);
 }
 
@@ -139,7 +140,7 @@ void display_end()
 
 	u32 end = HOST1X(0x30A4) + 5;
 	while (HOST1X(0x30A4) < end)
-		;
+		sched_yield();
 
 	DISPLAY_A(_DIREG(DC_CMD_STATE_ACCESS)) = READ_MUX | WRITE_MUX;
 	DSI(_DSIREG(DSI_VIDEO_MODE_CONTROL)) = 0;
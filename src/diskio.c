@@ -10,9 +10,108 @@
 #include <string.h>
 #include "diskio.h"		/* FatFs lower layer API */
 #include "sdmmc.h"
+#include "heap.h"
+#include "bcache.h"
 
 extern sdmmc_storage_t sd_storage;
 
+static DISKSTATS _disk_stats;
+static BYTE *_disk_bounce;
+static bcache_t _disk_cache;
+static int _disk_cache_ready;
+
+static int _disk_dma_ok(const void *buff)
+{
+	return (u32)buff >= DISK_DMA_BASE && !((u32)buff & 7);
+}
+
+static BYTE *_disk_get_bounce()
+{
+	//Only allocated once something actually needs it.
+	if (!_disk_bounce)
+		_disk_bounce = (BYTE *)memalign(0x10, DISK_BOUNCE_SIZE);
+	return _disk_bounce;
+}
+
+static int _disk_read_bounce(sdmmc_storage_t *storage, u32 sector, u32 count, BYTE *buff)
+{
+	BYTE *buf = _disk_get_bounce();
+	if (!buf)
+		return 0;
+	while (count)
+	{
+		UINT num = MIN(count, DISK_BOUNCE_SIZE / 512);
+		if (!sdmmc_storage_read(storage, sector, num, buf))
+			return 0;
+		memcpy(buff, buf, 512 * num);
+		_disk_stats.bounce_bytes += 512 * num;
+		_disk_stats.bounce_ops++;
+		buff += 512 * num;
+		sector += num;
+		count -= num;
+	}
+	return 1;
+}
+
+static int _disk_readv(void *dev, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov)
+{
+	sdmmc_storage_t *storage = (sdmmc_storage_t *)dev;
+
+	//Cache blocks are always DMA-safe, only a single caller buffer can need bouncing.
+	if (num_iov == 1 && !_disk_dma_ok(iov->buf))
+		return _disk_read_bounce(storage, sector, iov->num_sectors, (BYTE *)iov->buf);
+
+	for (u32 i = 0; i < num_iov; i++)
+		_disk_stats.direct_bytes += 512 * iov[i].num_sectors;
+	return sdmmc_storage_readv(storage, sector, iov, num_iov);
+}
+
+static int _disk_write(void *dev, u32 sector, u32 count, const void *buff)
+{
+	sdmmc_storage_t *storage = (sdmmc_storage_t *)dev;
+	const BYTE *bbuff = (const BYTE *)buff;
+
+	if (_disk_dma_ok(buff))
+	{
+		_disk_stats.direct_bytes += 512 * count;
+		return sdmmc_storage_write(storage, sector, count, (void *)buff);
+	}
+
+	BYTE *buf = _disk_get_bounce();
+	if (!buf)
+		return 0;
+	while (count)
+	{
+		UINT num = MIN(count, DISK_BOUNCE_SIZE / 512);
+		memcpy(buf, bbuff, 512 * num);
+		if (!sdmmc_storage_write(storage, sector, num, buf))
+			return 0;
+		_disk_stats.bounce_bytes += 512 * num;
+		_disk_stats.bounce_ops++;
+		bbuff += 512 * num;
+		sector += num;
+		count -= num;
+	}
+	return 1;
+}
+
+static const bcache_ops_t _disk_cache_ops = {
+	_disk_readv,
+	_disk_write
+};
+
+void disk_get_stats (
+	DISKSTATS* stats
+)
+{
+	memcpy(stats, &_disk_stats, sizeof(DISKSTATS));
+	if (_disk_cache_ready)
+		bcache_get_stats(&_disk_cache, &stats->cache);
+	else
+		memset(&stats->cache, 0, sizeof(bcache_stats_t));
+	memcpy(&stats->errs, &sd_storage.err_stats, sizeof(sdmmc_err_stats_t));
+}
+
 DSTATUS disk_status (
 	BYTE pdrv		/* Physical drive nmuber to identify the drive */
 )
@@ -24,6 +123,16 @@ DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {
+	//Called on every mount, the card might have changed since the last one.
+	if (!_disk_cache_ready)
+		_disk_cache_ready = bcache_init(&_disk_cache, &_disk_cache_ops, &sd_storage, sd_storage.sec_cnt,
+			DISK_CACHE_BLKS, DISK_CACHE_BLK_SECTORS, DISK_CACHE_MAX_RA);
+	else
+	{
+		_disk_cache.dev_sectors = sd_storage.sec_cnt;
+		bcache_invalidate(&_disk_cache);
+	}
+
 	return 0;
 }
 
@@ -34,15 +143,13 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-	if ((u32)buff >= 0x90000000)
-		return sdmmc_storage_read(&sd_storage, sector, count, buff) ? RES_OK : RES_ERROR;
-	u8 *buf = (u8 *)0x98000000; //TODO: define this somewhere.
-	if (sdmmc_storage_read(&sd_storage, sector, count, buf))
-	{
-		memcpy(buff, buf, 512 * count);
-		return RES_OK;
-	}
-	return RES_ERROR;
+	if (_disk_cache_ready)
+		return bcache_read(&_disk_cache, sector, count, buff) ? RES_OK : RES_ERROR;
+
+	sdmmc_iovec_t iov;
+	iov.buf = buff;
+	iov.num_sectors = count;
+	return _disk_readv(&sd_storage, sector, &iov, 1) ? RES_OK : RES_ERROR;
 }
 
 DRESULT disk_write (
@@ -52,13 +159,35 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-	if ((u32)buff >= 0x90000000)
-		return sdmmc_storage_write(&sd_storage, sector, count, (void *)buff) ? RES_OK : RES_ERROR;
-	u8 *buf = (u8 *)0x98000000; //TODO: define this somewhere.
-	memcpy(buf, buff, 512 * count);
-	if (sdmmc_storage_write(&sd_storage, sector, count, buf))
-		return RES_OK;
-	return RES_ERROR;
+	if (_disk_cache_ready)
+		return bcache_write(&_disk_cache, sector, count, buff) ? RES_OK : RES_ERROR;
+
+	return _disk_write(&sd_storage, sector, count, buff) ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_readv (
+	BYTE pdrv,					/* Physical drive nmuber to identify the drive */
+	DWORD sector,				/* Start sector in LBA */
+	const sdmmc_iovec_t *iov,	/* Buffers to scatter the consecutive sectors to */
+	UINT num_iov				/* Number of buffers */
+)
+{
+	UINT i;
+
+	//Bulk loads go around the cache, it is write-through so the card always has the latest data.
+	for (i = 0; i < num_iov && _disk_dma_ok(iov[i].buf); i++)
+		;
+	if (i == num_iov)
+		return _disk_readv(&sd_storage, sector, iov, num_iov) ? RES_OK : RES_ERROR;
+
+	//Some buffer needs bouncing, read them one by one.
+	for (i = 0; i < num_iov; i++)
+	{
+		if (disk_read(pdrv, (BYTE *)iov[i].buf, sector, iov[i].num_sectors) != RES_OK)
+			return RES_ERROR;
+		sector += iov[i].num_sectors;
+	}
+	return RES_OK;
 }
 
 DRESULT disk_ioctl (
@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
 #include "integer.h"
+#include "bcache.h"
+#include "sdmmc.h"
 
 
 /* Status of Disk Functions */
@@ -34,6 +36,29 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+DRESULT disk_readv (BYTE pdrv, DWORD sector, const sdmmc_iovec_t* iov, UINT num_iov);
+
+
+/* DMA buffer policy */
+
+/* Buffers outside DRAM (IRAM, MMIO) or not 8-byte aligned are bounced */
+#define DISK_DMA_BASE		0x80000000
+#define DISK_BOUNCE_SIZE	0x10000
+
+/* Sector cache between FatFs and the SD card */
+#define DISK_CACHE_BLKS			64
+#define DISK_CACHE_BLK_SECTORS	8
+#define DISK_CACHE_MAX_RA		16
+
+typedef struct {
+	DWORD	direct_bytes;	/* Transferred straight from/to the caller's buffer or the cache */
+	DWORD	bounce_bytes;	/* Copied through the bounce pool */
+	DWORD	bounce_ops;
+	bcache_stats_t	cache;
+	sdmmc_err_stats_t	errs;	/* SD transfer error recovery */
+} DISKSTATS;
+
+void disk_get_stats (DISKSTATS* stats);
 
 
 /* Disk Status Bits (DSTATUS) */
@@ -245,6 +245,17 @@
 #endif
 
 
+/* Directory cache */
+#if FF_USE_DCACHE
+#if !FF_USE_LFN
+#error Directory cache needs LFN enabled
+#endif
+#if FF_DCACHE_SIZE < 16 || (FF_DCACHE_SIZE & (FF_DCACHE_SIZE - 1)) || FF_DCACHE_DIRS < 1
+#error Wrong setting of FF_DCACHE_SIZE or FF_DCACHE_DIRS
+#endif
+#endif
+
+
 /* File lock controls */
 #if FF_FS_LOCK != 0
 #if FF_FS_READONLY
@@ -2422,12 +2433,13 @@ FRESULT dir_read (
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Find an object in the directory                  */
+/* Directory handling - Scan the directory for an object                 */
 /*-----------------------------------------------------------------------*/
 
 static
-FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp			/* Pointer to the directory object with the file name */
+FRESULT dir_scan (	/* FR_OK(0):succeeded, FR_NO_FILE:not found in the range, !=0:error */
+	DIR* dp,		/* Pointer to the directory object with the file name, positioned at the first entry to scan */
+	UINT nent		/* Number of entries to scan */
 )
 {
 	FRESULT res;
@@ -2437,29 +2449,6 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE a, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
-#if FF_FS_EXFAT
-	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-		BYTE nc;
-		UINT di, ni;
-		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
-
-		while ((res = dir_read_file(dp)) == FR_OK) {	/* Read an item */
-#if FF_MAX_LFN < 255
-			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
-#endif
-			if (ld_word(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
-			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
-				if ((di % SZDIRE) == 0) di += 2;
-				if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
-			}
-			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
-		}
-		return res;
-	}
-#endif
-	/* On the FAT/FAT32 volume */
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2493,6 +2482,7 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
 #endif
+		if (--nent == 0) { res = FR_NO_FILE; break; }	/* Reached to end of the range */
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
 
@@ -2502,6 +2492,296 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+#if FF_USE_DCACHE
+/*-----------------------------------------------------------------------*/
+/* Directory cache - Drop all indexed directories                        */
+/*-----------------------------------------------------------------------*/
+
+static
+void dc_reset (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	mem_set(fs->dc_ent, 0, sizeof fs->dc_ent);
+	fs->dc_ndir = fs->dc_nent = 0;
+	fs->dc_skip = 0xFFFFFFFF;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory cache - Name hashing                                        */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD dc_mix (		/* Returns the hash of a character at a position of the name */
+	UINT pos,		/* Position in the name (SFN characters are at 0x100-0x10A) */
+	DWORD chr		/* Up-cased character */
+)
+{
+	DWORD h = ((DWORD)pos << 16 ^ chr) * 0x9E3779B1;
+
+	h ^= h >> 15; h *= 0x85EBCA6B; h ^= h >> 13;
+	return h;
+}
+
+
+static
+DWORD dc_hash_lfn (	/* Returns the hash of an LFN, the characters are combined in any order */
+	const WCHAR* lfn	/* Pointer to the LFN */
+)
+{
+	DWORD h = 0;
+	UINT i;
+
+
+	for (i = 0; lfn[i]; i++) h ^= dc_mix(i, ff_wtoupper(lfn[i]));
+	return h;
+}
+
+
+static
+DWORD dc_hash_part (	/* Returns the hash of a part of LFN */
+	const BYTE* dir		/* Pointer to the LFN entry */
+)
+{
+	DWORD h = 0;
+	UINT i, s;
+	WCHAR uc;
+
+
+	i = ((dir[LDIR_Ord] & 0x3F) - 1) * 13;	/* Offset in the LFN */
+	for (s = 0; s < 13; s++) {
+		uc = ld_word(dir + LfnOfs[s]);
+		if (uc == 0) break;			/* End of the LFN */
+		h ^= dc_mix(i++, ff_wtoupper(uc));
+	}
+	return h;
+}
+
+
+static
+DWORD dc_hash_sfn (	/* Returns the hash of an SFN */
+	const BYTE* sfn		/* Pointer to the SFN (as in the directory entry) */
+)
+{
+	DWORD h = 0;
+	UINT i;
+
+
+	for (i = 0; i < 11; i++) h ^= dc_mix(0x100 + i, sfn[i]);
+	return h;
+}
+
+
+static
+UINT dc_slot (		/* Returns the first hash slot to probe */
+	DWORD sclust,	/* Directory start cluster */
+	DWORD hash		/* Name hash */
+)
+{
+	return (hash ^ sclust * 0x9E3779B1) % FF_DCACHE_SIZE;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory cache - Add a name to the hash table                        */
+/*-----------------------------------------------------------------------*/
+
+static
+int dc_insert (		/* 1:added, 0:table is full */
+	FATFS* fs,		/* Filesystem object */
+	DWORD sclust,	/* Directory start cluster */
+	DWORD hash,		/* Name hash */
+	DWORD clust,	/* Cluster containing the first entry */
+	DWORD loc		/* Offset and number of entries */
+)
+{
+	UINT i;
+	DCENT *ent;
+
+
+	if (fs->dc_nent >= FF_DCACHE_SIZE / 4 * 3) return 0;	/* Keep probe sequences short */
+	for (i = dc_slot(sclust, hash); fs->dc_ent[i].loc; i = (i + 1) % FF_DCACHE_SIZE) ;
+	ent = &fs->dc_ent[i];
+	ent->sclust = sclust;
+	ent->hash = hash;
+	ent->clust = clust;
+	ent->loc = loc;
+	fs->dc_nent++;
+	return 1;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory cache - Index all objects in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dc_build (	/* FR_OK:indexed, FR_NO_FILE:does not fit in the cache, !=0:error */
+	DIR* dp			/* Pointer to the directory object to be indexed */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD sclust = dp->obj.sclust, hash = 0, ofs = 0, clst = 0, loc, skip;
+	BYTE c, a, ord = 0xFF, sum = 0xFF;
+
+
+	if (fs->dc_ndir == FF_DCACHE_DIRS) {	/* Start over when all directory slots are used */
+		skip = fs->dc_skip;
+		dc_reset(fs);
+		fs->dc_skip = skip;				/* Nothing changed, a directory too large still is */
+	}
+
+	res = dir_sdi(dp, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF;
+		} else if (a == AM_LFN) {	/* An LFN entry, the same sequence checks as in dir_find() */
+			if (c & LLEF) {			/* Start of LFN sequence */
+				sum = dp->dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c;
+				ofs = dp->dptr; clst = dp->clust; hash = 0;
+			}
+			if (c == ord && sum == dp->dir[LDIR_Chksum] && ld_word(dp->dir + LDIR_FstClusLO) == 0) {
+				hash ^= dc_hash_part(dp->dir);
+				ord--;
+			} else {
+				ord = 0xFF;
+			}
+		} else {					/* An SFN entry, add it under its LFN and SFN */
+			if (ord != 0 || sum != sum_sfn(dp->dir)) {	/* No valid LFN */
+				ord = 0xFF; ofs = dp->dptr; clst = dp->clust;
+			}
+			loc = ofs | ((dp->dptr - ofs) / SZDIRE + 1) << 24;
+			if ((ord == 0 && !dc_insert(fs, sclust, hash, clst, loc)) || !dc_insert(fs, sclust, dc_hash_sfn(dp->dir), clst, loc)) {
+				dc_reset(fs);			/* Directory does not fit, leave it to linear scan */
+				fs->dc_skip = sclust;
+				return FR_NO_FILE;
+			}
+			ord = 0xFF;
+		}
+		res = dir_next(dp, 0);	/* Next entry */
+	}
+
+	if (res != FR_NO_FILE) {	/* Disk error, drop the partial index */
+		dc_reset(fs);
+		return res;
+	}
+	fs->dc_dir[fs->dc_ndir++] = sclust;	/* Register the directory as indexed */
+	return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory cache - Find an object in an indexed directory              */
+/*-----------------------------------------------------------------------*/
+
+static
+int dc_find (		/* 1:result is in *res, 0:directory is not indexed, use linear scan */
+	DIR* dp,		/* Pointer to the directory object with the file name */
+	FRESULT* res	/* Pointer to the result of the search */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	DWORD sclust = dp->obj.sclust, key[2];
+	UINT i, k, nkey = 0;
+	DCENT *ent;
+
+
+	if (sclust == fs->dc_skip) return 0;
+	for (i = 0; i < fs->dc_ndir && fs->dc_dir[i] != sclust; i++) ;
+	if (i == fs->dc_ndir) {		/* Index the directory on its first lookup */
+		*res = dc_build(dp);
+		if (*res == FR_NO_FILE) return 0;
+		if (*res != FR_OK) return 1;
+	}
+
+	/* Probe the names dir_find() would compare. Candidates are verified by scanning their entries, so hash collisions are harmless. */
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) key[nkey++] = dc_hash_lfn(fs->lfnbuf);
+	if (!(dp->fn[NSFLAG] & NS_LOSS)) key[nkey++] = dc_hash_sfn(dp->fn);
+	for (k = 0; k < nkey; k++) {
+		for (i = dc_slot(sclust, key[k]); (ent = &fs->dc_ent[i])->loc; i = (i + 1) % FF_DCACHE_SIZE) {
+			if (ent->sclust != sclust || ent->hash != key[k]) continue;
+			dp->dptr = ent->loc & 0xFFFFFF;
+			dp->clust = ent->clust;
+			if (ent->clust == 0) {	/* Static table */
+				dp->sect = fs->dirbase + dp->dptr / SS(fs);
+			} else {				/* Dynamic table */
+				dp->sect = clst2sect(fs, ent->clust);
+				if (dp->sect == 0) { *res = FR_INT_ERR; return 1; }
+				dp->sect += dp->dptr / SS(fs) & (fs->csize - 1);
+			}
+			dp->dir = fs->win + dp->dptr % SS(fs);
+			*res = dir_scan(dp, ent->loc >> 24);
+			if (*res != FR_NO_FILE) return 1;
+		}
+	}
+	*res = FR_NO_FILE;		/* The index covers the whole directory */
+	return 1;
+}
+
+#endif	/* FF_USE_DCACHE */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find an object in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp			/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+#if FF_FS_EXFAT
+	FATFS *fs = dp->obj.fs;
+#endif
+
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
+
+		while ((res = dir_read_file(dp)) == FR_OK) {	/* Read an item */
+#if FF_MAX_LFN < 255
+			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
+#endif
+			if (ld_word(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
+			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
+				if ((di % SZDIRE) == 0) di += 2;
+				if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
+			}
+			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+		}
+		return res;
+	}
+#endif
+	/* On the FAT/FAT32 volume */
+#if FF_USE_DCACHE
+	if (dc_find(dp, &res)) return res;
+	res = dir_sdi(dp, 0);			/* Rewind directory object after indexing */
+	if (res != FR_OK) return res;
+#endif
+	return dir_scan(dp, MAX_DIR / SZDIRE);
+}
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Register an object to the directory                                   */
@@ -2601,6 +2881,9 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 			fs->wflag = 1;
 		}
 	}
+#if FF_USE_DCACHE
+	dc_reset(fs);				/* The directory has changed */
+#endif
 
 	return res;
 }
@@ -2648,6 +2931,9 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		fs->wflag = 1;
 	}
 #endif
+#if FF_USE_DCACHE
+	dc_reset(fs);				/* The directory has changed */
+#endif
 
 	return res;
 }
@@ -3498,6 +3784,9 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 
 	fs->fs_type = fmt;		/* FAT sub-type */
 	fs->id = ++Fsid;		/* Volume mount ID */
+#if FF_USE_DCACHE
+	dc_reset(fs);			/* Drop the directory cache of the previous mount */
+#endif
 #if FF_USE_LFN == 1
 	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
 #if FF_FS_EXFAT
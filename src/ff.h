@@ -82,6 +82,19 @@ typedef DWORD FSIZE_t;
 
 
 
+#if FF_USE_DCACHE
+/* Directory cache entry (DCENT) */
+
+typedef struct {
+	DWORD	sclust;			/* Directory start cluster (0:root) */
+	DWORD	hash;			/* Hash of the up-cased LFN or the SFN */
+	DWORD	clust;			/* Cluster containing the first entry of the object */
+	DWORD	loc;			/* b23-b0:Offset of the first entry, b31-b24:Number of entries (0:blank slot) */
+} DCENT;
+#endif
+
+
+
 /* Filesystem object structure (FATFS) */
 
 typedef struct {
@@ -125,6 +138,13 @@ typedef struct {
 	DWORD	database;		/* Data base sector */
 	DWORD	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
+#if FF_USE_DCACHE
+	WORD	dc_ndir;		/* Number of indexed directories */
+	WORD	dc_nent;		/* Number of used hash slots */
+	DWORD	dc_skip;		/* Directory too large to be indexed (0xFFFFFFFF:none) */
+	DWORD	dc_dir[FF_DCACHE_DIRS];	/* Start clusters of the indexed directories */
+	DCENT	dc_ent[FF_DCACHE_SIZE];	/* Name hash table */
+#endif
 } FATFS;
 
 
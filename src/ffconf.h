@@ -42,10 +42,22 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
+#define FF_USE_DCACHE	1
+#define FF_DCACHE_SIZE	1024
+#define FF_DCACHE_DIRS	16
+/* The option FF_USE_DCACHE switches the directory entry cache. (0:Disable or 1:Enable)
+/  When enabled, a directory is indexed by up-cased name hash on its first lookup, and
+/  further lookups in it take a hash probe instead of a linear scan. It works on the
+/  FAT/FAT32 volume only and needs LFN enabled. FF_DCACHE_SIZE defines the number of
+/  hash slots (power of 2, 16 bytes each) in the filesystem object and FF_DCACHE_DIRS
+/  the number of directories indexed at a time. Any change to a directory drops the
+/  cache. */
+
+
 #define FF_USE_EXPAND	0
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
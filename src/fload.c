@@ -0,0 +1,279 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "fload.h"
+#include "diskio.h"
+#include "heap.h"
+#include "list.h"
+
+/*! Cluster link map of a file, [size, (clusters, first cluster)..., 0] as built by f_lseek(CREATE_LINKMAP). */
+typedef struct _fload_map_t
+{
+	u16 fs_id;
+	u32 sclust;
+	FSIZE_t objsize;
+	DWORD *tbl;
+	link_t link;
+} fload_map_t;
+
+LIST_INIT_STATIC(_fload_maps);
+
+void fload_reset()
+{
+	LIST_FOREACH_SAFE(iter, &_fload_maps)
+	{
+		fload_map_t *map = CONTAINER_OF(iter, fload_map_t, link);
+		free(map->tbl);
+		free(map);
+	}
+	list_init(&_fload_maps);
+}
+
+static DWORD *_fload_get_map(FIL *fp)
+{
+	LIST_FOREACH_ENTRY(fload_map_t, map, &_fload_maps, link)
+		if (map->fs_id == fp->obj.fs->id && map->sclust == fp->obj.sclust && map->objsize == fp->obj.objsize)
+			return map->tbl;
+
+	//Try a small table first, most files are in one or a few pieces.
+	DWORD *tbl = (DWORD *)malloc(FLOAD_MAP_SIZE * sizeof(DWORD));
+	tbl[0] = FLOAD_MAP_SIZE;
+	fp->cltbl = tbl;
+	FRESULT res = f_lseek(fp, CREATE_LINKMAP);
+	if (res == FR_NOT_ENOUGH_CORE)
+	{
+		u32 size = tbl[0];
+		free(tbl);
+		tbl = (DWORD *)malloc(size * sizeof(DWORD));
+		tbl[0] = size;
+		fp->cltbl = tbl;
+		res = f_lseek(fp, CREATE_LINKMAP);
+	}
+	if (res != FR_OK)
+	{
+		fp->cltbl = NULL;
+		free(tbl);
+		return NULL;
+	}
+
+	fload_map_t *map = (fload_map_t *)malloc(sizeof(fload_map_t));
+	map->fs_id = fp->obj.fs->id;
+	map->sclust = fp->obj.sclust;
+	map->objsize = fp->obj.objsize;
+	map->tbl = tbl;
+	list_append(&_fload_maps, &map->link);
+
+	return tbl;
+}
+
+int fload_read(FIL *fp, void *buf, u32 size)
+{
+	FATFS *fs = fp->obj.fs;
+	u8 *bbuf = (u8 *)buf;
+
+	size = MIN(size, fp->obj.objsize);
+	DWORD *tbl = _fload_get_map(fp);
+	if (!tbl)
+		return 0;
+	fp->cltbl = tbl;
+
+	//Read all whole sectors with one command per contiguous run of clusters.
+	u32 num_sectors = size / 512;
+	u32 done = 0;
+	for (DWORD *ent = tbl + 1; *ent && done < num_sectors; ent += 2)
+	{
+		u32 sector = fs->database + (ent[1] - 2) * fs->csize;
+		u32 num = MIN(ent[0] * fs->csize, num_sectors - done);
+		if (disk_read(fs->pdrv, bbuf + done * 512, sector, num) != RES_OK)
+			return 0;
+		done += num;
+	}
+	if (done < num_sectors)
+		return 0;
+
+	//The last partial sector goes through FatFs.
+	if (size % 512)
+	{
+		UINT br;
+		if (f_lseek(fp, done * 512) != FR_OK || f_read(fp, bbuf + done * 512, size % 512, &br) != FR_OK || br != size % 512)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*! Consecutive sectors of one file going to one buffer. */
+typedef struct _fload_seg_t
+{
+	u32 sector;
+	u32 num;
+	u8 *buf;
+} fload_seg_t;
+
+void fload_batch_init(fload_batch_t *batch)
+{
+	batch->fs = NULL;
+	list_init(&batch->ents);
+}
+
+fload_ent_t *fload_batch_add(arena_t *arena, fload_batch_t *batch, const char *path, void *hdr, u32 hdr_size)
+{
+	FIL fp;
+	UINT br;
+
+	if (f_open(&fp, path, FA_READ) != FR_OK)
+		return NULL;
+
+	//The header is read right away so the caller can decide whether the file is needed at all.
+	DWORD *tbl = NULL;
+	if (!hdr_size || (f_read(&fp, hdr, hdr_size, &br) == FR_OK && br == hdr_size))
+		tbl = _fload_get_map(&fp);
+	if (!tbl)
+	{
+		f_close(&fp);
+		return NULL;
+	}
+
+	fload_ent_t *ent = (fload_ent_t *)arena_push(arena, sizeof(fload_ent_t));
+	ent->path = path;
+	ent->size = f_size(&fp);
+	ent->buf = NULL;
+	ent->tbl = tbl;
+	ent->tail = NULL;
+	list_append(&batch->ents, &ent->link);
+	batch->fs = fp.obj.fs;
+
+	f_close(&fp);
+	return ent;
+}
+
+void fload_batch_drop(fload_ent_t *ent)
+{
+	list_remove(&ent->link);
+}
+
+int fload_batch_place(fload_ent_t *ent, void *dst, u32 max_size)
+{
+	//The file is read straight to its final location, so it has to fit there.
+	if (ent->size > max_size)
+		return 0;
+	ent->buf = dst;
+	return 1;
+}
+
+static int _fload_ent_segs(arena_t *arena, FATFS *fs, fload_ent_t *ent, fload_seg_t *segs, u32 *num_segs)
+{
+	u32 num_sectors = ALIGN(ent->size, 512) / 512;
+	u32 done = 0;
+
+	if (!ent->buf)
+		return 0;
+
+	for (DWORD *e = ent->tbl + 1; *e && done < num_sectors; e += 2)
+	{
+		fload_seg_t *seg = &segs[(*num_segs)++];
+		seg->sector = fs->database + (e[1] - 2) * fs->csize;
+		seg->num = MIN(e[0] * fs->csize, num_sectors - done);
+		seg->buf = (u8 *)ent->buf + done * 512;
+		done += seg->num;
+	}
+	if (done < num_sectors)
+		return 0;
+
+	//The last partial sector goes to scratch space and is copied once everything is read.
+	if (ent->size % 512)
+	{
+		fload_seg_t *seg = &segs[*num_segs - 1];
+		ent->tail = (u8 *)arena_push(arena, 512);
+		if (seg->num > 1)
+		{
+			seg->num--;
+			segs[*num_segs].sector = seg->sector + seg->num;
+			segs[*num_segs].num = 1;
+			seg = &segs[(*num_segs)++];
+		}
+		seg->buf = ent->tail;
+	}
+
+	return 1;
+}
+
+int fload_batch_run(arena_t *arena, fload_batch_t *batch)
+{
+	FATFS *fs = batch->fs;
+	sdmmc_iovec_t iov[FLOAD_BATCH_MAX_IOV];
+	int res = 0;
+
+	if (list_empty(&batch->ents))
+		return 1;
+
+	arena_mark_t mark = arena_mark(arena);
+
+	//One segment per extent, plus one for each split off partial sector.
+	u32 max_segs = 0;
+	LIST_FOREACH_ENTRY(fload_ent_t, ent, &batch->ents, link)
+	{
+		for (DWORD *e = ent->tbl + 1; *e; e += 2)
+			max_segs++;
+		max_segs++;
+	}
+
+	fload_seg_t *segs = (fload_seg_t *)arena_push(arena, max_segs * sizeof(fload_seg_t));
+	u32 num_segs = 0;
+	LIST_FOREACH_ENTRY(fload_ent_t, ent, &batch->ents, link)
+		if (!_fload_ent_segs(arena, fs, ent, segs, &num_segs))
+			goto out;
+
+	//Issue everything in on-disk order, there are only a few dozen segments so insertion sort will do.
+	for (u32 i = 1; i < num_segs; i++)
+	{
+		fload_seg_t seg = segs[i];
+		u32 j;
+		for (j = i; j > 0 && segs[j - 1].sector > seg.sector; j--)
+			segs[j] = segs[j - 1];
+		segs[j] = seg;
+	}
+
+	//Segments that follow each other on disk become one command scattering to all their buffers.
+	for (u32 i = 0; i < num_segs;)
+	{
+		u32 sector = segs[i].sector;
+		u32 next = sector;
+		u32 num_iov = 0;
+		while (i < num_segs && num_iov < FLOAD_BATCH_MAX_IOV && segs[i].sector == next)
+		{
+			iov[num_iov].buf = segs[i].buf;
+			iov[num_iov].num_sectors = segs[i].num;
+			next += segs[i].num;
+			num_iov++;
+			i++;
+		}
+		if (disk_readv(fs->pdrv, sector, iov, num_iov) != RES_OK)
+			goto out;
+	}
+
+	LIST_FOREACH_ENTRY(fload_ent_t, ent, &batch->ents, link)
+		if (ent->tail)
+			memcpy((u8 *)ent->buf + (ent->size & ~511), ent->tail, ent->size % 512);
+	res = 1;
+
+out:
+	LIST_FOREACH_ENTRY(fload_ent_t, ent, &batch->ents, link)
+		ent->tail = NULL;
+	arena_reset(arena, mark);
+	return res;
+}
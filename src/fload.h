@@ -0,0 +1,57 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FLOAD_H_
+#define _FLOAD_H_
+
+#include "types.h"
+#include "ff.h"
+#include "list.h"
+#include "arena.h"
+
+/*! Link map entries tried before asking FatFs for the exact size. */
+#define FLOAD_MAP_SIZE 32
+/*! Most buffers a single batch read command scatters to. */
+#define FLOAD_BATCH_MAX_IOV 64
+
+/*! File of a batch, buf has to point to size bytes before the batch is run (see fload_batch_place). */
+typedef struct _fload_ent_t
+{
+	const char *path;
+	u32 size;
+	void *buf;
+	DWORD *tbl;
+	u8 *tail;
+	link_t link;
+} fload_ent_t;
+
+/*! Files resolved up front and read together, in on-disk order. */
+typedef struct _fload_batch_t
+{
+	FATFS *fs;
+	link_t ents;
+} fload_batch_t;
+
+/*! Link maps are cached per mount and file, they have to be dropped whenever the SD card is (re)mounted. */
+void fload_reset();
+int fload_read(FIL *fp, void *buf, u32 size);
+void fload_batch_init(fload_batch_t *batch);
+fload_ent_t *fload_batch_add(arena_t *arena, fload_batch_t *batch, const char *path, void *hdr, u32 hdr_size);
+void fload_batch_drop(fload_ent_t *ent);
+int fload_batch_place(fload_ent_t *ent, void *dst, u32 max_size);
+int fload_batch_run(arena_t *arena, fload_batch_t *batch);
+
+#endif
@@ -17,95 +17,215 @@
 #include <string.h>
 #include "heap.h"
 
+/*! Chunk sizes include the header and are multiples of 0x10, bit 0 marks used chunks. */
+#define HNODE_USED 1
+#define HNODE_SIZE(node) ((node)->size & ~HNODE_USED)
+#define HNODE_MIN_SIZE (sizeof(hnode_t) + 0x10)
+
+/*! Free chunks are binned by power of two, bin i holds sizes [1 << i, 2 << i). */
+#define HEAP_NUM_BINS 32
+
 typedef struct _hnode
 {
-	int used;
 	u32 size;
-	struct _hnode *prev;
+	u32 prev_size; //Boundary tag, size of the chunk right before this one (0 for the first).
+	struct _hnode *prev; //Free list links, only valid for free chunks, used chunks keep their call site in prev.
 	struct _hnode *next;
 } hnode_t;
 
 typedef struct _heap
 {
 	u32 start;
-	hnode_t *first;
+	hnode_t *top; //Header after the last chunk, everything past it is untouched.
+	u32 bitmap; //Non-empty bins.
+	hnode_t *bins[HEAP_NUM_BINS];
+	heap_stats_t stats;
 } heap_t;
 
+static u32 _heap_bin(u32 size)
+{
+	return 31 - __builtin_clz(size);
+}
+
+static hnode_t *_heap_next(hnode_t *node)
+{
+	return (hnode_t *)((u32)node + HNODE_SIZE(node));
+}
+
+static hnode_t *_heap_prev(hnode_t *node)
+{
+	return (hnode_t *)((u32)node - node->prev_size);
+}
+
+static void _heap_bin_insert(heap_t *heap, hnode_t *node)
+{
+	u32 bin = _heap_bin(node->size);
+	node->prev = NULL;
+	node->next = heap->bins[bin];
+	if (node->next)
+		node->next->prev = node;
+	heap->bins[bin] = node;
+	heap->bitmap |= 1 << bin;
+}
+
+static void _heap_bin_remove(heap_t *heap, hnode_t *node)
+{
+	u32 bin = _heap_bin(node->size);
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		heap->bins[bin] = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	if (!heap->bins[bin])
+		heap->bitmap &= ~(1 << bin);
+}
+
 static void _heap_create(heap_t *heap, u32 start)
 {
+	memset(heap, 0, sizeof(heap_t));
 	heap->start = start;
-	heap->first = NULL;
+	heap->top = (hnode_t *)start;
+	heap->top->size = 0;
+	heap->top->prev_size = 0;
 }
 
-static u32 _heap_alloc(heap_t *heap, u32 size)
+static void _heap_release(heap_t *heap, hnode_t *node)
 {
-	hnode_t *node, *new;
-	int search = 1;
+	node->size &= ~HNODE_USED;
 
-	size = ALIGN(size, 0x10);
-
-	if (!heap->first)
+	//Merge with the neighbours using the boundary tags.
+	if (node->prev_size)
 	{
-		node = (hnode_t *)heap->start;
-		node->used = 1;
-		node->size = size;
-		node->prev = NULL;
-		node->next = NULL;
-		heap->first = node;
-
-		return (u32)node + sizeof(hnode_t);
+		hnode_t *prev = _heap_prev(node);
+		if (!(prev->size & HNODE_USED))
+		{
+			_heap_bin_remove(heap, prev);
+			prev->size += node->size;
+			node = prev;
+		}
 	}
 
-	node = heap->first;
-	while (search)
+	hnode_t *next = _heap_next(node);
+	if (next == heap->top)
 	{
-		if (!node->used && size + sizeof(hnode_t) < node->size)
-		{
-			new = (hnode_t *)((u32)node + sizeof(hnode_t) + size);
+		//Give the chunk back to the top.
+		node->size = 0;
+		heap->top = node;
+		return;
+	}
+	if (!(next->size & HNODE_USED))
+	{
+		_heap_bin_remove(heap, next);
+		node->size += next->size;
+		next = _heap_next(node);
+	}
+	next->prev_size = node->size;
 
-			new->size = node->size - sizeof(hnode_t) - size;
-			node->size = size;
-			node->used = 1;
-			new->used = 0;
-			new->next = node->next;
-			new->prev = node;
-			node->next = new;
+	_heap_bin_insert(heap, node);
+}
 
-			return (u32)node + sizeof(hnode_t);
-		}
-		if (node->next)
-			node = node->next;
-		else
-			search = 0;
-	}
+static void _heap_split(heap_t *heap, hnode_t *node, u32 size)
+{
+	u32 rest = HNODE_SIZE(node) - size;
+	if (rest < HNODE_MIN_SIZE)
+		return;
 
-	new = (hnode_t *)((u32)node + sizeof(hnode_t) + node->size);
-	new->used = 1;
-	new->size = size;
-	new->prev = node;
-	new->next = NULL;
-	node->next = new;
+	node->size = size | HNODE_USED;
+	hnode_t *new = _heap_next(node);
+	new->size = rest | HNODE_USED;
+	new->prev_size = size;
+	_heap_next(new)->prev_size = rest;
+	_heap_release(heap, new);
+}
 
-	return (u32)new + sizeof(hnode_t);
+static hnode_t *_heap_find(heap_t *heap, u32 size)
+{
+	//Sizes in the first bin can be smaller than the request, later bins always fit.
+	u32 bin = _heap_bin(size);
+	for (hnode_t *node = heap->bins[bin]; node; node = node->next)
+		if (node->size >= size)
+			return node;
+
+	u32 mask = bin < 31 ? heap->bitmap & ~((2 << bin) - 1) : 0;
+	if (!mask)
+		return NULL;
+	return heap->bins[__builtin_ctz(mask)];
 }
 
-static void _heap_free(heap_t *heap, u32 addr)
+static u32 _heap_alloc(heap_t *heap, u32 size)
 {
+	hnode_t *node;
+
+	size = ALIGN(size, 0x10) + sizeof(hnode_t);
+
+	node = _heap_find(heap, size);
+	if (node)
+	{
+		_heap_bin_remove(heap, node);
+		node->size |= HNODE_USED;
+		_heap_split(heap, node, size);
+	}
+	else
+	{
+		node = heap->top;
+		node->size = size | HNODE_USED;
+		heap->top = _heap_next(node);
+		heap->top->size = 0;
+		heap->top->prev_size = size;
+	}
+
+	return (u32)node + sizeof(hnode_t);
+}
+
+static u32 _heap_memalign(heap_t *heap, u32 align, u32 size)
+{
+	if (align <= 0x10)
+		return _heap_alloc(heap, size);
+
+	size = ALIGN(size, 0x10);
+
+	//Over-allocate, any leading gap is at least a header long as both sides are 0x10 aligned.
+	u32 addr = _heap_alloc(heap, size + align);
+	u32 aligned = ALIGN(addr, align);
 	hnode_t *node = (hnode_t *)(addr - sizeof(hnode_t));
-	node->used = 0;
-	node = heap->first;
-	while (node)
+	if (aligned != addr)
 	{
-		if (!node->used)
-			if (node->prev && !node->prev->used)
-			{
-				node->prev->size += node->size + sizeof(hnode_t);
-				node->prev->next = node->next;
-				if (node->next)
-					node->next->prev = node->prev;
-			}
-		node = node->next;
+		u32 gap = aligned - addr;
+		hnode_t *new = (hnode_t *)(aligned - sizeof(hnode_t));
+		new->size = (HNODE_SIZE(node) - gap) | HNODE_USED;
+		new->prev_size = gap;
+		_heap_next(new)->prev_size = HNODE_SIZE(new);
+		node->size = gap | HNODE_USED;
+		_heap_release(heap, node);
+		node = new;
 	}
+	_heap_split(heap, node, size + sizeof(hnode_t));
+
+	return aligned;
+}
+
+static void _heap_free(heap_t *heap, u32 addr)
+{
+	hnode_t *node = (hnode_t *)(addr - sizeof(hnode_t));
+	heap->stats.live_bytes -= HNODE_SIZE(node);
+	heap->stats.num_frees++;
+	_heap_release(heap, node);
+}
+
+static u32 _heap_track(heap_t *heap, u32 addr, void *tag)
+{
+	hnode_t *node = (hnode_t *)(addr - sizeof(hnode_t));
+	node->prev = (hnode_t *)tag;
+
+	heap_stats_t *stats = &heap->stats;
+	stats->live_bytes += HNODE_SIZE(node);
+	stats->peak_bytes = MAX(stats->peak_bytes, stats->live_bytes);
+	stats->num_allocs++;
+	stats->top = (u32)heap->top;
+	stats->peak_top = MAX(stats->peak_top, stats->top);
+
+	return addr;
 }
 
 static heap_t _heap;
@@ -117,17 +237,71 @@ void heap_init(u32 base)
 
 void *malloc(u32 size)
 {
-	return (void *)_heap_alloc(&_heap, size);
+	return (void *)_heap_track(&_heap, _heap_alloc(&_heap, size), __builtin_return_address(0));
+}
+
+void *memalign(u32 align, u32 size)
+{
+	return (void *)_heap_track(&_heap, _heap_memalign(&_heap, align, size), __builtin_return_address(0));
 }
 
 void *calloc(u32 num, u32 size)
 {
-	void *res = (void *)_heap_alloc(&_heap, num * size);
+	void *res = (void *)_heap_track(&_heap, _heap_alloc(&_heap, num * size), __builtin_return_address(0));
 	memset(res, 0, num * size);
 	return res;
 }
 
 void free(void *buf)
 {
-	_heap_free(&_heap, (u32)buf);
+	if (buf)
+		_heap_free(&_heap, (u32)buf);
+}
+
+void heap_get_stats(heap_stats_t *stats)
+{
+	memcpy(stats, &_heap.stats, sizeof(heap_stats_t));
+	stats->top = (u32)_heap.top;
+
+	//Free chunks below the top, the top itself is not counted as fragmentation.
+	stats->free_bytes = 0;
+	stats->largest_free = 0;
+	for (u32 i = 0; i < HEAP_NUM_BINS; i++)
+		for (hnode_t *node = _heap.bins[i]; node; node = node->next)
+		{
+			stats->free_bytes += node->size;
+			stats->largest_free = MAX(stats->largest_free, node->size);
+		}
+}
+
+u32 heap_get_tags(heap_tag_t *tags, u32 max_tags)
+{
+	u32 num_tags = 0;
+
+	//Walk all chunks and sum up the live ones per call site, the last entry collects overflow.
+	for (hnode_t *node = (hnode_t *)_heap.start; node != _heap.top; node = _heap_next(node))
+	{
+		if (!(node->size & HNODE_USED))
+			continue;
+
+		u32 i;
+		for (i = 0; i < num_tags && tags[i].tag != (u32)node->prev; i++)
+			;
+		if (i == num_tags)
+		{
+			if (num_tags == max_tags)
+				i = max_tags - 1;
+			else
+			{
+				tags[i].tag = (u32)node->prev;
+				tags[i].count = 0;
+				tags[i].bytes = 0;
+				num_tags++;
+			}
+		}
+		tags[i].count++;
+		tags[i].bytes += HNODE_SIZE(node);
+	}
+
+	return num_tags;
 }
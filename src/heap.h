@@ -19,9 +19,36 @@
 
 #include "types.h"
 
+/*! Number of call sites kept by the heap reports (heap_report.h). */
+#define HEAP_MAX_TAGS 32
+
+/*! Byte counts include chunk headers. */
+typedef struct _heap_stats_t
+{
+	u32 live_bytes;
+	u32 peak_bytes;
+	u32 num_allocs;
+	u32 num_frees;
+	u32 top;
+	u32 peak_top;
+	u32 free_bytes;
+	u32 largest_free;
+} heap_stats_t;
+
+/*! Live allocations of one call site. */
+typedef struct _heap_tag_t
+{
+	u32 tag;
+	u32 count;
+	u32 bytes;
+} heap_tag_t;
+
 void heap_init(u32 base);
 void *malloc(u32 size);
+void *memalign(u32 align, u32 size);
 void *calloc(u32 num, u32 size);
 void free(void *buf);
+void heap_get_stats(heap_stats_t *stats);
+u32 heap_get_tags(heap_tag_t *tags, u32 max_tags);
 
 #endif
@@ -0,0 +1,66 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "heap_report.h"
+#include "ff.h"
+
+static u32 _heap_frag(heap_stats_t *stats)
+{
+	return stats->free_bytes ? 100 - stats->largest_free * 100 / stats->free_bytes : 0;
+}
+
+void heap_print(gfx_con_t *con, u32 limit)
+{
+	heap_stats_t stats;
+	heap_tag_t tags[HEAP_MAX_TAGS];
+
+	heap_get_stats(&stats);
+	gfx_printf(con, "heap: live %08X peak %08X allocs %d frees %d\n",
+		stats.live_bytes, stats.peak_bytes, stats.num_allocs, stats.num_frees);
+	gfx_printf(con, "heap: top %08X peak %08X headroom %08X\n",
+		stats.top, stats.peak_top, limit - stats.peak_top);
+	gfx_printf(con, "heap: free %08X largest %08X frag %d%%\n",
+		stats.free_bytes, stats.largest_free, _heap_frag(&stats));
+
+	u32 num_tags = heap_get_tags(tags, HEAP_MAX_TAGS);
+	for (u32 i = 0; i < num_tags; i++)
+		gfx_printf(con, "heap: site %08X count %d bytes %08X\n", tags[i].tag, tags[i].count, tags[i].bytes);
+}
+
+int heap_save(const char *path, u32 limit)
+{
+	FIL fp;
+	heap_stats_t stats;
+	heap_tag_t tags[HEAP_MAX_TAGS];
+
+	if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+
+	heap_get_stats(&stats);
+	f_printf(&fp, "live_bytes,%u\npeak_bytes,%u\nnum_allocs,%u\nnum_frees,%u\n",
+		stats.live_bytes, stats.peak_bytes, stats.num_allocs, stats.num_frees);
+	f_printf(&fp, "top,%08X\npeak_top,%08X\nheadroom,%u\n", stats.top, stats.peak_top, limit - stats.peak_top);
+	f_printf(&fp, "free_bytes,%u\nlargest_free,%u\nfrag_percent,%u\n",
+		stats.free_bytes, stats.largest_free, _heap_frag(&stats));
+
+	//Call sites are return addresses, resolve them with addr2line against the ELF.
+	f_puts("site,count,bytes\n", &fp);
+	u32 num_tags = heap_get_tags(tags, HEAP_MAX_TAGS);
+	for (u32 i = 0; i < num_tags; i++)
+		f_printf(&fp, "%08X,%u,%u\n", tags[i].tag, tags[i].count, tags[i].bytes);
+
+	return f_close(&fp) == FR_OK;
+}
@@ -0,0 +1,28 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HEAP_REPORT_H_
+#define _HEAP_REPORT_H_
+
+#include "types.h"
+#include "gfx.h"
+#include "heap.h"
+
+/*! limit is the first address the heap must not grow into, the headroom is reported against it. */
+void heap_print(gfx_con_t *con, u32 limit);
+int heap_save(const char *path, u32 limit);
+
+#endif
@@ -24,6 +24,7 @@
 #include "pmc.h"
 #include "cluster.h"
 #include "heap.h"
+#include "heap_report.h"
 #include "tsec.h"
 #include "pkg2.h"
 #include "nx_emmc.h"
@@ -31,7 +32,14 @@
 #include "pkg1.h"
 #include "pkg2.h"
 #include "ff.h"
+#include "diskio.h"
+#include "fload.h"
 #include "ini.h"
+#include "bprof.h"
+#include "pkg2_cache.h"
+#include "arena.h"
+#include "sched.h"
+#include "main.h"
 
 enum KB_FIRMWARE_VERSION {
 	KB_FIRMWARE_VERSION_100_200 = 0,
@@ -42,6 +50,15 @@ enum KB_FIRMWARE_VERSION {
 	KB_FIRMWARE_VERSION_MAX
 };
 
+//Package2 is read in chunks of this size while the previous chunk is being decrypted.
+#define PKG2_READ_CHUNK_SIZE 0x40000
+
+//Warmboot firmware location (also handed to the PMC) and the BootConfig that is cleared right before booting.
+#define WARMBOOT_ADDR 0x8000D000
+#define WARMBOOT_MAX_SIZE 0x3000
+#define BOOTCONFIG_ADDR 0x4003D000
+#define BOOTCONFIG_SIZE 0x3000
+
 #define NUM_KEYBLOB_KEYS 5
 static const u8 keyblob_keyseeds[NUM_KEYBLOB_KEYS][0x10] = {
 	{ 0xDF, 0x20, 0x6F, 0x59, 0x44, 0x54, 0xEF, 0xDC, 0x70, 0x74, 0x48, 0x3B, 0x0D, 0xED, 0x9F, 0xD3 }, //1.0.0
@@ -83,6 +100,28 @@ static void _se_lock() {
 	SE(SE_SECURITY_0) &= 0xFFFFFFFB; //Make access lock regs secure only.
 }
 
+//Console and master key derivation per keyblob generation, each only depends on constant seeds.
+static const se_op_t _keygen_ops_100[] = {
+	{ SE_OP_UNWRAP, 0x0F, 0x0D, NULL, console_keyseed },
+	{ SE_OP_UNWRAP, 0x0C, 0x0C, NULL, master_keyseed_retail },
+};
+
+static const se_op_t _keygen_ops_400[] = {
+	{ SE_OP_UNWRAP, 0x0F, 0x0D, NULL, console_keyseed_4xx },
+	{ SE_OP_UNWRAP, 0x0F, 0x0F, NULL, console_keyseed },
+	{ SE_OP_UNWRAP, 0x0C, 0x0E, NULL, master_keyseed_4xx },
+	{ SE_OP_UNWRAP, 0x0C, 0x0C, NULL, master_keyseed_retail },
+};
+
+static const se_op_t _keygen_ops_500[] = {
+	{ SE_OP_UNWRAP, 0x0F, 0x0A, NULL, console_keyseed_4xx },
+	{ SE_OP_UNWRAP, 0x0F, 0x0F, NULL, console_keyseed },
+	{ SE_OP_UNWRAP, 0x0C, 0x0E, NULL, master_keyseed_4xx },
+	{ SE_OP_UNWRAP, 0x0C, 0x0C, NULL, master_keyseed_retail },
+};
+
+#define KEYGEN_OPS(ops) ops, sizeof(ops) / sizeof(se_op_t)
+
 // <-- key derivation algorithm
 int keygen(u8 *keyblob, u32 kb, void *tsec_fw) {
 	u8 tmp[0x10];
@@ -94,234 +133,423 @@ int keygen(u8 *keyblob, u32 kb, void *tsec_fw) {
 	if (tsec_query(tmp, 1, tsec_fw) < 0)
 		return 0;
 
-	se_aes_key_set(0x0D, tmp, 0x10);
-
-	//Derive keyblob keys from TSEC+SBK.
-	se_aes_crypt_block_ecb(0x0D, 0x00, tmp, keyblob_keyseeds[0]);
-	se_aes_unwrap_key(0x0F, 0x0E, tmp);
-	se_aes_crypt_block_ecb(0xD, 0x00, tmp, keyblob_keyseeds[kb]);
-	se_aes_unwrap_key(0x0D, 0x0E, tmp);
-
-	// Clear SBK
-	se_aes_key_clear(0x0E);
-
-	se_aes_crypt_block_ecb(0x0D, 0, tmp, cmac_keyseed);
-	se_aes_unwrap_key(0x0B, 0x0D, cmac_keyseed);
+	//Derive keyblob keys from TSEC+SBK, clear SBK and derive the keyblob MAC key.
+	const se_op_t keyblob_ops[] = {
+		{ SE_OP_KEY_SET, 0x0D, 0, NULL, tmp },
+		{ SE_OP_ECB_DEC, 0x0D, 0, tmp, keyblob_keyseeds[0] },
+		{ SE_OP_UNWRAP, 0x0E, 0x0F, NULL, tmp },
+		{ SE_OP_ECB_DEC, 0x0D, 0, tmp, keyblob_keyseeds[kb] },
+		{ SE_OP_UNWRAP, 0x0E, 0x0D, NULL, tmp },
+		{ SE_OP_KEY_CLEAR, 0x0E },
+		{ SE_OP_ECB_DEC, 0x0D, 0, tmp, cmac_keyseed },
+		{ SE_OP_UNWRAP, 0x0D, 0x0B, NULL, cmac_keyseed },
+	};
+	if (!se_run_ops(KEYGEN_OPS(keyblob_ops)))
+		return 0;
 
 	//Decrypt keyblob and set keyslots.
 	se_aes_crypt_ctr(0x0D, keyblob + 0x20, 0x90, keyblob + 0x20, 0x90, keyblob + 0x10);
-	se_aes_key_set(0x0B, keyblob + 0x20 + 0x80, 0x10); // package1 key
-	se_aes_key_set(0x0C, keyblob + 0x20, 0x10);
-	se_aes_key_set(0x0D, keyblob + 0x20, 0x10);
 
-	se_aes_crypt_block_ecb(0x0C, 0, tmp, master_keyseed_retail);
+	const se_op_t keyslot_ops[] = {
+		{ SE_OP_KEY_SET, 0x0B, 0, NULL, keyblob + 0x20 + 0x80 }, // package1 key
+		{ SE_OP_KEY_SET, 0x0C, 0, NULL, keyblob + 0x20 },
+		{ SE_OP_KEY_SET, 0x0D, 0, NULL, keyblob + 0x20 },
+		{ SE_OP_ECB_DEC, 0x0C, 0, tmp, master_keyseed_retail },
+	};
+	if (!se_run_ops(KEYGEN_OPS(keyslot_ops)))
+		return 0;
 
+	int res;
 	switch (kb) {
 		case KB_FIRMWARE_VERSION_100_200:
 		case KB_FIRMWARE_VERSION_300:
 		case KB_FIRMWARE_VERSION_301:
-			se_aes_unwrap_key(0x0D, 0x0F, console_keyseed);
-			se_aes_unwrap_key(0x0C, 0x0C, master_keyseed_retail);
+			res = se_run_ops(KEYGEN_OPS(_keygen_ops_100));
 		break;
 
 		case KB_FIRMWARE_VERSION_400:
-			se_aes_unwrap_key(0x0D, 0x0F, console_keyseed_4xx);
-			se_aes_unwrap_key(0x0F, 0x0F, console_keyseed);
-			se_aes_unwrap_key(0x0E, 0x0C, master_keyseed_4xx);
-			se_aes_unwrap_key(0x0C, 0x0C, master_keyseed_retail);
+			res = se_run_ops(KEYGEN_OPS(_keygen_ops_400));
 		break;
 
 		case KB_FIRMWARE_VERSION_500:
 		default:
-			se_aes_unwrap_key(0x0A, 0x0F, console_keyseed_4xx);
-			se_aes_unwrap_key(0x0F, 0x0F, console_keyseed);
-			se_aes_unwrap_key(0x0E, 0x0C, master_keyseed_4xx);
-			se_aes_unwrap_key(0x0C, 0x0C, master_keyseed_retail);
+			res = se_run_ops(KEYGEN_OPS(_keygen_ops_500));
 		break;
 	}
+	if (!res)
+		return 0;
 
 	// Package2 key 
 	se_key_acc_ctrl(0x08, 0x15);
-	se_aes_unwrap_key(0x08, 0x0C, key8_keyseed);
+	return se_aes_unwrap_key(0x08, 0x0C, key8_keyseed);
 }
 
 typedef struct _launch_ctxt_t {
+	//Everything allocated for this launch, released at once if it fails.
+	arena_t arena;
+
+	//eMMC session shared by all reads of a launch, its bring-up is started at boot in main.c.
+	sdmmc_storage_t *storage;
+
 	void *keyblob;
 
 	void *pkg1;
 	const pkg1_id_t *pkg1_id;
 
-	void *warmboot;
-	u32 warmboot_size;
-	void *secmon;
-	u32 secmon_size;
+	//SD files of the config, resolved while parsing it and read straight to where they boot from once pkg1 is unpacked.
+	fload_batch_t files;
+	fload_ent_t *warmboot_file;
+	fload_ent_t *secmon_file;
 
+	emmc_part_t pkg2_part;
 	void *pkg2;
 	u32 pkg2_size;
+	u32 pkg2_read;
 
+	const char *kernel_path;
+	//Kernel and KIP1s, read from the SD card by their own task while package2 is read from the eMMC.
+	fload_batch_t kips;
+	sched_task_t *kips_task;
+	int kips_res;
 	void *kernel;
 	u32 kernel_size;
+	//Set when the kernel is still package2 ciphertext under this section counter.
+	u8 *kernel_ctr;
 	link_t kip1_list;
+	//Set when INI1 is passed through, it is still package2 ciphertext under this section counter.
+	void *ini1;
+	u32 ini1_size;
+	u8 *ini1_ctr;
 
 	u8 *svcperm;
 	u8 *debugmode;
+	bool pkg2cache;
+	bool heapreport;
+	bool taskreport;
 } launch_ctxt_t;
 
 typedef struct _merge_kip_t {
+	const char *path;
+	fload_ent_t *file;
+	u64 tid;
 	void *kip1;
 	link_t link;
 } merge_kip_t;
 
+static bool _emmc_open(launch_ctxt_t *ctxt) {
+	//Finish the bring-up (and the HS400 tuning) only once per launch.
+	if (!ctxt->storage)
+		ctxt->storage = emmc_open();
+	return ctxt->storage != NULL;
+}
+
+static void _emmc_close(launch_ctxt_t *ctxt) {
+	if (ctxt->storage)
+		emmc_close();
+	ctxt->storage = NULL;
+}
+
 static bool _read_emmc_pkg1(launch_ctxt_t *ctxt, gfx_con_t * con) {
-	int res = false;
-	sdmmc_storage_t storage;
-	sdmmc_t sdmmc;
+	if (!_emmc_open(ctxt))
+		return false;
 
-	sdmmc_storage_init_mmc(&storage, &sdmmc, SDMMC_4, SDMMC_BUS_WIDTH_8, 4);
+	//Read package1 and all keyblobs in one go, we only know which keyblob we need after identifying package1.
+	ctxt->pkg1 = (u8 *)arena_push(&ctxt->arena, 0x40000);
+	u8 *keyblobs = (u8 *)arena_push(&ctxt->arena, KB_FIRMWARE_VERSION_MAX * NX_EMMC_BLOCKSIZE);
+	nx_emmc_io_t ios[] = {
+		{ NX_EMMC_PART_BOOT0, 0x100000 / NX_EMMC_BLOCKSIZE, 0x40000 / NX_EMMC_BLOCKSIZE, ctxt->pkg1 },
+		{ NX_EMMC_PART_BOOT0, 0x180000 / NX_EMMC_BLOCKSIZE, KB_FIRMWARE_VERSION_MAX, keyblobs }
+	};
+	if (!nx_emmc_io_run(ctxt->storage, ios, 2))
+		return false;
 
-	//Read package1.
-	ctxt->pkg1 = (u8 *)malloc(0x40000);
-	sdmmc_storage_set_mmc_partition(&storage, 1);
-	sdmmc_storage_read(&storage, 0x100000 / NX_EMMC_BLOCKSIZE, 0x40000 / NX_EMMC_BLOCKSIZE, ctxt->pkg1);
 	ctxt->pkg1_id = pkg1_identify(ctxt->pkg1);
 	if (!ctxt->pkg1_id)
 	{
 		gfx_prompt(con, error, "Could not identify pkg1 version (= '%s').", (char *)ctxt->pkg1 + 0x10);
-		goto out;
+		return false;
 	}
 	gfx_prompt(con, message, "Identified pkg1('%s'), and keyblob(%d)", (char *)(ctxt->pkg1 + 0x10), ctxt->pkg1_id->kb);
 
-	//Read the correct keyblob.
-	ctxt->keyblob = (u8 *)malloc(NX_EMMC_BLOCKSIZE);
-	sdmmc_storage_read(&storage, 0x180000 / NX_EMMC_BLOCKSIZE + ctxt->pkg1_id->kb, 1, ctxt->keyblob);
-
-	res = true;
+	//Select the correct keyblob.
+	ctxt->keyblob = keyblobs + ctxt->pkg1_id->kb * NX_EMMC_BLOCKSIZE;
 
-out:;
-	sdmmc_storage_end(&storage);
-	return res;
+	return true;
 }
 
-static bool _read_emmc_pkg2(launch_ctxt_t *ctxt, gfx_con_t * con) {
-	bool res = false;
-	sdmmc_storage_t storage;
-	sdmmc_t sdmmc;
-
-	sdmmc_storage_init_mmc(&storage, &sdmmc, SDMMC_4, SDMMC_BUS_WIDTH_8, 4);
-	sdmmc_storage_set_mmc_partition(&storage, 0);
+static bool _read_emmc_pkg2(launch_ctxt_t *ctxt, gfx_con_t * con, void *dst) {
+	if (!_emmc_open(ctxt))
+		return false;
 
-	//Parse eMMC GPT.
+	//Parse eMMC GPT, we only keep the package2 partition.
+	arena_mark_t mark = arena_mark(&ctxt->arena);
 	LIST_INIT(gpt);
-	nx_emmc_gpt_parse(&gpt, &storage);
+	nx_emmc_gpt_parse(&ctxt->arena, &gpt, ctxt->storage);
 
 	gfx_prompt(con, message, "Parsed GPT");
 
 	//Find package2 partition.
 	emmc_part_t *pkg2_part = nx_emmc_part_find(&gpt, "BCPKG2-1-Normal-Main");
+	if (pkg2_part)
+		ctxt->pkg2_part = *pkg2_part;
+	arena_reset(&ctxt->arena, mark);
 	if (!pkg2_part)
-		goto out;
+		return false;
+	pkg2_part = &ctxt->pkg2_part;
 
-	//Read in package2 header and get package2 real size.
-	//TODO: implement memalign for DMA buffers.
-	u8 *tmp = (u8 *)malloc(NX_EMMC_BLOCKSIZE);
-	nx_emmc_part_read(&storage, pkg2_part, 0x4000 / NX_EMMC_BLOCKSIZE, 1, tmp);
-	u32 *hdr = (u32 *)(tmp + 0x100);
+	//Package2 starts 0x4000 into the partition and can't be larger than what is left of it.
+	u32 pkg2_max_size = (pkg2_part->lba_end - pkg2_part->lba_start + 1) * NX_EMMC_BLOCKSIZE - 0x4000;
+
+	//Read in the first 16KB of package2 and get package2 real size before sizing the buffer.
+	u32 hdr_size = MIN(0x4000, pkg2_max_size);
+	u8 *hdr_buf = (u8 *)malloc(hdr_size);
+	if (!hdr_buf)
+		return false;
+	if (!nx_emmc_part_read(ctxt->storage, pkg2_part, 0x4000 / NX_EMMC_BLOCKSIZE, hdr_size / NX_EMMC_BLOCKSIZE, hdr_buf)) {
+		free(hdr_buf);
+		return false;
+	}
+	u32 *hdr = (u32 *)(hdr_buf + 0x100);
 	u32 pkg2_size = hdr[0] ^ hdr[2] ^ hdr[3];
-	free(tmp);
 	gfx_prompt(con, message, "The size of pkg2 is %08X", pkg2_size);
 
-	//Read in package2.
 	u32 pkg2_size_aligned = ALIGN(pkg2_size, NX_EMMC_BLOCKSIZE);
 	gfx_prompt(con, message, "The size of pkg2 aligned is %08X", pkg2_size_aligned);
+	u8 *pkg2 = NULL;
+	if (pkg2_size_aligned <= pkg2_max_size)
+		pkg2 = dst ? (u8 *)dst : (u8 *)arena_push(&ctxt->arena, pkg2_size_aligned);
+	if (!pkg2) {
+		free(hdr_buf);
+		return false;
+	}
+	hdr_size = MIN(hdr_size, pkg2_size_aligned);
+	memcpy(pkg2, hdr_buf, hdr_size);
+	free(hdr_buf);
 
-	ctxt->pkg2 = malloc(pkg2_size_aligned);
+	//Only the first chunk is read here, the rest follows in _read_emmc_pkg2_rest.
+	ctxt->pkg2 = pkg2;
 	ctxt->pkg2_size = pkg2_size;
-	nx_emmc_part_read(&storage, pkg2_part, 0x4000 / NX_EMMC_BLOCKSIZE, 
-		pkg2_size_aligned / NX_EMMC_BLOCKSIZE, ctxt->pkg2);
+	ctxt->pkg2_read = hdr_size;
+	return true;
+}
+
+static bool _read_emmc_pkg2_rest(launch_ctxt_t *ctxt, pkg2_stream_t *st) {
+	u32 pkg2_size_aligned = ALIGN(ctxt->pkg2_size, NX_EMMC_BLOCKSIZE);
 
-	res = true;
+	while (ctxt->pkg2_read < pkg2_size_aligned)
+	{
+		//Without decryption there is nothing to overlap with, so read the rest in one go.
+		u32 chunk = pkg2_size_aligned - ctxt->pkg2_read;
+		if (st)
+		{
+			chunk = MIN(chunk, PKG2_READ_CHUNK_SIZE);
+
+			//Let the SE work on what we have while the next chunk is read.
+			if (!pkg2_stream_decrypt(st, ctxt->pkg2_read))
+				return false;
+		}
+
+		if (!nx_emmc_part_read(ctxt->storage, &ctxt->pkg2_part, (0x4000 + ctxt->pkg2_read) / NX_EMMC_BLOCKSIZE,
+			chunk / NX_EMMC_BLOCKSIZE, (u8 *)ctxt->pkg2 + ctxt->pkg2_read))
+		{
+			if (st)
+				se_aes_crypt_ctr_wait();
+			return false;
+		}
+		ctxt->pkg2_read += chunk;
+	}
+
+	if (st && (!pkg2_stream_decrypt(st, ctxt->pkg2_size) || !pkg2_stream_finish(st)))
+		return false;
 
-out:;
-	nx_emmc_gpt_free(&gpt);
-	sdmmc_storage_end(&storage);
-	return res;
+	return true;
 }
 
 static bool _config_warmboot(gfx_con_t * con, launch_ctxt_t * ctxt, const char * value) {
-	FIL fp;
-	if (f_open(&fp, value, FA_READ) != FR_OK) {
+	fload_ent_t *file = fload_batch_add(&ctxt->arena, &ctxt->files, value, NULL, 0);
+	if (!file) {
 		gfx_prompt(con, error, "Failed to load warmboot %s.", value);
 		return false;
 	}
-	
-	ctxt->warmboot_size = f_size(&fp);
-	ctxt->warmboot = malloc(ctxt->warmboot_size);
-	f_read(&fp, ctxt->warmboot, ctxt->warmboot_size, NULL);
 
-	gfx_prompt(con, ok, "Loaded warmboot %s.", value);
-
-	f_close(&fp);
+	//Only the last warmboot of the section is used.
+	if (ctxt->warmboot_file)
+		fload_batch_drop(ctxt->warmboot_file);
+	ctxt->warmboot_file = file;
 	return true;
 }
 
 static bool _config_secmon(gfx_con_t * con, launch_ctxt_t * ctxt, const char * value) {
-	FIL fp;
-	if (f_open(&fp, value, FA_READ) != FR_OK) {
+	fload_ent_t *file = fload_batch_add(&ctxt->arena, &ctxt->files, value, NULL, 0);
+	if (!file) {
 		gfx_prompt(con, error, "Failed to load secmon %s.", value);
 		return false;
 	}
 
-	ctxt->secmon_size = f_size(&fp);
-	ctxt->secmon = malloc(ctxt->secmon_size);
-	f_read(&fp, ctxt->secmon, ctxt->secmon_size, NULL);
+	if (ctxt->secmon_file)
+		fload_batch_drop(ctxt->secmon_file);
+	ctxt->secmon_file = file;
+	return true;
+}
+
+static bool _load_config_files(gfx_con_t * con, launch_ctxt_t * ctxt) {
+	//Place each file at its boot location, the secmon has to end before the BootConfig which is cleared before booting.
+	if (ctxt->warmboot_file && !fload_batch_place(ctxt->warmboot_file, (void *)WARMBOOT_ADDR, WARMBOOT_MAX_SIZE)) {
+		gfx_prompt(con, error, "Warmboot %s is too large.", ctxt->warmboot_file->path);
+		return false;
+	}
+	if (ctxt->secmon_file && !fload_batch_place(ctxt->secmon_file, (void *)ctxt->pkg1_id->secmon_base, BOOTCONFIG_ADDR - ctxt->pkg1_id->secmon_base)) {
+		gfx_prompt(con, error, "Secmon %s is too large.", ctxt->secmon_file->path);
+		return false;
+	}
 
-	gfx_prompt(con, ok, "Loaded secmon %s.", value);
+	u32 prof = bprof_begin("config_files");
+	int res = fload_batch_run(&ctxt->arena, &ctxt->files);
+	bprof_end(prof);
+
+	if (!res) {
+		gfx_prompt(con, error, "Failed to load warmboot/secmon.");
+		return false;
+	}
+	if (ctxt->warmboot_file)
+		gfx_prompt(con, ok, "Loaded warmboot %s.", ctxt->warmboot_file->path);
+	if (ctxt->secmon_file)
+		gfx_prompt(con, ok, "Loaded secmon %s.", ctxt->secmon_file->path);
 
-	f_close(&fp);
 	return true;
 }
 
+//The kernel and KIP1s are only needed when package2 is not in the cache, so they are loaded lazily.
 static bool _config_kernel(gfx_con_t * con, launch_ctxt_t * ctxt, const char * value) {
-	FIL fp;
-	if (f_open(&fp, value, FA_READ) != FR_OK) {
+	FILINFO fno;
+	if (f_stat(value, &fno) != FR_OK) {
 		gfx_prompt(con, error, "Failed to load kernel %s.", value);
 		return false;
 	}
 
-	ctxt->kernel_size = f_size(&fp);
-	ctxt->kernel = malloc(ctxt->kernel_size);
-	f_read(&fp, ctxt->kernel, ctxt->kernel_size, NULL);
-
-	gfx_prompt(con, ok, "Loaded kernel %s.", value);
-
-	f_close(&fp);
+	ctxt->kernel_path = value;
 	return true;
 }
 
 static bool _config_kip1(gfx_con_t * con, launch_ctxt_t * ctxt, const char * value) {
-	FIL fp;
-	if (f_open(&fp, value, FA_READ) != FR_OK) {
+	FILINFO fno;
+	if (f_stat(value, &fno) != FR_OK) {
 		gfx_prompt(con, error, "Failed to load kip1 %s.", value);
 		return false;
 	}
 
-	merge_kip_t *mkip1 = (merge_kip_t *)malloc(sizeof(merge_kip_t));
-	mkip1->kip1 = malloc(f_size(&fp));
-	f_read(&fp, mkip1->kip1, f_size(&fp), NULL);
+	merge_kip_t *mkip1 = (merge_kip_t *)arena_push(&ctxt->arena, sizeof(merge_kip_t));
+	mkip1->path = value;
+	mkip1->file = NULL;
+	mkip1->kip1 = NULL;
+	list_append(&ctxt->kip1_list, &mkip1->link);
+	return true;
+}
 
-	gfx_prompt(con, ok, "Loaded kip1 %s.", value);
+static void _load_kernel_kips_task(void *arg) {
+	launch_ctxt_t *ctxt = (launch_ctxt_t *)arg;
+
+	//The batch gets its own scratch arena, the launch arena is used by the boot task meanwhile.
+	arena_t scratch;
+	arena_init(&scratch, 0);
+	u32 prof = bprof_begin("kernel_kips");
+	ctxt->kips_res = fload_batch_run(&scratch, &ctxt->kips);
+	bprof_end(prof);
+	arena_free(&scratch);
+}
+
+static bool _load_kernel_kips(gfx_con_t * con, launch_ctxt_t * ctxt) {
+	fload_batch_t *batch = &ctxt->kips;
+	fload_ent_t *kernel = NULL;
+	pkg2_kip1_t hdr;
+
+	//Resolve all files first, the KIP1 headers tell us which ones are actually needed.
+	fload_batch_init(batch);
+	if (ctxt->kernel_path) {
+		kernel = fload_batch_add(&ctxt->arena, batch, ctxt->kernel_path, NULL, 0);
+		if (!kernel) {
+			gfx_prompt(con, error, "Failed to load kernel %s.", ctxt->kernel_path);
+			return false;
+		}
+	}
+
+	LIST_FOREACH_ENTRY(merge_kip_t, mki, &ctxt->kip1_list, link) {
+		mki->file = fload_batch_add(&ctxt->arena, batch, mki->path, &hdr, OFFSET_OF(pkg2_kip1_t, tid) + sizeof(u64));
+		if (!mki->file) {
+			gfx_prompt(con, error, "Failed to load kip1 %s.", mki->path);
+			return false;
+		}
+		mki->tid = hdr.tid;
+	}
+
+	//A later KIP1 replaces an earlier one with the same title ID when merging, so don't load the earlier one at all.
+	LIST_FOREACH_SAFE(iter, &ctxt->kip1_list) {
+		merge_kip_t *mki = CONTAINER_OF(iter, merge_kip_t, link);
+		for (link_t *l = iter->next; l != &ctxt->kip1_list; l = l->next) {
+			if (CONTAINER_OF(l, merge_kip_t, link)->tid == mki->tid) {
+				gfx_prompt(con, message, "Skipping kip1 %s, replaced by %s.", mki->path, CONTAINER_OF(l, merge_kip_t, link)->path);
+				fload_batch_drop(mki->file);
+				list_remove(iter);
+				break;
+			}
+		}
+	}
+
+	if (kernel) {
+		ctxt->kernel_size = kernel->size;
+		ctxt->kernel = kernel->buf = arena_push(&ctxt->arena, kernel->size);
+	}
+	LIST_FOREACH_ENTRY(merge_kip_t, mki, &ctxt->kip1_list, link)
+		mki->kip1 = mki->file->buf = arena_push(&ctxt->arena, mki->file->size);
 
-	f_close(&fp);
-	list_append(&ctxt->kip1_list, &mkip1->link);
 	return true;
 }
 
+static void _load_kernel_kips_start(launch_ctxt_t * ctxt) {
+	//Without a free task slot the files are simply read right away.
+	ctxt->kips_task = sched_spawn("kernel_kips", _load_kernel_kips_task, ctxt, SCHED_STACK_SIZE);
+	if (!ctxt->kips_task)
+		_load_kernel_kips_task(ctxt);
+}
+
+static bool _load_kernel_kips_finish(gfx_con_t * con, launch_ctxt_t * ctxt) {
+	sched_join(ctxt->kips_task);
+	ctxt->kips_task = NULL;
+
+	if (!ctxt->kips_res) {
+		gfx_prompt(con, error, "Failed to load kernel/kip1s.");
+		return false;
+	}
+	if (ctxt->kernel_path)
+		gfx_prompt(con, ok, "Loaded kernel %s.", ctxt->kernel_path);
+	LIST_FOREACH_ENTRY(merge_kip_t, mki, &ctxt->kip1_list, link)
+		gfx_prompt(con, ok, "Loaded kip1 %s.", mki->path);
+
+	return true;
+}
+
+static bool _pkg2_cache_key(launch_ctxt_t * ctxt, u8 *key) {
+	//Collect the SD files that make up the rebuilt package2, in the order they are merged.
+	u32 num_paths = 0;
+	const char *paths[32];
+	if (ctxt->kernel_path)
+		paths[num_paths++] = ctxt->kernel_path;
+	LIST_FOREACH_ENTRY(merge_kip_t, mki, &ctxt->kip1_list, link) {
+		if (num_paths == 32)
+			return false;
+		paths[num_paths++] = mki->path;
+	}
+
+	u32 flags = (ctxt->svcperm ? 1 : 0) | (ctxt->debugmode ? 2 : 0);
+	return pkg2_cache_key(key, ctxt->pkg1_id->id, ctxt->pkg2, flags, paths, num_paths);
+}
+
 static bool _config_svcperm(gfx_con_t * con, launch_ctxt_t *ctxt, const char *value)
 {
 	if (*(u8 *)value == '1')
 	{
 		gfx_prompt(con, ok, "Disabled SVC verification.");
-		ctxt->svcperm = malloc(1);
+		ctxt->svcperm = arena_push(&ctxt->arena, 1);
 	}
 		
 	return true;
@@ -332,12 +560,57 @@ static bool _config_debugmode(gfx_con_t * con, launch_ctxt_t *ctxt, const char *
 	if (*(u8 *)value == '1')
 	{
 		gfx_prompt(con, ok, "Enabled debug mode.");
-		ctxt->debugmode = malloc(1);
+		ctxt->debugmode = arena_push(&ctxt->arena, 1);
 	}
 
 	return true;
 }
 
+static bool _config_pkg2cache(gfx_con_t * con, launch_ctxt_t *ctxt, const char *value)
+{
+	if (*(u8 *)value == '1')
+		ctxt->pkg2cache = true;
+
+	return true;
+}
+
+static bool _save_disk_stats(const char *path) {
+	FIL fp;
+	DISKSTATS stats;
+
+	if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return false;
+
+	disk_get_stats(&stats);
+	f_printf(&fp, "direct_bytes,%u\nbounce_bytes,%u\nbounce_ops,%u\n",
+		stats.direct_bytes, stats.bounce_bytes, stats.bounce_ops);
+	f_printf(&fp, "cache_hits,%u\ncache_misses,%u\ncache_readahead_blocks,%u\ncache_bypass_sectors,%u\ncommands,%u\n",
+		stats.cache.hits, stats.cache.misses, stats.cache.ra_blks, stats.cache.bypass_sectors, stats.cache.cmds);
+	f_printf(&fp, "err_timeout,%u\nerr_crc,%u\nerr_end_bit,%u\nerr_dma,%u\nerr_other,%u\n",
+		stats.errs.errors[SDMMC_ERR_TIMEOUT], stats.errs.errors[SDMMC_ERR_CRC], stats.errs.errors[SDMMC_ERR_END_BIT],
+		stats.errs.errors[SDMMC_ERR_DMA], stats.errs.errors[SDMMC_ERR_OTHER]);
+	f_printf(&fp, "retunes,%u\nstep_downs,%u\nsplits,%u\nfailed,%u\nbad_sector,%u\n",
+		stats.errs.retunes, stats.errs.step_downs, stats.errs.splits, stats.errs.failed, stats.errs.bad_sector);
+
+	return f_close(&fp) == FR_OK;
+}
+
+static bool _config_heapreport(gfx_con_t * con, launch_ctxt_t *ctxt, const char *value)
+{
+	if (*(u8 *)value == '1')
+		ctxt->heapreport = true;
+
+	return true;
+}
+
+static bool _config_taskreport(gfx_con_t * con, launch_ctxt_t *ctxt, const char *value)
+{
+	if (*(u8 *)value == '1')
+		ctxt->taskreport = true;
+
+	return true;
+}
+
 typedef struct _cfg_handler_t {
 	const char *key;
 	bool (*handler)(gfx_con_t * con, launch_ctxt_t *ctxt, const char *value);
@@ -350,13 +623,23 @@ static const cfg_handler_t _config_handlers[] = {
 	{ "kip1", _config_kip1 },
 	{ "fullsvcperm", _config_svcperm },
 	{ "debugmode", _config_debugmode },
+	{ "pkg2cache", _config_pkg2cache },
+	{ "heapreport", _config_heapreport },
+	{ "taskreport", _config_taskreport },
 	{ NULL, NULL },
 };
 
+static u32 _config_hashes[sizeof(_config_handlers) / sizeof(cfg_handler_t)];
+
 static bool _config(gfx_con_t * con, launch_ctxt_t *ctxt, ini_sec_t *cfg) {
+	//Keys come with their hash, so only a matching handler gets the strcmp.
+	if (!_config_hashes[0])
+		for(u32 i = 0; _config_handlers[i].key; i++)
+			_config_hashes[i] = ini_hash(_config_handlers[i].key);
+
 	LIST_FOREACH_ENTRY(ini_kv_t, kv, &cfg->kvs, link) {
 		for(u32 i = 0; _config_handlers[i].key; i++) {
-			if (!strcmp(_config_handlers[i].key, kv->key) && !_config_handlers[i].handler(con, ctxt, kv->val)) {
+			if (_config_hashes[i] == kv->hash && !strcmp(_config_handlers[i].key, kv->key) && !_config_handlers[i].handler(con, ctxt, kv->val)) {
 				return false;
 			}
 		}
@@ -365,16 +648,103 @@ static bool _config(gfx_con_t * con, launch_ctxt_t *ctxt, ini_sec_t *cfg) {
 	return true;
 }
 
-ini_sec_t * loadConfig(gfx_con_t * con, bool hen) {
-	LIST_INIT(ini_sections);
-	if (ini_parse(&ini_sections, "switchblade.ini")) {
-		LIST_FOREACH_ENTRY(ini_sec_t, ini_sec, &ini_sections, link) {
-			if (hen && strcmp(ini_sec->name, "hen") == 0) {
-				return ini_sec;
-			} else if (!hen && strcmp(ini_sec->name, "stock") == 0) {
-				return ini_sec;
-			}
+static bool _merge_pkg2(gfx_con_t * con, launch_ctxt_t * ctxt, link_t *kip1_info, patch_t *kernel_patchset) {
+	u32 prof;
+
+	if (!_load_kernel_kips(con, ctxt))
+		return false;
+
+	gfx_prompt(con, message, "Loading and decrypting pkg2...");
+
+	//Only decrypt the kernel if we are going to patch it, otherwise it is passed through as is.
+	bool patch_kernel = !ctxt->kernel && kernel_patchset != NULL && (ctxt->svcperm || ctxt->debugmode);
+	//Same for INI1, unless there are KIP1s to merge into it or it goes into the cache.
+	bool patch_ini1 = !list_empty(&ctxt->kip1_list) || ctxt->pkg2cache;
+	u32 sec_mask = 0;
+	if (patch_ini1)
+		sec_mask |= PKG2_SEC_BIT(PKG2_SEC_INI1);
+	if (patch_kernel)
+		sec_mask |= PKG2_SEC_BIT(PKG2_SEC_KERNEL);
+
+	pkg2_hdr_t *pkg2_hdr = pkg2_decrypt_hdr(ctxt->pkg2);
+	if (!pkg2_hdr) {
+		gfx_prompt(con, error, "Failed to decrypt pkg2.");
+		return false;
+	}
+
+	//Read the rest of package2, decrypting each chunk while the next one is read and the SD files are read alongside.
+	_load_kernel_kips_start(ctxt);
+	pkg2_stream_t st;
+	pkg2_stream_init(&st, pkg2_hdr, sec_mask);
+	prof = bprof_begin("pkg2_read_decrypt");
+	bool res = _read_emmc_pkg2_rest(ctxt, &st);
+	bprof_end(prof);
+
+	if (!_load_kernel_kips_finish(con, ctxt))
+		return false;
+	if (!res) {
+		gfx_prompt(con, error, "Failed to load pkg2.");
+		return false;
+	}
+
+	gfx_prompt(con, ok, "Loaded and decrypted pkg2.");
+
+	if (patch_ini1) {
+		gfx_prompt(con, message, "Parsing out KIP1 blobs...");
+
+		pkg2_parse_kips(&ctxt->arena, kip1_info, pkg2_hdr);
+
+		gfx_prompt(con, ok, "Parsed out KIP1 blobs.");
+	} else {
+		ctxt->ini1 = pkg2_hdr->data + pkg2_hdr->sec_size[PKG2_SEC_KERNEL];
+		ctxt->ini1_size = pkg2_hdr->sec_size[PKG2_SEC_INI1];
+		ctxt->ini1_ctr = &pkg2_hdr->sec_ctr[PKG2_SEC_INI1 * 0x10];
+	}
+
+	//Use the kernel included in package2 in case we didn't load one already.
+	if (!ctxt->kernel)
+	{
+		ctxt->kernel = pkg2_hdr->data;
+		ctxt->kernel_size = pkg2_hdr->sec_size[PKG2_SEC_KERNEL];
+
+		if (!patch_kernel)
+			ctxt->kernel_ctr = &pkg2_hdr->sec_ctr[PKG2_SEC_KERNEL * 0x10];
+		else
+		{
+			gfx_prompt(con, message, "Patching Kernel...");
+
+			if (ctxt->svcperm && kernel_patchset[0].off != 0xFFFFFFFF)
+				*(vu32 *)(ctxt->kernel + kernel_patchset[0].off) = kernel_patchset[0].val;
+
+			if (ctxt->debugmode && kernel_patchset[1].off != 0xFFFFFFFF)
+				*(vu32 *)(ctxt->kernel + kernel_patchset[1].off) = kernel_patchset[1].val;
+
+			gfx_prompt(con, ok, "Kernel Patched.");
 		}
+	}
+
+	//Merge extra KIP1s into loaded ones.
+	prof = bprof_begin("pkg2_merge");
+	LIST_FOREACH_ENTRY(merge_kip_t, mki, &ctxt->kip1_list, link) {
+		gfx_prompt(con, message, "Merging %s KIP1 blobs...", ((pkg2_kip1_t *)mki->kip1)->name);
+
+		pkg2_merge_kip(&ctxt->arena, kip1_info, (pkg2_kip1_t *)mki->kip1);
+
+		gfx_prompt(con, ok, "Merged %s KIP1 blobs...", ((pkg2_kip1_t *)mki->kip1)->name);
+	}
+	bprof_end(prof);
+
+	return true;
+}
+
+ini_sec_t * loadConfig(gfx_con_t * con, arena_t * arena, bool hen) {
+	LIST_INIT(ini_sections);
+	const char *name = hen ? "hen" : "stock";
+
+	//A compiled config needs no parsing at all unless it is stale, the plain one is only parsed up to the wanted section.
+	if (ini_load_bin(arena, &ini_sections, "switchblade.bin", "switchblade.ini", name) || ini_parse(arena, &ini_sections, "switchblade.ini", name)) {
+		if (!list_empty(&ini_sections))
+			return CONTAINER_OF(ini_sections.next, ini_sec_t, link);
 	} else {
 		gfx_prompt(con, error, "Could not find or open switchblade.ini.");
 	}
@@ -386,53 +756,57 @@ bool hos_launch(gfx_con_t * con, bool hen) {
 	int bootStatePackage2, bootStateContinue;
 	launch_ctxt_t ctxt;
 	memset(&ctxt, 0, sizeof(launch_ctxt_t));
+	arena_init(&ctxt.arena, 0);
+	fload_batch_init(&ctxt.files);
 	list_init(&ctxt.kip1_list);
 
-	ini_sec_t *cfg = loadConfig(con, hen);
+	u32 prof = bprof_begin("ini_parse");
+	ini_sec_t *cfg = loadConfig(con, &ctxt.arena, hen);
+	bprof_end(prof);
 	if (cfg && !_config(con, &ctxt, cfg))
-		return false;
+		goto fail;
 
 	gfx_prompt(con, message, "Loading pkg1...");
 
 	//Read package1 and the correct keyblob.
+	prof = bprof_begin("pkg1_read");
 	if (!_read_emmc_pkg1(&ctxt, con)) {
 		gfx_prompt(con, error, "Failed to load pkg1.");
-		return false;
+		goto fail;
 	}
+	bprof_end(prof);
 
 	gfx_prompt(con, ok, "Loaded pkg1.");
 	gfx_prompt(con, message, "Generating keys...");
 
 	//Generate keys.
+	prof = bprof_begin("keygen");
 	keygen(ctxt.keyblob, ctxt.pkg1_id->kb, (u8 *)ctxt.pkg1 + ctxt.pkg1_id->tsec_off);
+	bprof_end(prof);
 
 	gfx_prompt(con, ok, "Generated keys.");
 
 	//Decrypt and unpack package1 if we require parts of it.
-	if (!ctxt.warmboot || !ctxt.secmon)
+	if (!ctxt.warmboot_file || !ctxt.secmon_file)
 	{
 		gfx_prompt(con, message, "Decrypting and unpacking pkg1...");
 		
+		prof = bprof_begin("pkg1_decrypt_unpack");
 		pkg1_decrypt(ctxt.pkg1_id, ctxt.pkg1);
-		pkg1_unpack((void *)0x8000D000, (void *)ctxt.pkg1_id->secmon_base, ctxt.pkg1_id, ctxt.pkg1);
+		pkg1_unpack((void *)WARMBOOT_ADDR, (void *)ctxt.pkg1_id->secmon_base, ctxt.pkg1_id, ctxt.pkg1);
+		bprof_end(prof);
 
 		gfx_prompt(con, ok, "Decrypted and unpacked pkg1.");
 	}
 
-	if (ctxt.warmboot)
-		memcpy((void *)0x8000D000, ctxt.warmboot, ctxt.warmboot_size);
+	//Custom warmboot and secmon go over what pkg1 unpacked.
+	if (!_load_config_files(con, &ctxt))
+		goto fail;
 
 	//Set warmboot address in PMC.
-	PMC(APBDEV_PMC_SCRATCH1) = 0x8000D000;
+	PMC(APBDEV_PMC_SCRATCH1) = WARMBOOT_ADDR;
 
-	if (ctxt.secmon) {
-		gfx_prompt(con, message, "Replacing secmon...");
-
-		memcpy((void *)ctxt.pkg1_id->secmon_base, ctxt.secmon, ctxt.secmon_size);
-
-		gfx_prompt(con, ok, "Secmon replaced.");
-	}
-	else
+	if (!ctxt.secmon_file)
 	{
 		patch_t *secmon_patchset = ctxt.pkg1_id->secmon_patchset;
 		//In case a kernel patch option is set. Allows to disable Svc Verififcation or/and enable Debug mode
@@ -449,79 +823,88 @@ bool hos_launch(gfx_con_t * con, bool hen) {
 				gfx_prompt(con, ok, "Secmon patched.");
 			}
 
-			gfx_prompt(con, message, "Loading pkg2...");
+			gfx_prompt(con, message, "Loading pkg2 header...");
 			
-			//Read package2.
-			if (!_read_emmc_pkg2(&ctxt, con)) {
+			//Read the start of package2, the rest is only needed if it is not in the cache.
+			prof = bprof_begin("pkg2_read");
+			if (!_read_emmc_pkg2(&ctxt, con, NULL)) {
 				gfx_prompt(con, error, "Failed to load pkg2.");
-				return false;
+				goto fail;
 			}
+			bprof_end(prof);
 
-			gfx_prompt(con, ok, "Loaded pkg2.");
-			gfx_prompt(con, message, "Decrypting pkg2...");
+			gfx_prompt(con, ok, "Loaded pkg2 header.");
 
-			//Decrypt package2 and parse KIP1 blobs in INI1 section.
-			pkg2_hdr_t *pkg2_hdr = pkg2_decrypt(ctxt.pkg2);
-
-			gfx_prompt(con, ok, "Decrypted pkg2.");
-			gfx_prompt(con, message, "Parsing out KIP1 blobs...");
+			//The cache key has to be taken while the package2 header is still encrypted.
+			u8 cache_key[PKG2_CACHE_KEY_SIZE];
+			bool cache = ctxt.pkg2cache && _pkg2_cache_key(&ctxt, cache_key);
+			pkg2_ini1_t *cache_ini1;
 
 			LIST_INIT(kip1_info);
-			pkg2_parse_kips(&kip1_info, pkg2_hdr);
-
-			gfx_prompt(con, ok, "Parsed out KIP1 blobs.");
-
-			//Use the kernel included in package2 in case we didn't load one already.
-			if (!ctxt.kernel)
-			{
-				ctxt.kernel = pkg2_hdr->data;
-				ctxt.kernel_size = pkg2_hdr->sec_size[PKG2_SEC_KERNEL];
-
-				if (kernel_patchset != NULL && (ctxt.svcperm || ctxt.debugmode))
-				{
-					gfx_prompt(con, message, "Patching Kernel...");
-
-					if (ctxt.svcperm && kernel_patchset[0].off != 0xFFFFFFFF)
-						*(vu32 *)(ctxt.kernel + kernel_patchset[0].off) = kernel_patchset[0].val;
-
-					if (ctxt.debugmode && kernel_patchset[1].off != 0xFFFFFFFF)
-						*(vu32 *)(ctxt.kernel + kernel_patchset[1].off) = kernel_patchset[1].val;
-
-					gfx_prompt(con, ok, "Kernel Patched.");
+			prof = bprof_begin("pkg2_cache_load");
+			bool cached = cache && pkg2_cache_load(cache_key, &ctxt.kernel, &ctxt.kernel_size, &ctxt.kernel_ctr, &cache_ini1);
+			bprof_end(prof);
+
+			if (cached) {
+				//The cached kernel and INI1 are exactly what merging would produce.
+				pkg2_parse_ini1(&ctxt.arena, &kip1_info, cache_ini1);
+
+				gfx_prompt(con, ok, "Loaded pkg2 from cache.");
+			} else {
+				if (!_merge_pkg2(con, &ctxt, &kip1_info, kernel_patchset))
+					goto fail;
+
+				//Keep the merged result for the next boot, failing to do so only costs us the cache.
+				if (cache) {
+					arena_mark_t mark = arena_mark(&ctxt.arena);
+					pkg2_ini1_t *ini1 = (pkg2_ini1_t *)arena_push(&ctxt.arena, pkg2_calc_ini1_size(&kip1_info));
+					pkg2_build_ini1(ini1, &kip1_info);
+					prof = bprof_begin("pkg2_cache_save");
+					if (!pkg2_cache_save(cache_key, ctxt.kernel, ctxt.kernel_size, ctxt.kernel_ctr, ini1))
+						gfx_prompt(con, error, "Failed to save pkg2 cache.");
+					bprof_end(prof);
+					arena_reset(&ctxt.arena, mark);
 				}
 			}
-			
-			//Merge extra KIP1s into loaded ones.
-			LIST_FOREACH_ENTRY(merge_kip_t, mki, &ctxt.kip1_list, link) {
-				gfx_prompt(con, message, "Merging %s KIP1 blobs...", ((pkg2_kip1_t *)mki->kip1)->name);
-	
-				pkg2_merge_kip(&kip1_info, (pkg2_kip1_t *)mki->kip1);
-
-				gfx_prompt(con, ok, "Merged %s KIP1 blobs...", ((pkg2_kip1_t *)mki->kip1)->name);
-			}
 
 			gfx_prompt(con, message, "Encrypting pkg2...");
 
 			//Rebuild and encrypt package2.
-			pkg2_build_encrypt((void *)0xA9800000, ctxt.kernel, ctxt.kernel_size, &kip1_info);
+			prof = bprof_begin("pkg2_rebuild");
+			pkg2_build_encrypt((void *)0xA9800000, ctxt.kernel, ctxt.kernel_size, ctxt.kernel_ctr, &kip1_info, ctxt.ini1, ctxt.ini1_size, ctxt.ini1_ctr);
+			bprof_end(prof);
 
 			gfx_prompt(con, ok, "Encrypted pkg2.");
 		} else {
 			gfx_prompt(con, message, "Loading pkg2...");
 
-			//Read package2.
-			if (!_read_emmc_pkg2(&ctxt, con)) {
+			//Read package2 straight to where it is booted from.
+			prof = bprof_begin("pkg2_read");
+			if (!_read_emmc_pkg2(&ctxt, con, (void *)0xA9800000) || !_read_emmc_pkg2_rest(&ctxt, NULL)) {
 				gfx_prompt(con, error, "Failed to load pkg2.");
-				return false;
+				goto fail;
 			}
+			bprof_end(prof);
 
 			gfx_prompt(con, ok, "Loaded pkg2.");
-			memcpy((void *)0xA9800000, ctxt.pkg2, ctxt.pkg2_size);
 		}
 	}
 	
+	//Persist the boot timeline while the SD card is still mounted.
+	bprof_save("boot_profile.csv");
+	if (ctxt.taskreport)
+		sched_save("task_report.csv");
+	if (ctxt.heapreport) {
+		heap_save("heap_report.csv", 0xA9800000);
+		_save_disk_stats("disk_report.csv");
+	}
+
     // Unmount SD Card
 	f_mount(NULL, "", 1);
+	fload_reset();
+
+	//We are done with the eMMC.
+	_emmc_close(&ctxt);
 
 	gfx_prompt(con, message, "Booting...");
 
@@ -548,7 +931,7 @@ bool hos_launch(gfx_con_t * con, bool hen) {
 	}
 
 	//Clear 'BootConfig' for retail systems.
-	memset((void *)0x4003D000, 0, 0x3000);
+	memset((void *)BOOTCONFIG_ADDR, 0, BOOTCONFIG_SIZE);
 
 	//Lock SE before starting 'SecureMonitor'.
 	_se_lock();
@@ -560,9 +943,11 @@ bool hos_launch(gfx_con_t * con, bool hen) {
 	*mb_out = 0;
 
 	//Wait for secmon to get ready.
+	prof = bprof_begin("cluster_boot_cpu0");
 	cluster_boot_cpu0(ctxt.pkg1_id->secmon_base);
 	while (!*mb_out)
 		sleep(1);
+	bprof_end(prof);
 
 	//Signal 'BootConfig'.
 	//*mb_in = 1;
@@ -575,5 +960,11 @@ bool hos_launch(gfx_con_t * con, bool hen) {
 	while (1)
 		FLOW_CTLR(0x4) = 0x50000000;
 
+fail:;
+	_emmc_close(&ctxt);
+	arena_free(&ctxt.arena);
+	//Whatever is still live now leaks into the next attempt.
+	if (ctxt.heapreport)
+		heap_print(con, 0xA9800000);
 	return false;
 }
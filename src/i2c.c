@@ -18,6 +18,7 @@
 
 #include "i2c.h"
 #include "util.h"
+#include "sched.h"
 
 static u32 i2c_addrs[] = { 0x7000C000, 0x7000C400, 0x7000C500, 0x7000C700, 0x7000D000, 0x7000D100 };
 
@@ -48,7 +49,7 @@ static int _i2c_send_pkt(u32 idx, u32 x, u8 *buf, u32 size)
 
 	base[0] = base[0] & 0xFFFFFDFF | 0x200;
 	while (base[7] & 0x100)
-		;
+		sched_yield();
 
 	if (base[7] << 28)
 		return 0;
@@ -68,7 +69,7 @@ static int _i2c_recv_pkt(u32 idx, u8 *buf, u32 size, u32 x)
 
 	base[0] = base[0] & 0xFFFFFDFF | 0x200;
 	while (base[7] & 0x100)
-		;
+		sched_yield();
 
 	if (base[7] << 28)
 		return 0;
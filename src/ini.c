@@ -18,76 +18,280 @@
 
 #include "ini.h"
 #include "ff.h"
-#include "heap.h"
 
-
-static char *_strdup(char *str)
+u32 ini_hash(const char *str)
 {
-	char *res = malloc(strlen(str) + 1);
-	strcpy(res, str);
-	return res;
+	//FNV-1a.
+	u32 hash = 0x811C9DC5;
+	while (*str)
+		hash = (hash ^ (u8)*str++) * 0x01000193;
+	return hash;
 }
 
-int ini_parse(link_t *dst, char *ini_path)
+void ini_scan(char *buf, u32 size, ini_cb_t cb, void *arg)
 {
-	u32 lblen;
-	char lbuf[512];
-	FIL fp;
-	ini_sec_t *csec = NULL;
+	//Lines are cut in place, buf needs room for a terminator at buf[size].
+	char *end = buf + size;
+	char *sec = NULL;
 
-	if (f_open(&fp, ini_path, FA_READ) != FR_OK)
-		return 0;
-
-	do
+	for (char *line = buf; line < end;)
 	{
-		//Fetch one line.
-		lbuf[0] = 0;
-		f_gets(lbuf, 512, &fp);
-		lblen = strlen(lbuf);
+		//Fetch one line, dropping the newline and the CR of a CRLF.
+		char *eol = line;
+		while (eol < end && *eol != '\n')
+			eol++;
+		char *next = eol + 1;
+		*eol = 0;
+		if (eol > line && eol[-1] == '\r')
+			*--eol = 0;
 
 		//Skip empty lines and comments.
-		if (lblen <= 1 || lbuf[0] == '#')
+		if (eol == line || line[0] == '#')
+		{
+			line = next;
 			continue;
+		}
 
-		//Remove trailing newline.
-		if (lbuf[lblen - 1] == '\n')
-			lbuf[lblen - 1] = 0;
-
-		if (lblen > 2 && lbuf[0] == '[') //Create new section.
+		if (eol - line > 1 && line[0] == '[') //New section.
 		{
-			if (csec)
-			{
-				list_append(dst, &csec->link);
-				csec = NULL;
-			}
-
-			u32 i;
-			for (i = 0; i < lblen && lbuf[i] != '\n' && lbuf[i] != ']'; i++)
+			char *p;
+			for (p = line + 1; *p && *p != ']'; p++)
 				;
-			lbuf[i] = 0;
+			*p = 0;
 
-			csec = (ini_sec_t *)malloc(sizeof(ini_sec_t));
-			csec->name = _strdup(&lbuf[1]);
-			list_init(&csec->kvs);
+			sec = line + 1;
+			if (!cb(arg, sec, NULL, NULL))
+				return;
 		}
-		else if (csec) //Extract key/value.
+		else if (sec) //Extract key/value.
 		{
-			u32 i;
-			for (i = 0; i < lblen && lbuf[i] != '\n' && lbuf[i] != '='; i++)
+			char *p;
+			for (p = line; *p && *p != '='; p++)
 				;
-			lbuf[i] = 0;
+			char *val = p;
+			if (*p)
+				*val++ = 0;
 
-			ini_kv_t *kv = (ini_kv_t *)malloc(sizeof(ini_kv_t));
-			kv->key = _strdup(&lbuf[0]);
-			kv->val = _strdup(&lbuf[i + 1]);
-			list_append(&csec->kvs, &kv->link);
+			if (!cb(arg, sec, line, val))
+				return;
 		}
-	} while (!f_eof(&fp));
+
+		line = next;
+	}
+}
+
+typedef struct _ini_parse_ctxt_t
+{
+	arena_t *arena;
+	link_t *dst;
+	const char *sec_name;
+	ini_sec_t *csec;
+} ini_parse_ctxt_t;
+
+static int _ini_parse_cb(void *arg, char *sec, char *key, char *val)
+{
+	ini_parse_ctxt_t *ctxt = (ini_parse_ctxt_t *)arg;
+
+	if (!key)
+	{
+		//Everything past the wanted section is of no interest.
+		if (ctxt->sec_name && ctxt->csec)
+			return 0;
+		if (ctxt->sec_name && strcmp(sec, ctxt->sec_name))
+			return 1;
+
+		ctxt->csec = (ini_sec_t *)arena_push(ctxt->arena, sizeof(ini_sec_t));
+		ctxt->csec->name = sec;
+		list_init(&ctxt->csec->kvs);
+		list_append(ctxt->dst, &ctxt->csec->link);
+	}
+	else if (ctxt->csec && ctxt->csec->name == sec)
+	{
+		ini_kv_t *kv = (ini_kv_t *)arena_push(ctxt->arena, sizeof(ini_kv_t));
+		kv->key = key;
+		kv->val = val;
+		kv->hash = ini_hash(key);
+		list_append(&ctxt->csec->kvs, &kv->link);
+	}
+
+	return 1;
+}
+
+static char *_ini_read(arena_t *arena, char *path, u32 *size)
+{
+	FIL fp;
+	UINT br;
+
+	if (f_open(&fp, path, FA_READ) != FR_OK)
+		return NULL;
+
+	//One bulk read, the buffer stays alive with the arena as all strings point into it.
+	*size = f_size(&fp);
+	char *buf = (char *)arena_push(arena, *size + 1);
+	if (f_read(&fp, buf, *size, &br) != FR_OK || br != *size)
+		buf = NULL;
+	else
+		buf[*size] = 0;
 
 	f_close(&fp);
+	return buf;
+}
+
+int ini_parse(arena_t *arena, link_t *dst, char *ini_path, const char *sec_name)
+{
+	u32 size;
+	char *buf = _ini_read(arena, ini_path, &size);
+	if (!buf)
+		return 0;
+
+	ini_parse_ctxt_t ctxt;
+	ctxt.arena = arena;
+	ctxt.dst = dst;
+	ctxt.sec_name = sec_name;
+	ctxt.csec = NULL;
+	ini_scan(buf, size, _ini_parse_cb, &ctxt);
+
+	return 1;
+}
+
+typedef struct _ini_compile_ctxt_t
+{
+	char *text;
+	u8 *out;
+	u32 max_size;
+	u32 pos;
+	ini_bin_hdr_t *hdr;
+	ini_bin_sec_t *csec;
+} ini_compile_ctxt_t;
+
+static int _ini_compile_cb(void *arg, char *sec, char *key, char *val)
+{
+	ini_compile_ctxt_t *ctxt = (ini_compile_ctxt_t *)arg;
+
+	if (ctxt->pos + sizeof(ini_bin_kv_t) > ctxt->max_size)
+	{
+		ctxt->hdr = NULL;
+		return 0;
+	}
+
+	if (!key)
+	{
+		ctxt->csec = (ini_bin_sec_t *)(ctxt->out + ctxt->pos);
+		ctxt->csec->hash = ini_hash(sec);
+		ctxt->csec->name = sec - ctxt->text;
+		ctxt->csec->num_kvs = 0;
+		ctxt->hdr->num_secs++;
+		ctxt->pos += sizeof(ini_bin_sec_t);
+	}
+	else
+	{
+		ini_bin_kv_t *kv = (ini_bin_kv_t *)(ctxt->out + ctxt->pos);
+		kv->hash = ini_hash(key);
+		kv->key = key - ctxt->text;
+		kv->val = val - ctxt->text;
+		ctxt->csec->num_kvs++;
+		ctxt->pos += sizeof(ini_bin_kv_t);
+	}
+
+	return 1;
+}
+
+u32 ini_compile(char *buf, u32 size, u8 *out, u32 max_size)
+{
+	//buf is cut up in place like for ini_scan, and the result is appended as the text.
+	ini_compile_ctxt_t ctxt;
+	if (max_size < sizeof(ini_bin_hdr_t))
+		return 0;
+
+	ctxt.text = buf;
+	ctxt.out = out;
+	ctxt.max_size = max_size;
+	ctxt.pos = sizeof(ini_bin_hdr_t);
+	ctxt.hdr = (ini_bin_hdr_t *)out;
+	ctxt.csec = NULL;
+	ctxt.hdr->magic = INI_BIN_MAGIC;
+	ctxt.hdr->version = INI_BIN_VERSION;
+	ctxt.hdr->num_secs = 0;
+	ctxt.hdr->src_size = size;
+	ini_scan(buf, size, _ini_compile_cb, &ctxt);
+
+	if (!ctxt.hdr || ctxt.pos + size + 1 > max_size)
+		return 0;
+
+	ctxt.hdr->text_off = ctxt.pos;
+	memcpy(out + ctxt.pos, buf, size + 1);
+	ctxt.hdr->size = ctxt.pos + size + 1;
+
+	return ctxt.hdr->size;
+}
 
-	if (csec)
+int ini_load_bin(arena_t *arena, link_t *dst, char *bin_path, char *ini_path, const char *sec_name)
+{
+	//A .bin left over from before the .ini was edited must not win. Editors without a clock write fixed
+	//timestamps, so the size it was compiled from is compared as well.
+	FILINFO bin_fno, ini_fno;
+	bool check_ini = ini_path && f_stat(ini_path, &ini_fno) == FR_OK;
+	if (check_ini && (f_stat(bin_path, &bin_fno) != FR_OK ||
+		((u32)bin_fno.fdate << 16 | bin_fno.ftime) < ((u32)ini_fno.fdate << 16 | ini_fno.ftime)))
+		return 0;
+
+	u32 size;
+	u8 *buf = (u8 *)_ini_read(arena, bin_path, &size);
+	if (!buf)
+		return 0;
+
+	//Check the layout once, after that the records are used as they are.
+	ini_bin_hdr_t *hdr = (ini_bin_hdr_t *)buf;
+	if (size < sizeof(ini_bin_hdr_t) || hdr->magic != INI_BIN_MAGIC || hdr->version != INI_BIN_VERSION ||
+		hdr->size != size || hdr->text_off > size || buf[size - 1])
+		return 0;
+	if (check_ini && hdr->src_size != ini_fno.fsize)
+		return 0;
+
+	char *text = (char *)buf + hdr->text_off;
+	u32 text_size = size - hdr->text_off;
+	u32 pos = sizeof(ini_bin_hdr_t);
+	for (u32 i = 0; i < hdr->num_secs; i++)
+	{
+		ini_bin_sec_t *bsec = (ini_bin_sec_t *)(buf + pos);
+		if (pos + sizeof(ini_bin_sec_t) > hdr->text_off || bsec->name >= text_size ||
+			bsec->num_kvs > (hdr->text_off - pos - sizeof(ini_bin_sec_t)) / sizeof(ini_bin_kv_t))
+			return 0;
+		ini_bin_kv_t *bkvs = (ini_bin_kv_t *)(bsec + 1);
+		for (u32 j = 0; j < bsec->num_kvs; j++)
+			if (bkvs[j].key >= text_size || bkvs[j].val >= text_size)
+				return 0;
+		pos += sizeof(ini_bin_sec_t) + bsec->num_kvs * sizeof(ini_bin_kv_t);
+	}
+
+	//Only the string pointers are set up, names are matched by hash first.
+	u32 sec_hash = sec_name ? ini_hash(sec_name) : 0;
+	pos = sizeof(ini_bin_hdr_t);
+	for (u32 i = 0; i < hdr->num_secs; i++)
+	{
+		ini_bin_sec_t *bsec = (ini_bin_sec_t *)(buf + pos);
+		ini_bin_kv_t *bkvs = (ini_bin_kv_t *)(bsec + 1);
+		pos += sizeof(ini_bin_sec_t) + bsec->num_kvs * sizeof(ini_bin_kv_t);
+
+		if (sec_name && (bsec->hash != sec_hash || strcmp(text + bsec->name, sec_name)))
+			continue;
+
+		ini_sec_t *csec = (ini_sec_t *)arena_push(arena, sizeof(ini_sec_t));
+		csec->name = text + bsec->name;
+		list_init(&csec->kvs);
+		for (u32 j = 0; j < bsec->num_kvs; j++)
+		{
+			ini_kv_t *kv = (ini_kv_t *)arena_push(arena, sizeof(ini_kv_t));
+			kv->key = text + bkvs[j].key;
+			kv->val = text + bkvs[j].val;
+			kv->hash = bkvs[j].hash;
+			list_append(&csec->kvs, &kv->link);
+		}
 		list_append(dst, &csec->link);
 
+		if (sec_name)
+			break;
+	}
+
 	return 1;
 }
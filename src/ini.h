@@ -19,11 +19,42 @@
 
 #include "types.h"
 #include "list.h"
+#include "arena.h"
+
+/*! Compiled config as written by tools/ini2bin: header, section and key/value records, then the text. */
+#define INI_BIN_MAGIC 0x4E494253 //"SBIN"
+#define INI_BIN_VERSION 2
+
+typedef struct _ini_bin_hdr_t
+{
+	u32 magic;
+	u32 version;
+	u32 size;
+	u32 num_secs;
+	u32 text_off;
+	u32 src_size; //Size of the .ini it was compiled from.
+} ini_bin_hdr_t;
+
+/*! A section record is followed by num_kvs key/value records, strings are offsets into the text. */
+typedef struct _ini_bin_sec_t
+{
+	u32 hash;
+	u32 name;
+	u32 num_kvs;
+} ini_bin_sec_t;
+
+typedef struct _ini_bin_kv_t
+{
+	u32 hash;
+	u32 key;
+	u32 val;
+} ini_bin_kv_t;
 
 typedef struct _ini_kv_t
 {
 	char *key;
 	char *val;
+	u32 hash;
 	link_t link;
 } ini_kv_t;
 
@@ -34,6 +65,14 @@ typedef struct _ini_sec_t
 	link_t link;
 } ini_sec_t;
 
-int ini_parse(link_t *dst, char *ini_path);
+/*! Called with key NULL for a section and once per key/value in it, return 0 to stop scanning. */
+typedef int (*ini_cb_t)(void *arg, char *sec, char *key, char *val);
+
+u32 ini_hash(const char *str);
+void ini_scan(char *buf, u32 size, ini_cb_t cb, void *arg);
+u32 ini_compile(char *buf, u32 size, u8 *out, u32 max_size);
+int ini_parse(arena_t *arena, link_t *dst, char *ini_path, const char *sec_name);
+/*! Fails when the .bin is older than ini_path or was compiled from an .ini of another size, ini_path may be NULL. */
+int ini_load_bin(arena_t *arena, link_t *dst, char *bin_path, char *ini_path, const char *sec_name);
 
 #endif
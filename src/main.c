@@ -40,26 +40,97 @@
 #include "se_t210.h"
 #include "hos.h"
 #include "splash.h"
+#include "bprof.h"
+#include "sched.h"
+#include "main.h"
+#include "fload.h"
 
 //TODO: ugly.
 sdmmc_t sd_sdmmc;
 sdmmc_storage_t sd_storage;
-FATFS sd_fs;
+//The FatFs window buffer is read into directly, so the volume lives in DRAM and not in .bss.
+FATFS *sd_fs;
 int sd_mounted;
+sdmmc_t emmc_sdmmc;
+sdmmc_storage_t emmc_storage;
+
+//Card bring-ups in flight, the cards are powered up while other hardware is initialized.
+static sdmmc_init_t _sd_init;
+static sdmmc_init_t _emmc_init;
+
+static int _storage_init_run(sdmmc_init_t *init, u32 step)
+{
+	sdmmc_init_t *jobs[] = { &_sd_init, &_emmc_init };
+
+	//Advance every started bring-up, sleep only when all of them are waiting on their card.
+	while (init->step < step)
+	{
+		int wait = 0x7FFFFFFF;
+		for (u32 i = 0; i < sizeof(jobs) / sizeof(sdmmc_init_t *); i++)
+		{
+			if (!jobs[i]->storage || jobs[i]->step == SDMMC_INIT_STEP_END)
+				continue;
+			sdmmc_storage_init_poll(jobs[i]);
+			if (jobs[i]->step != SDMMC_INIT_STEP_END)
+				wait = MIN(wait, (int)(jobs[i]->wake - get_tmr()));
+		}
+		if (init->step < step && wait > 0)
+			sleep(wait);
+	}
+
+	return init->res;
+}
+
+static void _storage_init_start()
+{
+	sdmmc_storage_init_sd_start(&_sd_init, &sd_storage, &sd_sdmmc, SDMMC_1, SDMMC_BUS_WIDTH_4, 11);
+	sdmmc_storage_init_mmc_start(&_emmc_init, &emmc_storage, &emmc_sdmmc, SDMMC_4, SDMMC_BUS_WIDTH_8, 4);
+
+	//Get both cards through power on and the first op cond command, they finish powering up on their own.
+	_storage_init_run(&_sd_init, SDMMC_INIT_STEP_OP_COND);
+	_storage_init_run(&_emmc_init, SDMMC_INIT_STEP_OP_COND);
+}
+
+sdmmc_storage_t *emmc_open(void)
+{
+	if (!_emmc_init.storage)
+		sdmmc_storage_init_mmc_start(&_emmc_init, &emmc_storage, &emmc_sdmmc, SDMMC_4, SDMMC_BUS_WIDTH_8, 4);
+
+	if (_storage_init_run(&_emmc_init, SDMMC_INIT_STEP_END) == SDMMC_INIT_DONE)
+		return &emmc_storage;
+
+	memset(&_emmc_init, 0, sizeof(sdmmc_init_t));
+	return NULL;
+}
+
+void emmc_close(void)
+{
+	if (_emmc_init.res == SDMMC_INIT_DONE)
+		sdmmc_storage_end(&emmc_storage);
+	memset(&_emmc_init, 0, sizeof(sdmmc_init_t));
+}
 
 int sd_mount(gfx_con_t * con)
 {
 	if (sd_mounted)
 		return 1;
 
-	if (!sdmmc_storage_init_sd(&sd_storage, &sd_sdmmc, SDMMC_1, SDMMC_BUS_WIDTH_4, 11))
+	if (!_sd_init.storage)
+		sdmmc_storage_init_sd_start(&_sd_init, &sd_storage, &sd_sdmmc, SDMMC_1, SDMMC_BUS_WIDTH_4, 11);
+	int init_res = _storage_init_run(&_sd_init, SDMMC_INIT_STEP_END);
+	memset(&_sd_init, 0, sizeof(sdmmc_init_t));
+
+	if (init_res != SDMMC_INIT_DONE)
 	{
 		gfx_prompt(con, error, "Failed to init SD card (make sure that it is inserted).");
 	}
 	else
 	{
 		int res = 0;
-		res = f_mount(&sd_fs, "", 1);
+		if (!sd_fs)
+			sd_fs = (FATFS *)malloc(sizeof(FATFS));
+		fload_reset();
+		res = f_mount(sd_fs, "", 1);
 		if (res == FR_OK)
 		{
 			sd_mounted = 1;
@@ -80,6 +151,7 @@ void sd_unmount(gfx_con_t * con)
 	{
 		gfx_prompt(con, ok, "Unmounting SD card...");
 		f_mount(NULL, "", 1);
+		fload_reset();
 		sdmmc_storage_end(&sd_storage);
 	}
 }
@@ -257,15 +329,23 @@ void config_hw()
 
 	mc_config_carveout();
 
+	u32 prof = bprof_begin("sdram_init");
 	sdram_init();
 	//TODO: test this with LP0 wakeup.
 	sdram_lp0_save_params(sdram_get_params());
+	bprof_end(prof);
 }
 
 void launch_firmware(gfx_con_t * con, bool hen)
 {	
-	if (sd_mount(con)) {
+	u32 prof = bprof_begin("sd_mount");
+	int mounted = sd_mount(con);
+	bprof_end(prof);
+
+	if (mounted) {
+		prof = bprof_begin("draw_splash");
 		con->prompts_enabled = draw_splash(con);
+		bprof_end(prof);
 
 		if (!hos_launch(con, hen)) {
 			con->prompts_enabled = true;
@@ -289,17 +369,28 @@ void ipl_main()
 	gfx_ctxt_t gfx_ctxt;
 	gfx_con_t gfx_con;
 
+	bprof_init(NULL);
+
+	u32 prof = bprof_begin("config_hw");
 	config_hw();
+	bprof_end(prof);
 
 	//Pivot the stack so we have enough space.
 	pivot_stack(0x90010000);
 
 	//Tegra/Horizon configuration goes to 0x80000000+, package2 goes to 0xA9800000, we place our heap in between.
 	heap_init(0x90020000);
+	sched_init();
+
+	prof = bprof_begin("storage_init_start");
+	_storage_init_start();
+	bprof_end(prof);
 
+	prof = bprof_begin("display_init");
 	display_init();
 	u32 *fb = (u32 *)0xC0000000;
 	display_init_framebuffer(fb, 0xFF000000);
+	bprof_end(prof);
 	gfx_init_ctxt(&gfx_ctxt, fb, 720, 1280, 768);
 	gfx_con_init(&gfx_con, &gfx_ctxt);
 
@@ -0,0 +1,27 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MAIN_H_
+#define _MAIN_H_
+
+#include "types.h"
+#include "sdmmc.h"
+
+/*! Finishes the eMMC bring-up started at boot, returns NULL if the card didn't come up. */
+sdmmc_storage_t *emmc_open(void);
+void emmc_close(void);
+
+#endif
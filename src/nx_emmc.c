@@ -19,17 +19,84 @@
 #include "heap.h"
 #include "list.h"
 
-void nx_emmc_gpt_parse(link_t *gpt, sdmmc_storage_t *storage)
+static int _nx_emmc_io_cmp(const nx_emmc_io_t *a, const nx_emmc_io_t *b)
+{
+	if (a->partition != b->partition)
+		return a->partition < b->partition ? -1 : 1;
+	if (a->sector != b->sector)
+		return a->sector < b->sector ? -1 : 1;
+	return 0;
+}
+
+static int _nx_emmc_io_flush(sdmmc_storage_t *storage, sdmmc_qio_t *qios, u32 *num_qios)
+{
+	int res = !*num_qios || sdmmc_storage_read_queued(storage, qios, *num_qios);
+	*num_qios = 0;
+	return res;
+}
+
+int nx_emmc_io_run(sdmmc_storage_t *storage, nx_emmc_io_t *ios, u32 num_ios)
+{
+	sdmmc_qio_t qios[NX_EMMC_IO_MAX_QUEUED];
+	u32 num_qios = 0;
+
+	//Order the requests by partition and sector (insertion sort, batches are tiny).
+	for (u32 i = 1; i < num_ios; i++)
+	{
+		nx_emmc_io_t io = ios[i];
+		u32 j = i;
+		for (; j > 0 && _nx_emmc_io_cmp(&io, &ios[j - 1]) < 0; j--)
+			ios[j] = ios[j - 1];
+		ios[j] = io;
+	}
+
+	for (u32 i = 0; i < num_ios;)
+	{
+		//Merge requests that are contiguous both on the eMMC and in memory.
+		u32 sector = ios[i].sector;
+		u32 num_sectors = ios[i].num_sectors;
+		u8 *buf = (u8 *)ios[i].buf;
+		u32 j = i + 1;
+		for (; j < num_ios; j++)
+		{
+			if (ios[j].partition != ios[i].partition ||
+				ios[j].sector != sector + num_sectors ||
+				(u8 *)ios[j].buf != buf + num_sectors * NX_EMMC_BLOCKSIZE)
+				break;
+			num_sectors += ios[j].num_sectors;
+		}
+
+		//Only switch partitions when we actually change them, the reads of a partition go out as one queue.
+		if (storage->partition != ios[i].partition &&
+			(!_nx_emmc_io_flush(storage, qios, &num_qios) || !sdmmc_storage_set_mmc_partition(storage, ios[i].partition)))
+			return 0;
+
+		if (num_qios == NX_EMMC_IO_MAX_QUEUED && !_nx_emmc_io_flush(storage, qios, &num_qios))
+			return 0;
+		qios[num_qios].sector = sector;
+		qios[num_qios].num_sectors = num_sectors;
+		qios[num_qios].buf = buf;
+		num_qios++;
+
+		i = j;
+	}
+
+	return _nx_emmc_io_flush(storage, qios, &num_qios);
+}
+
+void nx_emmc_gpt_parse(arena_t *arena, link_t *gpt, sdmmc_storage_t *storage)
 {
 	u8 *buf = (u8 *)malloc(NX_GPT_NUM_BLOCKS * NX_EMMC_BLOCKSIZE);
 
-	sdmmc_storage_read(storage, NX_GPT_FIRST_LBA, NX_GPT_NUM_BLOCKS, buf);
+	//The GPT lives in the user partition.
+	nx_emmc_io_t io = { NX_EMMC_PART_USER, NX_GPT_FIRST_LBA, NX_GPT_NUM_BLOCKS, buf };
+	nx_emmc_io_run(storage, &io, 1);
 
 	gpt_header_t *hdr = (gpt_header_t *)buf;
 	for (u32 i = 0; i < hdr->num_part_ents; i++)
 	{
 		gpt_entry_t *ent = (gpt_entry_t *)(buf + (hdr->part_ent_lba - 1) * NX_EMMC_BLOCKSIZE + i * sizeof(gpt_entry_t));
-		emmc_part_t *part = (emmc_part_t *)malloc(sizeof(emmc_part_t));
+		emmc_part_t *part = (emmc_part_t *)arena_push(arena, sizeof(emmc_part_t));
 		part->lba_start = ent->lba_start;
 		part->lba_end = ent->lba_end;
 		part->attrs = ent->attrs;
@@ -45,12 +112,6 @@ void nx_emmc_gpt_parse(link_t *gpt, sdmmc_storage_t *storage)
 	free(buf);
 }
 
-void nx_emmc_gpt_free(link_t *gpt)
-{
-	LIST_FOREACH_SAFE(iter, gpt)
-		free(CONTAINER_OF(iter, emmc_part_t, link));
-}
-
 emmc_part_t *nx_emmc_part_find(link_t *gpt, const char *name)
 {
 	LIST_FOREACH_ENTRY(emmc_part_t, part, gpt, link)
@@ -20,6 +20,7 @@
 #include "types.h"
 #include "list.h"
 #include "sdmmc.h"
+#include "arena.h"
 
 typedef struct _gpt_entry_t
 {
@@ -54,6 +55,11 @@ typedef struct _gpt_header_t
 #define NX_GPT_NUM_BLOCKS 33
 #define NX_EMMC_BLOCKSIZE 512
 
+/*! eMMC hardware partitions. */
+#define NX_EMMC_PART_USER 0
+#define NX_EMMC_PART_BOOT0 1
+#define NX_EMMC_PART_BOOT1 2
+
 typedef struct _emmc_part_t
 {
 	u32 lba_start;
@@ -63,8 +69,20 @@ typedef struct _emmc_part_t
 	link_t link;
 } emmc_part_t;
 
-void nx_emmc_gpt_parse(link_t *gpt, sdmmc_storage_t *storage);
-void nx_emmc_gpt_free(link_t *gpt);
+/*! Reads nx_emmc_io_run() hands to the eMMC command queue at once. */
+#define NX_EMMC_IO_MAX_QUEUED 16
+
+/*! eMMC I/O request, see nx_emmc_io_run(). */
+typedef struct _nx_emmc_io_t
+{
+	u32 partition;
+	u32 sector;
+	u32 num_sectors;
+	void *buf;
+} nx_emmc_io_t;
+
+int nx_emmc_io_run(sdmmc_storage_t *storage, nx_emmc_io_t *ios, u32 num_ios);
+void nx_emmc_gpt_parse(arena_t *arena, link_t *gpt, sdmmc_storage_t *storage);
 emmc_part_t *nx_emmc_part_find(link_t *gpt, const char *name);
 int nx_emmc_part_read(sdmmc_storage_t *storage, emmc_part_t *part, u32 sector_off, u32 num_sectors, void *buf);
 int nx_emmc_part_write(sdmmc_storage_t *storage, emmc_part_t *part, u32 sector_off, u32 num_sectors, void *buf);
@@ -23,6 +23,7 @@
 #define APB_MISC_GP_SDMMC1_CLK_LPBK_CONTROL 0x8D4
 #define APB_MISC_GP_SDMMC3_CLK_LPBK_CONTROL 0x8D8
 #define APB_MISC_GP_SDMMC1_PAD_CFGPADCTRL 0xA98
+#define APB_MISC_GP_EMMC4_PAD_CFGPADCTRL 0xAB4
 #define APB_MISC_GP_VGPIO_GPIO_MUX_SEL 0xB74
 
 /*! Pinmux registers. */
@@ -33,16 +33,19 @@ static u32 _pkg2_calc_kip1_size(pkg2_kip1_t *kip1)
 	return size;
 }
 
-void pkg2_parse_kips(link_t *info, pkg2_hdr_t *pkg2)
+void pkg2_parse_kips(arena_t *arena, link_t *info, pkg2_hdr_t *pkg2)
 {
-	u8 *ptr = pkg2->data + pkg2->sec_size[PKG2_SEC_KERNEL];
-	pkg2_ini1_t *ini1 = (pkg2_ini1_t *)ptr;
-	ptr += sizeof(pkg2_ini1_t);
+	pkg2_parse_ini1(arena, info, (pkg2_ini1_t *)(pkg2->data + pkg2->sec_size[PKG2_SEC_KERNEL]));
+}
+
+void pkg2_parse_ini1(arena_t *arena, link_t *info, pkg2_ini1_t *ini1)
+{
+	u8 *ptr = (u8 *)ini1 + sizeof(pkg2_ini1_t);
 
 	for (u32 i = 0; i < ini1->num_procs; i++)
 	{
 		pkg2_kip1_t *kip1 = (pkg2_kip1_t *)ptr;
-		pkg2_kip1_info_t *ki = (pkg2_kip1_info_t *)malloc(sizeof(pkg2_kip1_info_t));
+		pkg2_kip1_info_t *ki = (pkg2_kip1_info_t *)arena_push(arena, sizeof(pkg2_kip1_info_t));
 		ki->kip1 = kip1;
 		ki->size = _pkg2_calc_kip1_size(kip1);
 		list_append(info, &ki->link);
@@ -71,34 +74,27 @@ DPRINTF("replaced kip (new size %08X)\n", ki->size);
 		}
 }
 
-void pkg2_add_kip(link_t *info, pkg2_kip1_t *kip1)
+void pkg2_add_kip(arena_t *arena, link_t *info, pkg2_kip1_t *kip1)
 {
-	pkg2_kip1_info_t *ki = (pkg2_kip1_info_t *)malloc(sizeof(pkg2_kip1_info_t));
+	pkg2_kip1_info_t *ki = (pkg2_kip1_info_t *)arena_push(arena, sizeof(pkg2_kip1_info_t));
 	ki->kip1 = kip1;
 	ki->size = _pkg2_calc_kip1_size(kip1);
 DPRINTF("added kip (size %08X)\n", ki->size);
 	list_append(info, &ki->link);
 }
 
-void pkg2_merge_kip(link_t *info, pkg2_kip1_t *kip1)
+void pkg2_merge_kip(arena_t *arena, link_t *info, pkg2_kip1_t *kip1)
 {
 	if (pkg2_has_kip(info, kip1->tid))
 		pkg2_replace_kip(info, kip1->tid, kip1);
 	else
-		pkg2_add_kip(info, kip1);
+		pkg2_add_kip(arena, info, kip1);
 }
 
-pkg2_hdr_t *pkg2_decrypt(void *data)
+pkg2_hdr_t *pkg2_decrypt_hdr(void *data)
 {
-	u8 *pdata = (u8 *)data;
-	
 	//Skip signature.
-	pdata += 0x100;
-
-	pkg2_hdr_t *hdr = (pkg2_hdr_t *)pdata;
-
-	//Skip header.
-	pdata += sizeof(pkg2_hdr_t);
+	pkg2_hdr_t *hdr = (pkg2_hdr_t *)((u8 *)data + 0x100);
 
 	//Decrypt header.
 	se_aes_crypt_ctr(8, hdr, sizeof(pkg2_hdr_t), hdr, sizeof(pkg2_hdr_t), hdr);
@@ -107,22 +103,115 @@ pkg2_hdr_t *pkg2_decrypt(void *data)
 	if (hdr->magic != PKG2_MAGIC)
 		return NULL;
 
+	return hdr;
+}
+
+void pkg2_stream_init(pkg2_stream_t *st, pkg2_hdr_t *hdr, u32 sec_mask)
+{
+	memset(st, 0, sizeof(pkg2_stream_t));
+	st->hdr = hdr;
+	st->sec_mask = sec_mask;
+}
+
+int pkg2_stream_decrypt(pkg2_stream_t *st, u32 avail)
+{
+	pkg2_hdr_t *hdr = st->hdr;
+	u32 sec_start = 0x100 + sizeof(pkg2_hdr_t);
+
 	for (u32 i = 0; i < 4; i++)
 	{
-DPRINTF("sec %d has size %08X\n", i, hdr->sec_size[i]);
-		if (!hdr->sec_size[i])
-			continue;
+		u32 sec_size = hdr->sec_size[i];
+		u8 *sec = hdr->data + sec_start - (0x100 + sizeof(pkg2_hdr_t));
+
+		if ((st->sec_mask & PKG2_SEC_BIT(i)) && st->sec_done[i] < sec_size && avail > sec_start)
+		{
+			//Whole blocks of what arrived so far, the last partial block only once the section is complete.
+			u32 end = MIN(avail - sec_start, sec_size);
+			if (end < sec_size)
+				end &= 0xFFFFFFF0;
 
-		se_aes_crypt_ctr(8, pdata, hdr->sec_size[i], pdata, hdr->sec_size[i], &hdr->sec_ctr[i * 0x10]);
-		//gfx_hexdump(&gfx_con, (u32)pdata, pdata, 0x100);
+			if (end > st->sec_done[i])
+			{
+DPRINTF("sec %d decrypting %08X-%08X\n", i, st->sec_done[i], end);
+				if (!se_aes_crypt_ctr_start(8, sec + st->sec_done[i], sec + st->sec_done[i],
+					end - st->sec_done[i], &hdr->sec_ctr[i * 0x10], st->sec_done[i] >> 4))
+					return 0;
+				st->sec_done[i] = end;
+			}
+		}
 
-		pdata += hdr->sec_size[i];
+		sec_start += sec_size;
 	}
 
+	return 1;
+}
+
+int pkg2_stream_finish(pkg2_stream_t *st)
+{
+	if (!se_aes_crypt_ctr_wait())
+		return 0;
+
+	for (u32 i = 0; i < 4; i++)
+		if ((st->sec_mask & PKG2_SEC_BIT(i)) && st->sec_done[i] != st->hdr->sec_size[i])
+			return 0;
+
+	return 1;
+}
+
+pkg2_hdr_t *pkg2_decrypt(void *data, u32 sec_mask)
+{
+	pkg2_stream_t st;
+
+	pkg2_hdr_t *hdr = pkg2_decrypt_hdr(data);
+	if (!hdr)
+		return NULL;
+
+	//Everything is already there, decrypt it in one go.
+	pkg2_stream_init(&st, hdr, sec_mask);
+	if (!pkg2_stream_decrypt(&st, 0xFFFFFFFF) || !pkg2_stream_finish(&st))
+		return NULL;
+
 	return hdr;
 }
 
-void pkg2_build_encrypt(void *dst, void *kernel, u32 kernel_size, link_t *kips_info)
+u32 pkg2_calc_ini1_size(link_t *kips_info)
+{
+	u32 size = sizeof(pkg2_ini1_t);
+	LIST_FOREACH_ENTRY(pkg2_kip1_info_t, ki, kips_info, link)
+		size += ki->size;
+	return size;
+}
+
+u32 pkg2_build_ini1(void *dst, link_t *kips_info)
+{
+	u8 *pdst = (u8 *)dst;
+	u32 ini1_size = sizeof(pkg2_ini1_t);
+	pkg2_ini1_t *ini1 = (pkg2_ini1_t *)pdst;
+	memset(ini1, 0, sizeof(pkg2_ini1_t));
+	ini1->magic = INI1_MAGIC;
+	pdst += sizeof(pkg2_ini1_t);
+	LIST_FOREACH_ENTRY(pkg2_kip1_info_t, ki, kips_info, link)
+	{
+DPRINTF("adding kip1 '%s' @ %08X (%08X)\n", ki->kip1->name, (u32)ki->kip1, ki->size);
+		memcpy(pdst, ki->kip1, ki->size);
+		pdst += ki->size;
+		ini1_size += ki->size;
+		ini1->num_procs++;
+	}
+	ini1->size = ini1_size;
+
+	return ini1_size;
+}
+
+static void _pkg2_encrypt_hdr(pkg2_hdr_t *hdr, u32 sec_size)
+{
+	*(u32 *)hdr->ctr = 0x100 + sizeof(pkg2_hdr_t) + sec_size;
+	se_aes_crypt_ctr(8, hdr, sizeof(pkg2_hdr_t), hdr, sizeof(pkg2_hdr_t), hdr);
+	memset(hdr->ctr, 0 , 0x10);
+	*(u32 *)hdr->ctr = 0x100 + sizeof(pkg2_hdr_t) + sec_size;
+}
+
+void pkg2_build_encrypt(void *dst, void *kernel, u32 kernel_size, const u8 *kernel_ctr, link_t *kips_info, const void *ini1_enc, u32 ini1_enc_size, const u8 *ini1_ctr)
 {
 	u8 *pdst = (u8 *)dst;
 
@@ -139,37 +228,64 @@ void pkg2_build_encrypt(void *dst, void *kernel, u32 kernel_size, link_t *kips_i
 DPRINTF("kernel @ %08X (%08X)\n", (u32)kernel, kernel_size);
 
 	//Kernel.
-	memcpy(pdst, kernel, kernel_size);
 	hdr->sec_size[PKG2_SEC_KERNEL] = kernel_size;
 	hdr->sec_off[PKG2_SEC_KERNEL] = 0x10000000;
-	se_aes_crypt_ctr(8, pdst, kernel_size, pdst, kernel_size, &hdr->sec_ctr[PKG2_SEC_KERNEL * 0x10]);
-	pdst += kernel_size;
+	if (kernel_ctr)
+	{
+		//Already encrypted, reusing its counter makes the copy a valid section.
+		memcpy(pdst, kernel, kernel_size);
+		memcpy(&hdr->sec_ctr[PKG2_SEC_KERNEL * 0x10], kernel_ctr, 0x10);
+DPRINTF("kernel passed through\n");
+	}
+	else
+	{
+		se_frag_t kernel_frag = { kernel, kernel_size };
+		se_aes_crypt_ctr_sg(8, pdst, &kernel_frag, 1, &hdr->sec_ctr[PKG2_SEC_KERNEL * 0x10]);
 DPRINTF("kernel encrypted\n");
+	}
+	pdst += kernel_size;
 
 	//INI1.
-	u32 ini1_size = sizeof(pkg2_ini1_t);
-	pkg2_ini1_t *ini1 = (pkg2_ini1_t *)pdst;
-	memset(ini1, 0, sizeof(pkg2_ini1_t));
-	ini1->magic = INI1_MAGIC;
-	pdst += sizeof(pkg2_ini1_t);
+	hdr->sec_off[PKG2_SEC_INI1] = 0x14080000;
+	if (ini1_ctr)
+	{
+		//Untouched, passed through like the kernel.
+		memcpy(pdst, ini1_enc, ini1_enc_size);
+		memcpy(&hdr->sec_ctr[PKG2_SEC_INI1 * 0x10], ini1_ctr, 0x10);
+		hdr->sec_size[PKG2_SEC_INI1] = ini1_enc_size;
+		_pkg2_encrypt_hdr(hdr, kernel_size + ini1_enc_size);
+DPRINTF("INI1 passed through\n");
+		return;
+	}
+
+	//Encrypted straight from the KIP1 buffers into place.
+	u32 num_frags = 1;
+	LIST_FOREACH_ENTRY(pkg2_kip1_info_t, ki, kips_info, link)
+		num_frags++;
+	se_frag_t *frags = (se_frag_t *)malloc(sizeof(se_frag_t) * num_frags);
+
+	pkg2_ini1_t ini1;
+	memset(&ini1, 0, sizeof(pkg2_ini1_t));
+	ini1.magic = INI1_MAGIC;
+	ini1.size = pkg2_calc_ini1_size(kips_info);
+	ini1.num_procs = num_frags - 1;
+	frags[0].src = &ini1;
+	frags[0].size = sizeof(pkg2_ini1_t);
+	u32 i = 1;
 	LIST_FOREACH_ENTRY(pkg2_kip1_info_t, ki, kips_info, link)
 	{
 DPRINTF("adding kip1 '%s' @ %08X (%08X)\n", ki->kip1->name, (u32)ki->kip1, ki->size);
-		memcpy(pdst, ki->kip1, ki->size);
-		pdst += ki->size;
-		ini1_size += ki->size;
-		ini1->num_procs++;
+		frags[i].src = ki->kip1;
+		frags[i].size = ki->size;
+		i++;
 	}
-	ini1->size = ini1_size;
+
+	u32 ini1_size = ini1.size;
 	hdr->sec_size[PKG2_SEC_INI1] = ini1_size;
-	hdr->sec_off[PKG2_SEC_INI1] = 0x14080000;
-	se_aes_crypt_ctr(8, ini1, ini1_size, ini1, ini1_size, &hdr->sec_ctr[PKG2_SEC_INI1 * 0x10]);
+	se_aes_crypt_ctr_sg(8, pdst, frags, num_frags, &hdr->sec_ctr[PKG2_SEC_INI1 * 0x10]);
+	free(frags);
 DPRINTF("INI1 encrypted\n");
 
-	//Encrypt header.
-	*(u32 *)hdr->ctr = 0x100 + sizeof(pkg2_hdr_t) + kernel_size + ini1_size;
-	se_aes_crypt_ctr(8, hdr, sizeof(pkg2_hdr_t), hdr, sizeof(pkg2_hdr_t), hdr);
-	memset(hdr->ctr, 0 , 0x10);
-	*(u32 *)hdr->ctr = 0x100 + sizeof(pkg2_hdr_t) + kernel_size + ini1_size;
+	_pkg2_encrypt_hdr(hdr, kernel_size + ini1_size);
 }
 
@@ -19,11 +19,13 @@
 
 #include "types.h"
 #include "list.h"
+#include "arena.h"
 
 #define PKG2_MAGIC 0x31324B50
 #define PKG2_SEC_BASE 0x80000000
 #define PKG2_SEC_KERNEL 0
 #define PKG2_SEC_INI1 1
+#define PKG2_SEC_BIT(x) (1 << (x))
 
 #define INI1_MAGIC 0x31494E49
 
@@ -82,13 +84,29 @@ typedef struct _pkg2_kip1_info_t
 	link_t link;
 } pkg2_kip1_info_t;
 
-void pkg2_parse_kips(link_t *info, pkg2_hdr_t *pkg2);
+/*! Incremental section decryption while package2 is still being read. */
+typedef struct _pkg2_stream_t
+{
+	pkg2_hdr_t *hdr;
+	u32 sec_mask;
+	u32 sec_done[4];
+} pkg2_stream_t;
+
+void pkg2_parse_kips(arena_t *arena, link_t *info, pkg2_hdr_t *pkg2);
+void pkg2_parse_ini1(arena_t *arena, link_t *info, pkg2_ini1_t *ini1);
 int pkg2_has_kip(link_t *info, u64 tid);
 void pkg2_replace_kip(link_t *info, u64 tid, pkg2_kip1_t *kip1);
-void pkg2_add_kip(link_t *info, pkg2_kip1_t *kip1);
-void pkg2_merge_kip(link_t *info, pkg2_kip1_t *kip1);
+void pkg2_add_kip(arena_t *arena, link_t *info, pkg2_kip1_t *kip1);
+void pkg2_merge_kip(arena_t *arena, link_t *info, pkg2_kip1_t *kip1);
 
-pkg2_hdr_t *pkg2_decrypt(void *data);
-void pkg2_build_encrypt(void *dst, void *kernel, u32 kernel_size, link_t *kips_info);
+pkg2_hdr_t *pkg2_decrypt_hdr(void *data);
+void pkg2_stream_init(pkg2_stream_t *st, pkg2_hdr_t *hdr, u32 sec_mask);
+int pkg2_stream_decrypt(pkg2_stream_t *st, u32 avail);
+int pkg2_stream_finish(pkg2_stream_t *st);
+pkg2_hdr_t *pkg2_decrypt(void *data, u32 sec_mask);
+u32 pkg2_calc_ini1_size(link_t *kips_info);
+u32 pkg2_build_ini1(void *dst, link_t *kips_info);
+/*! Sections with a counter are still package2 ciphertext and copied as is, the INI1 is built from kips_info otherwise. */
+void pkg2_build_encrypt(void *dst, void *kernel, u32 kernel_size, const u8 *kernel_ctr, link_t *kips_info, const void *ini1_enc, u32 ini1_enc_size, const u8 *ini1_ctr);
 
 #endif
@@ -0,0 +1,184 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "pkg2_cache.h"
+#include "heap.h"
+#include "se.h"
+#include "ff.h"
+
+static void _pkg2_cache_path(char *path, const u8 *key)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	//sb_cache/pkg2_<first 8 key bytes in hex>.bin, the full key is checked against the header.
+	strcpy(path, PKG2_CACHE_DIR "/pkg2_");
+	char *ptr = path + strlen(path);
+	for (u32 i = 0; i < 8; i++)
+	{
+		*ptr++ = hex[key[i] >> 4];
+		*ptr++ = hex[key[i] & 0xF];
+	}
+	strcpy(ptr, ".bin");
+}
+
+static int _pkg2_cache_read(FIL *fp, void *buf, u32 size, const u8 *sha256)
+{
+	UINT br;
+	u8 hash[0x20];
+
+	if (f_read(fp, buf, size, &br) != FR_OK || br != size)
+		return 0;
+
+	//Make sure a torn write or a flaky card never ends up in the boot chain.
+	if (!se_calc_sha256(hash, buf, size) || memcmp(hash, sha256, 0x20))
+		return 0;
+
+	return 1;
+}
+
+int pkg2_cache_key(u8 *key, const char *pkg1_id, const void *pkg2, u32 flags, const char **paths, u32 num_paths)
+{
+	FILINFO fno;
+	int res = 0;
+
+	//Everything the rebuilt package2 depends on is laid out in one buffer and hashed in one go.
+	u32 size = 0x10 + 0x200 + sizeof(u32);
+	for (u32 i = 0; i < num_paths; i++)
+		size += sizeof(u64) + 2 * sizeof(u16) + strlen(paths[i]) + 1;
+
+	u8 *buf = (u8 *)calloc(size, 1);
+	if (!buf)
+		return 0;
+	u8 *ptr = buf;
+
+	strncpy((char *)ptr, pkg1_id, 0x10);
+	ptr += 0x10;
+	//Signature and still encrypted header.
+	memcpy(ptr, pkg2, 0x200);
+	ptr += 0x200;
+	memcpy(ptr, &flags, sizeof(u32));
+	ptr += sizeof(u32);
+
+	for (u32 i = 0; i < num_paths; i++)
+	{
+		if (f_stat(paths[i], &fno) != FR_OK)
+			goto out;
+
+		u64 fsize = fno.fsize;
+		memcpy(ptr, &fsize, sizeof(u64));
+		ptr += sizeof(u64);
+		memcpy(ptr, &fno.fdate, sizeof(u16));
+		ptr += sizeof(u16);
+		memcpy(ptr, &fno.ftime, sizeof(u16));
+		ptr += sizeof(u16);
+		strcpy((char *)ptr, paths[i]);
+		ptr += strlen(paths[i]) + 1;
+	}
+
+	res = se_calc_sha256(key, buf, size);
+
+out:;
+	free(buf);
+	return res;
+}
+
+int pkg2_cache_load(const u8 *key, void **kernel, u32 *kernel_size, u8 **kernel_ctr, pkg2_ini1_t **ini1)
+{
+	FIL fp;
+	UINT br;
+	char path[32];
+	pkg2_cache_hdr_t hdr;
+	u8 *buf = NULL;
+	int res = 0;
+
+	_pkg2_cache_path(path, key);
+	if (f_open(&fp, path, FA_READ) != FR_OK)
+		return 0;
+
+	if (f_read(&fp, &hdr, sizeof(pkg2_cache_hdr_t), &br) != FR_OK || br != sizeof(pkg2_cache_hdr_t))
+		goto out;
+	if (hdr.magic != PKG2_CACHE_MAGIC || hdr.version != PKG2_CACHE_VERSION ||
+		memcmp(hdr.key, key, PKG2_CACHE_KEY_SIZE) ||
+		hdr.kernel_size > PKG2_CACHE_MAX_SIZE || hdr.ini1_size > PKG2_CACHE_MAX_SIZE ||
+		f_size(&fp) != sizeof(pkg2_cache_hdr_t) + hdr.kernel_size + hdr.ini1_size)
+		goto out;
+
+	//The kernel counter goes first, keep the INI1 aligned as the KIP1 headers are parsed in place.
+	u32 ini1_off = 0x10 + ALIGN(hdr.kernel_size, 0x10);
+	buf = (u8 *)malloc(ini1_off + hdr.ini1_size);
+	if (!buf)
+		goto out;
+	if (!_pkg2_cache_read(&fp, buf + 0x10, hdr.kernel_size, hdr.kernel_sha256) ||
+		!_pkg2_cache_read(&fp, buf + ini1_off, hdr.ini1_size, hdr.ini1_sha256))
+		goto out;
+	if (((pkg2_ini1_t *)(buf + ini1_off))->magic != INI1_MAGIC)
+		goto out;
+	memcpy(buf, hdr.kernel_ctr, 0x10);
+
+	*kernel = buf + 0x10;
+	*kernel_size = hdr.kernel_size;
+	*kernel_ctr = (hdr.flags & PKG2_CACHE_FLAG_KERNEL_ENC) ? buf : NULL;
+	*ini1 = (pkg2_ini1_t *)(buf + ini1_off);
+	res = 1;
+
+out:;
+	if (!res)
+		free(buf);
+	f_close(&fp);
+	return res;
+}
+
+int pkg2_cache_save(const u8 *key, const void *kernel, u32 kernel_size, const u8 *kernel_ctr, const pkg2_ini1_t *ini1)
+{
+	FIL fp;
+	UINT bw;
+	char path[32];
+	pkg2_cache_hdr_t hdr;
+
+	memset(&hdr, 0, sizeof(pkg2_cache_hdr_t));
+	hdr.magic = PKG2_CACHE_MAGIC;
+	hdr.version = PKG2_CACHE_VERSION;
+	memcpy(hdr.key, key, PKG2_CACHE_KEY_SIZE);
+	hdr.kernel_size = kernel_size;
+	hdr.ini1_size = ini1->size;
+	if (kernel_ctr)
+	{
+		hdr.flags |= PKG2_CACHE_FLAG_KERNEL_ENC;
+		memcpy(hdr.kernel_ctr, kernel_ctr, 0x10);
+	}
+	if (!se_calc_sha256(hdr.kernel_sha256, kernel, kernel_size) ||
+		!se_calc_sha256(hdr.ini1_sha256, ini1, ini1->size))
+		return 0;
+
+	//The directory is most likely already there.
+	f_mkdir(PKG2_CACHE_DIR);
+
+	_pkg2_cache_path(path, key);
+	if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+
+	int res = f_write(&fp, &hdr, sizeof(pkg2_cache_hdr_t), &bw) == FR_OK && bw == sizeof(pkg2_cache_hdr_t) &&
+		f_write(&fp, kernel, kernel_size, &bw) == FR_OK && bw == kernel_size &&
+		f_write(&fp, ini1, ini1->size, &bw) == FR_OK && bw == ini1->size;
+	res = f_close(&fp) == FR_OK && res;
+
+	//Don't leave a partial entry behind, it would only fail verification on every boot.
+	if (!res)
+		f_unlink(path);
+
+	return res;
+}
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PKG2_CACHE_H_
+#define _PKG2_CACHE_H_
+
+#include "types.h"
+#include "pkg2.h"
+
+#define PKG2_CACHE_DIR "sb_cache"
+#define PKG2_CACHE_MAGIC 0x48433250
+#define PKG2_CACHE_VERSION 2
+#define PKG2_CACHE_KEY_SIZE 0x20
+//Kernel and INI1 both come out of a package2, which never exceeds its 8MB partition.
+#define PKG2_CACHE_MAX_SIZE 0x800000
+
+//The kernel is stored as package2 ciphertext under kernel_ctr.
+#define PKG2_CACHE_FLAG_KERNEL_ENC 1
+
+typedef struct _pkg2_cache_hdr_t
+{
+	u32 magic;
+	u32 version;
+	u8 key[PKG2_CACHE_KEY_SIZE];
+	u8 kernel_sha256[0x20];
+	u8 ini1_sha256[0x20];
+	u32 kernel_size;
+	u32 ini1_size;
+	u32 flags;
+	u8 kernel_ctr[0x10];
+} pkg2_cache_hdr_t;
+
+int pkg2_cache_key(u8 *key, const char *pkg1_id, const void *pkg2, u32 flags, const char **paths, u32 num_paths);
+int pkg2_cache_load(const u8 *key, void **kernel, u32 *kernel_size, u8 **kernel_ctr, pkg2_ini1_t **ini1);
+int pkg2_cache_save(const u8 *key, const void *kernel, u32 kernel_size, const u8 *kernel_ctr, const pkg2_ini1_t *ini1);
+
+#endif
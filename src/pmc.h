@@ -44,5 +44,7 @@
 #define APBDEV_PMC_RST_STATUS_0 0x1B4
 #define APBDEV_PMC_SECURE_SCRATCH49_0 0x3A4
 #define APBDEV_PMC_SCRATCH49_0 0x244
+#define APBDEV_PMC_SCRATCH118 0x6F8
+#define APBDEV_PMC_SCRATCH119 0x6FC
 
 #endif
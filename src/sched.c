@@ -0,0 +1,152 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "sched.h"
+#include "heap.h"
+#include "util.h"
+#include "ff.h"
+
+//Saves r4-r11 and lr on the current stack, stores sp to *save_sp and resumes the stack at new_sp (start.S).
+extern void sched_switch(u32 **save_sp, u32 *new_sp);
+
+static sched_task_t _sched_tasks[SCHED_MAX_TASKS];
+static sched_task_t *_sched_cur;
+static u32 _sched_num;
+static u32 _sched_ready;
+
+static void _sched_switch_to(sched_task_t *prev, sched_task_t *next)
+{
+	u32 now = get_tmr();
+	prev->run_us += now - prev->tmr;
+	prev->tmr = now;
+	next->wait_us += now - next->tmr;
+	next->tmr = now;
+	next->switches++;
+
+	_sched_cur = next;
+	sched_switch(&prev->sp, next->sp);
+}
+
+static sched_task_t *_sched_next(sched_task_t *task)
+{
+	//Round robin, the boot task never finishes so there always is a ready one.
+	do
+		task = task + 1 == &_sched_tasks[_sched_num] ? _sched_tasks : task + 1;
+	while (task->state != SCHED_TASK_READY);
+	return task;
+}
+
+static void _sched_entry()
+{
+	sched_task_t *task = _sched_cur;
+	task->entry(task->arg);
+
+	task->state = SCHED_TASK_DONE;
+	_sched_ready--;
+	sched_evt_set(&task->done);
+
+	//The stack is released by whoever joins the task, we never come back here.
+	_sched_switch_to(task, _sched_next(task));
+}
+
+void sched_init()
+{
+	memset(_sched_tasks, 0, sizeof(_sched_tasks));
+
+	//The boot task keeps running on the current stack.
+	_sched_cur = &_sched_tasks[0];
+	_sched_cur->name = "main";
+	_sched_cur->state = SCHED_TASK_READY;
+	_sched_cur->tmr = get_tmr();
+	_sched_num = 1;
+	_sched_ready = 1;
+}
+
+sched_task_t *sched_spawn(const char *name, sched_entry_t entry, void *arg, u32 stack_size)
+{
+	if (!_sched_cur || _sched_num == SCHED_MAX_TASKS)
+		return NULL;
+
+	sched_task_t *task = &_sched_tasks[_sched_num];
+	memset(task, 0, sizeof(sched_task_t));
+	task->stack = malloc(stack_size);
+	task->entry = entry;
+	task->arg = arg;
+	task->name = name;
+
+	//Initial frame for sched_switch(): r4-r11 cleared and lr pointing at the entry trampoline.
+	task->sp = (u32 *)(((u32)task->stack + stack_size) & ~7) - 9;
+	memset(task->sp, 0, 8 * sizeof(u32));
+	task->sp[8] = (u32)_sched_entry;
+
+	task->state = SCHED_TASK_READY;
+	task->tmr = get_tmr();
+	_sched_num++;
+	_sched_ready++;
+
+	return task;
+}
+
+void sched_yield()
+{
+	if (_sched_ready < 2)
+		return;
+
+	_sched_switch_to(_sched_cur, _sched_next(_sched_cur));
+}
+
+void sched_join(sched_task_t *task)
+{
+	if (!task)
+		return;
+
+	sched_evt_wait(&task->done);
+	free(task->stack);
+	task->stack = NULL;
+}
+
+void sched_evt_set(sched_evt_t *evt)
+{
+	evt->set = 1;
+}
+
+void sched_evt_wait(sched_evt_t *evt)
+{
+	while (!evt->set)
+		sched_yield();
+}
+
+int sched_save(const char *path)
+{
+	FIL fp;
+
+	if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+
+	f_puts("task,run_us,wait_us,switches\n", &fp);
+	for (u32 i = 0; i < _sched_num; i++)
+	{
+		sched_task_t *task = &_sched_tasks[i];
+		u32 run_us = task->run_us;
+		//The caller is still running, count it up to now.
+		if (task == _sched_cur)
+			run_us += get_tmr() - task->tmr;
+		f_printf(&fp, "%s,%u,%u,%u\n", task->name, run_us, task->wait_us, task->switches);
+	}
+
+	return f_close(&fp) == FR_OK;
+}
@@ -0,0 +1,61 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "types.h"
+
+/*! Task slots including the boot task, finished tasks keep theirs for the report. */
+#define SCHED_MAX_TASKS 8
+#define SCHED_STACK_SIZE 0x4000
+
+#define SCHED_TASK_FREE  0
+#define SCHED_TASK_READY 1
+#define SCHED_TASK_DONE  2
+
+typedef void (*sched_entry_t)(void *arg);
+
+typedef struct _sched_evt_t
+{
+	volatile u32 set;
+} sched_evt_t;
+
+typedef struct _sched_task_t
+{
+	u32 *sp; //Saved by sched_switch() while the task is not running.
+	void *stack;
+	sched_entry_t entry;
+	void *arg;
+	const char *name;
+	u32 state;
+	sched_evt_t done;
+	u32 run_us;  //Time spent running.
+	u32 wait_us; //Time spent switched out while other tasks ran.
+	u32 switches;
+	u32 tmr; //When the task was last switched in or out.
+} sched_task_t;
+
+/*! Tasks are cooperative, they only switch in sched_yield(), which device waits and sleep() call. */
+void sched_init();
+sched_task_t *sched_spawn(const char *name, sched_entry_t entry, void *arg, u32 stack_size);
+void sched_yield();
+void sched_join(sched_task_t *task);
+void sched_evt_set(sched_evt_t *evt);
+void sched_evt_wait(sched_evt_t *evt);
+int sched_save(const char *path);
+
+#endif
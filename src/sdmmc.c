@@ -20,6 +20,9 @@
 #include "sd.h"
 #include "util.h"
 #include "heap.h"
+#include "t210.h"
+#include "pmc.h"
+#include "sched.h"
 
 /*#include "gfx.h"
 extern gfx_ctxt_t gfx_ctxt;
@@ -42,6 +45,29 @@ static inline u32 unstuff_bits(u32 *resp, u32 start, u32 size)
 * Common functions for SD and MMC.
 */
 
+/*! Transfer retry policy. */
+#define SDMMC_RETRY_MAX       48    //Failures per request before giving up.
+#define SDMMC_RETRY_SPLIT     2     //Failures of a range before it is split in half.
+#define SDMMC_RETRY_SECTOR    4     //Failures of a single sector before it is considered bad.
+#define SDMMC_RETRY_TIMEOUTS  6     //Timeouts in a row before the card is considered gone.
+#define SDMMC_RETRY_RETUNE    2     //CRC errors in a row before re-tuning, one more steps the bus down.
+#define SDMMC_RETRY_DELAY     1000  //First backoff in us, doubled on every further error.
+#define SDMMC_RETRY_DELAY_MAX 64000
+
+typedef struct _sdmmc_retry_t
+{
+	u32 fails;       //Failures in this request.
+	u32 range_fails; //Failures of the current range.
+	u32 crc_errs;    //CRC or end bit errors in a row.
+	u32 timeouts;    //Timeouts in a row.
+	u32 delay;
+	u32 max_sectors; //Range limit, halved on every split.
+	u32 split_end;   //The limit is lifted once transfers get past the range that was split.
+} sdmmc_retry_t;
+
+static int _sdmmc_storage_retune(sdmmc_storage_t *storage);
+static int _sdmmc_storage_step_down(sdmmc_storage_t *storage);
+
 static int _sdmmc_storage_check_result(u32 res)
 {
 	//Error mask:
@@ -127,21 +153,35 @@ static int _sdmmc_storage_check_status(sdmmc_storage_t *storage)
 	return _sdmmc_storage_get_status(storage, &tmp, 0);
 }
 
-static int _sdmmc_storage_readwrite_ex(sdmmc_storage_t *storage, u32 *blkcnt_out, u32 sector, u32 num_sectors, void *buf, u32 is_write)
+static int _sdmmc_storage_readwrite_ex(sdmmc_storage_t *storage, u32 *blkcnt_out, u32 *err_out, u32 sector, u32 num_sectors, const sdmmc_iovec_t *iov, u32 num_iov, u32 is_write)
 {
+#ifdef SDMMC_FAULT_INJECT
+	u32 fault = sdmmc_fault_inject(storage, sector, num_sectors, is_write);
+	if (fault)
+	{
+		storage->sdmmc->errintsts = fault;
+		*err_out = sdmmc_get_error(storage->sdmmc);
+		return 0;
+	}
+#endif
+
 	sdmmc_cmd_t cmdbuf;
 	sdmmc_init_cmd(&cmdbuf, is_write ? MMC_WRITE_MULTIPLE_BLOCK : MMC_READ_MULTIPLE_BLOCK, sector, SDMMC_RSP_TYPE_1, 0);
 
 	sdmmc_req_t reqbuf;
-	reqbuf.buf = buf;
+	reqbuf.buf = NULL;
 	reqbuf.num_sectors = num_sectors;
 	reqbuf.blksize = 512;
 	reqbuf.is_write = is_write;
 	reqbuf.is_multi_block = 1;
 	reqbuf.is_auto_cmd12 = 1;
+	reqbuf.iov = iov;
+	reqbuf.num_iov = num_iov;
 
 	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, &reqbuf, blkcnt_out))
 	{
+		//Classify before the commands below replace the error status.
+		*err_out = sdmmc_get_error(storage->sdmmc);
 		u32 tmp = 0;
 		sdmmc_stop_transmission(storage->sdmmc, &tmp);
 		_sdmmc_storage_get_status(storage, &tmp, 0);
@@ -158,37 +198,140 @@ int sdmmc_storage_end(sdmmc_storage_t *storage)
 	return 1;
 }
 
-static int _sdmmc_storage_readwrite(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf, u32 is_write)
+static int _sdmmc_storage_recover(sdmmc_storage_t *storage, sdmmc_retry_t *retry, u32 err, u32 sector, u32 num_sectors)
 {
-	u8 *bbuf = (u8 *)buf;
+	sdmmc_err_stats_t *stats = &storage->err_stats;
+
+	DPRINTF("readwrite: error %d at %08X (%08X)\n", err, sector, num_sectors);
+	stats->errors[err]++;
+	if (++retry->fails > SDMMC_RETRY_MAX)
+		return 0;
 
-	while (num_sectors)
+	if (err == SDMMC_ERR_CRC || err == SDMMC_ERR_END_BIT)
 	{
-		u32 blkcnt = 0;
-		//Retry 9 times on error.
-		u32 retries = 10;
-		do
+		//Signal integrity, retry right away, then re-tune and then step down the bus speed.
+		retry->timeouts = 0;
+		if (++retry->crc_errs >= SDMMC_RETRY_RETUNE)
 		{
-			if (_sdmmc_storage_readwrite_ex(storage, &blkcnt, sector, MIN(num_sectors, 0xFFFF), bbuf, is_write))
-				goto out;
+			//Tuning needs the SD clock running, init left it gated between commands.
+			sdmmc_sd_clock_ctrl(storage->sdmmc, 0);
+			if (retry->crc_errs == SDMMC_RETRY_RETUNE && _sdmmc_storage_retune(storage))
+				stats->retunes++;
 			else
-				retries--;
-
-			sleep(500000);
+			{
+				if (_sdmmc_storage_step_down(storage))
+					stats->step_downs++;
+				retry->crc_errs = 0;
+			}
+			sdmmc_sd_clock_ctrl(storage->sdmmc, 1);
+		}
+	}
+	else
+	{
+		//Anything else gets a growing delay, a card that keeps timing out is not bisected.
+		retry->crc_errs = 0;
+		if (err != SDMMC_ERR_TIMEOUT)
+			retry->timeouts = 0;
+		else if (++retry->timeouts >= SDMMC_RETRY_TIMEOUTS)
+			return 0;
+		sleep(retry->delay);
+		retry->delay = MIN(retry->delay * 2, SDMMC_RETRY_DELAY_MAX);
+	}
 
-		} while (retries);
+	//Split ranges that keep failing to isolate bad sectors.
+	if (++retry->range_fails < (num_sectors > 1 ? SDMMC_RETRY_SPLIT : SDMMC_RETRY_SECTOR))
+		return 1;
+	if (num_sectors == 1)
+	{
+		stats->bad_sector = sector;
 		return 0;
+	}
+	retry->max_sectors = num_sectors / 2;
+	retry->split_end = MAX(retry->split_end, sector + num_sectors);
+	retry->range_fails = 0;
+	stats->splits++;
+
+	return 1;
+}
+
+static int _sdmmc_storage_readwritev(sdmmc_storage_t *storage, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov, u32 is_write)
+{
+	//Sectors of iov[0] already transferred, if any we finish that buffer on its own.
+	u32 done = 0;
+	sdmmc_iovec_t head;
+
+	sdmmc_retry_t retry;
+	memset(&retry, 0, sizeof(sdmmc_retry_t));
+	retry.delay = SDMMC_RETRY_DELAY;
+	retry.max_sectors = 0xFFFF;
+
+	while (num_iov)
+	{
+		if (!iov->num_sectors)
+		{
+			iov++;
+			num_iov--;
+			continue;
+		}
+
+		const sdmmc_iovec_t *req_iov = iov;
+		u32 req_num_iov = num_iov;
+		if (done)
+		{
+			head.buf = (u8 *)iov->buf + 512 * done;
+			head.num_sectors = iov->num_sectors - done;
+			req_iov = &head;
+			req_num_iov = 1;
+		}
+
+		u32 num_sectors = 0;
+		for (u32 i = 0; i < req_num_iov && num_sectors < retry.max_sectors; i++)
+			num_sectors += req_iov[i].num_sectors;
+		num_sectors = MIN(num_sectors, retry.max_sectors);
+
+		u32 blkcnt = 0;
+		u32 err = SDMMC_ERR_NONE;
+		if (!_sdmmc_storage_readwrite_ex(storage, &blkcnt, &err, sector, num_sectors, req_iov, req_num_iov, is_write))
+		{
+			if (_sdmmc_storage_recover(storage, &retry, err, sector, num_sectors))
+				continue;
+			storage->err_stats.failed++;
+			return 0;
+		}
 
-out:;
 		DPRINTF("readwrite: %08X\n", blkcnt);
 		sector += blkcnt;
-		num_sectors -= blkcnt;
-		bbuf += 512 * blkcnt;
+		retry.range_fails = 0;
+		retry.crc_errs = 0;
+		retry.timeouts = 0;
+		retry.delay = SDMMC_RETRY_DELAY;
+		if (sector >= retry.split_end)
+			retry.max_sectors = 0xFFFF;
+		while (blkcnt)
+		{
+			u32 left = iov->num_sectors - done;
+			if (blkcnt < left)
+			{
+				done += blkcnt;
+				break;
+			}
+			blkcnt -= left;
+			done = 0;
+			iov++;
+			num_iov--;
+		}
 	}
 
 	return 1;
 }
 
+static int _sdmmc_storage_readwrite(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf, u32 is_write)
+{
+	sdmmc_iovec_t iov;
+	iov.buf = buf;
+	iov.num_sectors = num_sectors;
+	return _sdmmc_storage_readwritev(storage, sector, &iov, 1, is_write);
+}
 
 int sdmmc_storage_read(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf)
 {
@@ -200,6 +343,69 @@ int sdmmc_storage_write(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, v
 	return _sdmmc_storage_readwrite(storage, sector, num_sectors, buf, 1);
 }
 
+int sdmmc_storage_readv(sdmmc_storage_t *storage, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov)
+{
+	return _sdmmc_storage_readwritev(storage, sector, iov, num_iov, 0);
+}
+
+int sdmmc_storage_writev(sdmmc_storage_t *storage, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov)
+{
+	return _sdmmc_storage_readwritev(storage, sector, iov, num_iov, 1);
+}
+
+/*
+* Tuning cache.
+*/
+
+static u32 _sdmmc_storage_tap_reg(sdmmc_storage_t *storage)
+{
+	//Scratch registers left alone by sdram_lp0, they survive warm reboots.
+	switch (storage->sdmmc->id)
+	{
+	case SDMMC_1:
+		return APBDEV_PMC_SCRATCH119;
+	case SDMMC_4:
+		return APBDEV_PMC_SCRATCH118;
+	}
+	return 0;
+}
+
+static u32 _sdmmc_storage_tap_key(sdmmc_storage_t *storage, u32 type)
+{
+	//FNV-1a over the CID (which has the serial) and the bus speed, the tap goes in the low byte.
+	u32 hash = 0x811C9DC5;
+	for (u32 i = 0; i < sizeof(storage->raw_cid); i++)
+		hash = (hash ^ storage->raw_cid[i]) * 0x01000193;
+	hash = (hash ^ type) * 0x01000193;
+	return (hash << 8) | 0x80000000;
+}
+
+static int _sdmmc_storage_load_tap(sdmmc_storage_t *storage, u32 type, u32 *tap)
+{
+	u32 reg = _sdmmc_storage_tap_reg(storage);
+	if (!reg || (PMC(reg) & 0xFFFFFF00) != _sdmmc_storage_tap_key(storage, type))
+		return 0;
+	*tap = PMC(reg) & 0xFF;
+	return 1;
+}
+
+static void _sdmmc_storage_save_tap(sdmmc_storage_t *storage, u32 type)
+{
+	//Also keeps the tap around for HS400, which uses it instead of tuning.
+	sdmmc_get_venclkctl(storage->sdmmc);
+	u32 reg = _sdmmc_storage_tap_reg(storage);
+	if (!reg)
+		return;
+	PMC(reg) = _sdmmc_storage_tap_key(storage, type) | (storage->sdmmc->venclkctl_tap & 0xFF);
+}
+
+static void _sdmmc_storage_drop_tap(sdmmc_storage_t *storage)
+{
+	u32 reg = _sdmmc_storage_tap_reg(storage);
+	if (reg)
+		PMC(reg) = 0;
+}
+
 /*
 * MMC specific functions.
 */
@@ -228,27 +434,17 @@ static int _mmc_storage_get_op_cond_inner(sdmmc_storage_t *storage, u32 *pout, u
 	return sdmmc_get_rsp(storage->sdmmc, pout, 4, SDMMC_RSP_TYPE_3);
 }
 
-static int _mmc_storage_get_op_cond(sdmmc_storage_t *storage, u32 power)
+static int _mmc_storage_poll_op_cond(sdmmc_storage_t *storage, u32 power)
 {
-	u32 timeout = get_tmr() + 1500000;
-
-	while (1)
-	{
-		u32 cond = 0;
-		if (!_mmc_storage_get_op_cond_inner(storage, &cond, power))
-			break;
-		if (cond & MMC_CARD_BUSY)
-		{
-			if (cond & 0x40000000)
-				storage->has_sector_access = 1;
-			return 1;
-		}
-		if (get_tmr() > timeout)
-			break;
-		sleep(1000);
-	}
-
-	return 0;
+	u32 cond = 0;
+	if (!_mmc_storage_get_op_cond_inner(storage, &cond, power))
+		return SDMMC_INIT_FAILED;
+	if (!(cond & MMC_CARD_BUSY))
+		return SDMMC_INIT_BUSY;
+
+	if (cond & 0x40000000)
+		storage->has_sector_access = 1;
+	return SDMMC_INIT_DONE;
 }
 
 static int _mmc_storage_set_relative_addr(sdmmc_storage_t *storage)
@@ -322,6 +518,8 @@ static int _mmc_storage_parse_ext_csd(sdmmc_storage_t *storage, u8 *buf)
 	storage->ext_csd.bkops = buf[EXT_CSD_BKOPS_SUPPORT];
 	storage->ext_csd.bkops_en = buf[EXT_CSD_BKOPS_EN];
 	storage->ext_csd.bkops_status = buf[EXT_CSD_BKOPS_STATUS];
+	storage->ext_csd.cmdq_depth = (buf[EXT_CSD_CMDQ_DEPTH] & 0x1F) + 1;
+	storage->ext_csd.cmdq_support = buf[EXT_CSD_CMDQ_SUPPORT];
 
 	storage->sec_cnt  = *(u32 *)&buf[EXT_CSD_SEC_CNT];
 }
@@ -338,6 +536,8 @@ static int _mmc_storage_get_ext_csd(sdmmc_storage_t *storage, void *buf)
 	reqbuf.is_write = 0;
 	reqbuf.is_multi_block = 0;
 	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
 
 	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, &reqbuf, 0))
 		return 0;
@@ -388,6 +588,7 @@ static int _mmc_storage_enable_HS(sdmmc_storage_t *storage, int check)
 		return 0;
 	if (!sdmmc_setup_clock(storage->sdmmc, 2))
 		return 0;
+	storage->bus_type = 2;
 	DPRINTF("[mmc] switched to HS\n");
 	if (check || _sdmmc_storage_check_status(storage))
 		return 1;
@@ -400,18 +601,16 @@ static int _mmc_storage_enable_HS200(sdmmc_storage_t *storage)
 		return 0;
 	if (!sdmmc_setup_clock(storage->sdmmc, 3))
 		return 0;
+	storage->bus_type = 3;
 	if (!sdmmc_config_tuning(storage->sdmmc, 3, MMC_SEND_TUNING_BLOCK_HS200))
 		return 0;
 	DPRINTF("[mmc] switched to HS200\n");
 	return _sdmmc_storage_check_status(storage);
 }
 
-static int _mmc_storage_enable_HS400(sdmmc_storage_t *storage)
+static int _mmc_storage_switch_HS400(sdmmc_storage_t *storage, int check)
 {
-	if (!_mmc_storage_enable_HS200(storage))
-		return 0;
-	sdmmc_get_venclkctl(storage->sdmmc);
-	if (!_mmc_storage_enable_HS(storage, 0))
+	if (!_mmc_storage_enable_HS(storage, check))
 		return 0;
 	if (!_mmc_storage_switch(storage, SDMMC_SWITCH(MMC_SWITCH_MODE_WRITE_BYTE, EXT_CSD_BUS_WIDTH, EXT_CSD_DDR_BUS_WIDTH_8)))
 		return 0;
@@ -419,10 +618,64 @@ static int _mmc_storage_enable_HS400(sdmmc_storage_t *storage)
 		return 0;
 	if (!sdmmc_setup_clock(storage->sdmmc, 4))
 		return 0;
+	storage->bus_type = 4;
 	DPRINTF("[mmc] switched to HS400\n");
 	return _sdmmc_storage_check_status(storage);
 }
 
+static int _mmc_storage_enable_HS400_saved(sdmmc_storage_t *storage)
+{
+	u32 tap;
+	if (!_sdmmc_storage_load_tap(storage, 4, &tap))
+		return 0;
+
+	//The tap is all HS200 tuning is needed for, go straight from HS and check it with an EXT_CSD read.
+	sdmmc_set_tap(storage->sdmmc, tap);
+	u8 *ext_csd = (u8 *)malloc(512);
+	int res = _mmc_storage_switch_HS400(storage, 1) && _mmc_storage_get_ext_csd(storage, ext_csd);
+	free(ext_csd);
+	if (res)
+	{
+		DPRINTF("[mmc] used saved tap %02X\n", tap);
+		return 1;
+	}
+
+	//Back to HS with a SDR bus so tuning can start over.
+	DPRINTF("[mmc] saved tap %02X failed\n", tap);
+	_sdmmc_storage_drop_tap(storage);
+	storage->sdmmc->venclkctl_set = 0;
+	sdmmc_setup_clock(storage->sdmmc, 2);
+	storage->bus_type = 2;
+	_mmc_storage_switch(storage, SDMMC_SWITCH(MMC_SWITCH_MODE_WRITE_BYTE, EXT_CSD_HS_TIMING, EXT_CSD_TIMING_HS));
+	_mmc_storage_switch(storage, SDMMC_SWITCH(MMC_SWITCH_MODE_WRITE_BYTE, EXT_CSD_BUS_WIDTH, EXT_CSD_BUS_WIDTH_8));
+	return 0;
+}
+
+static int _mmc_storage_enable_HS400(sdmmc_storage_t *storage)
+{
+	if (_mmc_storage_enable_HS400_saved(storage))
+		return 1;
+
+	if (!_mmc_storage_enable_HS200(storage))
+		return 0;
+	_sdmmc_storage_save_tap(storage, 4);
+	return _mmc_storage_switch_HS400(storage, 0);
+}
+
+static int _mmc_storage_disable_HS400(sdmmc_storage_t *storage)
+{
+	//Commands stay SDR in HS400, go back to HS timing at a HS clock and then to HS200 from there.
+	if (!sdmmc_setup_clock(storage->sdmmc, 2))
+		return 0;
+	storage->bus_type = 2;
+	if (!_mmc_storage_switch(storage, SDMMC_SWITCH(MMC_SWITCH_MODE_WRITE_BYTE, EXT_CSD_HS_TIMING, EXT_CSD_TIMING_HS)))
+		return 0;
+	if (!_mmc_storage_switch(storage, SDMMC_SWITCH(MMC_SWITCH_MODE_WRITE_BYTE, EXT_CSD_BUS_WIDTH, EXT_CSD_BUS_WIDTH_8)))
+		return 0;
+	DPRINTF("[mmc] left HS400\n");
+	return _mmc_storage_enable_HS200(storage);
+}
+
 static int _mmc_storage_enable_highspeed(sdmmc_storage_t *storage, u32 card_type, u32 type)
 {
 	//TODO: this should be a config item.
@@ -454,26 +707,30 @@ static int _mmc_storage_enable_bkops(sdmmc_storage_t *storage)
 	return _sdmmc_storage_check_status(storage);
 }
 
-int sdmmc_storage_init_mmc(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type)
+void sdmmc_storage_init_mmc_start(sdmmc_init_t *init, sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type)
 {
 	memset(storage, 0, sizeof(sdmmc_storage_t));
 	storage->sdmmc = sdmmc;
 	storage->rca = 2; //TODO: this could be a config item.
 
-	if (!sdmmc_init(sdmmc, id, SDMMC_POWER_1_8, SDMMC_BUS_WIDTH_1, 0, 0))
-		return 0;
-	DPRINTF("[mmc] after init\n");
-
-	sleep(1000 + (74000 + sdmmc->divisor - 1) / sdmmc->divisor);
-
-	if (!_sdmmc_storage_go_idle_state(storage))
-		return 0;
-	DPRINTF("[mmc] went to idle state\n");
+	memset(init, 0, sizeof(sdmmc_init_t));
+	init->storage = storage;
+	init->id = id;
+	init->bus_width = bus_width;
+	init->type = type;
+	init->step = SDMMC_INIT_STEP_POWER;
+	init->wake = get_tmr();
+}
 
-	if (!_mmc_storage_get_op_cond(storage, SDMMC_POWER_1_8))
-		return 0;
-	DPRINTF("[mmc] got op cond\n");
+int sdmmc_storage_init_mmc(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type)
+{
+	sdmmc_init_t init;
+	sdmmc_storage_init_mmc_start(&init, storage, sdmmc, id, bus_width, type);
+	return sdmmc_storage_init_wait(&init);
+}
 
+static int _mmc_storage_init_setup(sdmmc_storage_t *storage, u32 bus_width, u32 type)
+{
 	if (!_sdmmc_storage_get_cid(storage, storage->raw_cid))
 		return 0;
 	DPRINTF("[mmc] got cid\n");
@@ -489,6 +746,7 @@ int sdmmc_storage_init_mmc(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32
 
 	if (!sdmmc_setup_clock(storage->sdmmc, 1))
 		return 0;
+	storage->bus_type = 1;
 	DPRINTF("[mmc] after setup clock\n");
 
 	if (!_sdmmc_storage_select_card(storage))
@@ -552,6 +810,147 @@ int sdmmc_storage_set_mmc_partition(sdmmc_storage_t *storage, u32 partition)
 	return 1;
 }
 
+/*
+* Command queue.
+*/
+
+#define MMC_CMDQ_MAX_SECTORS 0xFFFF  //Block count field of the task parameters.
+#define MMC_CMDQ_TIMEOUT     1000000 //For the next task to become ready, in us.
+
+static int _mmc_storage_cmdq_enable(sdmmc_storage_t *storage, int enable)
+{
+	if (!_mmc_storage_switch(storage, SDMMC_SWITCH(MMC_SWITCH_MODE_WRITE_BYTE, EXT_CSD_CMDQ_MODE_EN, enable ? EXT_CSD_CMDQ_MODE_ENABLED : 0)))
+		return 0;
+	return _sdmmc_storage_check_status(storage);
+}
+
+static int _mmc_storage_cmdq_queue(sdmmc_storage_t *storage, u32 task, u32 sector, u32 num_sectors)
+{
+	//Parameters have the direction (bit 30 for reads), task ID and block count, the address follows on its own.
+	if (!_sdmmc_storage_execute_cmd_type1(storage, MMC_QUE_TASK_PARAMS, (1 << 30) | (task << 16) | num_sectors, 0, R1_STATE_TRAN))
+		return 0;
+	return _sdmmc_storage_execute_cmd_type1(storage, MMC_QUE_TASK_ADDR, sector, 0, R1_STATE_TRAN);
+}
+
+static int _mmc_storage_cmdq_status(sdmmc_storage_t *storage, u32 *qsr)
+{
+	//CMD13 with bit 15 set returns the queue status register instead, one ready bit per task.
+	sdmmc_cmd_t cmdbuf;
+	sdmmc_init_cmd(&cmdbuf, MMC_SEND_STATUS, (storage->rca << 16) | (1 << 15), SDMMC_RSP_TYPE_1, 0);
+	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, 0, 0))
+		return 0;
+	return sdmmc_get_rsp(storage->sdmmc, qsr, 4, SDMMC_RSP_TYPE_1);
+}
+
+static int _mmc_storage_cmdq_execute(sdmmc_storage_t *storage, u32 task, u32 num_sectors, void *buf)
+{
+	sdmmc_cmd_t cmdbuf;
+	sdmmc_init_cmd(&cmdbuf, MMC_EXECUTE_READ_TASK, task << 16, SDMMC_RSP_TYPE_1, 0);
+
+	//The task already has its length, so there is no CMD12.
+	sdmmc_req_t reqbuf;
+	reqbuf.buf = buf;
+	reqbuf.blksize = 512;
+	reqbuf.num_sectors = num_sectors;
+	reqbuf.is_write = 0;
+	reqbuf.is_multi_block = 1;
+	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
+
+	u32 blkcnt = 0;
+	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, &reqbuf, &blkcnt) || blkcnt != num_sectors)
+		return 0;
+
+	u32 tmp = 0;
+	sdmmc_get_rsp(storage->sdmmc, &tmp, 4, SDMMC_RSP_TYPE_1);
+	return _sdmmc_storage_check_result(tmp);
+}
+
+static int _mmc_storage_cmdq_read(sdmmc_storage_t *storage, const sdmmc_qio_t *ios, u32 num_ios)
+{
+	u32 depth = MIN(storage->ext_csd.cmdq_depth, 32);
+	u8 *task_buf[32];
+	u32 task_num[32];
+	u32 queued = 0;
+	u32 i = 0, done = 0;
+	u32 timeout = get_tmr() + MMC_CMDQ_TIMEOUT;
+
+	while (i < num_ios || queued)
+	{
+		//Keep every free task busy, large reads take several.
+		for (u32 task = 0; task < depth && i < num_ios; task++)
+		{
+			if (queued & (1 << task))
+				continue;
+
+			u32 num = MIN(ios[i].num_sectors - done, MMC_CMDQ_MAX_SECTORS);
+			if (num)
+			{
+				if (!_mmc_storage_cmdq_queue(storage, task, ios[i].sector + done, num))
+					return 0;
+				task_buf[task] = (u8 *)ios[i].buf + 512 * done;
+				task_num[task] = num;
+				queued |= 1 << task;
+				done += num;
+			}
+			if (done == ios[i].num_sectors)
+			{
+				i++;
+				done = 0;
+			}
+		}
+
+		//The device readies tasks in whatever order suits it, run them as they come.
+		u32 qsr = 0;
+		if (!_mmc_storage_cmdq_status(storage, &qsr))
+			return 0;
+		qsr &= queued;
+		if (!qsr)
+		{
+			if ((int)(get_tmr() - timeout) > 0)
+				return 0;
+			sched_yield();
+			continue;
+		}
+
+		for (u32 task = 0; task < depth; task++)
+		{
+			if (!(qsr & (1 << task)))
+				continue;
+			if (!_mmc_storage_cmdq_execute(storage, task, task_num[task], task_buf[task]))
+				return 0;
+			queued &= ~(1 << task);
+		}
+		timeout = get_tmr() + MMC_CMDQ_TIMEOUT;
+	}
+
+	return 1;
+}
+
+int sdmmc_storage_read_queued(sdmmc_storage_t *storage, const sdmmc_qio_t *ios, u32 num_ios)
+{
+	//A single read gains nothing from the queue, which is also only enabled for the duration of a batch.
+	if (num_ios > 1 && storage->ext_csd.cmdq_support & 1 && _mmc_storage_cmdq_enable(storage, 1))
+	{
+		int res = _mmc_storage_cmdq_read(storage, ios, num_ios);
+		if (!res)
+		{
+			//Discard the whole queue (task management op 1).
+			DPRINTF("[mmc] cmdq read failed\n");
+			_sdmmc_storage_execute_cmd_type1(storage, MMC_CMDQ_TASK_MGMT, 1, 1, 0x10);
+		}
+		if (_mmc_storage_cmdq_enable(storage, 0) && res)
+			return 1;
+	}
+
+	//Plain reads, which also redo a failed batch with the full error recovery.
+	for (u32 i = 0; i < num_ios; i++)
+		if (!sdmmc_storage_read(storage, ios[i].sector, ios[i].num_sectors, ios[i].buf))
+			return 0;
+	return 1;
+}
+
 /*
 * SD specific functions.
 */
@@ -602,42 +1001,32 @@ static int _sd_storage_get_op_cond_once(sdmmc_storage_t *storage, u32 *cond, int
 	return sdmmc_get_rsp(storage->sdmmc, cond, 4, SDMMC_RSP_TYPE_3);
 }
 
-static int _sd_storage_get_op_cond(sdmmc_storage_t *storage, int is_version_1, int supports_low_voltage)
+static int _sd_storage_poll_op_cond(sdmmc_storage_t *storage, int is_version_1, int supports_low_voltage)
 {
-	u32 timeout = get_tmr() + 1500000;
+	u32 cond = 0;
+	if (!_sd_storage_get_op_cond_once(storage, &cond, is_version_1, supports_low_voltage))
+		return SDMMC_INIT_FAILED;
+	if (!(cond & MMC_CARD_BUSY))
+		return SDMMC_INIT_BUSY;
 
-	while (1)
+	if (cond & SD_OCR_CCS)
+		storage->has_sector_access = 1;
+
+	if (cond & SD_ROCR_S18A && supports_low_voltage)
 	{
-		u32 cond = 0;
-		if (!_sd_storage_get_op_cond_once(storage, &cond, is_version_1, supports_low_voltage))
-			break;
-		if (cond & MMC_CARD_BUSY)
+		//The low voltage regulator configuration is valid for SDMMC1 only.
+		if (storage->sdmmc->id == SDMMC_1 &&
+			_sdmmc_storage_execute_cmd_type1(storage, SD_SWITCH_VOLTAGE, 0, 0, R1_STATE_READY))
 		{
-			if (cond & SD_OCR_CCS)
-				storage->has_sector_access = 1;
+			if (!sdmmc_enable_low_voltage(storage->sdmmc))
+				return SDMMC_INIT_FAILED;
+			storage->is_low_voltage = 1;
 
-			if (cond & SD_ROCR_S18A && supports_low_voltage)
-			{
-				//The low voltage regulator configuration is valid for SDMMC1 only.
-				if (storage->sdmmc->id == SDMMC_1 &&
-					_sdmmc_storage_execute_cmd_type1(storage, SD_SWITCH_VOLTAGE, 0, 0, R1_STATE_READY))
-				{
-					if (!sdmmc_enable_low_voltage(storage->sdmmc))
-						return 0;
-					storage->is_low_voltage = 1;
-
-					DPRINTF("-> switched to low voltage\n");
-				}
-			}
-
-			return 1;
+			DPRINTF("-> switched to low voltage\n");
 		}
-		if (get_tmr() > timeout)
-			break;
-		sleep(10000); // Needs to be at least 10ms for some SD Cards
 	}
 
-	return 0;
+	return SDMMC_INIT_DONE;
 }
 
 static int _sd_storage_get_rca(sdmmc_storage_t *storage)
@@ -699,6 +1088,8 @@ int _sd_storage_get_scr(sdmmc_storage_t *storage, u8 *buf)
 	reqbuf.is_write = 0;
 	reqbuf.is_multi_block = 0;
 	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
 
 	if (!_sd_storage_execute_app_cmd(storage, R1_STATE_TRAN, 0, &cmdbuf, &reqbuf, 0))
 		return 0;
@@ -731,6 +1122,8 @@ int _sd_storage_switch_get(sdmmc_storage_t *storage, void *buf)
 	reqbuf.is_write = 0;
 	reqbuf.is_multi_block = 0;
 	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
 
 	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, &reqbuf, 0))
 		return 0;
@@ -752,6 +1145,8 @@ int _sd_storage_switch(sdmmc_storage_t *storage, void *buf, int flag, u32 arg)
 	reqbuf.is_write = 0;
 	reqbuf.is_multi_block = 0;
 	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
 
 	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, &reqbuf, 0))
 		return 0;
@@ -816,8 +1211,25 @@ int _sd_storage_enable_highspeed_low_volt(sdmmc_storage_t *storage, u32 type, u8
 		return 0;
 	if (!sdmmc_setup_clock(storage->sdmmc, type))
 		return 0;
+	storage->bus_type = type;
+
+	//Try the tap saved by an earlier tuning first, a single read of the switch status checks it.
+	u32 tap;
+	if (_sdmmc_storage_load_tap(storage, type, &tap))
+	{
+		sdmmc_set_tap(storage->sdmmc, tap);
+		if (_sd_storage_switch_get(storage, buf) && _sdmmc_storage_check_status(storage))
+		{
+			DPRINTF("[sd] used saved tap %02X\n", tap);
+			return 1;
+		}
+		DPRINTF("[sd] saved tap %02X failed\n", tap);
+		_sdmmc_storage_drop_tap(storage);
+	}
+
 	if (!sdmmc_config_tuning(storage->sdmmc, type, MMC_SEND_TUNING_BLOCK))
 		return 0;
+	_sdmmc_storage_save_tap(storage, type);
 	return _sdmmc_storage_check_status(storage);
 }
 
@@ -833,7 +1245,10 @@ int _sd_storage_enable_highspeed_high_volt(sdmmc_storage_t *storage, u8 *buf)
 		return 0;
 	if (!_sdmmc_storage_check_status(storage))
 		return 0;
-	return sdmmc_setup_clock(storage->sdmmc, 7);
+	if (!sdmmc_setup_clock(storage->sdmmc, 7))
+		return 0;
+	storage->bus_type = 7;
+	return 1;
 }
 
 static void _sd_storage_parse_ssr(sdmmc_storage_t *storage)
@@ -892,6 +1307,8 @@ static int _sd_storage_get_ssr(sdmmc_storage_t *storage, u8 *buf)
 	reqbuf.is_write = 0;
 	reqbuf.is_multi_block = 0;
 	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
 
 	if (!(storage->csd.cmdclass & CCC_APP_SPEC)) {
 		DPRINTF("[sd] ssr: Card lacks mandatory SD Status function\n");
@@ -956,32 +1373,30 @@ static void _sd_storage_parse_csd(sdmmc_storage_t *storage)
 	}
 }
 
-int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type)
+void sdmmc_storage_init_sd_start(sdmmc_init_t *init, sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type)
 {
-	int is_version_1 = 0;
-
 	memset(storage, 0, sizeof(sdmmc_storage_t));
 	storage->sdmmc = sdmmc;
 
-	if (!sdmmc_init(sdmmc, id, SDMMC_POWER_3_3, SDMMC_BUS_WIDTH_1, 5, 0))
-		return 0;
-	DPRINTF("[sd] after init\n");
-
-	sleep(1000 + (74000 + sdmmc->divisor - 1) / sdmmc->divisor);
-
-	if (!_sdmmc_storage_go_idle_state(storage))
-		return 0;
-	DPRINTF("[sd] went to idle state\n");
-
-	is_version_1 = _sd_storage_send_if_cond(storage);
-	if (is_version_1 == 2)
-		return 0;
-	DPRINTF("[sd] after send if cond\n");
+	memset(init, 0, sizeof(sdmmc_init_t));
+	init->storage = storage;
+	init->id = id;
+	init->bus_width = bus_width;
+	init->type = type;
+	init->is_sd = 1;
+	init->step = SDMMC_INIT_STEP_POWER;
+	init->wake = get_tmr();
+}
 
-	if (!_sd_storage_get_op_cond(storage, is_version_1, bus_width == SDMMC_BUS_WIDTH_4 && type == 11))
-		return 0;
-	DPRINTF("[sd] got op cond\n");
+int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type)
+{
+	sdmmc_init_t init;
+	sdmmc_storage_init_sd_start(&init, storage, sdmmc, id, bus_width, type);
+	return sdmmc_storage_init_wait(&init);
+}
 
+static int _sd_storage_init_setup(sdmmc_storage_t *storage, u32 bus_width, u32 type)
+{
 	if (!_sdmmc_storage_get_cid(storage, storage->raw_cid))
 		return 0;
 	DPRINTF("[sd] got cid\n");
@@ -1014,6 +1429,7 @@ int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32
 	{
 		if (!sdmmc_setup_clock(storage->sdmmc, 6))
 			return 0;
+		storage->bus_type = 6;
 		DPRINTF("[sd] after setup clock\n");
 	}
 
@@ -1069,7 +1485,7 @@ int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32
 		DPRINTF("[sd] enabled highspeed (high voltage)\n");
 	}
 
-	sdmmc_sd_clock_ctrl(sdmmc, 1);
+	sdmmc_sd_clock_ctrl(storage->sdmmc, 1);
 
     // Parse additional card info from sd status
 	if (_sd_storage_get_ssr(storage, buf))
@@ -1079,6 +1495,155 @@ int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32
 	return 1;
 }
 
+/*
+* Resumable bring-up.
+*/
+
+static int _sdmmc_storage_init_sleep(sdmmc_init_t *init, u32 step, u32 us)
+{
+	init->step = step;
+	init->wake = get_tmr() + us;
+	return SDMMC_INIT_BUSY;
+}
+
+static int _sdmmc_storage_init_end(sdmmc_init_t *init, int res)
+{
+	init->step = SDMMC_INIT_STEP_END;
+	init->res = res ? SDMMC_INIT_DONE : SDMMC_INIT_FAILED;
+	return init->res;
+}
+
+int sdmmc_storage_init_poll(sdmmc_init_t *init)
+{
+	sdmmc_storage_t *storage = init->storage;
+	sdmmc_t *sdmmc = storage->sdmmc;
+	int res;
+
+	if (init->step == SDMMC_INIT_STEP_END)
+		return init->res;
+	if ((int)(get_tmr() - init->wake) < 0)
+		return SDMMC_INIT_BUSY;
+
+	switch (init->step)
+	{
+	case SDMMC_INIT_STEP_POWER:
+		if (!sdmmc_init(sdmmc, init->id, init->is_sd ? SDMMC_POWER_3_3 : SDMMC_POWER_1_8, SDMMC_BUS_WIDTH_1, init->is_sd ? 5 : 0, 0))
+			return _sdmmc_storage_init_end(init, 0);
+		storage->bus_type = init->is_sd ? 5 : 0;
+		DPRINTF("[sdmmc] after init\n");
+		//Power ramp up and at least 74 clocks before the first command.
+		return _sdmmc_storage_init_sleep(init, SDMMC_INIT_STEP_IDLE, 1000 + (74000 + sdmmc->divisor - 1) / sdmmc->divisor);
+
+	case SDMMC_INIT_STEP_IDLE:
+		if (!_sdmmc_storage_go_idle_state(storage))
+			return _sdmmc_storage_init_end(init, 0);
+		DPRINTF("[sdmmc] went to idle state\n");
+		if (init->is_sd)
+		{
+			init->is_version_1 = _sd_storage_send_if_cond(storage);
+			if (init->is_version_1 == 2)
+				return _sdmmc_storage_init_end(init, 0);
+			DPRINTF("[sd] after send if cond\n");
+		}
+		init->step = SDMMC_INIT_STEP_OP_COND;
+		init->deadline = get_tmr() + 1500000;
+		//Fall through.
+
+	case SDMMC_INIT_STEP_OP_COND:
+		//The card powers up on its own after the first op cond command, we just have to ask again later.
+		if (init->is_sd)
+			res = _sd_storage_poll_op_cond(storage, init->is_version_1, init->bus_width == SDMMC_BUS_WIDTH_4 && init->type == 11);
+		else
+			res = _mmc_storage_poll_op_cond(storage, SDMMC_POWER_1_8);
+		if (res == SDMMC_INIT_BUSY)
+		{
+			if ((int)(get_tmr() - init->deadline) > 0)
+				return _sdmmc_storage_init_end(init, 0);
+			//Needs to be at least 10ms for some SD cards.
+			return _sdmmc_storage_init_sleep(init, SDMMC_INIT_STEP_OP_COND, init->is_sd ? 10000 : 1000);
+		}
+		if (res == SDMMC_INIT_FAILED)
+			return _sdmmc_storage_init_end(init, 0);
+		DPRINTF("[sdmmc] got op cond\n");
+		//Fall through.
+
+	case SDMMC_INIT_STEP_SETUP:
+		if (init->is_sd)
+			res = _sd_storage_init_setup(storage, init->bus_width, init->type);
+		else
+			res = _mmc_storage_init_setup(storage, init->bus_width, init->type);
+		return _sdmmc_storage_init_end(init, res);
+	}
+
+	return _sdmmc_storage_init_end(init, 0);
+}
+
+int sdmmc_storage_init_wait(sdmmc_init_t *init)
+{
+	int res;
+	while ((res = sdmmc_storage_init_poll(init)) == SDMMC_INIT_BUSY)
+	{
+		int left = (int)(init->wake - get_tmr());
+		if (left > 0)
+			sleep(left);
+	}
+	return res == SDMMC_INIT_DONE;
+}
+
+/*
+* Error recovery.
+*/
+
+static int _sdmmc_storage_retune(sdmmc_storage_t *storage)
+{
+	//HS400 can only be tuned in HS200, it steps down instead.
+	u32 cmd;
+	switch (storage->bus_type)
+	{
+	case 3:
+	case 14:
+		cmd = MMC_SEND_TUNING_BLOCK_HS200;
+		break;
+	case 10:
+	case 11:
+		cmd = MMC_SEND_TUNING_BLOCK;
+		break;
+	default:
+		return 0;
+	}
+
+	if (!sdmmc_config_tuning(storage->sdmmc, storage->bus_type, cmd))
+		return 0;
+	_sdmmc_storage_save_tap(storage, storage->bus_type);
+	return 1;
+}
+
+static int _sdmmc_storage_step_down(sdmmc_storage_t *storage)
+{
+	int res = 0;
+	u8 *buf;
+
+	//HS400 -> HS200 -> HS52 for MMC, SDR104 -> SDR50 for SD.
+	switch (storage->bus_type)
+	{
+	case 4:
+		res = _mmc_storage_disable_HS400(storage);
+		break;
+	case 3:
+		//The card only answers at the HS clock once it switched, check it after lowering ours.
+		res = _mmc_storage_enable_HS(storage, 0);
+		break;
+	case 11:
+		buf = (u8 *)malloc(512);
+		res = _sd_storage_enable_highspeed_low_volt(storage, 10, buf);
+		free(buf);
+		break;
+	}
+
+	DPRINTF("[sdmmc] stepped down to %d (%d)\n", storage->bus_type, res);
+	return res;
+}
+
 /*
 * Gamecard specific functions.
 */
@@ -1096,6 +1661,8 @@ int _gc_storage_custom_cmd(sdmmc_storage_t *storage, void *buf)
 	reqbuf.is_write = 1;
 	reqbuf.is_multi_block = 0;
 	reqbuf.is_auto_cmd12 = 0;
+	reqbuf.iov = NULL;
+	reqbuf.num_iov = 0;
 
 	if (!sdmmc_execute_cmd(storage->sdmmc, &cmdbuf, &reqbuf, 0))
 	{
@@ -1117,6 +1684,7 @@ int sdmmc_storage_init_gc(sdmmc_storage_t *storage, sdmmc_t *sdmmc)
 
 	if (!sdmmc_init(sdmmc, SDMMC_2, SDMMC_POWER_1_8, SDMMC_BUS_WIDTH_8, 14, 0))
 		return 0;
+	storage->bus_type = 14;
 	DPRINTF("[gc] after init\n");
 
 	sleep(1000 + (10000 + sdmmc->divisor - 1) / sdmmc->divisor);
@@ -58,6 +58,8 @@ typedef struct _mmc_ext_csd
 	u8  ext_struct;   /* 194 */
 	u8  card_type;    /* 196 */
 	u8  bkops_status; /* 246 */
+	u8  cmdq_depth;   /* 307 */
+	u8  cmdq_support; /* 308 */
 	u16 dev_version;
 	u8  boot_mult;
 	u8  rpmb_mult;
@@ -79,6 +81,17 @@ typedef struct _sd_ssr {
 	u8 app_class;
 } sd_ssr_t;
 
+/*! SDMMC transfer recovery counters. */
+typedef struct _sdmmc_err_stats_t
+{
+	u32 errors[SDMMC_ERR_MAX]; //Failed transfers per error class.
+	u32 retunes;
+	u32 step_downs;
+	u32 splits;
+	u32 failed;     //Transfers given up on.
+	u32 bad_sector; //Last sector that failed on its own, 0 if none.
+} sdmmc_err_stats_t;
+
 /*! SDMMC storage context. */
 typedef struct _sdmmc_storage_t
 {
@@ -97,14 +110,63 @@ typedef struct _sdmmc_storage_t
 	mmc_ext_csd_t ext_csd;
 	sd_scr_t      scr;
 	sd_ssr_t      ssr;
+	u32 bus_type; //Current bus speed, as passed to sdmmc_setup_clock().
+	sdmmc_err_stats_t err_stats;
 } sdmmc_storage_t;
 
+/*! One read of a command queue batch, see sdmmc_storage_read_queued(). */
+typedef struct _sdmmc_qio_t
+{
+	u32 sector;
+	u32 num_sectors;
+	void *buf;
+} sdmmc_qio_t;
+
+/*! Steps of a storage bring-up. */
+#define SDMMC_INIT_STEP_POWER   1
+#define SDMMC_INIT_STEP_IDLE    2
+#define SDMMC_INIT_STEP_OP_COND 3
+#define SDMMC_INIT_STEP_SETUP   4
+#define SDMMC_INIT_STEP_END     5
+
+/*! Results of sdmmc_storage_init_poll(). */
+#define SDMMC_INIT_FAILED 0
+#define SDMMC_INIT_DONE   1
+#define SDMMC_INIT_BUSY   2
+
+/*! Resumable storage bring-up, the card needs time between some of the steps. */
+typedef struct _sdmmc_init_t
+{
+	sdmmc_storage_t *storage;
+	u32 id;
+	u32 bus_width;
+	u32 type;
+	int is_sd;
+	int is_version_1;
+	u32 step;
+	u32 wake;     //Nothing to do before get_tmr() reaches this.
+	u32 deadline; //Give up on the card powering up after this.
+	int res;
+} sdmmc_init_t;
+
 int sdmmc_storage_end(sdmmc_storage_t *storage);
 int sdmmc_storage_read(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf);
 int sdmmc_storage_write(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, void *buf);
+int sdmmc_storage_readv(sdmmc_storage_t *storage, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov);
+int sdmmc_storage_writev(sdmmc_storage_t *storage, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov);
+void sdmmc_storage_init_mmc_start(sdmmc_init_t *init, sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type);
 int sdmmc_storage_init_mmc(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type);
 int sdmmc_storage_set_mmc_partition(sdmmc_storage_t *storage, u32 partition);
+int sdmmc_storage_read_queued(sdmmc_storage_t *storage, const sdmmc_qio_t *ios, u32 num_ios);
+void sdmmc_storage_init_sd_start(sdmmc_init_t *init, sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type);
 int sdmmc_storage_init_sd(sdmmc_storage_t *storage, sdmmc_t *sdmmc, u32 id, u32 bus_width, u32 type);
+int sdmmc_storage_init_poll(sdmmc_init_t *init);
+int sdmmc_storage_init_wait(sdmmc_init_t *init);
 int sdmmc_storage_init_gc(sdmmc_storage_t *storage, sdmmc_t *sdmmc);
 
+#ifdef SDMMC_FAULT_INJECT
+/*! Provided by the test build, returns errintsts bits to fail a transfer with or 0 to let it through. */
+u32 sdmmc_fault_inject(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, u32 is_write);
+#endif
+
 #endif
@@ -25,6 +25,8 @@
 #include "pmc.h"
 #include "pinmux.h"
 #include "gpio.h"
+#include "heap.h"
+#include "sched.h"
 
 /*#include "gfx.h"
 extern gfx_ctxt_t gfx_ctxt;
@@ -32,14 +34,6 @@ extern gfx_con_t gfx_con;
 #define DPRINTF(...) gfx_printf(&gfx_con, __VA_ARGS__)*/
 #define DPRINTF(...)
 
-/*! SCMMC controller base addresses. */
-static const u32 _sdmmc_bases[4] = {
-	0x700B0000,
-	0x700B0200,
-	0x700B0400,
-	0x700B0600,
-};
-
 int sdmmc_get_voltage(sdmmc_t *sdmmc)
 {
 	u32 p = sdmmc->regs->pwrcon;
@@ -143,7 +137,7 @@ static void _sdmmc_pad_config_fallback(sdmmc_t *sdmmc, u32 power)
 {
 	_sdmmc_get_clkcon(sdmmc);
 	if (sdmmc->id == SDMMC_4)
-		*(vu32 *)0x70000AB4 = ((*(vu32 *)0x70000AB4) & 0x3FFC) | 0x1040;
+		APB_MISC(APB_MISC_GP_EMMC4_PAD_CFGPADCTRL) = (APB_MISC(APB_MISC_GP_EMMC4_PAD_CFGPADCTRL) & 0x3FFC) | 0x1040;
 	//TODO: load standard values for other controllers, can depend on power.
 }
 
@@ -388,6 +382,7 @@ static int _sdmmc_wait_prnsts_type0(sdmmc_t *sdmmc, u32 wait_dat)
 	while(sdmmc->regs->prnsts & 1) //CMD inhibit.
 		if (get_tmr() > timeout)
 		{
+			sdmmc->errintsts |= SDMMC_ERRINTSTS_SW_TIMEOUT;
 			_sdmmc_reset(sdmmc);
 			return 0;
 		}
@@ -398,6 +393,7 @@ static int _sdmmc_wait_prnsts_type0(sdmmc_t *sdmmc, u32 wait_dat)
 		while (sdmmc->regs->prnsts & 2) //DAT inhibit.
 			if (get_tmr() > timeout)
 			{
+				sdmmc->errintsts |= SDMMC_ERRINTSTS_SW_TIMEOUT;
 				_sdmmc_reset(sdmmc);
 				return 0;
 			}
@@ -414,6 +410,7 @@ static int _sdmmc_wait_prnsts_type1(sdmmc_t *sdmmc)
 	while (!(sdmmc->regs->prnsts & 0x100000)) //DAT0 line level.
 		if (get_tmr() > timeout)
 		{
+			sdmmc->errintsts |= SDMMC_ERRINTSTS_SW_TIMEOUT;
 			_sdmmc_reset(sdmmc);
 			return 0;
 		}
@@ -567,6 +564,29 @@ int sdmmc_config_tuning(sdmmc_t *sdmmc, u32 type, u32 cmd)
 	return 0;
 }
 
+void sdmmc_set_tap(sdmmc_t *sdmmc, u32 tap)
+{
+	//Changing the tap with the SD clock running can glitch the lines, stop it and reset them afterwards.
+	int should_enable_sd_clock = 0;
+	if (sdmmc->regs->clkcon & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE)
+	{
+		should_enable_sd_clock = 1;
+		sdmmc->regs->clkcon &= ~TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE;
+	}
+
+	sdmmc->regs->venclkctl = sdmmc->regs->venclkctl & 0xFF00FFFF | (tap << 16);
+	sdmmc->venclkctl_tap = tap;
+	sdmmc->venclkctl_set = 1;
+
+	if (should_enable_sd_clock)
+	{
+		sleep(1);
+		_sdmmc_reset(sdmmc);
+		sdmmc->regs->clkcon |= TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE;
+		_sdmmc_get_clkcon(sdmmc);
+	}
+}
+
 static int _sdmmc_enable_internal_clock(sdmmc_t *sdmmc)
 {
 	//Enable internal clock and wait till it is stable.
@@ -669,14 +689,14 @@ static void _sdmmc_autocal_execute(sdmmc_t *sdmmc, u32 power)
 static void _sdmmc_enable_interrupts(sdmmc_t *sdmmc)
 {
 	sdmmc->regs->norintstsen |= 0xB;
-	sdmmc->regs->errintstsen |= 0x17F;
+	sdmmc->regs->errintstsen |= 0x17F | TEGRA_MMC_ERRINTSTS_ADMA_ERROR;
 	sdmmc->regs->norintsts = sdmmc->regs->norintsts;
 	sdmmc->regs->errintsts = sdmmc->regs->errintsts;
 }
 
 static void _sdmmc_mask_interrupts(sdmmc_t *sdmmc)
 {
-	sdmmc->regs->errintstsen &= 0xFE80;
+	sdmmc->regs->errintstsen &= 0xFE80 & ~TEGRA_MMC_ERRINTSTS_ADMA_ERROR;
 	sdmmc->regs->norintstsen &= 0xFFF4;
 }
 
@@ -693,6 +713,7 @@ static int _sdmmc_check_mask_interrupt(sdmmc_t *sdmmc, u16 *pout, u16 mask)
 	//Check for error interrupt.
 	if (norintsts & TEGRA_MMC_NORINTSTS_ERR_INTERRUPT)
 	{
+		sdmmc->errintsts |= errintsts;
 		sdmmc->regs->errintsts = errintsts;
 		return SDMMC_MASKINT_ERROR;
 	}
@@ -717,6 +738,8 @@ static int _sdmmc_wait_request(sdmmc_t *sdmmc)
 			break;
 		if (res != SDMMC_MASKINT_NOERROR || get_tmr() > timeout)
 		{
+			if (res == SDMMC_MASKINT_NOERROR)
+				sdmmc->errintsts |= SDMMC_ERRINTSTS_SW_TIMEOUT;
 			_sdmmc_reset(sdmmc);
 			return 0;
 		}
@@ -775,20 +798,53 @@ static int _sdmmc_config_dma(sdmmc_t *sdmmc, u32 *blkcnt_out, sdmmc_req_t *req)
 	if (!req->blksize || !req->num_sectors)
 		return 0;
 
-	u32 blkcnt = req->num_sectors;
-	if (blkcnt >= 0xFFFF)
-		blkcnt = 0xFFFF;
-	u32 admaaddr = (u32)req->buf;
+	if (!sdmmc->adma_desc)
+		sdmmc->adma_desc = (sdmmc_adma_desc_t *)malloc(SDMMC_ADMA_MAX_DESCS * sizeof(sdmmc_adma_desc_t));
+	if (!sdmmc->adma_desc)
+		return 0;
 
-	//Check alignment.
-	if (admaaddr << 29)
+	sdmmc_iovec_t single;
+	single.buf = req->buf;
+	single.num_sectors = req->num_sectors;
+	const sdmmc_iovec_t *iov = req->iov ? req->iov : &single;
+	u32 num_iov = req->iov ? req->num_iov : 1;
+
+	//Build a descriptor chain covering the whole transfer, we stop early if we run out of descriptors.
+	u32 size_left = MIN(req->num_sectors, 0xFFFF) * req->blksize;
+	u32 num_descs = 0;
+	for (u32 i = 0; i < num_iov && size_left && num_descs < SDMMC_ADMA_MAX_DESCS; i++)
+	{
+		u32 addr = (u32)iov[i].buf;
+		u32 size = MIN(iov[i].num_sectors * req->blksize, size_left);
+
+		//Check alignment.
+		if (size && (addr & 7))
+			return 0;
+
+		while (size && num_descs < SDMMC_ADMA_MAX_DESCS)
+		{
+			u32 len = MIN(size, SDMMC_ADMA_MAX_LEN);
+			sdmmc_adma_desc_t *desc = &sdmmc->adma_desc[num_descs++];
+			desc->attr = TEGRA_MMC_ADMA_VALID | TEGRA_MMC_ADMA_ACT_TRAN;
+			desc->len = len & 0xFFFF;
+			desc->addr_lo = addr;
+			desc->addr_hi = 0;
+			desc->res = 0;
+			addr += len;
+			size -= len;
+			size_left -= len;
+		}
+	}
+
+	u32 blkcnt = MIN(req->num_sectors, 0xFFFF) - size_left / req->blksize;
+	if (!blkcnt)
 		return 0;
+	sdmmc->adma_desc[num_descs - 1].attr |= TEGRA_MMC_ADMA_END;
 
-	sdmmc->regs->admaaddr = admaaddr;
+	sdmmc->regs->hostctl = (sdmmc->regs->hostctl & ~TEGRA_MMC_HOSTCTL_DMASEL_MASK) | TEGRA_MMC_HOSTCTL_DMASEL_ADMA2;
+	sdmmc->regs->admaaddr = (u32)sdmmc->adma_desc;
 	sdmmc->regs->admaaddr_hi = 0;
 
-	sdmmc->dma_addr_next = (admaaddr + 0x80000) & 0xFFF80000;
-
 	sdmmc->regs->blksize = req->blksize | 0x7000;
 	sdmmc->regs->blkcnt = blkcnt;
 
@@ -819,24 +875,13 @@ static int _sdmmc_update_dma(sdmmc_t *sdmmc)
 		u32 timeout = get_tmr() + 1500000;
 		do
 		{
-			int res = 0;
-			while (1)
-			{
-				u16 intr = 0;
-				res = _sdmmc_check_mask_interrupt(sdmmc, &intr, 
-					TEGRA_MMC_NORINTSTS_XFER_COMPLETE | TEGRA_MMC_NORINTSTS_DMA_INTERRUPT);
-				if (res < 0)
-					break;
-				if (intr & TEGRA_MMC_NORINTSTS_XFER_COMPLETE)
-					return 1; //Transfer complete.
-				if (intr & TEGRA_MMC_NORINTSTS_DMA_INTERRUPT)
-				{
-					//Update DMA.
-					sdmmc->regs->admaaddr = sdmmc->dma_addr_next;
-					sdmmc->regs->admaaddr_hi = 0;
-					sdmmc->dma_addr_next += 0x80000;
-				}
-			}
+			//The descriptor chain covers the whole transfer, we only wait for it to complete.
+			//Yield first so the status is always checked once more after other tasks ran.
+			sched_yield();
+			u16 intr = 0;
+			int res = _sdmmc_check_mask_interrupt(sdmmc, &intr, TEGRA_MMC_NORINTSTS_XFER_COMPLETE);
+			if (res == SDMMC_MASKINT_MASKED)
+				return 1; //Transfer complete.
 			if (res != SDMMC_MASKINT_NOERROR)
 			{
 				_sdmmc_reset(sdmmc);
@@ -845,6 +890,7 @@ static int _sdmmc_update_dma(sdmmc_t *sdmmc)
 		} while (get_tmr() < timeout);
 	} while (sdmmc->regs->blkcnt != blkcnt);
 
+	sdmmc->errintsts |= SDMMC_ERRINTSTS_SW_TIMEOUT;
 	_sdmmc_reset(sdmmc);
 	return 0;
 }
@@ -859,7 +905,8 @@ static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_
 	int is_data_present = 0;
 	if (req)
 	{
-		_sdmmc_config_dma(sdmmc, &blkcnt, req);
+		if (!_sdmmc_config_dma(sdmmc, &blkcnt, req))
+			return 0;
 		_sdmmc_enable_interrupts(sdmmc);
 		is_data_present = 1;
 	}
@@ -882,7 +929,7 @@ static int _sdmmc_execute_cmd_inner(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_
 			_sdmmc_cache_rsp(sdmmc, sdmmc->rsp, 0x10, cmd->rsp_type);
 		}
 		if (req)
-			_sdmmc_update_dma(sdmmc);
+			res = _sdmmc_update_dma(sdmmc);
 	}
 
 	_sdmmc_mask_interrupts(sdmmc);
@@ -971,7 +1018,7 @@ int sdmmc_init(sdmmc_t *sdmmc, u32 id, u32 power, u32 bus_width, u32 type, int n
 
 	memset(sdmmc, 0, sizeof(sdmmc_t));
 
-	sdmmc->regs = (t210_sdmmc_t *)_sdmmc_bases[id];
+	sdmmc->regs = (t210_sdmmc_t *)(SDMMC_BASE + SDMMC_SIZE * id);
 	sdmmc->id = id;
 	sdmmc->clock_stopped = 1;
 
@@ -1023,6 +1070,12 @@ void sdmmc_end(sdmmc_t *sdmmc)
 		clock_sdmmc_disable(sdmmc->id);
 		sdmmc->clock_stopped = 1;
 	}
+
+	if (sdmmc->adma_desc)
+	{
+		free(sdmmc->adma_desc);
+		sdmmc->adma_desc = NULL;
+	}
 }
 
 void sdmmc_init_cmd(sdmmc_cmd_t *cmdbuf, u16 cmd, u32 arg, u32 rsp_type, u32 check_busy)
@@ -1051,6 +1104,7 @@ int sdmmc_execute_cmd(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *b
 		sleep((8000 + sdmmc->divisor - 1) / sdmmc->divisor);
 	}
 
+	sdmmc->errintsts = 0;
 	int res = _sdmmc_execute_cmd_inner(sdmmc, cmd, req, blkcnt_out);
 	sleep((8000 + sdmmc->divisor - 1) / sdmmc->divisor);
 	if (should_disable_sd_clock)
@@ -1059,6 +1113,23 @@ int sdmmc_execute_cmd(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *b
 	return res;
 }
 
+u32 sdmmc_get_error(sdmmc_t *sdmmc)
+{
+	u32 err = sdmmc->errintsts;
+
+	if (!err)
+		return SDMMC_ERR_OTHER; //Failed without the controller flagging anything (setup, card status).
+	if (err & TEGRA_MMC_ERRINTSTS_ADMA_ERROR)
+		return SDMMC_ERR_DMA;
+	if (err & (TEGRA_MMC_ERRINTSTS_CMD_CRC | TEGRA_MMC_ERRINTSTS_DATA_CRC | TEGRA_MMC_ERRINTSTS_TUNING))
+		return SDMMC_ERR_CRC;
+	if (err & (TEGRA_MMC_ERRINTSTS_CMD_END_BIT | TEGRA_MMC_ERRINTSTS_DATA_END_BIT))
+		return SDMMC_ERR_END_BIT;
+	if (err & (TEGRA_MMC_ERRINTSTS_CMD_TIMEOUT | TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT | SDMMC_ERRINTSTS_SW_TIMEOUT))
+		return SDMMC_ERR_TIMEOUT;
+	return SDMMC_ERR_OTHER;
+}
+
 int sdmmc_enable_low_voltage(sdmmc_t *sdmmc)
 {
 	if(sdmmc->id != SDMMC_1)
@@ -49,6 +49,18 @@
 #define SDMMC_MASKINT_NOERROR -1
 #define SDMMC_MASKINT_ERROR   -2
 
+/*! SDMMC error classes, see sdmmc_get_error(). */
+#define SDMMC_ERR_NONE    0
+#define SDMMC_ERR_TIMEOUT 1
+#define SDMMC_ERR_CRC     2
+#define SDMMC_ERR_END_BIT 3
+#define SDMMC_ERR_DMA     4
+#define SDMMC_ERR_OTHER   5
+#define SDMMC_ERR_MAX     6
+
+/*! Not a register bit, set in errintsts when the driver gave up waiting on the controller. */
+#define SDMMC_ERRINTSTS_SW_TIMEOUT 0x10000
+
 /*! SDMMC host control 2 */
 #define SDHCI_CTRL_UHS_MASK			0xFFF8
 #define SDHCI_CTRL_VDD_330			0xFFF7
@@ -71,6 +83,20 @@
 /*! Helper for SWITCH command argument. */
 #define SDMMC_SWITCH(mode, index, value) (((mode) << 24) | ((index) << 16) | ((value) << 8))
 
+/*! ADMA2 descriptors per request and bytes per descriptor (a length of 0 encodes 64KB). */
+#define SDMMC_ADMA_MAX_DESCS 512
+#define SDMMC_ADMA_MAX_LEN 0x10000
+
+/*! ADMA2 descriptor, 128-bit as host version 4 mode with 64-bit addressing is used. */
+typedef struct _sdmmc_adma_desc_t
+{
+	u16 attr;
+	u16 len;
+	u32 addr_lo;
+	u32 addr_hi;
+	u32 res;
+} sdmmc_adma_desc_t;
+
 /*! SDMMC controller context. */
 typedef struct _sdmmc_t
 {
@@ -83,9 +109,10 @@ typedef struct _sdmmc_t
 	int venclkctl_set;
 	u32 venclkctl_tap;
 	u32 expected_rsp_type;
-	u32 dma_addr_next;
+	sdmmc_adma_desc_t *adma_desc;
 	u32 rsp[4];
 	u32 rsp3;
+	u32 errintsts; //Error interrupt status collected since the last command was issued.
 } sdmmc_t;
 
 /*! SDMMC command. */
@@ -97,7 +124,14 @@ typedef struct _sdmmc_cmd_t
 	u32 check_busy;
 } sdmmc_cmd_t;
 
-/*! SDMMC request. */
+/*! SDMMC scatter-gather buffer, buffers need to be 8-byte aligned. */
+typedef struct _sdmmc_iovec_t
+{
+	void *buf;
+	u32 num_sectors;
+} sdmmc_iovec_t;
+
+/*! SDMMC request, buf is ignored if iov is set. */
 typedef struct _sdmmc_req_t
 {
 	void *buf;
@@ -106,6 +140,8 @@ typedef struct _sdmmc_req_t
 	int is_write;
 	int is_multi_block;
 	int is_auto_cmd12;
+	const sdmmc_iovec_t *iov;
+	u32 num_iov;
 } sdmmc_req_t;
 
 int sdmmc_get_voltage(sdmmc_t *sdmmc);
@@ -116,11 +152,13 @@ int sdmmc_setup_clock(sdmmc_t *sdmmc, u32 type);
 void sdmmc_sd_clock_ctrl(sdmmc_t *sdmmc, int no_sd);
 int sdmmc_get_rsp(sdmmc_t *sdmmc, u32 *rsp, u32 size, u32 type);
 int sdmmc_config_tuning(sdmmc_t *sdmmc, u32 type, u32 cmd);
+void sdmmc_set_tap(sdmmc_t *sdmmc, u32 tap);
 int sdmmc_stop_transmission(sdmmc_t *sdmmc, u32 *rsp);
 int sdmmc_init(sdmmc_t *sdmmc, u32 id, u32 power, u32 bus_width, u32 type, int no_sd);
 void sdmmc_end(sdmmc_t *sdmmc);
 void sdmmc_init_cmd(sdmmc_cmd_t *cmdbuf, u16 cmd, u32 arg, u32 rsp_type, u32 check_busy);
 int sdmmc_execute_cmd(sdmmc_t *sdmmc, sdmmc_cmd_t *cmd, sdmmc_req_t *req, u32 *blkcnt_out);
+u32 sdmmc_get_error(sdmmc_t *sdmmc);
 int sdmmc_enable_low_voltage(sdmmc_t *sdmmc);
 
 #endif
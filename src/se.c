@@ -19,20 +19,46 @@
 #include "heap.h"
 #include "t210.h"
 #include "se_t210.h"
+#include "sched.h"
 
-typedef struct _se_ll_t
+//Maximum number of source fragments gathered by a single operation.
+#define SE_LL_MAX_ENTRIES 16
+
+typedef struct _se_ll_ent_t
 {
-	vu32 num;
 	vu32 addr;
 	vu32 size;
+} se_ll_ent_t;
+
+typedef struct _se_ll_t
+{
+	vu32 num;
+	se_ll_ent_t ent[SE_LL_MAX_ENTRIES];
 } se_ll_t;
 
+//Tweaks for this many bytes worth of sectors are generated per XTS batch.
+#define SE_XTS_BATCH_SIZE 0x4000
+
+//Linked lists and bounce blocks used by every operation, the SE only runs one at a time.
+static se_ll_t _se_ll_src, _se_ll_dst;
+static u32 _se_block[4];
+static u32 _se_stitch[4];
+//Set while an operation started by se_aes_crypt_ctr_start() is running.
+static bool _se_busy;
+//Result of that operation once someone waited for it.
+static int _se_async_res = 1;
+//Held by the task using the engine, all of the above is only touched with it held.
+static bool _se_locked;
+//Allocated on first use and kept, XTS is the only user.
+static u8 *_se_xts_tweaks;
+
 static void _gf256_mul_x(void *block)
 {
 	u8 *pdata = (u8 *)block;
 	u32 carry = 0;
 
-	for (u32 i = 0xF; i >= 0; i--)
+	//XTS tweaks are little endian, byte 0 holds the lowest bits.
+	for (u32 i = 0; i < 0x10; i++)
 	{
 		u8 b = pdata[i];
 		pdata[i] = (b << 1) | carry;
@@ -40,14 +66,34 @@ static void _gf256_mul_x(void *block)
 	}
 
 	if (carry)
-		pdata[0xF] ^= 0x87;
+		pdata[0] ^= 0x87;
+}
+
+static void _se_xor(void *dst, const void *src1, const void *src2, u32 size)
+{
+	if (!(((u32)dst | (u32)src1 | (u32)src2 | size) & 3))
+	{
+		u32 *pdst = (u32 *)dst;
+		const u32 *psrc1 = (const u32 *)src1;
+		const u32 *psrc2 = (const u32 *)src2;
+		for (u32 i = 0; i < size / 4; i++)
+			pdst[i] = psrc1[i] ^ psrc2[i];
+	}
+	else
+	{
+		u8 *pdst = (u8 *)dst;
+		const u8 *psrc1 = (const u8 *)src1;
+		const u8 *psrc2 = (const u8 *)src2;
+		for (u32 i = 0; i < size; i++)
+			pdst[i] = psrc1[i] ^ psrc2[i];
+	}
 }
 
 static void _se_ll_init(se_ll_t *ll, u32 addr, u32 size)
 {
 	ll->num = 0;
-	ll->addr = addr;
-	ll->size = size;
+	ll->ent[0].addr = addr;
+	ll->ent[0].size = size;
 }
 
 static void _se_ll_set(se_ll_t *dst, se_ll_t *src)
@@ -59,7 +105,7 @@ static void _se_ll_set(se_ll_t *dst, se_ll_t *src)
 static int _se_wait()
 {
 	while (!(SE(SE_INT_STATUS_REG_OFFSET) & SE_INT_OP_DONE(INT_SET)))
-		;
+		sched_yield();
 	if (SE(SE_INT_STATUS_REG_OFFSET) & SE_INT_ERROR(INT_SET) ||
 		SE(SE_STATUS_0) & 3 ||
 		SE(SE_ERR_STATUS_0) != 0)
@@ -67,41 +113,64 @@ static int _se_wait()
 	return 1;
 }
 
-static int _se_execute(u32 op, void *dst, u32 dst_size, const void *src, u32 src_size)
+static void _se_lock()
 {
-	se_ll_t *ll_dst = NULL, *ll_src = NULL;
+	//Tasks only switch in sched_yield(), so the check and set can't be interleaved.
+	while (_se_locked)
+		sched_yield();
+	_se_locked = true;
 
-	if (dst)
+	//Registers can't be touched before an operation left running by se_aes_crypt_ctr_start() is done.
+	if (_se_busy)
 	{
-		ll_dst = (se_ll_t *)malloc(sizeof(se_ll_t));
-		_se_ll_init(ll_dst, (u32)dst, dst_size);
+		_se_busy = false;
+		if (!_se_wait())
+			_se_async_res = 0;
 	}
+}
 
-	if (src)
-	{
-		ll_src = (se_ll_t *)malloc(sizeof(se_ll_t));
-		_se_ll_init(ll_src, (u32)src, src_size);
-	}
+static void _se_unlock()
+{
+	_se_locked = false;
+}
 
+static void _se_start_ll(u32 op, se_ll_t *ll_dst, se_ll_t *ll_src)
+{
 	_se_ll_set(ll_dst, ll_src);
 
 	SE(SE_ERR_STATUS_0) = SE(SE_ERR_STATUS_0);
 	SE(SE_INT_STATUS_REG_OFFSET) = SE(SE_INT_STATUS_REG_OFFSET);
 	SE(SE_OPERATION_REG_OFFSET) = SE_OPERATION(op);
+}
 
-	int res = _se_wait();
+static int _se_execute_ll(u32 op, se_ll_t *ll_dst, se_ll_t *ll_src)
+{
+	_se_start_ll(op, ll_dst, ll_src);
+	return _se_wait();
+}
+
+static int _se_execute(u32 op, void *dst, u32 dst_size, const void *src, u32 src_size)
+{
+	se_ll_t *ll_dst = NULL, *ll_src = NULL;
 
-	if (src)
-		free(ll_src);
 	if (dst)
-		free(ll_dst);
+	{
+		ll_dst = &_se_ll_dst;
+		_se_ll_init(ll_dst, (u32)dst, dst_size);
+	}
 
-	return res;
+	if (src)
+	{
+		ll_src = &_se_ll_src;
+		_se_ll_init(ll_src, (u32)src, src_size);
+	}
+
+	return _se_execute_ll(op, ll_dst, ll_src);
 }
 
 static int _se_execute_one_block(u32 op, void *dst, u32 dst_size, const void *src, u32 src_size)
 {
-	u8 *block = (u8 *)malloc(0x10);
+	u8 *block = (u8 *)_se_block;
 	memset(block, 0, 0x10);
 
 	SE(SE_BLOCK_COUNT_REG_OFFSET) = 0;
@@ -109,11 +178,24 @@ static int _se_execute_one_block(u32 op, void *dst, u32 dst_size, const void *sr
 	memcpy(block, src, src_size);
 	int res = _se_execute(op, block, 0x10, block, 0x10);
 	memcpy(dst, block, dst_size);
-	
-	free(block);
+
 	return res;
 }
 
+static u32 _se_ecb_config(u32 enc)
+{
+	if (enc)
+		return SE_CONFIG_ENC_ALG(ALG_AES_ENC) | SE_CONFIG_DST(DST_MEMORY);
+	return SE_CONFIG_DEC_ALG(ALG_AES_DEC) | SE_CONFIG_DST(DST_MEMORY);
+}
+
+static u32 _se_ecb_crypto(u32 ks, u32 enc)
+{
+	//The field macros don't parenthesize their argument.
+	u32 core = enc ? CORE_ENCRYPT : CORE_DECRYPT;
+	return SE_CRYPTO_KEY_INDEX(ks) | SE_CRYPTO_CORE_SEL(core);
+}
+
 static void _se_aes_ctr_set(void *ctr)
 {
 	u32 *data = (u32 *)ctr;
@@ -121,23 +203,41 @@ static void _se_aes_ctr_set(void *ctr)
 		SE(SE_CRYPTO_CTR_REG_OFFSET + 4 * i) = data[i];
 }
 
+static void _se_aes_ctr_set_offset(const void *ctr, u32 blocks)
+{
+	//Big endian 128-bit add of the block offset.
+	u8 tmp[0x10];
+	memcpy(tmp, ctr, 0x10);
+	for (int i = 0xF; i >= 0 && blocks; i--)
+	{
+		blocks += tmp[i];
+		tmp[i] = blocks & 0xFF;
+		blocks >>= 8;
+	}
+	_se_aes_ctr_set(tmp);
+}
+
 void se_rsa_acc_ctrl(u32 rs, u32 flags)
 {
+	_se_lock();
 	if (flags & 0x7F)
 		SE(SE_RSA_KEYTABLE_ACCESS_REG_OFFSET + 4 * rs) = ((flags >> 4) & 4 | flags & 3) ^ 7;
 	if (flags & 0x80)
 		SE(SE_RSA_KEYTABLE_ACCESS_LOCK_OFFSET) &= ~(1 << rs);
+	_se_unlock();
 }
 
 void se_key_acc_ctrl(u32 ks, u32 flags)
 {
+	_se_lock();
 	if (flags & 0x7F)
 		SE(SE_KEY_TABLE_ACCESS_REG_OFFSET + 4 * ks) = ~flags;
 	if (flags & 0x80)
 		SE(SE_KEY_TABLE_ACCESS_LOCK_OFFSET) &= ~(1 << ks);
+	_se_unlock();
 }
 
-void se_aes_key_set(u32 ks, void *key, u32 size)
+static void _se_aes_key_set(u32 ks, void *key, u32 size)
 {
 	u32 *data = (u32 *)key;
 	for (u32 i = 0; i < size / 4; i++)
@@ -147,7 +247,14 @@ void se_aes_key_set(u32 ks, void *key, u32 size)
 	}
 }
 
-void se_aes_key_clear(u32 ks)
+void se_aes_key_set(u32 ks, void *key, u32 size)
+{
+	_se_lock();
+	_se_aes_key_set(ks, key, size);
+	_se_unlock();
+}
+
+static void _se_aes_key_clear(u32 ks)
 {
 	for (u32 i = 0; i < TEGRA_SE_AES_MAX_KEY_SIZE / 4; i++)
 	{
@@ -156,31 +263,112 @@ void se_aes_key_clear(u32 ks)
 	}
 }
 
+void se_aes_key_clear(u32 ks)
+{
+	_se_lock();
+	_se_aes_key_clear(ks);
+	_se_unlock();
+}
+
 int se_aes_unwrap_key(u32 ks_dst, u32 ks_src, const void *input)
 {
+	_se_lock();
 	SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_DEC_ALG(ALG_AES_DEC) | SE_CONFIG_DST(DST_KEYTAB);
-	SE(SE_CRYPTO_REG_OFFSET) = SE_CRYPTO_KEY_INDEX(ks_src) | SE_CRYPTO_CORE_SEL(CORE_DECRYPT);
+	SE(SE_CRYPTO_REG_OFFSET) = _se_ecb_crypto(ks_src, 0);
 	SE(SE_CRYPTO_KEYTABLE_DST_REG_OFFSET) = SE_CRYPTO_KEYTABLE_DST_KEY_INDEX(ks_dst);
-	return _se_execute(OP_START, NULL, 0, input, 0x10);
+	int res = _se_execute(OP_START, NULL, 0, input, 0x10);
+	_se_unlock();
+	return res;
+}
+
+static int _se_aes_crypt_ecb(u32 ks, u32 enc, void *dst, u32 dst_size, const void *src, u32 src_size)
+{
+	SE(SE_CONFIG_REG_OFFSET) = _se_ecb_config(enc);
+	SE(SE_CRYPTO_REG_OFFSET) = _se_ecb_crypto(ks, enc);
+	SE(SE_BLOCK_COUNT_REG_OFFSET) = (src_size >> 4) - 1;
+	return _se_execute(OP_START, dst, dst_size, src, src_size);
+}
+
+int se_aes_crypt_ecb(u32 ks, u32 enc, void *dst, u32 dst_size, const void *src, u32 src_size)
+{
+	_se_lock();
+	int res = _se_aes_crypt_ecb(ks, enc, dst, dst_size, src, src_size);
+	_se_unlock();
+	return res;
 }
 
 int se_aes_crypt_block_ecb(u32 ks, u32 enc, void *dst, const void *src)
 {
-	if (enc)
-	{
-		SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_ENC_ALG(ALG_AES_ENC) | SE_CONFIG_DST(DST_MEMORY);
-		SE(SE_CRYPTO_REG_OFFSET) = SE_CRYPTO_KEY_INDEX(ks) | SE_CRYPTO_CORE_SEL(CORE_ENCRYPT);
-	}
-	else
+	return se_aes_crypt_ecb(ks, enc, dst, 0x10, src, 0x10);
+}
+
+static int _se_run_ops(const se_op_t *ops, u32 num_ops)
+{
+	//Registers are only written when they differ from what the previous operation of the batch left.
+	u32 config = 0xFFFFFFFF;
+	u32 crypto = 0xFFFFFFFF;
+	u32 ks_dst = 0xFFFFFFFF;
+
+	SE(SE_BLOCK_COUNT_REG_OFFSET) = 0;
+
+	for (u32 i = 0; i < num_ops; i++)
 	{
-		SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_DEC_ALG(ALG_AES_DEC) | SE_CONFIG_DST(DST_MEMORY);
-		SE(SE_CRYPTO_REG_OFFSET) = SE_CRYPTO_KEY_INDEX(ks) | SE_CRYPTO_CORE_SEL(CORE_DECRYPT);
+		const se_op_t *op = &ops[i];
+		u32 op_config, op_crypto;
+
+		switch (op->op)
+		{
+		case SE_OP_KEY_SET:
+			_se_aes_key_set(op->ks, (void *)op->src, 0x10);
+			continue;
+		case SE_OP_KEY_CLEAR:
+			_se_aes_key_clear(op->ks);
+			continue;
+		case SE_OP_ECB_ENC:
+		case SE_OP_ECB_DEC:
+			op_config = _se_ecb_config(op->op == SE_OP_ECB_ENC);
+			op_crypto = _se_ecb_crypto(op->ks, op->op == SE_OP_ECB_ENC);
+			break;
+		case SE_OP_UNWRAP:
+			op_config = SE_CONFIG_DEC_ALG(ALG_AES_DEC) | SE_CONFIG_DST(DST_KEYTAB);
+			op_crypto = _se_ecb_crypto(op->ks, 0);
+			if (op->ks_dst != ks_dst)
+			{
+				SE(SE_CRYPTO_KEYTABLE_DST_REG_OFFSET) = SE_CRYPTO_KEYTABLE_DST_KEY_INDEX(op->ks_dst);
+				ks_dst = op->ks_dst;
+			}
+			break;
+		default:
+			return 0;
+		}
+
+		if (op_config != config)
+		{
+			SE(SE_CONFIG_REG_OFFSET) = op_config;
+			config = op_config;
+		}
+		if (op_crypto != crypto)
+		{
+			SE(SE_CRYPTO_REG_OFFSET) = op_crypto;
+			crypto = op_crypto;
+		}
+
+		if (!_se_execute(OP_START, op->dst, op->dst ? 0x10 : 0, op->src, 0x10))
+			return 0;
 	}
-	SE(SE_BLOCK_COUNT_REG_OFFSET) = 0;
-	return _se_execute(OP_START, dst, 0x10, src, 0x10);
+
+	return 1;
 }
 
-int se_aes_crypt_ctr(u32 ks, void *dst, u32 dst_size, const void *src, u32 src_size, void *ctr)
+int se_run_ops(const se_op_t *ops, u32 num_ops)
+{
+	_se_lock();
+	int res = _se_run_ops(ops, num_ops);
+	_se_unlock();
+	return res;
+}
+
+static int _se_aes_crypt_ctr(u32 ks, void *dst, u32 dst_size, const void *src, u32 src_size, void *ctr)
 {
 	SE(SE_SPARE_0_REG_OFFSET) = 1;
 	SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_ENC_ALG(ALG_AES_ENC) | SE_CONFIG_DST(DST_MEMORY);
@@ -206,51 +394,299 @@ int se_aes_crypt_ctr(u32 ks, void *dst, u32 dst_size, const void *src, u32 src_s
 	return 1;
 }
 
-int se_aes_xts_crypt_sec(u32 ks1, u32 ks2, u32 enc, u64 sec, void *dst, void *src, u32 secsize)
+int se_aes_crypt_ctr(u32 ks, void *dst, u32 dst_size, const void *src, u32 src_size, void *ctr)
 {
-	int res = 0;
-	u8 *tweak = (u8 *)malloc(0x10);
+	_se_lock();
+	int res = _se_aes_crypt_ctr(ks, dst, dst_size, src, src_size, ctr);
+	_se_unlock();
+	return res;
+}
+
+static int _se_calc_sha256(void *dst, const void *src, u32 src_size)
+{
+	SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_ENC_MODE(MODE_SHA256) | SE_CONFIG_ENC_ALG(ALG_SHA) | SE_CONFIG_DST(DST_HASHREG);
+	SE(SE_SHA_CONFIG_REG_OFFSET) = SHA_ENABLE;
+
+	//Message length and bits left are 128-bit values in bits, we only ever hash < 512MB.
+	for (u32 i = 0; i < 4; i++)
+	{
+		SE(SE_SHA_MSG_LENGTH_REG_OFFSET + 4 * i) = i ? 0 : src_size << 3;
+		SE(SE_SHA_MSG_LEFT_REG_OFFSET + 4 * i) = i ? 0 : src_size << 3;
+	}
+
+	if (!_se_execute(OP_START, NULL, 0, src, src_size))
+		return 0;
+
+	//The hash registers hold the digest words in big endian.
 	u8 *pdst = (u8 *)dst;
-	u8 *psrc = (u8 *)src;
+	for (u32 i = 0; i < 8; i++)
+	{
+		u32 val = SE(SE_HASH_RESULT_REG_OFFSET + 4 * i);
+		pdst[4 * i + 0] = (val >> 24) & 0xFF;
+		pdst[4 * i + 1] = (val >> 16) & 0xFF;
+		pdst[4 * i + 2] = (val >> 8) & 0xFF;
+		pdst[4 * i + 3] = val & 0xFF;
+	}
+
+	return 1;
+}
+
+int se_calc_sha256(void *dst, const void *src, u32 src_size)
+{
+	_se_lock();
+	int res = _se_calc_sha256(dst, src, src_size);
+	_se_unlock();
+	return res;
+}
+
+typedef struct _se_sg_ctxt_t
+{
+	const void *ctr;
+	u8 *dst;
+	u8 *run;
+	u8 *pdst;
+	u32 stitched;
+} se_sg_ctxt_t;
+
+static int _se_sg_flush(se_sg_ctxt_t *sg)
+{
+	if (sg->pdst == sg->run)
+		return 1;
+
+	//Everything gathered so far lands contiguously at run, its counter is offset by the blocks before it.
+	_se_ll_init(&_se_ll_dst, (u32)sg->run, sg->pdst - sg->run);
+	_se_aes_ctr_set_offset(sg->ctr, (sg->run - sg->dst) >> 4);
+	SE(SE_BLOCK_COUNT_REG_OFFSET) = ((sg->pdst - sg->run) >> 4) - 1;
+	int res = _se_execute_ll(OP_START, &_se_ll_dst, &_se_ll_src);
+
+	sg->run = sg->pdst;
+	_se_ll_src.num = 0;
+	return res;
+}
 
-	//Generate tweak.
-	for (int i = 0xF; i >= 0; i--)
+static int _se_sg_add(se_sg_ctxt_t *sg, const void *src, u32 size)
+{
+	//The DMA wants word aligned sources, anything else is copied over and processed in place.
+	if ((u32)src & 3)
 	{
-		tweak[i] = sec & 0xFF;
-		sec >>= 8;
+		memcpy(sg->pdst, src, size);
+		src = sg->pdst;
 	}
-	if (!se_aes_crypt_block_ecb(ks1, 1, tweak, tweak))
-		goto out;
 
-	//We are assuming a 0x10-aligned sector size in this implementation.
-	for (u32 i = 0; i < secsize / 0x10; i++)
+	u32 n = sg->pdst == sg->run ? 0 : _se_ll_src.num + 1;
+	_se_ll_src.num = n;
+	_se_ll_src.ent[n].addr = (u32)src;
+	_se_ll_src.ent[n].size = size;
+	sg->pdst += size;
+
+	if (n == SE_LL_MAX_ENTRIES - 1)
+		return _se_sg_flush(sg);
+	return 1;
+}
+
+static int _se_sg_stitch(se_sg_ctxt_t *sg, u32 size)
+{
+	//A block straddling two fragments is encrypted on its own at its counter offset.
+	if (!_se_sg_flush(sg))
+		return 0;
+
+	_se_aes_ctr_set_offset(sg->ctr, (sg->pdst - sg->dst) >> 4);
+	if (!_se_execute_one_block(OP_START, sg->pdst, size, _se_stitch, 0x10))
+		return 0;
+
+	sg->pdst += size;
+	sg->run = sg->pdst;
+	sg->stitched = 0;
+	return 1;
+}
+
+static int _se_aes_crypt_ctr_sg(u32 ks, void *dst, const se_frag_t *frags, u32 num_frags, const void *ctr)
+{
+	se_sg_ctxt_t sg;
+	sg.ctr = ctr;
+	sg.dst = (u8 *)dst;
+	sg.run = sg.dst;
+	sg.pdst = sg.dst;
+	sg.stitched = 0;
+
+	SE(SE_SPARE_0_REG_OFFSET) = 1;
+	SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_ENC_ALG(ALG_AES_ENC) | SE_CONFIG_DST(DST_MEMORY);
+	SE(SE_CRYPTO_REG_OFFSET) = SE_CRYPTO_KEY_INDEX(ks) | SE_CRYPTO_CORE_SEL(CORE_ENCRYPT) |
+		SE_CRYPTO_XOR_POS(XOR_BOTTOM) | SE_CRYPTO_INPUT_SEL(INPUT_LNR_CTR) | SE_CRYPTO_CTR_VAL(1);
+	_se_ll_src.num = 0;
+
+	for (u32 i = 0; i < num_frags; i++)
 	{
-		for (u32 j = 0; j < 0x10; j++)
-			pdst[j] = psrc[j] ^ tweak[j];
-		if (!se_aes_crypt_block_ecb(ks2, enc, pdst, pdst))
-			goto out;
-		for (u32 j = 0; j < 0x10; j++)
-			pdst[j] = pdst[j] ^ tweak[j];
-		_gf256_mul_x(tweak);
-		psrc += 0x10;
-		pdst += 0x10;
+		const u8 *src = (const u8 *)frags[i].src;
+		u32 size = frags[i].size;
+
+		//Complete a block left open by the previous fragments first.
+		if (sg.stitched)
+		{
+			u32 take = MIN(0x10 - sg.stitched, size);
+			memcpy((u8 *)_se_stitch + sg.stitched, src, take);
+			sg.stitched += take;
+			src += take;
+			size -= take;
+			if (sg.stitched < 0x10)
+				continue;
+			if (!_se_sg_stitch(&sg, 0x10))
+				return 0;
+		}
+
+		//Whole blocks are gathered straight from the fragment.
+		if (size & 0xFFFFFFF0)
+		{
+			if (!_se_sg_add(&sg, src, size & 0xFFFFFFF0))
+				return 0;
+			src += size & 0xFFFFFFF0;
+		}
+
+		if (size & 0xF)
+		{
+			memset(_se_stitch, 0, 0x10);
+			memcpy(_se_stitch, src, size & 0xF);
+			sg.stitched = size & 0xF;
+		}
 	}
 
-	res = 1;
+	if (!_se_sg_flush(&sg))
+		return 0;
+	if (sg.stitched)
+		return _se_sg_stitch(&sg, sg.stitched);
 
-out:;
-	free(tweak);
+	return 1;
+}
+
+int se_aes_crypt_ctr_sg(u32 ks, void *dst, const se_frag_t *frags, u32 num_frags, const void *ctr)
+{
+	_se_lock();
+	int res = _se_aes_crypt_ctr_sg(ks, dst, frags, num_frags, ctr);
+	_se_unlock();
 	return res;
 }
 
-int se_aes_xts_crypt(u32 ks1, u32 ks2, u32 enc, u64 sec, void *dst, void *src, u32 secsize, u32 num_secs)
+static int _se_aes_crypt_ctr_start(u32 ks, void *dst, const void *src, u32 size, const void *ctr, u32 ctr_offset)
 {
 	u8 *pdst = (u8 *)dst;
-	u8 *psrc = (u8 *)src;
+	const u8 *psrc = (const u8 *)src;
 
-	for (u32 i = 0; i < num_secs; i++)
-		if (!se_aes_xts_crypt_sec(ks1, ks2, enc, sec + i, pdst + secsize * i, psrc + secsize * i, secsize))
+	SE(SE_SPARE_0_REG_OFFSET) = 1;
+	SE(SE_CONFIG_REG_OFFSET) = SE_CONFIG_ENC_ALG(ALG_AES_ENC) | SE_CONFIG_DST(DST_MEMORY);
+	SE(SE_CRYPTO_REG_OFFSET) = SE_CRYPTO_KEY_INDEX(ks) | SE_CRYPTO_CORE_SEL(CORE_ENCRYPT) |
+		SE_CRYPTO_XOR_POS(XOR_BOTTOM) | SE_CRYPTO_INPUT_SEL(INPUT_LNR_CTR) | SE_CRYPTO_CTR_VAL(1);
+
+	//CTR blocks don't depend on each other, so the partial last block is simply done first.
+	u32 size_aligned = size & 0xFFFFFFF0;
+	if (size & 0xF)
+	{
+		_se_aes_ctr_set_offset(ctr, ctr_offset + (size_aligned >> 4));
+		if (!_se_execute_one_block(OP_START, pdst + size_aligned, size & 0xF, psrc + size_aligned, size & 0xF))
 			return 0;
+	}
+
+	if (!size_aligned)
+		return 1;
+
+	_se_aes_ctr_set_offset(ctr, ctr_offset);
+	SE(SE_BLOCK_COUNT_REG_OFFSET) = (size_aligned >> 4) - 1;
+	_se_ll_init(&_se_ll_dst, (u32)pdst, size_aligned);
+	_se_ll_init(&_se_ll_src, (u32)psrc, size_aligned);
+	_se_start_ll(OP_START, &_se_ll_dst, &_se_ll_src);
+	_se_busy = true;
 
 	return 1;
 }
+
+//Returns with the bulk of the operation still running, other SE functions wait for it before touching the engine.
+int se_aes_crypt_ctr_start(u32 ks, void *dst, const void *src, u32 size, const void *ctr, u32 ctr_offset)
+{
+	//Only one operation can be in flight, the previous one has to have succeeded.
+	_se_lock();
+	int res = _se_async_res;
+	_se_async_res = 1;
+	if (res)
+		res = _se_aes_crypt_ctr_start(ks, dst, src, size, ctr, ctr_offset);
+	_se_unlock();
+	return res;
+}
+
+int se_aes_crypt_ctr_wait()
+{
+	//Taking the lock waits for the operation.
+	_se_lock();
+	int res = _se_async_res;
+	_se_async_res = 1;
+	_se_unlock();
+	return res;
+}
+
+int se_aes_xts_crypt_sec(u32 ks1, u32 ks2, u32 enc, u64 sec, void *dst, void *src, u32 secsize)
+{
+	return se_aes_xts_crypt(ks1, ks2, enc, sec, dst, src, secsize, 1);
+}
+
+int se_aes_xts_crypt(u32 ks1, u32 ks2, u32 enc, u64 sec, void *dst, void *src, u32 secsize, u32 num_secs)
+{
+	int res = 0;
+	u8 *pdst = (u8 *)dst;
+	u8 *psrc = (u8 *)src;
+
+	//We are assuming a 0x10-aligned sector size in this implementation.
+	if (secsize > SE_XTS_BATCH_SIZE)
+		return 0;
+	u32 batch_secs = SE_XTS_BATCH_SIZE / secsize;
+	_se_lock();
+	if (!_se_xts_tweaks)
+		_se_xts_tweaks = (u8 *)malloc(SE_XTS_BATCH_SIZE);
+	u8 *tweaks = _se_xts_tweaks;
+
+	while (num_secs)
+	{
+		u32 secs = MIN(num_secs, batch_secs);
+		u32 size = secs * secsize;
+
+		//Generate the initial tweaks of all sectors in the batch with one operation.
+		memset(tweaks, 0, secs * 0x10);
+		for (u32 i = 0; i < secs; i++)
+		{
+			u64 tweak_sec = sec + i;
+			for (int j = 0xF; j >= 8; j--)
+			{
+				tweaks[i * 0x10 + j] = tweak_sec & 0xFF;
+				tweak_sec >>= 8;
+			}
+		}
+		if (!_se_aes_crypt_ecb(ks1, 1, tweaks, secs * 0x10, tweaks, secs * 0x10))
+			goto out;
+
+		//Expand each sector's tweak sequence, going backwards keeps the initial tweaks intact until used.
+		for (u32 i = secs; i-- > 0;)
+		{
+			u8 *ptweak = tweaks + i * secsize;
+			memmove(ptweak, tweaks + i * 0x10, 0x10);
+			for (u32 j = 0x10; j < secsize; j += 0x10)
+			{
+				memcpy(ptweak + j, ptweak + j - 0x10, 0x10);
+				_gf256_mul_x(ptweak + j);
+			}
+		}
+
+		//XOR in, one ECB operation over the whole batch, XOR out.
+		_se_xor(pdst, psrc, tweaks, size);
+		if (!_se_aes_crypt_ecb(ks2, enc, pdst, size, pdst, size))
+			goto out;
+		_se_xor(pdst, pdst, tweaks, size);
+
+		sec += secs;
+		num_secs -= secs;
+		psrc += size;
+		pdst += size;
+	}
+
+	res = 1;
+
+out:;
+	_se_unlock();
+	return res;
+}
@@ -19,12 +19,43 @@
 
 #include "types.h"
 
+#define SE_OP_ECB_ENC 0
+#define SE_OP_ECB_DEC 1
+#define SE_OP_UNWRAP 2
+#define SE_OP_KEY_SET 3
+#define SE_OP_KEY_CLEAR 4
+
+/*! Single block operation for se_run_ops, ks is the key used, ks_dst the slot an unwrapped key goes to. */
+typedef struct _se_op_t
+{
+	u32 op;
+	u32 ks;
+	u32 ks_dst;
+	void *dst;
+	const void *src;
+} se_op_t;
+
 void se_rsa_acc_ctrl(u32 rs, u32 flags);
 void se_key_acc_ctrl(u32 ks, u32 flags);
 void se_aes_key_set(u32 ks, void *key, u32 size);
 void se_aes_key_clear(u32 ks);
 int se_aes_unwrap_key(u32 ks_dst, u32 ks_src, const void *input);
+int se_aes_crypt_ecb(u32 ks, u32 enc, void *dst, u32 dst_size, const void *src, u32 src_size);
 int se_aes_crypt_block_ecb(u32 ks, u32 enc, void *dst, const void *src);
+/*! Source fragment for scatter-gather operations. */
+typedef struct _se_frag_t
+{
+	const void *src;
+	u32 size;
+} se_frag_t;
+
+int se_run_ops(const se_op_t *ops, u32 num_ops);
 int se_aes_crypt_ctr(u32 ks, void *dst, u32 dst_size, const void *src, u32 src_size, void *ctr);
+int se_aes_xts_crypt_sec(u32 ks1, u32 ks2, u32 enc, u64 sec, void *dst, void *src, u32 secsize);
+int se_aes_xts_crypt(u32 ks1, u32 ks2, u32 enc, u64 sec, void *dst, void *src, u32 secsize, u32 num_secs);
+int se_aes_crypt_ctr_start(u32 ks, void *dst, const void *src, u32 size, const void *ctr, u32 ctr_offset);
+int se_aes_crypt_ctr_wait();
+int se_aes_crypt_ctr_sg(u32 ks, void *dst, const se_frag_t *frags, u32 num_frags, const void *ctr);
+int se_calc_sha256(void *dst, const void *src, u32 src_size);
 
 #endif
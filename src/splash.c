@@ -19,11 +19,9 @@
 
 #include "splash.h"
 #include "ff.h"
+#include "fload.h"
 #include "util.h"
 
-/* Size of the Splash Screen. */
-const int SPLASH_SIZE = 3932169;
-
 /* Linked List for the Splash Screens. */
 typedef struct flist {
     TCHAR name[FF_LFN_BUF + 1];
@@ -33,15 +31,20 @@ typedef struct flist {
 
 bool write_splash_to_framebuffer(gfx_con_t * con, char * filename) {
     FIL fp;
-    char buffer[SPLASH_SIZE + 1];
+    UINT br;
+    u8 * fb = (u8 *)con->gfx_ctxt->fb;
+    u32 fb_size = con->gfx_ctxt->height * con->gfx_ctxt->stride * sizeof(u32);
 
     // Open the file.
     if (f_open(&fp, filename, FA_READ) == FR_OK) {
-        // Read the file to the buffer.
-	    f_read(&fp, buffer, SPLASH_SIZE, NULL);
+        // Read the file straight into the framebuffer, never past its end.
+        fload_read(&fp, fb, fb_size);
 
-        // Copy the splash from our buffer to the framebuffer.
-        memcpy(con->gfx_ctxt->fb, buffer + 1, SPLASH_SIZE);
+        // The image starts at the second byte of the file, move it into place and fetch its last byte.
+        memmove(fb, fb + 1, fb_size - 1);
+        if (f_lseek(&fp, fb_size) == FR_OK) {
+            f_read(&fp, fb + fb_size - 1, 1, &br);
+        }
 
         // Clean up.
         f_close(&fp);
@@ -50,6 +50,8 @@
 #define SE_BASE 0x70012000
 #define MC_BASE 0x70019000
 #define EMC_BASE 0x7001B000
+#define SDMMC_BASE 0x700B0000
+#define SDMMC_SIZE 0x200
 #define MIPI_CAL_BASE 0x700E3000
 #define I2S_BASE 0x702D1000
 
@@ -71,10 +71,9 @@ int tsec_query(u8 *dst, u32 rev, void *fw)
 	}
 
 	//Load firmware.
-	u8 *fwbuf = (u8 *)malloc(0x2000);
-	u8 *fwbuf_aligned = (u8 *)ALIGN((u32)fwbuf + 0x1000, 0x100);
-	memcpy(fwbuf_aligned, fw, 0xF00);
-	TSEC(0x1110) = (u32)fwbuf_aligned >> 8;// tsec_dmatrfbase_r
+	u8 *fwbuf = (u8 *)memalign(0x100, 0xF00);
+	memcpy(fwbuf, fw, 0xF00);
+	TSEC(0x1110) = (u32)fwbuf >> 8;// tsec_dmatrfbase_r
 	for (u32 addr = 0; addr < 0xF00; addr += 0x100)
 		if (!_tsec_dma_pa_to_internal_100(0, addr, addr))
 		{
@@ -16,6 +16,7 @@
 
 #include "util.h"
 #include "t210.h"
+#include "sched.h"
 
 u32 get_tmr()
 {
@@ -25,8 +26,9 @@ u32 get_tmr()
 void sleep(u32 ticks)
 {
 	u32 start = TMR(0x10);
+	//Other tasks get to run meanwhile, waits are minimums anyway.
 	while (TMR(0x10) - start <= ticks)
-		;
+		sched_yield();
 }
 
 void exec_cfg(u32 *base, const cfg_op_t *ops, u32 num_ops)
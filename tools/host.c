@@ -0,0 +1,284 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//REG_ERR and REG_EFL need GNU extensions, which declare a sleep() of their own.
+#define _GNU_SOURCE
+#define sleep _host_libc_sleep
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#undef sleep
+
+#include "host.h"
+#include "util.h"
+
+#define HOST_STACK_SIZE 0x800000
+#define HOST_MAX_DEVS 8
+#define HOST_MAX_WINS 8
+//x86 trap flag, single steps the access that faulted.
+#define HOST_EFL_TF 0x100
+
+typedef struct _host_win_t
+{
+	u32 base;
+	u32 size;
+	host_mmio_rd_t rd;
+	host_mmio_wr_t wr;
+} host_win_t;
+
+static u32 _host_tmr;
+static host_dev_t _host_devs[HOST_MAX_DEVS];
+static u32 _host_num_devs;
+static u32 _host_checks;
+static u32 _host_failed;
+
+static host_win_t _host_wins[HOST_MAX_WINS];
+static u32 _host_num_wins;
+static u32 _host_open;
+//The access being single stepped.
+static host_win_t *_host_pend;
+static u32 _host_pend_addr;
+static u32 _host_pend_old;
+static int _host_pend_wr;
+
+//Saved task context, what sched.c keeps as the task's stack pointer on the host.
+typedef struct _host_task_t
+{
+	u32 magic;
+	ucontext_t ctx;
+} host_task_t;
+
+#define HOST_TASK_MAGIC 0x4B534154
+#define HOST_TASK_STACK_SIZE 0x3800
+
+//Context switched to last, freed by whoever runs next.
+static host_task_t *_host_task_done;
+static void (*_host_task_entry)();
+
+static int _host_argc;
+static char **_host_argv;
+static ucontext_t _host_ctx_main;
+static ucontext_t _host_ctx_test;
+
+void host_check(int res, const char *expr, const char *file, int line)
+{
+	_host_checks++;
+	if (res)
+		return;
+	_host_failed++;
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+}
+
+static void _host_protect(int prot)
+{
+	for (u32 i = 0; i < _host_num_wins; i++)
+		if (_host_wins[i].rd || _host_wins[i].wr)
+			mprotect((void *)(unsigned long)_host_wins[i].base, _host_wins[i].size, prot);
+}
+
+void host_mmio_open()
+{
+	if (!_host_open++)
+		_host_protect(PROT_READ | PROT_WRITE);
+}
+
+void host_mmio_close()
+{
+	if (!--_host_open)
+		_host_protect(PROT_NONE);
+}
+
+static host_win_t *_host_find_win(u32 addr)
+{
+	for (u32 i = 0; i < _host_num_wins; i++)
+		if (addr - _host_wins[i].base < _host_wins[i].size)
+			return &_host_wins[i];
+	return NULL;
+}
+
+//Register accesses fault, the hooks see them around a single step of the faulting instruction.
+static void _host_segv(int sig, siginfo_t *info, void *ctx)
+{
+	ucontext_t *uc = (ucontext_t *)ctx;
+	u32 addr = (u32)(unsigned long)info->si_addr;
+	host_win_t *win = (unsigned long)info->si_addr >> 32 ? NULL : _host_find_win(addr);
+	if (!win || _host_open)
+	{
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+
+	host_mmio_open();
+	if (win->rd)
+		win->rd(addr);
+	_host_pend = win;
+	_host_pend_addr = addr;
+	_host_pend_old = *(vu32 *)(unsigned long)(addr & ~3);
+	_host_pend_wr = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+	uc->uc_mcontext.gregs[REG_EFL] |= HOST_EFL_TF;
+}
+
+static void _host_trap(int sig, siginfo_t *info, void *ctx)
+{
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uc->uc_mcontext.gregs[REG_EFL] &= ~HOST_EFL_TF;
+	if (!_host_pend)
+		return;
+
+	host_win_t *win = _host_pend;
+	_host_pend = NULL;
+	if (_host_pend_wr && win->wr)
+		win->wr(_host_pend_addr, _host_pend_old, *(vu32 *)(unsigned long)(_host_pend_addr & ~3));
+	host_mmio_close();
+}
+
+void *host_mmio_map(u32 base, u32 size, host_mmio_rd_t rd, host_mmio_wr_t wr)
+{
+	void *res = mmap((void *)(unsigned long)base, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (res != (void *)(unsigned long)base || _host_num_wins == HOST_MAX_WINS)
+	{
+		fprintf(stderr, "could not map %08X\n", base);
+		exit(1);
+	}
+
+	host_win_t *win = &_host_wins[_host_num_wins++];
+	win->base = base;
+	win->size = size;
+	win->rd = rd;
+	win->wr = wr;
+	if ((rd || wr) && !_host_open)
+		mprotect(res, size, PROT_NONE);
+
+	return res;
+}
+
+void host_add_dev(host_dev_t step)
+{
+	_host_devs[_host_num_devs++] = step;
+}
+
+void host_advance(u32 us)
+{
+	_host_tmr += us;
+	if (!_host_num_devs)
+		return;
+
+	host_mmio_open();
+	for (u32 i = 0; i < _host_num_devs; i++)
+		_host_devs[i](_host_tmr);
+	host_mmio_close();
+}
+
+u32 host_now()
+{
+	return _host_tmr;
+}
+
+u32 get_tmr()
+{
+	host_advance(1);
+	return _host_tmr;
+}
+
+void sleep(u32 ticks)
+{
+	host_advance(ticks);
+}
+
+//Device waits yield, without the scheduler linked in they just let the devices run.
+__attribute__((weak)) void sched_yield()
+{
+	host_advance(1);
+}
+
+static void _host_task_start()
+{
+	free(_host_task_done);
+	_host_task_done = NULL;
+	_host_task_entry();
+}
+
+//Host side of sched_switch() in start.S, new_sp is either a context saved here or the frame built by sched_spawn().
+void sched_switch(u32 **save_sp, u32 *new_sp)
+{
+	host_task_t *prev = (host_task_t *)calloc(1, sizeof(host_task_t));
+	host_task_t *next = (host_task_t *)new_sp;
+	prev->magic = HOST_TASK_MAGIC;
+	*save_sp = (u32 *)prev;
+
+	if (next->magic != HOST_TASK_MAGIC)
+	{
+		//A new task, its frame holds the entry in the saved lr slot and its stack ends right below.
+		_host_task_entry = (void (*)())(unsigned long)new_sp[8];
+		next = (host_task_t *)calloc(1, sizeof(host_task_t));
+		getcontext(&next->ctx);
+		next->ctx.uc_stack.ss_sp = (u8 *)new_sp - HOST_TASK_STACK_SIZE;
+		next->ctx.uc_stack.ss_size = HOST_TASK_STACK_SIZE;
+		next->ctx.uc_link = NULL;
+		makecontext(&next->ctx, _host_task_start, 0);
+	}
+
+	next->magic = 0;
+	_host_task_done = next;
+	swapcontext(&prev->ctx, &next->ctx);
+
+	//Resumed by some other task.
+	free(_host_task_done);
+	_host_task_done = NULL;
+}
+
+static void _host_run()
+{
+	test_main(_host_argc, _host_argv);
+}
+
+int main(int argc, char **argv)
+{
+	//Keep every allocation on the brk heap, which sits right above the non-PIE image.
+	mallopt(M_MMAP_MAX, 0);
+
+	void *stack = malloc(HOST_STACK_SIZE);
+	if ((unsigned long)stack + HOST_STACK_SIZE > 0xFFFFFFFFUL)
+	{
+		fprintf(stderr, "heap is above 4GB, build without PIE\n");
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sa.sa_sigaction = _host_segv;
+	sigaction(SIGSEGV, &sa, NULL);
+	sa.sa_sigaction = _host_trap;
+	sigaction(SIGTRAP, &sa, NULL);
+
+	_host_argc = argc;
+	_host_argv = argv;
+	getcontext(&_host_ctx_test);
+	_host_ctx_test.uc_stack.ss_sp = stack;
+	_host_ctx_test.uc_stack.ss_size = HOST_STACK_SIZE;
+	_host_ctx_test.uc_link = &_host_ctx_main;
+	makecontext(&_host_ctx_test, _host_run, 0);
+	swapcontext(&_host_ctx_main, &_host_ctx_test);
+
+	printf("%s: %u checks, %u failed\n", argv[0], _host_checks, _host_failed);
+	return _host_failed ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "types.h"
+
+/*! Host runs of bootloader sources, see the test target in the Makefile.
+ *  The sources keep pointers in u32, so tests are built without PIE and run on a stack and heap below 4GB. */
+
+#define CHECK(cond) host_check((cond) ? 1 : 0, #cond, __FILE__, __LINE__)
+
+/*! Simulated device, called whenever the virtual clock moves. */
+typedef void (*host_dev_t)(u32 now);
+/*! Register access hooks, rd runs before any access and wr after a write with the old and new word at addr & ~3. */
+typedef void (*host_mmio_rd_t)(u32 addr);
+typedef void (*host_mmio_wr_t)(u32 addr, u32 old, u32 val);
+
+/*! Provided by each test, returns with the checks done. */
+void test_main(int argc, char **argv);
+
+void host_check(int res, const char *expr, const char *file, int line);
+/*! Backs a register window at its real address with zeroed memory, accesses trap into the hooks if there are any. */
+void *host_mmio_map(u32 base, u32 size, host_mmio_rd_t rd, host_mmio_wr_t wr);
+/*! Lets the simulators touch trapping windows directly, device steps already run with them open. */
+void host_mmio_open();
+void host_mmio_close();
+void host_add_dev(host_dev_t step);
+/*! Moves the virtual clock, get_tmr() ticks it by 1us and sleep() by the time slept. */
+void host_advance(u32 us);
+u32 host_now();
+
+/*! sched.c switches through this on the host, task stacks have to be at least 0x4000 bytes. */
+void sched_switch(u32 **save_sp, u32 *new_sp);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ini.h"
+
+//Host build of the config compiler, see the ini2bin target in the Makefile.
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s switchblade.ini switchblade.bin\n", argv[0]);
+		return 1;
+	}
+
+	FILE *fp = fopen(argv[1], "rb");
+	if (!fp)
+	{
+		fprintf(stderr, "could not open %s\n", argv[1]);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	u32 size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char *buf = (char *)malloc(size + 1);
+	if (fread(buf, 1, size, fp) != size)
+	{
+		fprintf(stderr, "could not read %s\n", argv[1]);
+		return 1;
+	}
+	buf[size] = 0;
+	fclose(fp);
+
+	//Records take at most 12 bytes per line, which take at least 2 bytes each.
+	u32 max_size = sizeof(ini_bin_hdr_t) + size * 6 + size + 1;
+	u8 *out = (u8 *)malloc(max_size);
+	u32 out_size = ini_compile(buf, size, out, max_size);
+	if (!out_size)
+	{
+		fprintf(stderr, "could not compile %s\n", argv[1]);
+		return 1;
+	}
+
+	fp = fopen(argv[2], "wb");
+	if (!fp || fwrite(out, 1, out_size, fp) != out_size)
+	{
+		fprintf(stderr, "could not write %s\n", argv[2]);
+		return 1;
+	}
+	fclose(fp);
+
+	return 0;
+}
@@ -0,0 +1,1771 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//The libc headers declare a sleep() and clock_t of their own.
+#define sleep _host_libc_sleep
+#define clock_t _host_libc_clock_t
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#undef sleep
+#undef clock_t
+
+#include "host.h"
+#include "sdsim.h"
+#include "t210.h"
+#include "clock.h"
+#include "sdmmc_driver.h"
+#include "mmc.h"
+#include "sd.h"
+
+#define SDSIM_NUM_SLOTS 4
+#define SDSIM_MAX_SEGS 1024
+
+//Bus cycles around commands and blocks: Ncr and Nrc around a response, start/end bits, CRC16 and the gap between blocks.
+#define SDSIM_CMD_CYCLES 48
+#define SDSIM_RSP_GAP 16
+#define SDSIM_BLK_CYCLES 26
+//Nac of register reads (EXT_CSD, SCR, switch status), memory reads take the card's read_us instead.
+#define SDSIM_REG_NAC 64
+//Data timeout counter clock.
+#define SDSIM_TMCLK_KHZ 12000
+
+#define SDSIM_PRNSTS_CMD_INHIBIT 0x1
+#define SDSIM_PRNSTS_DAT_INHIBIT 0x2
+#define SDSIM_PRNSTS_DAT_ACTIVE 0x4
+#define SDSIM_PRNSTS_WR_ACTIVE 0x100
+#define SDSIM_PRNSTS_RD_ACTIVE 0x200
+#define SDSIM_PRNSTS_CARD 0x70000
+#define SDSIM_PRNSTS_WP 0x80000
+#define SDSIM_PRNSTS_DAT0 0x100000
+#define SDSIM_PRNSTS_DAT 0xF00000
+#define SDSIM_PRNSTS_CMD 0x1000000
+
+#define SDSIM_NORINTSTS_BRR 0x20
+
+#define SDSIM_CMDQ_MAX_TASKS 32
+//Tasks a card reads in at once, see _sdsim_cmdq_update().
+#define SDSIM_CMDQ_UNITS 4
+#define SDSIM_CMDQ_NONE 0xFF
+
+//What the card does with the data lines after a command.
+typedef struct _sdsim_xfer_t
+{
+	int active;
+	int is_read;
+	int is_mem;     //Storage access, register reads come from buf.
+	int is_ready;   //Read in already by the command queue, the first block goes out without the access time.
+	u8 *mem;
+	u8 buf[512];
+	u32 blksize;    //What the card sends or takes per block.
+	u32 avail;      //Blocks before the end of the partition, the card stops with OUT_OF_RANGE there.
+	u32 num;        //Blocks before the card goes back to tran on its own, 0 runs until CMD12.
+} sdsim_xfer_t;
+
+typedef struct _sdsim_task_t
+{
+	u32 sector;
+	u32 num;
+	u32 seq;       //Order the task was queued in.
+	u32 queued_at;
+} sdsim_task_t;
+
+typedef struct _sdsim_seg_t
+{
+	u32 addr;
+	u32 len;
+} sdsim_seg_t;
+
+typedef struct _sdsim_slot_t
+{
+	t210_sdmmc_t *regs;
+	sdsim_card_t *card;
+	sdsim_stats_t stats;
+
+	//Clock and reset controller.
+	int car_reset;
+	int car_clk;
+
+	//Command line.
+	int cmd_busy;
+	int cmd_wait_clk; //Issued with the SD clock stopped.
+	u32 cmd_due;
+	u16 cmd_err;
+	u32 rsp[4];
+
+	//Data lines, busy until dat_due with DAT0 low from dat_end on.
+	int dat_busy;
+	int dat_is_read;
+	u32 dat_start;
+	u32 dat_end;
+	u32 dat_due;
+	u16 dat_err;
+	u32 dat_err_at;
+	u32 dat_blocks;   //Blocks the host asked for.
+	u32 dat_ok;       //Blocks that make it before an error.
+	u32 dat_blksize;
+	u32 blk_ns;
+	int dat_auto12;
+	int dat_counted;  //Blocks show up in blkcnt.
+	sdsim_seg_t segs[SDSIM_MAX_SEGS];
+	u32 num_segs;
+
+	//Tuning, runs one block per tuning command until the iterations are done.
+	int tuning_cmd;
+	int tuning_started;
+	int tuning_ok;
+	u32 tuning_due;
+	u32 tuning_left;
+
+	//Card.
+	u32 state;
+	u32 rca;
+	u32 status;      //R1 bits reported with the next response.
+	int app_cmd;
+	int op_started;
+	u32 op_ready;
+	int s18;
+	int volt_switch; //After CMD11 until the host restarts the clock at 1.8V.
+	u32 prg_due;
+	u32 prg_next;
+	u32 blk_count;   //CMD23.
+	u32 sd_func;
+	u32 sd_func_next; //Takes over once the switch status block is out.
+	u32 sd_width;
+	u8 ext_csd[512];
+	sdsim_xfer_t xfer;
+
+	//Command queue.
+	u32 cmdq_param;   //CMD44 waiting for its CMD45, 0 if none.
+	u32 cmdq_queued;
+	u32 cmdq_started;
+	u32 cmdq_ready;   //Queue status register.
+	u32 cmdq_seq;
+	sdsim_task_t tasks[SDSIM_CMDQ_MAX_TASKS];
+	u8 unit_task[SDSIM_CMDQ_UNITS];
+	u32 unit_due[SDSIM_CMDQ_UNITS];
+} sdsim_slot_t;
+
+static sdsim_slot_t _sdsim_slots[SDSIM_NUM_SLOTS];
+
+static const u32 _sdsim_car_src[SDSIM_NUM_SLOTS] = {
+	CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC1, CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC2,
+	CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC3, CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC4
+};
+//Register offset and bit of each controller in the L and U device banks.
+static const u32 _sdsim_car_bank[SDSIM_NUM_SLOTS] = { 0, 0, 8, 0 };
+static const u32 _sdsim_car_bit[SDSIM_NUM_SLOTS] = { 1 << 14, 1 << 9, 1 << 5, 1 << 15 };
+
+static int _sdsim_after(u32 now, u32 t)
+{
+	return (int)(now - t) >= 0;
+}
+
+static u32 _sdsim_cycles_us(u32 cycles, u32 khz)
+{
+	if (!khz)
+		khz = 1;
+	return (u32)(((u64)cycles * 1000 + khz - 1) / khz);
+}
+
+static void _sdsim_set_bits(u32 *r, u32 start, u32 size, u32 val)
+{
+	//Same layout as the driver's responses, r[0] has bits 127:96.
+	for (u32 i = 0; i < size; i++)
+	{
+		u32 bit = start + i;
+		u32 *w = &r[3 - bit / 32];
+		if ((val >> i) & 1)
+			*w |= 1u << (bit & 31);
+		else
+			*w &= ~(1u << (bit & 31));
+	}
+}
+
+/*
+* Bus setup.
+*/
+
+static u32 _sdsim_khz(sdsim_slot_t *slot)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	u32 div = CLOCK(_sdsim_car_src[slot - _sdsim_slots]) & 0xFF;
+	u32 src = 816000 / (div + 2);
+	u32 n = (regs->clkcon >> 8) | (((regs->clkcon >> 6) & 3) << 8);
+	return n ? src / (2 * n) : src;
+}
+
+static int _sdsim_running(sdsim_slot_t *slot)
+{
+	return !slot->car_reset && slot->car_clk && (slot->regs->clkcon & TEGRA_MMC_CLKCON_INTERNAL_CLOCK_ENABLE);
+}
+
+static int _sdsim_clk_on(sdsim_slot_t *slot)
+{
+	return _sdsim_running(slot) && (slot->regs->clkcon & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE);
+}
+
+static u32 _sdsim_host_width(sdsim_slot_t *slot)
+{
+	u8 h = slot->regs->hostctl;
+	if (h & TEGRA_MMC_HOSTCTL_8BIT)
+		return 8;
+	if (h & TEGRA_MMC_HOSTCTL_4BIT)
+		return 4;
+	return 1;
+}
+
+static int _sdsim_host_ddr(sdsim_slot_t *slot)
+{
+	u16 h = slot->regs->hostctl2;
+	u32 uhs = h & 7;
+	return (h & SDHCI_CTRL_VDD_180) && (uhs == UHS_DDR50_BUS_SPEED || uhs == HS400_BUS_SPEED);
+}
+
+static u32 _sdsim_card_width(sdsim_slot_t *slot)
+{
+	if (slot->card->is_sd)
+		return slot->sd_width;
+	switch (slot->ext_csd[EXT_CSD_BUS_WIDTH])
+	{
+	case EXT_CSD_BUS_WIDTH_4:
+	case EXT_CSD_DDR_BUS_WIDTH_4:
+		return 4;
+	case EXT_CSD_BUS_WIDTH_8:
+	case EXT_CSD_DDR_BUS_WIDTH_8:
+		return 8;
+	}
+	return 1;
+}
+
+static int _sdsim_card_ddr(sdsim_slot_t *slot)
+{
+	if (slot->card->is_sd)
+		return slot->sd_func == UHS_DDR50_BUS_SPEED;
+	u8 w = slot->ext_csd[EXT_CSD_BUS_WIDTH];
+	return w == EXT_CSD_DDR_BUS_WIDTH_4 || w == EXT_CSD_DDR_BUS_WIDTH_8;
+}
+
+static u32 _sdsim_card_max_khz(sdsim_slot_t *slot)
+{
+	//Identification runs at whatever the host picked, the card only checks its interface timing once addressed.
+	if (slot->state < R1_STATE_STBY)
+		return 0xFFFFFFFF;
+
+	if (slot->card->is_sd)
+	{
+		static const u32 sd_khz[] = { 25000, 50000, 100000, 208000, 50000 };
+		return sd_khz[slot->sd_func];
+	}
+
+	static const u32 mmc_khz[] = { 26000, 52000, 200000, 200000 };
+	return mmc_khz[slot->ext_csd[EXT_CSD_HS_TIMING] & 3];
+}
+
+static int _sdsim_tap_ok(sdsim_slot_t *slot, u32 khz)
+{
+	//Only the fast modes need the sampling point tuned.
+	u32 tap = (slot->regs->venclkctl >> 16) & 0xFF;
+	return khz <= 100000 || (tap >= slot->card->tap_lo && tap <= slot->card->tap_hi);
+}
+
+static void _sdsim_update_prnsts(sdsim_slot_t *slot)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	u32 prnsts = regs->prnsts & (SDSIM_PRNSTS_CMD_INHIBIT | SDSIM_PRNSTS_DAT_INHIBIT);
+
+	if (slot->card)
+		prnsts |= SDSIM_PRNSTS_CARD | SDSIM_PRNSTS_WP;
+	prnsts |= SDSIM_PRNSTS_CMD;
+	if (!slot->volt_switch)
+		prnsts |= SDSIM_PRNSTS_DAT;
+	if (slot->dat_busy)
+	{
+		prnsts |= SDSIM_PRNSTS_DAT_ACTIVE | (slot->dat_is_read ? SDSIM_PRNSTS_RD_ACTIVE : SDSIM_PRNSTS_WR_ACTIVE);
+		if (!slot->dat_is_read && _sdsim_after(host_now(), slot->dat_end))
+			prnsts &= ~SDSIM_PRNSTS_DAT0;
+	}
+
+	regs->prnsts = prnsts;
+}
+
+static void _sdsim_raise(sdsim_slot_t *slot, u16 bits)
+{
+	slot->regs->norintsts |= bits & slot->regs->norintstsen;
+}
+
+static void _sdsim_raise_err(sdsim_slot_t *slot, u16 bits)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	regs->errintsts |= bits & regs->errintstsen;
+	if (regs->errintsts)
+		regs->norintsts |= TEGRA_MMC_NORINTSTS_ERR_INTERRUPT;
+}
+
+static void _sdsim_reset_regs(sdsim_slot_t *slot)
+{
+	memset((void *)slot->regs, 0, SDMMC_SIZE);
+	slot->regs->capareg = 0x10000000; //64-bit system bus.
+	slot->cmd_busy = 0;
+	slot->cmd_wait_clk = 0;
+	slot->dat_busy = 0;
+	slot->tuning_cmd = 0;
+	slot->tuning_left = 0;
+	_sdsim_update_prnsts(slot);
+}
+
+/*
+* Card.
+*/
+
+static u32 _sdsim_card_state(sdsim_slot_t *slot)
+{
+	if (slot->state == R1_STATE_PRG && _sdsim_after(host_now(), slot->prg_due))
+		slot->state = slot->prg_next;
+	return slot->state;
+}
+
+static void _sdsim_card_busy(sdsim_slot_t *slot, u32 until, u32 next)
+{
+	slot->state = R1_STATE_PRG;
+	slot->prg_due = until;
+	slot->prg_next = next;
+}
+
+static u32 _sdsim_r1(sdsim_slot_t *slot, u32 state, u32 err)
+{
+	u32 r1 = slot->status | err | (state << 9);
+	if (state == R1_STATE_TRAN || state == R1_STATE_STBY)
+		r1 |= R1_READY_FOR_DATA;
+	if (slot->app_cmd)
+		r1 |= R1_APP_CMD;
+	slot->status = 0;
+	return r1;
+}
+
+static void _sdsim_card_reset(sdsim_slot_t *slot)
+{
+	slot->state = R1_STATE_IDLE;
+	slot->rca = 0;
+	slot->status = 0;
+	slot->app_cmd = 0;
+	slot->op_started = 0;
+	slot->blk_count = 0;
+	slot->sd_func = 0;
+	slot->sd_func_next = 0;
+	slot->sd_width = 1;
+	slot->xfer.active = 0;
+	slot->ext_csd[EXT_CSD_BUS_WIDTH] = EXT_CSD_BUS_WIDTH_1;
+	slot->ext_csd[EXT_CSD_HS_TIMING] = EXT_CSD_TIMING_BC;
+	slot->ext_csd[EXT_CSD_PART_CONFIG] &= ~EXT_CSD_PART_CONFIG_ACC_MASK;
+	slot->ext_csd[EXT_CSD_CMDQ_MODE_EN] = 0;
+	slot->cmdq_param = 0;
+	slot->cmdq_queued = 0;
+	slot->cmdq_started = 0;
+	slot->cmdq_ready = 0;
+	memset(slot->unit_task, SDSIM_CMDQ_NONE, sizeof(slot->unit_task));
+}
+
+static void _sdsim_card_insert(sdsim_slot_t *slot, sdsim_card_t *card)
+{
+	slot->card = card;
+	memset(slot->ext_csd, 0, sizeof(slot->ext_csd));
+	slot->s18 = 0;
+	slot->volt_switch = 0;
+	_sdsim_card_reset(slot);
+	if (!card || card->is_sd)
+		return;
+
+	u8 *ext_csd = slot->ext_csd;
+	ext_csd[EXT_CSD_PARTITION_SUPPORT] = 7;
+	ext_csd[EXT_CSD_REV] = 8;
+	ext_csd[EXT_CSD_STRUCTURE] = 2;
+	ext_csd[EXT_CSD_CARD_TYPE] = EXT_CSD_CARD_TYPE_HS_26 | EXT_CSD_CARD_TYPE_HS_52 |
+		EXT_CSD_CARD_TYPE_DDR_1_8V | EXT_CSD_CARD_TYPE_HS200_1_8V | EXT_CSD_CARD_TYPE_HS400_1_8V;
+	ext_csd[EXT_CSD_PART_SWITCH_TIME] = 1;
+	*(u32 *)&ext_csd[EXT_CSD_SEC_CNT] = card->part_sectors[SDSIM_PART_USER];
+	ext_csd[EXT_CSD_BOOT_MULT] = card->part_sectors[SDSIM_PART_BOOT0] / 256;
+	*(u16 *)&ext_csd[EXT_CSD_DEVICE_VERSION] = 0x100;
+	ext_csd[EXT_CSD_BKOPS_SUPPORT] = 1;
+	if (card->cmdq_depth)
+	{
+		ext_csd[EXT_CSD_CMDQ_DEPTH] = (card->cmdq_depth - 1) & EXT_CSD_CMDQ_DEPTH_MASK;
+		ext_csd[EXT_CSD_CMDQ_SUPPORT] = EXT_CSD_CMDQ_SUPPORTED;
+	}
+}
+
+static void _sdsim_cid(sdsim_slot_t *slot, u32 *r)
+{
+	static const char mmc_name[] = "SIMMMC";
+	static const char sd_name[] = "SIMSD";
+
+	memset(r, 0, 16);
+	if (slot->card->is_sd)
+	{
+		_sdsim_set_bits(r, 120, 8, 0x03);
+		_sdsim_set_bits(r, 104, 16, 0x5344);
+		for (u32 i = 0; i < 5; i++)
+			_sdsim_set_bits(r, 96 - 8 * i, 8, sd_name[i]);
+		_sdsim_set_bits(r, 56, 8, 0x10);
+		_sdsim_set_bits(r, 24, 32, 0x5D000001 + (slot - _sdsim_slots));
+		_sdsim_set_bits(r, 12, 8, 18);
+		_sdsim_set_bits(r, 8, 4, 6);
+	}
+	else
+	{
+		_sdsim_set_bits(r, 120, 8, 0x15);
+		_sdsim_set_bits(r, 112, 2, 1);
+		_sdsim_set_bits(r, 104, 8, 0x01);
+		for (u32 i = 0; i < 6; i++)
+			_sdsim_set_bits(r, 96 - 8 * i, 8, mmc_name[i]);
+		_sdsim_set_bits(r, 48, 8, 0x10);
+		_sdsim_set_bits(r, 16, 32, 0x3E000001 + (slot - _sdsim_slots));
+		_sdsim_set_bits(r, 12, 4, 6);
+		_sdsim_set_bits(r, 8, 4, 5);
+	}
+}
+
+static void _sdsim_csd(sdsim_slot_t *slot, u32 *r)
+{
+	memset(r, 0, 16);
+	if (slot->card->is_sd)
+	{
+		_sdsim_set_bits(r, 126, 2, 1);
+		_sdsim_set_bits(r, 96, 8, 0x32);
+		_sdsim_set_bits(r, 84, 12, 0x5B5);
+		_sdsim_set_bits(r, 80, 4, 9);
+		_sdsim_set_bits(r, 48, 22, slot->card->part_sectors[SDSIM_PART_USER] / 1024 - 1);
+	}
+	else
+	{
+		_sdsim_set_bits(r, 126, 2, CSD_STRUCT_EXT_CSD);
+		_sdsim_set_bits(r, 122, 4, CSD_SPEC_VER_4);
+		_sdsim_set_bits(r, 96, 8, 0x32);
+		_sdsim_set_bits(r, 84, 12, 0x8F5);
+		_sdsim_set_bits(r, 80, 4, 9);
+		_sdsim_set_bits(r, 62, 12, 0xFFF);
+		_sdsim_set_bits(r, 47, 3, 7);
+	}
+}
+
+static void _sdsim_xfer_reg(sdsim_slot_t *slot, const void *data, u32 size)
+{
+	sdsim_xfer_t *xfer = &slot->xfer;
+	memset(xfer, 0, sizeof(sdsim_xfer_t));
+	xfer->active = 1;
+	xfer->is_read = 1;
+	memcpy(xfer->buf, data, size);
+	xfer->mem = xfer->buf;
+	xfer->blksize = size;
+	xfer->avail = 1;
+	xfer->num = 1;
+}
+
+static u32 _sdsim_xfer_mem(sdsim_slot_t *slot, u32 sector, int is_read, u32 num)
+{
+	sdsim_card_t *card = slot->card;
+	u32 part = card->is_sd ? SDSIM_PART_USER : slot->ext_csd[EXT_CSD_PART_CONFIG] & EXT_CSD_PART_CONFIG_ACC_MASK;
+	if (sector >= card->part_sectors[part])
+		return R1_OUT_OF_RANGE | R1_ADDRESS_ERROR;
+
+	sdsim_xfer_t *xfer = &slot->xfer;
+	memset(xfer, 0, sizeof(sdsim_xfer_t) - sizeof(xfer->buf));
+	xfer->active = 1;
+	xfer->is_read = is_read;
+	xfer->is_mem = 1;
+	xfer->mem = card->part[part] + (u64)sector * 512;
+	xfer->blksize = 512;
+	xfer->avail = card->part_sectors[part] - sector;
+	xfer->num = num;
+	return 0;
+}
+
+static u32 _sdsim_mmc_switch(sdsim_slot_t *slot, u32 arg)
+{
+	u32 mode = (arg >> 24) & 3;
+	u32 index = (arg >> 16) & 0xFF;
+	u32 value = (arg >> 8) & 0xFF;
+	u8 *ext_csd = slot->ext_csd;
+	u8 card_type = ext_csd[EXT_CSD_CARD_TYPE];
+
+	if (mode == MMC_SWITCH_MODE_SET_BITS || mode == MMC_SWITCH_MODE_CLEAR_BITS)
+	{
+		if (index != EXT_CSD_BKOPS_EN)
+			return 0;
+		ext_csd[index] = mode == MMC_SWITCH_MODE_SET_BITS ? ext_csd[index] | value : ext_csd[index] & ~value;
+		return 1;
+	}
+	if (mode != MMC_SWITCH_MODE_WRITE_BYTE)
+		return 0;
+
+	switch (index)
+	{
+	case EXT_CSD_BUS_WIDTH:
+		//DDR needs HS timing to be selected first.
+		if (value == EXT_CSD_DDR_BUS_WIDTH_4 || value == EXT_CSD_DDR_BUS_WIDTH_8)
+		{
+			if (ext_csd[EXT_CSD_HS_TIMING] != EXT_CSD_TIMING_HS || !(card_type & EXT_CSD_CARD_TYPE_DDR_1_8V))
+				return 0;
+		}
+		else if (value > EXT_CSD_BUS_WIDTH_8)
+			return 0;
+		break;
+	case EXT_CSD_HS_TIMING:
+		switch (value & 0xF)
+		{
+		case EXT_CSD_TIMING_BC:
+			break;
+		case EXT_CSD_TIMING_HS:
+			if (!(card_type & EXT_CSD_CARD_TYPE_HS_52))
+				return 0;
+			break;
+		case EXT_CSD_TIMING_HS200:
+			if (!(card_type & EXT_CSD_CARD_TYPE_HS200_1_8V) ||
+				(ext_csd[EXT_CSD_BUS_WIDTH] != EXT_CSD_BUS_WIDTH_4 && ext_csd[EXT_CSD_BUS_WIDTH] != EXT_CSD_BUS_WIDTH_8))
+				return 0;
+			break;
+		case EXT_CSD_TIMING_HS400:
+			if (!(card_type & EXT_CSD_CARD_TYPE_HS400_1_8V) || ext_csd[EXT_CSD_BUS_WIDTH] != EXT_CSD_DDR_BUS_WIDTH_8)
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+		break;
+	case EXT_CSD_PART_CONFIG:
+		//Not with the queue enabled either.
+		if ((value & EXT_CSD_PART_CONFIG_ACC_MASK) >= SDSIM_MAX_PARTS ||
+			!slot->card->part_sectors[value & EXT_CSD_PART_CONFIG_ACC_MASK] || ext_csd[EXT_CSD_CMDQ_MODE_EN])
+			return 0;
+		break;
+	case EXT_CSD_CMDQ_MODE_EN:
+		//Only switched with the queue empty.
+		if (!ext_csd[EXT_CSD_CMDQ_SUPPORT] || value > EXT_CSD_CMDQ_MODE_ENABLED || slot->cmdq_queued)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	ext_csd[index] = value;
+	return 1;
+}
+
+static void _sdsim_sd_switch(sdsim_slot_t *slot, u32 arg, u8 *buf)
+{
+	//Group 1 only, SDR50 and up need 1.8V signaling.
+	u32 supported = slot->s18 ? 0x1F : 0x03;
+	u32 func = arg & 0xF;
+
+	memset(buf, 0, 64);
+	buf[1] = 200; //Max current in mA.
+	buf[12] = 0x80;
+	buf[13] = supported;
+	if (func == 0xF)
+		func = slot->sd_func;
+	else if (func > UHS_DDR50_BUS_SPEED || !(supported & (1 << func)))
+		func = 0xF;
+	buf[16] = func;
+	buf[17] = 1;
+
+	if (arg & (1u << 31) && func != 0xF)
+		slot->sd_func_next = func;
+}
+
+static void _sdsim_cmdq_update(sdsim_slot_t *slot, u32 now)
+{
+	//Up to SDSIM_CMDQ_UNITS tasks are read in at once, a free unit takes the lowest address waiting whatever order it was queued in.
+	int changed = 1;
+	while (changed)
+	{
+		changed = 0;
+		for (u32 u = 0; u < SDSIM_CMDQ_UNITS; u++)
+		{
+			u32 task = slot->unit_task[u];
+			if (task != SDSIM_CMDQ_NONE)
+			{
+				if (!_sdsim_after(now, slot->unit_due[u]))
+					continue;
+				slot->cmdq_ready |= 1 << task;
+				slot->unit_task[u] = SDSIM_CMDQ_NONE;
+			}
+
+			u32 next = SDSIM_CMDQ_NONE;
+			for (u32 i = 0; i < SDSIM_CMDQ_MAX_TASKS; i++)
+				if (slot->cmdq_queued & ~slot->cmdq_started & (1 << i) &&
+					(next == SDSIM_CMDQ_NONE || slot->tasks[i].sector < slot->tasks[next].sector))
+					next = i;
+			if (next == SDSIM_CMDQ_NONE)
+				continue;
+
+			//A unit that went idle before the task came in starts on its arrival.
+			u32 start = slot->unit_due[u];
+			if (_sdsim_after(slot->tasks[next].queued_at, start))
+				start = slot->tasks[next].queued_at;
+			slot->unit_task[u] = next;
+			slot->unit_due[u] = start + slot->card->read_us;
+			slot->cmdq_started |= 1 << next;
+			changed = 1;
+		}
+	}
+}
+
+static void _sdsim_cmdq_discard(sdsim_slot_t *slot, u32 mask)
+{
+	for (u32 u = 0; u < SDSIM_CMDQ_UNITS; u++)
+		if (slot->unit_task[u] != SDSIM_CMDQ_NONE && mask & (1 << slot->unit_task[u]))
+			slot->unit_task[u] = SDSIM_CMDQ_NONE;
+	slot->cmdq_queued &= ~mask;
+	slot->cmdq_started &= ~mask;
+	slot->cmdq_ready &= ~mask;
+}
+
+static int _sdsim_cmdq_cmd(sdsim_slot_t *slot, u32 cmd, u32 arg, u32 *r, u32 *busy_us)
+{
+	sdsim_card_t *card = slot->card;
+	u32 state = _sdsim_card_state(slot);
+	u32 now = host_now();
+	u32 task = (arg >> 16) & 0x1F;
+
+	if (state != R1_STATE_TRAN || !slot->ext_csd[EXT_CSD_CMDQ_MODE_EN])
+		return -1;
+
+	_sdsim_cmdq_update(slot, now);
+	switch (cmd)
+	{
+	case MMC_QUE_TASK_PARAMS:
+		//Read tasks only, with a free task ID.
+		if (!(arg & (1 << 30)) || task >= card->cmdq_depth || slot->cmdq_queued & (1 << task) || !(arg & 0xFFFF))
+		{
+			r[0] = _sdsim_r1(slot, state, R1_ERROR);
+			return 1;
+		}
+		slot->cmdq_param = arg;
+		r[0] = _sdsim_r1(slot, state, 0);
+		return 1;
+	case MMC_QUE_TASK_ADDR:
+	{
+		if (!slot->cmdq_param)
+			return -1;
+		u32 param = slot->cmdq_param;
+		slot->cmdq_param = 0;
+		task = (param >> 16) & 0x1F;
+		if (card->cmdq_error || arg + (param & 0xFFFF) > card->part_sectors[SDSIM_PART_USER])
+		{
+			r[0] = _sdsim_r1(slot, state, card->cmdq_error ? R1_ERROR : R1_OUT_OF_RANGE);
+			card->cmdq_error = 0;
+			return 1;
+		}
+		slot->tasks[task].sector = arg;
+		slot->tasks[task].num = param & 0xFFFF;
+		slot->tasks[task].seq = slot->cmdq_seq++;
+		slot->tasks[task].queued_at = now;
+		slot->cmdq_queued |= 1 << task;
+		_sdsim_cmdq_update(slot, now);
+		r[0] = _sdsim_r1(slot, state, 0);
+		return 1;
+	}
+	case MMC_EXECUTE_READ_TASK:
+	{
+		if (!(slot->cmdq_ready & (1 << task)))
+		{
+			r[0] = _sdsim_r1(slot, state, R1_ERROR);
+			return 1;
+		}
+
+		//Counts tasks that go ahead of one queued before them.
+		for (u32 i = 0; i < SDSIM_CMDQ_MAX_TASKS; i++)
+			if (slot->cmdq_queued & (1 << i) && slot->tasks[i].seq < slot->tasks[task].seq)
+			{
+				slot->stats.cmdq_out_of_order++;
+				break;
+			}
+		slot->stats.cmdq_tasks++;
+		_sdsim_cmdq_discard(slot, 1 << task);
+
+		_sdsim_xfer_mem(slot, slot->tasks[task].sector, 1, slot->tasks[task].num);
+		slot->xfer.is_ready = 1;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->state = R1_STATE_DATA;
+		return 1;
+	}
+	case MMC_CMDQ_TASK_MGMT:
+		//Discard the queue or one task.
+		if ((arg & 0xF) == 1)
+			_sdsim_cmdq_discard(slot, 0xFFFFFFFF);
+		else if ((arg & 0xF) == 2)
+			_sdsim_cmdq_discard(slot, 1 << task);
+		else
+			return -1;
+		slot->cmdq_param = 0;
+		r[0] = _sdsim_r1(slot, state, 0);
+		*busy_us = 10;
+		_sdsim_card_busy(slot, now + 10, R1_STATE_TRAN);
+		return 1;
+	}
+
+	return -1;
+}
+
+/*! Returns 0 if the card does not respond. */
+static int _sdsim_mmc_cmd(sdsim_slot_t *slot, u32 cmd, u32 arg, u32 *r, u32 *busy_us)
+{
+	sdsim_card_t *card = slot->card;
+	u32 state = _sdsim_card_state(slot);
+	u32 now = host_now();
+	int addressed = (arg >> 16) == slot->rca;
+
+	switch (cmd)
+	{
+	case MMC_GO_IDLE_STATE:
+		_sdsim_card_reset(slot);
+		return 0;
+	case MMC_SEND_OP_COND:
+		if (state != R1_STATE_IDLE)
+			break;
+		if (!slot->op_started)
+		{
+			slot->op_started = 1;
+			slot->op_ready = now + card->power_up_us;
+		}
+		r[0] = 0x40FF8080;
+		if (_sdsim_after(now, slot->op_ready))
+		{
+			r[0] |= MMC_CARD_BUSY;
+			slot->state = R1_STATE_READY;
+		}
+		return 1;
+	case MMC_ALL_SEND_CID:
+		if (state != R1_STATE_READY)
+			break;
+		_sdsim_cid(slot, r);
+		slot->state = R1_STATE_IDENT;
+		return 1;
+	case MMC_SET_RELATIVE_ADDR:
+		if (state != R1_STATE_IDENT || !(arg >> 16))
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->rca = arg >> 16;
+		slot->state = R1_STATE_STBY;
+		return 1;
+	case MMC_SEND_CSD:
+	case MMC_SEND_CID:
+		if (state != R1_STATE_STBY || !addressed)
+			break;
+		if (cmd == MMC_SEND_CSD)
+			_sdsim_csd(slot, r);
+		else
+			_sdsim_cid(slot, r);
+		return 1;
+	case MMC_SELECT_CARD:
+		if (!addressed)
+		{
+			if (state >= R1_STATE_TRAN)
+				slot->state = R1_STATE_STBY;
+			return 0;
+		}
+		if (state != R1_STATE_STBY)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->state = R1_STATE_TRAN;
+		*busy_us = 10;
+		return 1;
+	case MMC_SEND_STATUS:
+		if (!addressed || state < R1_STATE_STBY)
+			break;
+		//Bit 15 asks for the queue status instead.
+		if (arg & (1 << 15) && slot->ext_csd[EXT_CSD_CMDQ_MODE_EN])
+		{
+			_sdsim_cmdq_update(slot, now);
+			r[0] = slot->cmdq_ready;
+			return 1;
+		}
+		r[0] = _sdsim_r1(slot, state, 0);
+		return 1;
+	case MMC_SET_BLOCKLEN:
+		if (state != R1_STATE_TRAN)
+			break;
+		r[0] = _sdsim_r1(slot, state, arg != 512 ? R1_BLOCK_LEN_ERROR : 0);
+		return 1;
+	case MMC_QUE_TASK_PARAMS:
+	case MMC_QUE_TASK_ADDR:
+	case MMC_EXECUTE_READ_TASK:
+	case MMC_CMDQ_TASK_MGMT:
+	{
+		int res = _sdsim_cmdq_cmd(slot, cmd, arg, r, busy_us);
+		if (res < 0)
+			break;
+		return res;
+	}
+	case MMC_SWITCH:
+		if (state != R1_STATE_TRAN)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		if (!_sdsim_mmc_switch(slot, arg))
+			slot->status |= R1_SWITCH_ERROR;
+		*busy_us = card->busy_us;
+		_sdsim_card_busy(slot, now + card->busy_us, R1_STATE_TRAN);
+		return 1;
+	case MMC_SEND_EXT_CSD:
+		if (state != R1_STATE_TRAN)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		_sdsim_xfer_reg(slot, slot->ext_csd, 512);
+		slot->state = R1_STATE_DATA;
+		return 1;
+	case MMC_SET_BLOCK_COUNT:
+		if (state != R1_STATE_TRAN || slot->ext_csd[EXT_CSD_CMDQ_MODE_EN])
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->blk_count = arg & 0xFFFF;
+		return 1;
+	case MMC_READ_SINGLE_BLOCK:
+	case MMC_READ_MULTIPLE_BLOCK:
+	case MMC_WRITE_BLOCK:
+	case MMC_WRITE_MULTIPLE_BLOCK:
+	{
+		//Data only goes through tasks with the queue enabled.
+		if (state != R1_STATE_TRAN || slot->ext_csd[EXT_CSD_CMDQ_MODE_EN])
+			break;
+		int is_read = cmd == MMC_READ_SINGLE_BLOCK || cmd == MMC_READ_MULTIPLE_BLOCK;
+		u32 num = cmd == MMC_READ_SINGLE_BLOCK || cmd == MMC_WRITE_BLOCK ? 1 : slot->blk_count;
+		slot->blk_count = 0;
+		u32 err = _sdsim_xfer_mem(slot, arg, is_read, num);
+		r[0] = _sdsim_r1(slot, state, err);
+		if (!err)
+			slot->state = is_read ? R1_STATE_DATA : R1_STATE_RCV;
+		return 1;
+	}
+	case MMC_STOP_TRANSMISSION:
+		if (state != R1_STATE_DATA && state != R1_STATE_RCV)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->xfer.active = 0;
+		*busy_us = 10;
+		_sdsim_card_busy(slot, now + 10, R1_STATE_TRAN);
+		return 1;
+	}
+
+	slot->status |= R1_ILLEGAL_COMMAND;
+	slot->stats.illegal++;
+	return 0;
+}
+
+static int _sdsim_sd_cmd(sdsim_slot_t *slot, u32 cmd, u32 arg, u32 *r, u32 *busy_us)
+{
+	sdsim_card_t *card = slot->card;
+	u32 state = _sdsim_card_state(slot);
+	u32 now = host_now();
+	int addressed = (arg >> 16) == slot->rca;
+	int app_cmd = slot->app_cmd;
+	u8 buf[64];
+
+	slot->app_cmd = 0;
+	if (app_cmd)
+	{
+		switch (cmd)
+		{
+		case SD_APP_OP_COND:
+			if (state != R1_STATE_IDLE)
+				break;
+			r[0] = 0x00FF8000;
+			if (!(arg & 0xFF8000))
+				return 1;
+			if (!slot->op_started)
+			{
+				slot->op_started = 1;
+				slot->op_ready = now + card->power_up_us;
+			}
+			if (_sdsim_after(now, slot->op_ready))
+			{
+				r[0] |= MMC_CARD_BUSY | (arg & SD_OCR_CCS) | (arg & SD_OCR_S18R);
+				slot->state = R1_STATE_READY;
+			}
+			return 1;
+		case SD_APP_SET_BUS_WIDTH:
+			if (state != R1_STATE_TRAN || (arg & 3) == 1 || (arg & 3) == 3)
+				break;
+			r[0] = _sdsim_r1(slot, state, 0);
+			slot->sd_width = (arg & 3) == SD_BUS_WIDTH_4 ? 4 : 1;
+			return 1;
+		case SD_APP_SET_CLR_CARD_DETECT:
+			if (state != R1_STATE_TRAN)
+				break;
+			r[0] = _sdsim_r1(slot, state, 0);
+			return 1;
+		case SD_APP_SEND_SCR:
+			if (state != R1_STATE_TRAN)
+				break;
+			r[0] = _sdsim_r1(slot, state, 0);
+			memset(buf, 0, 8);
+			buf[0] = SCR_SPEC_VER_2;
+			buf[1] = SD_SCR_BUS_WIDTH_1 | SD_SCR_BUS_WIDTH_4;
+			buf[2] = 0x80; //Spec 3.0.
+			_sdsim_xfer_reg(slot, buf, 8);
+			slot->state = R1_STATE_DATA;
+			return 1;
+		case SD_APP_SD_STATUS:
+			if (state != R1_STATE_TRAN)
+				break;
+			r[0] = _sdsim_r1(slot, state, 0);
+			memset(buf, 0, 64);
+			buf[0] = slot->sd_width == 4 ? SD_BUS_WIDTH_4 << 6 : 0;
+			buf[8] = 4; //Class 10.
+			buf[14] = 0x10; //UHS grade 1.
+			_sdsim_xfer_reg(slot, buf, 64);
+			slot->state = R1_STATE_DATA;
+			return 1;
+		}
+		//Anything else is a regular command.
+	}
+
+	switch (cmd)
+	{
+	case MMC_GO_IDLE_STATE:
+		_sdsim_card_reset(slot);
+		return 0;
+	case SD_SEND_IF_COND:
+		if (state != R1_STATE_IDLE)
+			break;
+		r[0] = arg & 0xFFF;
+		return 1;
+	case MMC_APP_CMD:
+		if (state != R1_STATE_IDLE && (!addressed || state < R1_STATE_STBY))
+			break;
+		slot->app_cmd = 1;
+		r[0] = _sdsim_r1(slot, state, 0);
+		return 1;
+	case SD_SWITCH_VOLTAGE:
+		if (state != R1_STATE_READY)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		//The card drives the data lines low until the host restarts the clock at 1.8V.
+		if (!slot->s18)
+			slot->volt_switch = 1;
+		return 1;
+	case MMC_ALL_SEND_CID:
+		if (state != R1_STATE_READY)
+			break;
+		_sdsim_cid(slot, r);
+		slot->state = R1_STATE_IDENT;
+		return 1;
+	case SD_SEND_RELATIVE_ADDR:
+		if (state != R1_STATE_IDENT && state != R1_STATE_STBY)
+			break;
+		if (state == R1_STATE_IDENT)
+			slot->rca = 0x0001 + (slot - _sdsim_slots);
+		r[0] = (slot->rca << 16) | (_sdsim_r1(slot, state, 0) & 0x1FFF);
+		slot->state = R1_STATE_STBY;
+		return 1;
+	case MMC_SEND_CSD:
+	case MMC_SEND_CID:
+		if (state != R1_STATE_STBY || !addressed)
+			break;
+		if (cmd == MMC_SEND_CSD)
+			_sdsim_csd(slot, r);
+		else
+			_sdsim_cid(slot, r);
+		return 1;
+	case MMC_SELECT_CARD:
+		if (!addressed)
+		{
+			if (state >= R1_STATE_TRAN)
+				slot->state = R1_STATE_STBY;
+			return 0;
+		}
+		if (state != R1_STATE_STBY)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->state = R1_STATE_TRAN;
+		*busy_us = 10;
+		return 1;
+	case MMC_SEND_STATUS:
+		if (!addressed || state < R1_STATE_STBY)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		return 1;
+	case MMC_SET_BLOCKLEN:
+		if (state != R1_STATE_TRAN)
+			break;
+		r[0] = _sdsim_r1(slot, state, arg != 512 ? R1_BLOCK_LEN_ERROR : 0);
+		return 1;
+	case SD_SWITCH:
+		if (state != R1_STATE_TRAN)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		_sdsim_sd_switch(slot, arg, buf);
+		_sdsim_xfer_reg(slot, buf, 64);
+		slot->state = R1_STATE_DATA;
+		return 1;
+	case MMC_READ_SINGLE_BLOCK:
+	case MMC_READ_MULTIPLE_BLOCK:
+	case MMC_WRITE_BLOCK:
+	case MMC_WRITE_MULTIPLE_BLOCK:
+	{
+		if (state != R1_STATE_TRAN)
+			break;
+		int is_read = cmd == MMC_READ_SINGLE_BLOCK || cmd == MMC_READ_MULTIPLE_BLOCK;
+		u32 num = cmd == MMC_READ_SINGLE_BLOCK || cmd == MMC_WRITE_BLOCK ? 1 : 0;
+		u32 err = _sdsim_xfer_mem(slot, arg, is_read, num);
+		r[0] = _sdsim_r1(slot, state, err);
+		if (!err)
+			slot->state = is_read ? R1_STATE_DATA : R1_STATE_RCV;
+		return 1;
+	}
+	case MMC_STOP_TRANSMISSION:
+		if (state != R1_STATE_DATA && state != R1_STATE_RCV)
+			break;
+		r[0] = _sdsim_r1(slot, state, 0);
+		slot->xfer.active = 0;
+		*busy_us = 10;
+		_sdsim_card_busy(slot, now + 10, R1_STATE_TRAN);
+		return 1;
+	}
+
+	slot->status |= R1_ILLEGAL_COMMAND;
+	slot->stats.illegal++;
+	return 0;
+}
+
+static int _sdsim_card_cmd(sdsim_slot_t *slot, u32 cmd, u32 arg, u32 *r, u32 *busy_us)
+{
+	slot->stats.cmds++;
+	slot->stats.cmd_count[cmd & 63]++;
+	*busy_us = 0;
+	memset(r, 0, 16);
+	if (slot->card->is_sd)
+		return _sdsim_sd_cmd(slot, cmd, arg, r, busy_us);
+	return _sdsim_mmc_cmd(slot, cmd, arg, r, busy_us);
+}
+
+static int _sdsim_tuning_cmd_ok(sdsim_slot_t *slot, u32 cmd)
+{
+	//Tuning blocks are only sent in the modes that need tuning, on the bus width the card is set to.
+	if (_sdsim_card_state(slot) != R1_STATE_TRAN || _sdsim_card_width(slot) != _sdsim_host_width(slot))
+		return 0;
+	if (slot->card->is_sd)
+		return cmd == MMC_SEND_TUNING_BLOCK && slot->s18 &&
+			(slot->sd_func == UHS_SDR50_BUS_SPEED || slot->sd_func == UHS_SDR104_BUS_SPEED);
+	return cmd == MMC_SEND_TUNING_BLOCK_HS200 && slot->ext_csd[EXT_CSD_HS_TIMING] == EXT_CSD_TIMING_HS200;
+}
+
+/*
+* Controller.
+*/
+
+static int _sdsim_adma_walk(sdsim_slot_t *slot, u32 bytes)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	int desc64 = (regs->hostctl2 & (SDHCI_HOST_VERSION_4_EN | SDHCI_ADDRESSING_64BIT_EN)) ==
+		(SDHCI_HOST_VERSION_4_EN | SDHCI_ADDRESSING_64BIT_EN);
+	u32 desc_size = desc64 ? 16 : 8;
+	u32 addr = regs->admaaddr;
+	u32 total = 0;
+
+	slot->num_segs = 0;
+	if ((regs->hostctl & TEGRA_MMC_HOSTCTL_DMASEL_MASK) != TEGRA_MMC_HOSTCTL_DMASEL_ADMA2 || (desc64 && regs->admaaddr_hi))
+		return 0;
+
+	for (u32 i = 0; i < SDSIM_MAX_SEGS * 2 && total < bytes; i++)
+	{
+		if (!addr || (addr & (desc_size / 2 - 1)))
+			return 0;
+		u16 attr = *(u16 *)(unsigned long)addr;
+		u32 len = *(u16 *)(unsigned long)(addr + 2);
+		u32 daddr = *(u32 *)(unsigned long)(addr + 4);
+		u32 daddr_hi = desc64 ? *(u32 *)(unsigned long)(addr + 8) : 0;
+
+		if (!(attr & TEGRA_MMC_ADMA_VALID) || daddr_hi)
+			return 0;
+		if ((attr & TEGRA_MMC_ADMA_ACT_LINK) == TEGRA_MMC_ADMA_ACT_LINK)
+		{
+			addr = daddr;
+			continue;
+		}
+		if ((attr & TEGRA_MMC_ADMA_ACT_LINK) == TEGRA_MMC_ADMA_ACT_TRAN)
+		{
+			if (!len)
+				len = 0x10000;
+			if ((daddr & (desc_size / 2 - 1)) || slot->num_segs == SDSIM_MAX_SEGS)
+				return 0;
+			len = MIN(len, bytes - total);
+			slot->segs[slot->num_segs].addr = daddr;
+			slot->segs[slot->num_segs].len = len;
+			slot->num_segs++;
+			total += len;
+		}
+		if (attr & TEGRA_MMC_ADMA_END)
+			break;
+		addr += desc_size;
+	}
+
+	return total >= bytes;
+}
+
+static void _sdsim_dma(sdsim_slot_t *slot, u32 blocks)
+{
+	sdsim_xfer_t *xfer = &slot->xfer;
+	u32 left = blocks * slot->dat_blksize;
+	u8 *mem = xfer->mem;
+
+	for (u32 i = 0; i < slot->num_segs && left; i++)
+	{
+		u32 len = MIN(slot->segs[i].len, left);
+		void *host = (void *)(unsigned long)slot->segs[i].addr;
+		if (slot->dat_is_read)
+			memcpy(host, mem, len);
+		else
+			memcpy(mem, host, len);
+		mem += len;
+		left -= len;
+	}
+}
+
+//The card's side of a transfer, sized ones go back to tran on their own after the last block.
+static void _sdsim_card_sent(sdsim_slot_t *slot, u32 blocks)
+{
+	sdsim_xfer_t *xfer = &slot->xfer;
+
+	if (xfer->is_mem)
+		xfer->mem += blocks * xfer->blksize;
+	xfer->avail -= MIN(blocks, xfer->avail);
+	if (!xfer->num)
+		return;
+	xfer->num -= MIN(blocks, xfer->num);
+	if (!xfer->num)
+	{
+		xfer->active = 0;
+		if (slot->state == R1_STATE_DATA || slot->state == R1_STATE_RCV)
+			slot->state = R1_STATE_TRAN;
+		slot->sd_func = slot->sd_func_next;
+	}
+}
+
+static void _sdsim_start_data(sdsim_slot_t *slot, u32 khz)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	sdsim_xfer_t *xfer = &slot->xfer;
+	u16 trnmod = regs->trnmod;
+	u32 now = slot->cmd_due;
+
+	slot->dat_busy = 1;
+	slot->dat_is_read = (trnmod & TEGRA_MMC_TRNMOD_DATA_XFER_DIR_SEL_READ) != 0;
+	slot->dat_blksize = regs->blksize & 0xFFF;
+	slot->dat_blocks = trnmod & TEGRA_MMC_TRNMOD_MULTI_BLOCK_SELECT ?
+		(trnmod & TEGRA_MMC_TRNMOD_BLOCK_COUNT_ENABLE ? regs->blkcnt : 0xFFFF) : 1;
+	slot->dat_counted = (trnmod & (TEGRA_MMC_TRNMOD_MULTI_BLOCK_SELECT | TEGRA_MMC_TRNMOD_BLOCK_COUNT_ENABLE)) ==
+		(TEGRA_MMC_TRNMOD_MULTI_BLOCK_SELECT | TEGRA_MMC_TRNMOD_BLOCK_COUNT_ENABLE);
+	slot->dat_auto12 = (trnmod & TEGRA_MMC_TRNMOD_AUTO_CMD12) != 0;
+	slot->dat_err = 0;
+	slot->dat_ok = slot->dat_blocks;
+
+	u32 width = _sdsim_host_width(slot);
+	u32 ddr = _sdsim_host_ddr(slot) ? 2 : 1;
+	u32 blk_cycles = slot->dat_blksize * 8 / (width * ddr) + SDSIM_BLK_CYCLES;
+	slot->blk_ns = (u32)((u64)blk_cycles * 1000000 / (khz ? khz : 1));
+
+	u32 start = now;
+	if (xfer->active && xfer->is_read)
+		start += xfer->is_mem ? (xfer->is_ready ? 0 : slot->card->read_us) : _sdsim_cycles_us(SDSIM_REG_NAC, khz);
+	slot->dat_start = start;
+
+	//Host side setup first, then whatever the card does with the lines.
+	u16 err = 0;
+	u32 ok = slot->dat_blocks;
+	if (!(trnmod & TEGRA_MMC_TRNMOD_DMA_ENABLE) || !_sdsim_adma_walk(slot, slot->dat_blocks * slot->dat_blksize))
+	{
+		slot->stats.violations++;
+		regs->admaerr = 1;
+		err = TEGRA_MMC_ERRINTSTS_ADMA_ERROR;
+		ok = 0;
+	}
+	else if (!xfer->active || xfer->is_read != slot->dat_is_read)
+	{
+		//The card is not sending, the host times out.
+		err = TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT;
+		ok = 0;
+		start = now + _sdsim_cycles_us(1 << (13 + (regs->timeoutcon & 0xF)), SDSIM_TMCLK_KHZ);
+	}
+	else if (xfer->blksize != slot->dat_blksize)
+	{
+		err = TEGRA_MMC_ERRINTSTS_DATA_END_BIT;
+		ok = 0;
+	}
+	else if (width != _sdsim_card_width(slot) || (ddr == 2) != _sdsim_card_ddr(slot) ||
+		khz > _sdsim_card_max_khz(slot) || (slot->dat_is_read && !_sdsim_tap_ok(slot, khz)))
+	{
+		slot->stats.crc_errors++;
+		err = TEGRA_MMC_ERRINTSTS_DATA_CRC;
+		ok = 0;
+		//The card did not take a block, nothing gets written.
+		if (!slot->dat_is_read)
+			xfer->active = 0;
+	}
+	else if (slot->dat_blocks > xfer->avail)
+	{
+		err = TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT;
+		ok = xfer->avail;
+	}
+	else if (xfer->num && slot->dat_blocks > xfer->num)
+	{
+		err = TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT;
+		ok = xfer->num;
+	}
+
+	slot->dat_ok = ok;
+	slot->dat_end = start + (u32)(((u64)ok * slot->blk_ns + 999) / 1000);
+	slot->dat_due = slot->dat_end;
+	if (err)
+	{
+		slot->dat_err = err;
+		slot->dat_err_at = slot->dat_end + (err == TEGRA_MMC_ERRINTSTS_DATA_CRC ? (slot->blk_ns + 999) / 1000 : 0);
+		if (err == TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT && ok)
+			slot->dat_err_at += _sdsim_cycles_us(1 << (13 + (regs->timeoutcon & 0xF)), SDSIM_TMCLK_KHZ);
+		return;
+	}
+
+	//Auto CMD12 after the last block and the card's programming time.
+	u32 cmd12_us = _sdsim_cycles_us(SDSIM_CMD_CYCLES * 2 + SDSIM_RSP_GAP, khz);
+	if (slot->dat_auto12)
+		slot->dat_due += cmd12_us;
+	if (!slot->dat_is_read)
+		slot->dat_due += slot->card->write_us;
+}
+
+static void _sdsim_finish_data(sdsim_slot_t *slot)
+{
+	u32 blocks = slot->dat_ok;
+
+	_sdsim_dma(slot, blocks);
+	if (slot->dat_is_read)
+		slot->stats.read_blocks += blocks;
+	else
+		slot->stats.write_blocks += blocks;
+	slot->stats.data_us += slot->dat_end - slot->dat_start;
+
+	//Reads the host garbled still went out in full.
+	if (slot->xfer.active)
+		_sdsim_card_sent(slot, slot->dat_err == TEGRA_MMC_ERRINTSTS_DATA_CRC && slot->dat_is_read ? slot->dat_blocks : blocks);
+}
+
+static void _sdsim_end_data(sdsim_slot_t *slot)
+{
+	t210_sdmmc_t *regs = slot->regs;
+
+	_sdsim_finish_data(slot);
+	if (slot->dat_counted)
+		regs->blkcnt = 0;
+
+	if (slot->dat_auto12)
+	{
+		slot->stats.cmds++;
+		slot->stats.cmd_count[MMC_STOP_TRANSMISSION]++;
+		regs->rspreg3 = _sdsim_r1(slot, slot->state, 0);
+		slot->xfer.active = 0;
+		slot->state = R1_STATE_TRAN;
+	}
+
+	regs->prnsts &= ~SDSIM_PRNSTS_DAT_INHIBIT;
+	slot->dat_busy = 0;
+	_sdsim_raise(slot, TEGRA_MMC_NORINTSTS_XFER_COMPLETE);
+}
+
+static void _sdsim_start(sdsim_slot_t *slot)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	u16 cmdreg = regs->cmdreg;
+	u32 cmd = cmdreg >> 8;
+	u32 rsp_type = cmdreg & TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_MASK;
+	int data = (cmdreg & TEGRA_MMC_TRNMOD_DATA_PRESENT_SELECT_DATA_TRANSFER) != 0;
+	u32 khz = _sdsim_khz(slot);
+	u32 now = host_now();
+
+	slot->cmd_wait_clk = 0;
+	slot->cmd_busy = 1;
+	slot->cmd_err = 0;
+	slot->cmd_due = now + _sdsim_cycles_us(SDSIM_CMD_CYCLES * 2 + SDSIM_RSP_GAP +
+		(rsp_type == TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_LENGTH_136 ? 88 : 0), khz);
+
+	if (!slot->card)
+	{
+		slot->cmd_err = TEGRA_MMC_ERRINTSTS_CMD_TIMEOUT;
+		return;
+	}
+
+	//A card that can't keep up with the clock sees garbage and the host gets garbage back.
+	if (khz > _sdsim_card_max_khz(slot))
+	{
+		slot->stats.crc_errors++;
+		slot->status |= R1_COM_CRC_ERROR;
+		slot->cmd_err = TEGRA_MMC_ERRINTSTS_CMD_CRC;
+		return;
+	}
+
+	u32 busy_us;
+	slot->xfer.active = slot->xfer.active && (slot->state == R1_STATE_DATA || slot->state == R1_STATE_RCV);
+	if (!_sdsim_card_cmd(slot, cmd, regs->argument, slot->rsp, &busy_us))
+	{
+		if (rsp_type != TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_NO_RESPONSE)
+			slot->cmd_err = TEGRA_MMC_ERRINTSTS_CMD_TIMEOUT;
+		return;
+	}
+
+	if (data)
+		_sdsim_start_data(slot, khz);
+	else if (rsp_type == TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_LENGTH_48_BUSY)
+	{
+		slot->dat_busy = 1;
+		slot->dat_is_read = 0;
+		slot->dat_err = 0;
+		slot->dat_ok = 0;
+		slot->dat_counted = 0;
+		slot->dat_auto12 = 0;
+		slot->num_segs = 0;
+		slot->dat_start = slot->dat_end = slot->cmd_due;
+		slot->dat_due = slot->cmd_due + busy_us;
+	}
+}
+
+static void _sdsim_issue(sdsim_slot_t *slot)
+{
+	t210_sdmmc_t *regs = slot->regs;
+	u16 cmdreg = regs->cmdreg;
+	u32 cmd = cmdreg >> 8;
+	int uses_dat = (cmdreg & TEGRA_MMC_TRNMOD_DATA_PRESENT_SELECT_DATA_TRANSFER) ||
+		(cmdreg & TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_MASK) == TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_LENGTH_48_BUSY;
+
+	if (!_sdsim_running(slot))
+	{
+		slot->stats.violations++;
+		return;
+	}
+
+	//Tuning commands are run by the tuning engine, one block at a time.
+	if (regs->hostctl2 & SDHCI_CTRL_EXEC_TUNING && (cmd == MMC_SEND_TUNING_BLOCK || cmd == MMC_SEND_TUNING_BLOCK_HS200))
+	{
+		slot->tuning_cmd = cmd;
+		slot->tuning_started = 0;
+		return;
+	}
+
+	if (regs->prnsts & SDSIM_PRNSTS_CMD_INHIBIT || (uses_dat && regs->prnsts & SDSIM_PRNSTS_DAT_INHIBIT))
+	{
+		slot->stats.violations++;
+		return;
+	}
+
+	regs->prnsts |= SDSIM_PRNSTS_CMD_INHIBIT | (uses_dat ? SDSIM_PRNSTS_DAT_INHIBIT : 0);
+	if (!(regs->clkcon & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE))
+		slot->cmd_wait_clk = 1;
+	else
+		_sdsim_start(slot);
+}
+
+static void _sdsim_tuning_step(sdsim_slot_t *slot, u32 now)
+{
+	t210_sdmmc_t *regs = slot->regs;
+
+	if (!slot->tuning_started)
+	{
+		if (!_sdsim_clk_on(slot))
+			return;
+		u32 khz = _sdsim_khz(slot);
+		u32 blk = regs->blksize & 0xFFF;
+		slot->tuning_started = 1;
+		slot->tuning_due = now + _sdsim_cycles_us(SDSIM_CMD_CYCLES * 2 + SDSIM_RSP_GAP + SDSIM_REG_NAC +
+			blk * 8 / _sdsim_host_width(slot) + SDSIM_BLK_CYCLES, khz);
+		slot->stats.cmds++;
+		slot->stats.cmd_count[slot->tuning_cmd]++;
+		slot->tuning_ok = slot->card && _sdsim_tuning_cmd_ok(slot, slot->tuning_cmd) &&
+			khz <= _sdsim_card_max_khz(slot) && blk == _sdsim_host_width(slot) * 16;
+		if (!slot->tuning_ok)
+			slot->stats.crc_errors++;
+		return;
+	}
+	if (!_sdsim_after(now, slot->tuning_due))
+		return;
+
+	slot->tuning_cmd = 0;
+	if (!slot->tuning_ok || !slot->tuning_left)
+		return;
+
+	_sdsim_raise(slot, SDSIM_NORINTSTS_BRR);
+	if (--slot->tuning_left)
+		return;
+
+	//Sweep done, sample in the middle of the window that passed.
+	static const u32 iters[] = { 40, 64, 128, 192, 256 };
+	u32 lo = slot->card->tap_lo;
+	u32 hi = MIN(slot->card->tap_hi, iters[MIN((regs->field_1C0 >> 13) & 7, 4)] - 1);
+	regs->hostctl2 &= ~SDHCI_CTRL_EXEC_TUNING;
+	if (lo <= hi)
+	{
+		regs->venclkctl = (regs->venclkctl & 0xFF00FFFF) | (((lo + hi) / 2) << 16);
+		regs->hostctl2 |= SDHCI_CTRL_TUNED_CLK;
+		slot->stats.tunings++;
+	}
+}
+
+static void _sdsim_slot_step(sdsim_slot_t *slot, u32 now)
+{
+	t210_sdmmc_t *regs = slot->regs;
+
+	if (slot->cmd_busy && _sdsim_after(now, slot->cmd_due))
+	{
+		slot->cmd_busy = 0;
+		regs->prnsts &= ~SDSIM_PRNSTS_CMD_INHIBIT;
+		if (slot->cmd_err)
+		{
+			//The data phase never starts, the host has to reset the lines.
+			slot->dat_busy = 0;
+			_sdsim_raise_err(slot, slot->cmd_err);
+		}
+		else
+		{
+			u32 *r = slot->rsp;
+			if ((regs->cmdreg & TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_MASK) == TEGRA_MMC_CMDREG_RESP_TYPE_SELECT_LENGTH_136)
+			{
+				//CRC stripped.
+				regs->rspreg3 = r[0] >> 8;
+				regs->rspreg2 = (r[0] << 24) | (r[1] >> 8);
+				regs->rspreg1 = (r[1] << 24) | (r[2] >> 8);
+				regs->rspreg0 = (r[2] << 24) | (r[3] >> 8);
+			}
+			else
+				regs->rspreg0 = r[0];
+			_sdsim_raise(slot, TEGRA_MMC_NORINTSTS_CMD_COMPLETE);
+		}
+	}
+
+	if (slot->dat_busy && !slot->cmd_busy)
+	{
+		if (slot->dat_err)
+		{
+			if (_sdsim_after(now, slot->dat_err_at))
+			{
+				//Whatever made it before the error is in memory, the lines stay inhibited until reset.
+				_sdsim_finish_data(slot);
+				if (slot->dat_counted)
+					regs->blkcnt = slot->dat_blocks - slot->dat_ok;
+				slot->dat_busy = 0;
+				_sdsim_raise_err(slot, slot->dat_err);
+			}
+		}
+		else if (_sdsim_after(now, slot->dat_due))
+			_sdsim_end_data(slot);
+		else if (slot->dat_counted && slot->blk_ns && _sdsim_after(now, slot->dat_start))
+		{
+			u32 done = (u32)((u64)(now - slot->dat_start) * 1000 / slot->blk_ns);
+			regs->blkcnt = slot->dat_blocks - MIN(done, slot->dat_blocks);
+		}
+	}
+
+	if (slot->tuning_cmd)
+		_sdsim_tuning_step(slot, now);
+
+	_sdsim_update_prnsts(slot);
+}
+
+static void _sdsim_step(u32 now)
+{
+	for (u32 i = 0; i < SDSIM_NUM_SLOTS; i++)
+		if (!_sdsim_slots[i].car_reset)
+			_sdsim_slot_step(&_sdsim_slots[i], now);
+}
+
+static void _sdsim_wr_clkcon(sdsim_slot_t *slot, u16 old, u16 val)
+{
+	t210_sdmmc_t *regs = slot->regs;
+
+	if (val & TEGRA_MMC_CLKCON_INTERNAL_CLOCK_ENABLE)
+		val |= TEGRA_MMC_CLKCON_INTERNAL_CLOCK_STABLE;
+	else
+		val &= ~TEGRA_MMC_CLKCON_INTERNAL_CLOCK_STABLE;
+	regs->clkcon = val;
+
+	//Divider changes with the clock running glitch the card.
+	if (old & val & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE && (old ^ val) & 0xFFC0)
+		slot->stats.violations++;
+	if (slot->dat_busy && !(val & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE) && !_sdsim_after(host_now(), slot->dat_end))
+		slot->stats.violations++;
+
+	if (!(~old & val & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE) || !_sdsim_running(slot))
+		return;
+
+	if (slot->volt_switch && regs->hostctl2 & SDHCI_CTRL_VDD_180)
+	{
+		slot->volt_switch = 0;
+		slot->s18 = 1;
+	}
+	if (slot->cmd_wait_clk)
+		_sdsim_start(slot);
+}
+
+static void _sdsim_wr(u32 addr, u32 old, u32 val)
+{
+	u32 off = addr - SDMMC_BASE;
+	u32 id = off / SDMMC_SIZE;
+	if (id >= SDSIM_NUM_SLOTS)
+		return;
+	sdsim_slot_t *slot = &_sdsim_slots[id];
+	t210_sdmmc_t *regs = slot->regs;
+	u32 shift = (off & 2) * 8;
+	off &= SDMMC_SIZE - 1;
+
+	if (slot->car_reset || !slot->car_clk)
+	{
+		//Held in reset or without a clock the access aborts on the real bus, the driver would never get past it.
+		fprintf(stderr, "sdsim: SDMMC%d register %03X written while in reset or gated\n", id + 1, off);
+		exit(1);
+	}
+
+	switch (off)
+	{
+	case offsetof(t210_sdmmc_t, cmdreg):
+		_sdsim_issue(slot);
+		break;
+	case offsetof(t210_sdmmc_t, clkcon):
+		_sdsim_wr_clkcon(slot, old, val);
+		break;
+	case offsetof(t210_sdmmc_t, swrst):
+		if (val & (TEGRA_MMC_SWRST_SW_RESET_FOR_ALL << 24))
+		{
+			_sdsim_reset_regs(slot);
+			break;
+		}
+		if (val & (TEGRA_MMC_SWRST_SW_RESET_FOR_CMD_LINE << 24))
+		{
+			slot->cmd_busy = 0;
+			slot->cmd_wait_clk = 0;
+			regs->prnsts &= ~SDSIM_PRNSTS_CMD_INHIBIT;
+		}
+		if (val & (TEGRA_MMC_SWRST_SW_RESET_FOR_DAT_LINE << 24))
+		{
+			slot->dat_busy = 0;
+			regs->prnsts &= ~SDSIM_PRNSTS_DAT_INHIBIT;
+		}
+		regs->swrst = 0;
+		_sdsim_update_prnsts(slot);
+		break;
+	case offsetof(t210_sdmmc_t, norintsts):
+	case offsetof(t210_sdmmc_t, errintsts):
+	{
+		//Write 1 to clear, the error summary follows the error bits.
+		u16 bits = val >> shift;
+		u16 prev = old >> shift;
+		if (off == offsetof(t210_sdmmc_t, norintsts))
+			regs->norintsts = prev & ~bits;
+		else
+			regs->errintsts = prev & ~bits;
+		if (regs->errintsts)
+			regs->norintsts |= TEGRA_MMC_NORINTSTS_ERR_INTERRUPT;
+		else
+			regs->norintsts &= ~TEGRA_MMC_NORINTSTS_ERR_INTERRUPT;
+		break;
+	}
+	case offsetof(t210_sdmmc_t, hostctl2):
+		if (~(old >> 16) & val >> 16 & SDHCI_CTRL_EXEC_TUNING)
+		{
+			static const u32 iters[] = { 40, 64, 128, 192, 256 };
+			slot->tuning_left = iters[MIN((regs->field_1C0 >> 13) & 7, 4)];
+			regs->hostctl2 &= ~SDHCI_CTRL_TUNED_CLK;
+		}
+		break;
+	case offsetof(t210_sdmmc_t, venclkctl):
+		if ((old ^ val) & 0xFF0000 && regs->clkcon & TEGRA_MMC_CLKCON_SD_CLOCK_ENABLE)
+			slot->stats.violations++;
+		break;
+	case offsetof(t210_sdmmc_t, field_1B0):
+	case offsetof(t210_sdmmc_t, field_1BC):
+	case offsetof(t210_sdmmc_t, autocalcfg):
+		//DLL and pad calibration finish right away.
+		*(vu32 *)(unsigned long)addr &= 0x7FFFFFFF;
+		break;
+	}
+}
+
+static void _sdsim_car_wr(u32 addr, u32 old, u32 val)
+{
+	u32 off = addr - CLOCK_BASE;
+	u32 bank = 0;
+
+	switch (off)
+	{
+	case CLK_RST_CONTROLLER_RST_DEV_L_SET:
+	case CLK_RST_CONTROLLER_RST_DEV_U_SET:
+		bank = off == CLK_RST_CONTROLLER_RST_DEV_U_SET ? 8 : 0;
+		CLOCK(CLK_RST_CONTROLLER_RST_DEVICES_L + bank) |= val;
+		break;
+	case CLK_RST_CONTROLLER_RST_DEV_L_CLR:
+	case CLK_RST_CONTROLLER_RST_DEV_U_CLR:
+		bank = off == CLK_RST_CONTROLLER_RST_DEV_U_CLR ? 8 : 0;
+		CLOCK(CLK_RST_CONTROLLER_RST_DEVICES_L + bank) &= ~val;
+		break;
+	case CLK_RST_CONTROLLER_CLK_ENB_L_SET:
+	case CLK_RST_CONTROLLER_CLK_ENB_U_SET:
+		bank = off == CLK_RST_CONTROLLER_CLK_ENB_U_SET ? 8 : 0;
+		CLOCK(CLK_RST_CONTROLLER_CLK_OUT_ENB_L + bank) |= val;
+		break;
+	case CLK_RST_CONTROLLER_CLK_ENB_L_CLR:
+	case CLK_RST_CONTROLLER_CLK_ENB_U_CLR:
+		bank = off == CLK_RST_CONTROLLER_CLK_ENB_U_CLR ? 8 : 0;
+		CLOCK(CLK_RST_CONTROLLER_CLK_OUT_ENB_L + bank) &= ~val;
+		break;
+	default:
+		for (u32 i = 0; i < SDSIM_NUM_SLOTS; i++)
+			if (off == _sdsim_car_src[i] && _sdsim_clk_on(&_sdsim_slots[i]) && old != val)
+				_sdsim_slots[i].stats.violations++;
+		return;
+	}
+
+	for (u32 i = 0; i < SDSIM_NUM_SLOTS; i++)
+	{
+		sdsim_slot_t *slot = &_sdsim_slots[i];
+		u32 bit = _sdsim_car_bit[i];
+		int reset = (CLOCK(CLK_RST_CONTROLLER_RST_DEVICES_L + _sdsim_car_bank[i]) & bit) != 0;
+		int clk = (CLOCK(CLK_RST_CONTROLLER_CLK_OUT_ENB_L + _sdsim_car_bank[i]) & bit) != 0;
+
+		//Work in flight is lost along with the registers.
+		if (reset && !slot->car_reset)
+		{
+			if (slot->cmd_busy || slot->dat_busy)
+				slot->stats.violations++;
+			_sdsim_reset_regs(slot);
+		}
+		if (!clk && slot->car_clk && (slot->cmd_busy || slot->dat_busy))
+			slot->stats.violations++;
+		slot->car_reset = reset;
+		slot->car_clk = clk;
+	}
+}
+
+void sdsim_init()
+{
+	host_mmio_map(SDMMC_BASE, 0x1000, NULL, _sdsim_wr);
+	host_mmio_map(CLOCK_BASE, 0x1000, NULL, _sdsim_car_wr);
+	host_mmio_map(GPIO_BASE, 0x1000, NULL, NULL);
+	//APB misc, pinmux and PMC.
+	host_mmio_map(APB_MISC_BASE, 0x10000, NULL, NULL);
+
+	host_mmio_open();
+	memset(_sdsim_slots, 0, sizeof(_sdsim_slots));
+	for (u32 i = 0; i < SDSIM_NUM_SLOTS; i++)
+		memset(_sdsim_slots[i].unit_task, SDSIM_CMDQ_NONE, sizeof(_sdsim_slots[i].unit_task));
+	for (u32 i = 0; i < SDSIM_NUM_SLOTS; i++)
+	{
+		sdsim_slot_t *slot = &_sdsim_slots[i];
+		slot->regs = (t210_sdmmc_t *)(unsigned long)(SDMMC_BASE + i * SDMMC_SIZE);
+		//Out of reset with the clocks gated, as the bootrom leaves them.
+		slot->car_reset = 1;
+		CLOCK(CLK_RST_CONTROLLER_RST_DEVICES_L + _sdsim_car_bank[i]) |= _sdsim_car_bit[i];
+		_sdsim_reset_regs(slot);
+	}
+	host_mmio_close();
+
+	host_add_dev(_sdsim_step);
+}
+
+void sdsim_card_init(sdsim_card_t *card, int is_sd, u32 sectors)
+{
+	memset(card, 0, sizeof(sdsim_card_t));
+	card->is_sd = is_sd;
+	card->part[SDSIM_PART_USER] = (u8 *)calloc(sectors, 512);
+	card->part_sectors[SDSIM_PART_USER] = sectors;
+	if (!is_sd)
+	{
+		for (u32 i = SDSIM_PART_BOOT0; i <= SDSIM_PART_BOOT1; i++)
+		{
+			card->part[i] = (u8 *)calloc(SDSIM_MMC_BOOT_SECTORS, 512);
+			card->part_sectors[i] = SDSIM_MMC_BOOT_SECTORS;
+		}
+	}
+
+	card->power_up_us = is_sd ? 20000 : 5000;
+	card->read_us = is_sd ? 150 : 60;
+	card->write_us = is_sd ? 800 : 300;
+	card->busy_us = 50;
+	card->tap_lo = SDSIM_TAP_LO;
+	card->tap_hi = SDSIM_TAP_HI;
+	card->cmdq_depth = is_sd ? 0 : SDSIM_CMDQ_MAX_TASKS;
+}
+
+int sdsim_card_load(sdsim_card_t *card, u32 part, const char *path)
+{
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < 512)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return 0;
+
+	free(card->part[part]);
+	card->part[part] = (u8 *)mem;
+	card->part_sectors[part] = st.st_size / 512;
+	return 1;
+}
+
+void sdsim_attach(u32 id, sdsim_card_t *card)
+{
+	host_mmio_open();
+	_sdsim_card_insert(&_sdsim_slots[id], card);
+	_sdsim_update_prnsts(&_sdsim_slots[id]);
+	host_mmio_close();
+}
+
+void sdsim_get_stats(u32 id, sdsim_stats_t *stats)
+{
+	memcpy(stats, &_sdsim_slots[id].stats, sizeof(sdsim_stats_t));
+}
+
+void sdsim_clear_stats(u32 id)
+{
+	memset(&_sdsim_slots[id].stats, 0, sizeof(sdsim_stats_t));
+}
+
+void sdsim_get_state(u32 id, sdsim_state_t *state)
+{
+	sdsim_slot_t *slot = &_sdsim_slots[id];
+
+	host_mmio_open();
+	memset(state, 0, sizeof(sdsim_state_t));
+	state->khz = _sdsim_running(slot) ? _sdsim_khz(slot) : 0;
+	state->width = _sdsim_host_width(slot);
+	state->ddr = _sdsim_host_ddr(slot);
+	state->tap = (slot->regs->venclkctl >> 16) & 0xFF;
+	if (slot->card)
+	{
+		state->card_state = _sdsim_card_state(slot);
+		state->timing = slot->card->is_sd ? slot->sd_func : slot->ext_csd[EXT_CSD_HS_TIMING];
+		state->partition = slot->card->is_sd ? 0 : slot->ext_csd[EXT_CSD_PART_CONFIG] & EXT_CSD_PART_CONFIG_ACC_MASK;
+		state->low_voltage = slot->s18;
+		state->cmdq = slot->ext_csd[EXT_CSD_CMDQ_MODE_EN];
+	}
+	host_mmio_close();
+}
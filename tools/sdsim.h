@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SDSIM_H_
+#define _SDSIM_H_
+
+#include "types.h"
+
+/*! Partitions of a card, SD cards only have the user area. */
+#define SDSIM_PART_USER  0
+#define SDSIM_PART_BOOT0 1
+#define SDSIM_PART_BOOT1 2
+#define SDSIM_MAX_PARTS  3
+
+/*! Card defaults, see sdsim_card_init(). */
+#define SDSIM_MMC_BOOT_SECTORS 0x2000
+#define SDSIM_TAP_LO 0x30
+#define SDSIM_TAP_HI 0x70
+
+/*! eMMC or SD card behind one of the controllers, the cost model fields can be changed at any time. */
+typedef struct _sdsim_card_t
+{
+	int is_sd;
+	u8 *part[SDSIM_MAX_PARTS];
+	u32 part_sectors[SDSIM_MAX_PARTS];
+	u32 power_up_us; //Op cond reports busy for this long after the first one.
+	u32 read_us;     //Access time before the first block of a read.
+	u32 write_us;    //Programming time after the last block of a write.
+	u32 busy_us;     //Busy after switches and selects.
+	u32 tap_lo;      //Taps that sample reads right once the bus runs above 100MHz, empty if tap_lo > tap_hi.
+	u32 tap_hi;
+	u32 cmdq_depth;  //Command queue tasks, 0 without one. Read when the card is attached.
+	int cmdq_error;  //Fails the next task queued with a general error.
+} sdsim_card_t;
+
+typedef struct _sdsim_stats_t
+{
+	u32 cmds;          //Commands the card got, auto CMD12 included.
+	u32 cmd_count[64];
+	u32 read_blocks;
+	u32 write_blocks;
+	u32 data_us;       //Time the data lines were busy with transfers.
+	u32 tunings;       //Tuning runs that found a tap.
+	u32 crc_errors;    //Responses and blocks garbled by a bus setup the card is not in or a bad tap.
+	u32 illegal;       //Commands the card did not take in its state.
+	u32 violations;    //Commands issued while inhibited or held in reset, clock or tap changes with the SD clock running.
+	u32 cmdq_tasks;    //Command queue tasks executed.
+	u32 cmdq_out_of_order; //Tasks executed ahead of one queued before them.
+} sdsim_stats_t;
+
+/*! What the bus and card are set to. */
+typedef struct _sdsim_state_t
+{
+	u32 khz;       //SD clock.
+	u32 width;     //Host data lines.
+	int ddr;
+	u32 tap;
+	u32 card_state; //R1 current state.
+	u32 timing;    //EXT_CSD HS_TIMING for MMC, function group 1 for SD.
+	u32 partition;
+	int low_voltage;
+	int cmdq;      //Command queue enabled.
+} sdsim_state_t;
+
+/*! Model of the T210 SDMMC controllers at SDMMC_BASE and the clock, pad and PMC registers the driver touches. */
+void sdsim_init();
+/*! Fills in the cost model defaults and zeroed partitions, sectors is the user area size and a multiple of 1024. */
+void sdsim_card_init(sdsim_card_t *card, int is_sd, u32 sectors);
+/*! Backs a partition with a disk image instead, writes go to the file. */
+int sdsim_card_load(sdsim_card_t *card, u32 part, const char *path);
+/*! Plugs the card into controller id, NULL removes it. */
+void sdsim_attach(u32 id, sdsim_card_t *card);
+void sdsim_get_stats(u32 id, sdsim_stats_t *stats);
+void sdsim_clear_stats(u32 id);
+void sdsim_get_state(u32 id, sdsim_state_t *state);
+
+#endif
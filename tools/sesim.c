@@ -0,0 +1,376 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "sesim.h"
+#include "t210.h"
+#include "se_t210.h"
+
+#define SE_REG(off) (*(vu32 *)(unsigned long)(SE_BASE + (off)))
+
+static const u8 _aes_sbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+};
+static u8 _aes_inv_sbox[256];
+
+static const u32 _sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+//Registers latched when an operation starts.
+typedef struct _sesim_op_t
+{
+	u32 config;
+	u32 crypto;
+	u32 blkcnt;
+	u32 ctr[4];
+	u32 in_ll;
+	u32 out_ll;
+	u32 keytab_dst;
+} sesim_op_t;
+
+static u32 _sesim_keys[TEGRA_SE_KEYSLOT_COUNT][SE_KEYTABLE_REG_MAX_DATA];
+static sesim_op_t _sesim_op;
+static int _sesim_busy;
+static u32 _sesim_start;
+static u32 _sesim_done;
+static sesim_stats_t _sesim_stats;
+
+static u8 _gmul(u8 a, u8 b)
+{
+	u8 res = 0;
+	while (b)
+	{
+		if (b & 1)
+			res ^= a;
+		a = (a << 1) ^ (a & 0x80 ? 0x1B : 0);
+		b >>= 1;
+	}
+	return res;
+}
+
+void sesim_aes128(const u8 *key, int enc, u8 *dst, const u8 *src)
+{
+	u8 rk[176];
+	u8 s[16], t[16];
+
+	//Key expansion.
+	memcpy(rk, key, 16);
+	u8 rcon = 1;
+	for (u32 i = 16; i < 176; i += 4)
+	{
+		u8 w[4];
+		memcpy(w, rk + i - 4, 4);
+		if (!(i % 16))
+		{
+			u8 tmp = w[0];
+			w[0] = _aes_sbox[w[1]] ^ rcon;
+			w[1] = _aes_sbox[w[2]];
+			w[2] = _aes_sbox[w[3]];
+			w[3] = _aes_sbox[tmp];
+			rcon = _gmul(rcon, 2);
+		}
+		for (u32 j = 0; j < 4; j++)
+			rk[i + j] = rk[i + j - 16] ^ w[j];
+	}
+
+	memcpy(s, src, 16);
+	if (enc)
+	{
+		for (u32 j = 0; j < 16; j++)
+			s[j] ^= rk[j];
+		for (u32 r = 1; r <= 10; r++)
+		{
+			//SubBytes and ShiftRows, the state is column major.
+			for (u32 j = 0; j < 16; j++)
+				t[j] = _aes_sbox[s[(j + 4 * (j & 3)) & 15]];
+			for (u32 c = 0; c < 16 && r != 10; c += 4)
+			{
+				u8 a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+				t[c] = _gmul(a0, 2) ^ _gmul(a1, 3) ^ a2 ^ a3;
+				t[c + 1] = a0 ^ _gmul(a1, 2) ^ _gmul(a2, 3) ^ a3;
+				t[c + 2] = a0 ^ a1 ^ _gmul(a2, 2) ^ _gmul(a3, 3);
+				t[c + 3] = _gmul(a0, 3) ^ a1 ^ a2 ^ _gmul(a3, 2);
+			}
+			for (u32 j = 0; j < 16; j++)
+				s[j] = t[j] ^ rk[r * 16 + j];
+		}
+	}
+	else
+	{
+		for (u32 j = 0; j < 16; j++)
+			s[j] ^= rk[160 + j];
+		for (u32 r = 10; r-- > 0;)
+		{
+			//InvShiftRows and InvSubBytes.
+			for (u32 j = 0; j < 16; j++)
+				t[(j + 4 * (j & 3)) & 15] = _aes_inv_sbox[s[j]];
+			for (u32 j = 0; j < 16; j++)
+				t[j] ^= rk[r * 16 + j];
+			for (u32 c = 0; c < 16 && r; c += 4)
+			{
+				u8 a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3];
+				t[c] = _gmul(a0, 14) ^ _gmul(a1, 11) ^ _gmul(a2, 13) ^ _gmul(a3, 9);
+				t[c + 1] = _gmul(a0, 9) ^ _gmul(a1, 14) ^ _gmul(a2, 11) ^ _gmul(a3, 13);
+				t[c + 2] = _gmul(a0, 13) ^ _gmul(a1, 9) ^ _gmul(a2, 14) ^ _gmul(a3, 11);
+				t[c + 3] = _gmul(a0, 11) ^ _gmul(a1, 13) ^ _gmul(a2, 9) ^ _gmul(a3, 14);
+			}
+			memcpy(s, t, 16);
+		}
+	}
+	memcpy(dst, s, 16);
+}
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void _sha256(u8 *digest, const u8 *src, u32 size)
+{
+	u32 h[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+	u32 padded = ALIGN(size + 9, 64);
+	u8 *msg = (u8 *)calloc(padded, 1);
+	memcpy(msg, src, size);
+	msg[size] = 0x80;
+	u64 bits = (u64)size << 3;
+	for (u32 i = 0; i < 8; i++)
+		msg[padded - 1 - i] = bits >> (8 * i);
+
+	for (u32 off = 0; off < padded; off += 64)
+	{
+		u32 w[64];
+		for (u32 i = 0; i < 16; i++)
+			w[i] = msg[off + 4 * i] << 24 | msg[off + 4 * i + 1] << 16 | msg[off + 4 * i + 2] << 8 | msg[off + 4 * i + 3];
+		for (u32 i = 16; i < 64; i++)
+		{
+			u32 s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			u32 s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		u32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+		for (u32 i = 0; i < 64; i++)
+		{
+			u32 t1 = hh + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + _sha256_k[i] + w[i];
+			u32 t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+	}
+	free(msg);
+
+	for (u32 i = 0; i < 8; i++)
+		for (u32 j = 0; j < 4; j++)
+			digest[4 * i + j] = h[i] >> (24 - 8 * j);
+}
+
+//Walks a linked list as built by se.c, [last index, (address, size)...].
+static u32 _sesim_ll_size(u32 ll)
+{
+	vu32 *p = (vu32 *)(unsigned long)ll;
+	u32 size = 0;
+	for (u32 i = 0; i <= p[0]; i++)
+		size += p[2 + 2 * i];
+	return size;
+}
+
+static void _sesim_ll_copy(u32 ll, u8 *buf, u32 size, int gather)
+{
+	vu32 *p = (vu32 *)(unsigned long)ll;
+	for (u32 i = 0; i <= p[0] && size; i++)
+	{
+		u8 *addr = (u8 *)(unsigned long)p[1 + 2 * i];
+		u32 num = MIN(p[2 + 2 * i], size);
+		if (gather)
+			memcpy(buf, addr, num);
+		else
+			memcpy(addr, buf, num);
+		buf += num;
+		size -= num;
+	}
+}
+
+static void _sesim_run(sesim_op_t *op)
+{
+	u32 alg = (op->config >> SE_CONFIG_ENC_ALG_SHIFT) & 0xF;
+	u32 dst = (op->config >> SE_CONFIG_DST_SHIFT) & 7;
+
+	if (alg == ALG_SHA)
+	{
+		u32 size = _sesim_ll_size(op->in_ll);
+		u8 *buf = (u8 *)malloc(size + 1);
+		u8 digest[0x20];
+		_sesim_ll_copy(op->in_ll, buf, size, 1);
+		_sha256(digest, buf, size);
+		free(buf);
+		for (u32 i = 0; i < 8; i++)
+			SE_REG(SE_HASH_RESULT_REG_OFFSET + 4 * i) =
+				digest[4 * i] << 24 | digest[4 * i + 1] << 16 | digest[4 * i + 2] << 8 | digest[4 * i + 3];
+		return;
+	}
+
+	u8 key[16];
+	memcpy(key, _sesim_keys[(op->crypto >> SE_CRYPTO_KEY_INDEX_SHIFT) & 0xF], 16);
+	int enc = (op->crypto >> SE_CRYPTO_CORE_SEL_SHIFT) & 1;
+	int ctr = ((op->crypto >> SE_CRYPTO_INPUT_SEL_SHIFT) & 3) == INPUT_LNR_CTR;
+
+	if (dst == DST_KEYTAB)
+	{
+		u8 blk[16];
+		_sesim_ll_copy(op->in_ll, blk, 16, 1);
+		sesim_aes128(key, 0, blk, blk);
+		memcpy(_sesim_keys[(op->keytab_dst >> SE_KEY_INDEX_SHIFT) & 0xF], blk, 16);
+		return;
+	}
+
+	u32 size = (op->blkcnt + 1) * 16;
+	u8 *buf = (u8 *)malloc(size);
+	u8 cnt[16], ks[16];
+	memcpy(cnt, op->ctr, 16);
+	_sesim_ll_copy(op->in_ll, buf, size, 1);
+	for (u32 off = 0; off < size; off += 16)
+	{
+		if (!ctr)
+		{
+			sesim_aes128(key, enc, buf + off, buf + off);
+			continue;
+		}
+
+		//Big endian counter, incremented per block.
+		sesim_aes128(key, 1, ks, cnt);
+		for (u32 i = 0; i < 16; i++)
+			buf[off + i] ^= ks[i];
+		for (int i = 15; i >= 0 && !++cnt[i]; i--)
+			;
+	}
+	_sesim_ll_copy(op->out_ll, buf, size, 0);
+	free(buf);
+
+	//The counter registers are left past the last block, a following single block operation continues from there.
+	if (ctr)
+	{
+		memcpy(op->ctr, cnt, 16);
+		for (u32 i = 0; i < 4; i++)
+			SE_REG(SE_CRYPTO_CTR_REG_OFFSET + 4 * i) = op->ctr[i];
+	}
+}
+
+static void _sesim_step(u32 now)
+{
+	if (!_sesim_busy || (int)(now - _sesim_done) < 0)
+		return;
+
+	_sesim_run(&_sesim_op);
+	_sesim_busy = 0;
+	_sesim_stats.busy_us += now - _sesim_start;
+	SE_REG(SE_STATUS_0) = 0;
+	SE_REG(SE_INT_STATUS_REG_OFFSET) |= SE_INT_OP_DONE(INT_SET);
+}
+
+static void _sesim_wr(u32 addr, u32 old, u32 val)
+{
+	u32 off = (addr & ~3) - SE_BASE;
+
+	//The engine latches its setup when started, software has to leave it alone until OP_DONE.
+	if (_sesim_busy)
+		_sesim_stats.busy_writes++;
+
+	switch (off)
+	{
+	case SE_INT_STATUS_REG_OFFSET:
+	case SE_ERR_STATUS_0:
+		SE_REG(off) = old & ~val;
+		break;
+	case SE_KEYTABLE_DATA0_REG_OFFSET:
+	{
+		u32 sel = SE_REG(SE_KEYTABLE_REG_OFFSET);
+		_sesim_keys[(sel >> SE_KEYTABLE_SLOT_SHIFT) & 0xF][sel & 0xF] = val;
+		break;
+	}
+	case SE_OPERATION_REG_OFFSET:
+		if (val != OP_START)
+			break;
+		_sesim_op.config = SE_REG(SE_CONFIG_REG_OFFSET);
+		_sesim_op.crypto = SE_REG(SE_CRYPTO_REG_OFFSET);
+		_sesim_op.blkcnt = SE_REG(SE_BLOCK_COUNT_REG_OFFSET);
+		for (u32 i = 0; i < 4; i++)
+			_sesim_op.ctr[i] = SE_REG(SE_CRYPTO_CTR_REG_OFFSET + 4 * i);
+		_sesim_op.in_ll = SE_REG(SE_IN_LL_ADDR_REG_OFFSET);
+		_sesim_op.out_ll = SE_REG(SE_OUT_LL_ADDR_REG_OFFSET);
+		_sesim_op.keytab_dst = SE_REG(SE_CRYPTO_KEYTABLE_DST_REG_OFFSET);
+
+		u32 blocks = ((_sesim_op.config >> SE_CONFIG_ENC_ALG_SHIFT) & 0xF) == ALG_SHA ?
+			_sesim_ll_size(_sesim_op.in_ll) / 16 : _sesim_op.blkcnt + 1;
+		_sesim_stats.ops++;
+		_sesim_stats.blocks += blocks;
+		_sesim_busy = 1;
+		_sesim_start = host_now();
+		_sesim_done = _sesim_start + SESIM_OP_US + blocks / SESIM_BLOCKS_PER_US;
+		SE_REG(SE_STATUS_0) = 1;
+		SE_REG(off) = 0;
+		break;
+	}
+}
+
+void sesim_init()
+{
+	for (u32 i = 0; i < 256; i++)
+		_aes_inv_sbox[_aes_sbox[i]] = i;
+
+	host_mmio_map(SE_BASE, 0x1000, NULL, _sesim_wr);
+	host_add_dev(_sesim_step);
+}
+
+void sesim_get_stats(sesim_stats_t *stats)
+{
+	memcpy(stats, &_sesim_stats, sizeof(sesim_stats_t));
+}
+
+int sesim_busy()
+{
+	return _sesim_busy;
+}
@@ -0,0 +1,42 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SESIM_H_
+#define _SESIM_H_
+
+#include "types.h"
+
+/*! Cost of an operation, the engine is busy for this long before OP_DONE is raised. */
+#define SESIM_OP_US 2
+#define SESIM_BLOCKS_PER_US 8
+
+typedef struct _sesim_stats_t
+{
+	u32 ops;
+	u32 blocks;
+	/*! Registers written while an operation was running, which corrupts it on the real engine. */
+	u32 busy_writes;
+	u32 busy_us;
+} sesim_stats_t;
+
+/*! Model of the security engine's AES-128 ECB/CTR, key unwrap and SHA-256 operations at SE_BASE. */
+void sesim_init();
+void sesim_get_stats(sesim_stats_t *stats);
+int sesim_busy();
+/*! Software AES-128, for building expected results. */
+void sesim_aes128(const u8 *key, int enc, u8 *dst, const u8 *src);
+
+#endif
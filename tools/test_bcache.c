@@ -0,0 +1,191 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "bcache.h"
+
+//Same geometry as the SD cache in diskio.
+#define BLKS 64
+#define BLK_SECTORS 8
+#define MAX_RA 16
+
+typedef struct _disk_t
+{
+	u8 *data;
+	u32 sectors;
+	u32 bad_sector; //Reads covering it fail, 0 for none.
+	u32 cmds;
+	u32 past_end;
+} disk_t;
+
+static int _disk_readv(void *dev, u32 sector, const sdmmc_iovec_t *iov, u32 num_iov)
+{
+	disk_t *disk = (disk_t *)dev;
+	disk->cmds++;
+
+	u32 num = 0;
+	for (u32 i = 0; i < num_iov; i++)
+		num += iov[i].num_sectors;
+	if (sector + num > disk->sectors)
+	{
+		disk->past_end++;
+		return 0;
+	}
+	if (disk->bad_sector && disk->bad_sector >= sector && disk->bad_sector < sector + num)
+		return 0;
+
+	for (u32 i = 0; i < num_iov; i++)
+	{
+		memcpy(iov[i].buf, disk->data + sector * 512, iov[i].num_sectors * 512);
+		sector += iov[i].num_sectors;
+	}
+	return 1;
+}
+
+static int _disk_write(void *dev, u32 sector, u32 num_sectors, const void *buf)
+{
+	disk_t *disk = (disk_t *)dev;
+	disk->cmds++;
+	if (sector + num_sectors > disk->sectors)
+		return 0;
+	memcpy(disk->data + sector * 512, buf, num_sectors * 512);
+	return 1;
+}
+
+static const bcache_ops_t _disk_ops = {
+	_disk_readv,
+	_disk_write
+};
+
+static disk_t _disk;
+static bcache_t _bc;
+static u8 _buf[0x4000];
+
+static void _disk_init(u32 sectors)
+{
+	free(_disk.data);
+	memset(&_disk, 0, sizeof(disk_t));
+	_disk.sectors = sectors;
+	_disk.data = (u8 *)malloc(sectors * 512);
+	//Every word holds its own offset, so misplaced data is caught.
+	for (u32 i = 0; i < sectors * 128; i++)
+		((u32 *)_disk.data)[i] = i;
+}
+
+static int _disk_match(u32 sector, u32 num_sectors, const void *buf)
+{
+	return !memcmp(_disk.data + sector * 512, buf, num_sectors * 512);
+}
+
+static void _test_sequential()
+{
+	_disk_init(0x2000);
+	CHECK(bcache_init(&_bc, &_disk_ops, &_disk, _disk.sectors, BLKS, BLK_SECTORS, MAX_RA));
+
+	//FatFs walking a FAT or a directory, one sector at a time.
+	int ok = 1;
+	for (u32 i = 0; i < 4000; i++)
+		ok &= bcache_read(&_bc, i, 1, _buf) && _disk_match(i, 1, _buf);
+	CHECK(ok);
+
+	bcache_stats_t stats;
+	bcache_get_stats(&_bc, &stats);
+	printf("sequential: 4000 single sector reads, %u commands, %u hits, %u misses, %u read-ahead blocks\n",
+		_disk.cmds, stats.hits, stats.misses, stats.ra_blks);
+	//The read-ahead ramps up to MAX_RA blocks, after that every command fills MAX_RA * BLK_SECTORS sectors.
+	CHECK(_disk.cmds == stats.cmds);
+	CHECK(_disk.cmds <= 4000 / (MAX_RA * BLK_SECTORS) + 5);
+
+	bcache_end(&_bc);
+}
+
+static void _test_random()
+{
+	_disk_init(0x2000);
+	CHECK(bcache_init(&_bc, &_disk_ops, &_disk, _disk.sectors, BLKS, BLK_SECTORS, MAX_RA));
+
+	int ok = 1;
+	srand(1);
+	for (u32 i = 0; i < 20000 && ok; i++)
+	{
+		u32 num = rand() % 3 ? 1 + rand() % 4 : 1 + rand() % 24;
+		u32 sector = rand() % (_disk.sectors - num);
+
+		//Writes have to show up in later reads whether the block is cached or not.
+		if (!(rand() % 8))
+		{
+			for (u32 j = 0; j < num * 128; j++)
+				((u32 *)_buf)[j] = rand();
+			ok &= bcache_write(&_bc, sector, num, _buf);
+			ok &= _disk_match(sector, num, _buf);
+		}
+		else
+			ok &= bcache_read(&_bc, sector, num, _buf) && _disk_match(sector, num, _buf);
+	}
+	CHECK(ok);
+	CHECK(!_disk.past_end);
+
+	bcache_end(&_bc);
+}
+
+static void _test_device_end()
+{
+	//The device ends 3 sectors into its last block.
+	_disk_init(0x1003);
+	CHECK(bcache_init(&_bc, &_disk_ops, &_disk, _disk.sectors, BLKS, BLK_SECTORS, MAX_RA));
+
+	int ok = 1;
+	for (u32 i = 0xF00; i < _disk.sectors; i++)
+		ok &= bcache_read(&_bc, i, 1, _buf) && _disk_match(i, 1, _buf);
+	CHECK(ok);
+	CHECK(!_disk.past_end);
+
+	//Straight to the last block, nothing cached in front of it.
+	bcache_invalidate(&_bc);
+	CHECK(bcache_read(&_bc, 0x1002, 1, _buf) && _disk_match(0x1002, 1, _buf));
+	CHECK(bcache_read(&_bc, 0x1000, 3, _buf) && _disk_match(0x1000, 3, _buf));
+	CHECK(!_disk.past_end);
+
+	bcache_end(&_bc);
+}
+
+static void _test_bad_sector()
+{
+	_disk_init(0x2000);
+	CHECK(bcache_init(&_bc, &_disk_ops, &_disk, _disk.sectors, BLKS, BLK_SECTORS, MAX_RA));
+
+	//Read-ahead running into a bad sector must not fail reads in front of it.
+	_disk.bad_sector = 0x100;
+	int ok = 1;
+	for (u32 i = 0xC0; i < 0x100; i++)
+		ok &= bcache_read(&_bc, i, 1, _buf) && _disk_match(i, 1, _buf);
+	CHECK(ok);
+	CHECK(!bcache_read(&_bc, 0x100, 1, _buf));
+
+	bcache_end(&_bc);
+}
+
+void test_main(int argc, char **argv)
+{
+	_test_sequential();
+	_test_random();
+	_test_device_end();
+	_test_bad_sector();
+}
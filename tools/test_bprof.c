@@ -0,0 +1,122 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "bprof.h"
+
+//Injected timer, each test sets it to whatever it needs.
+static u32 _tmr;
+
+static u32 _test_tmr()
+{
+	return _tmr;
+}
+
+static void _test_pairing()
+{
+	_tmr = 0;
+	bprof_init(_test_tmr);
+	CHECK(bprof_count() == 0);
+	CHECK(bprof_get(0) == NULL);
+
+	//Nested and overlapping spans each keep their own start and end.
+	_tmr = 100;
+	u32 outer = bprof_begin("outer");
+	_tmr = 150;
+	u32 inner = bprof_begin("inner");
+	_tmr = 175;
+	u32 other = bprof_begin("other");
+	_tmr = 200;
+	bprof_end(inner);
+	_tmr = 300;
+	bprof_end(outer);
+
+	CHECK(bprof_count() == 3);
+	const bprof_evt_t *evt = bprof_get(0);
+	CHECK(evt->id == outer && !strcmp(evt->name, "outer") && evt->start == 100 && evt->end == 300);
+	evt = bprof_get(1);
+	CHECK(evt->id == inner && !strcmp(evt->name, "inner") && evt->start == 150 && evt->end == 200);
+	//Never ended, the report uses the start as its end.
+	evt = bprof_get(2);
+	CHECK(evt->id == other && evt->start == 175 && evt->end == 0);
+
+	//Names are cut to fit.
+	u32 id = bprof_begin("a_stage_name_that_is_way_too_long_to_keep");
+	evt = bprof_get(bprof_count() - 1);
+	CHECK(evt->id == id && strlen(evt->name) == BPROF_NAME_LEN - 1);
+}
+
+static void _test_wraparound()
+{
+	u32 ids[BPROF_MAX_EVENTS + 10];
+	char name[BPROF_NAME_LEN];
+
+	_tmr = 0;
+	bprof_init(_test_tmr);
+	for (u32 i = 0; i < BPROF_MAX_EVENTS + 10; i++)
+	{
+		_tmr = i * 10;
+		sprintf(name, "evt%u", i);
+		ids[i] = bprof_begin(name);
+	}
+
+	//Only the newest events are kept, oldest first.
+	CHECK(bprof_count() == BPROF_MAX_EVENTS);
+	CHECK(bprof_get(BPROF_MAX_EVENTS) == NULL);
+	int ok = 1;
+	for (u32 i = 0; i < BPROF_MAX_EVENTS; i++)
+	{
+		const bprof_evt_t *evt = bprof_get(i);
+		sprintf(name, "evt%u", i + 10);
+		ok &= evt->id == ids[i + 10] && !strcmp(evt->name, name) && evt->start == (i + 10) * 10;
+	}
+	CHECK(ok);
+
+	//Ending an overwritten event must leave the one now in its slot alone.
+	_tmr = 5000;
+	bprof_end(ids[3]);
+	const bprof_evt_t *evt = bprof_get(ids[3] + BPROF_MAX_EVENTS - 11);
+	CHECK(evt->id == ids[3] + BPROF_MAX_EVENTS && evt->end == 0);
+	bprof_end(ids[BPROF_MAX_EVENTS + 9]);
+	evt = bprof_get(BPROF_MAX_EVENTS - 1);
+	CHECK(evt->id == ids[BPROF_MAX_EVENTS + 9] && evt->end == 5000);
+}
+
+static void _test_timer_wrap()
+{
+	_tmr = 0xFFFFFF00;
+	bprof_init(_test_tmr);
+	u32 id = bprof_begin("wrap");
+	_tmr = 0x100;
+	bprof_end(id);
+
+	const bprof_evt_t *evt = bprof_get(0);
+	CHECK(evt->start == 0xFFFFFF00ULL && evt->end == 0x100000100ULL);
+	_tmr = 0xFFFFFFFF;
+	CHECK(bprof_now() == 0x1FFFFFFFFULL);
+	_tmr = 5;
+	CHECK(bprof_now() == 0x200000005ULL);
+}
+
+void test_main(int argc, char **argv)
+{
+	_test_pairing();
+	_test_wraparound();
+	_test_timer_wrap();
+}
@@ -0,0 +1,306 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "sdsim.h"
+#include "sdmmc.h"
+#include "ff.h"
+
+//64MB with one sector per cluster is FAT32 and puts every 16 directory entries in a cluster of their own.
+#define SD_SECTORS 0x20000
+#define FAT_RSVD 32
+#define FAT_SIZE 1024
+
+sdmmc_storage_t sd_storage;
+static sdmmc_t _sd_sdmmc;
+static sdsim_card_t _sd_card;
+static FATFS _fs;
+
+//The SD slot's regulator sits behind I2C, which is not modelled.
+int max77620_regulator_set_voltage(u32 id, u32 mv)
+{
+	return 1;
+}
+
+int max77620_regulator_enable(u32 id, int enable)
+{
+	return 1;
+}
+
+static void _st16(u8 *p, u32 val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+}
+
+static void _st32(u8 *p, u32 val)
+{
+	_st16(p, val);
+	_st16(p + 2, val >> 16);
+}
+
+//Empty FAT32 volume without a partition table, the root directory is cluster 2.
+static void _format(u8 *disk)
+{
+	u8 *bs = disk;
+	memcpy(bs, "\xEB\x58\x90MSDOS5.0", 11);
+	_st16(bs + 11, 512);
+	bs[13] = 1;
+	_st16(bs + 14, FAT_RSVD);
+	bs[16] = 2;
+	bs[21] = 0xF8;
+	_st16(bs + 24, 63);
+	_st16(bs + 26, 255);
+	_st32(bs + 32, SD_SECTORS);
+	_st32(bs + 36, FAT_SIZE);
+	_st32(bs + 44, 2);
+	_st16(bs + 48, 1);
+	_st16(bs + 50, 6);
+	bs[64] = 0x80;
+	bs[66] = 0x29;
+	memcpy(bs + 71, "NO NAME    FAT32   ", 19);
+	_st16(bs + 510, 0xAA55);
+
+	u8 *fsi = disk + 512;
+	_st32(fsi, 0x41615252);
+	_st32(fsi + 484, 0x61417272);
+	_st32(fsi + 488, 0xFFFFFFFF);
+	_st32(fsi + 492, 0xFFFFFFFF);
+	_st32(fsi + 508, 0xAA550000);
+
+	for (u32 i = 0; i < 2; i++)
+	{
+		u8 *fat = disk + (FAT_RSVD + i * FAT_SIZE) * 512;
+		_st32(fat, 0x0FFFFFF8);
+		_st32(fat + 4, 0x0FFFFFFF);
+		_st32(fat + 8, 0x0FFFFFFF);
+	}
+}
+
+static int _create(const char *path)
+{
+	FIL fp;
+	UINT bw;
+	if (f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+	int res = f_write(&fp, path, strlen(path), &bw) == FR_OK && bw == strlen(path);
+	return f_close(&fp) == FR_OK && res;
+}
+
+static int _exists(const char *path)
+{
+	FILINFO fno;
+	return f_stat(path, &fno) == FR_OK;
+}
+
+static int _missing(const char *path)
+{
+	FILINFO fno;
+	return f_stat(path, &fno) == FR_NO_FILE;
+}
+
+static u32 _sclust(const char *path)
+{
+	DIR dir;
+	if (f_opendir(&dir, path) != FR_OK)
+		return 0;
+	u32 sclust = dir.obj.sclust;
+	f_closedir(&dir);
+	return sclust;
+}
+
+static int _indexed(u32 sclust)
+{
+	for (u32 i = 0; i < _fs.dc_ndir; i++)
+		if (_fs.dc_dir[i] == sclust)
+			return 1;
+	return 0;
+}
+
+//Name of length len, different per i.
+static void _long_name(char *buf, const char *dir, u32 i, u32 len)
+{
+	u32 n = sprintf(buf, "%s/%03u ", dir, i);
+	for (u32 j = 0; j < len; j++)
+		buf[n + j] = 'a' + (i + j) % 26;
+	buf[n + len] = 0;
+}
+
+static void _test_names()
+{
+	CHECK(_create("Long File Name Number One.txt"));
+	CHECK(_create("SHORT.TXT"));
+	CHECK(_create("lower.bin"));
+	CHECK(f_mkdir("dir") == FR_OK);
+	CHECK(_create("dir/Another Long Name.ini"));
+
+	//The first lookup indexes the root, the rest go through the index.
+	CHECK(_exists("Long File Name Number One.txt"));
+	CHECK(_indexed(_sclust("")));
+	CHECK(_exists("LONG FILE NAME NUMBER ONE.TXT"));
+	CHECK(_exists("long file name number one.txt"));
+	CHECK(_exists("LONGFI~1.TXT"));
+	CHECK(_exists("longfi~1.txt"));
+	CHECK(_exists("short.txt"));
+	CHECK(_exists("Short.Txt"));
+	CHECK(_exists("LOWER.BIN"));
+	CHECK(_exists("dir/another long name.INI"));
+	CHECK(_exists("DIR/ANOTHE~1.INI"));
+	CHECK(_indexed(_sclust("dir")));
+
+	//Misses in an indexed directory.
+	CHECK(_missing("Long File Name Number Two.txt"));
+	CHECK(_missing("Long File Name Number One.tx"));
+	CHECK(_missing("SHORT.TX"));
+	CHECK(_missing("LONGFI~2.TXT"));
+	CHECK(_missing("dir/short.txt"));
+}
+
+static void _test_split()
+{
+	//1 to 60 characters are 1 to 5 LFN entries, with 16 entries per cluster plenty of names cross a cluster boundary.
+	char path[128];
+	CHECK(f_mkdir("split") == FR_OK);
+	for (u32 i = 0; i < 60; i++)
+	{
+		_long_name(path, "split", i, i + 1);
+		CHECK(_create(path));
+	}
+
+	int ok = 1;
+	for (u32 i = 0; i < 60; i++)
+	{
+		_long_name(path, "split", i, i + 1);
+		ok &= _exists(path);
+		for (char *p = path; *p; p++)
+			if (*p >= 'a' && *p <= 'z')
+				*p -= 'a' - 'A';
+		ok &= _exists(path);
+		//Same name one character short.
+		path[strlen(path) - 1] = 0;
+		ok &= _missing(path);
+	}
+	CHECK(ok);
+	CHECK(_indexed(_sclust("split")));
+}
+
+static void _test_changes()
+{
+	//Each change has to be seen by the next lookup in the indexed directory.
+	CHECK(_exists("dir/Another Long Name.ini"));
+	CHECK(_missing("dir/Created Later.ini"));
+	CHECK(_create("dir/Created Later.ini"));
+	CHECK(_exists("dir/created later.ini"));
+
+	CHECK(f_unlink("dir/Another Long Name.ini") == FR_OK);
+	CHECK(_missing("dir/Another Long Name.ini"));
+	CHECK(_missing("dir/ANOTHE~1.INI"));
+
+	CHECK(f_rename("dir/Created Later.ini", "dir/Renamed Again.ini") == FR_OK);
+	CHECK(_missing("dir/Created Later.ini"));
+	CHECK(_exists("dir/RENAMED AGAIN.INI"));
+
+	//Moved into another indexed directory.
+	CHECK(_exists("split/000 a"));
+	CHECK(f_rename("dir/Renamed Again.ini", "split/Moved Over.ini") == FR_OK);
+	CHECK(_missing("dir/Renamed Again.ini"));
+	CHECK(_exists("split/moved over.ini"));
+
+	//Replaced in place keeps the name visible.
+	CHECK(_create("split/Moved Over.ini"));
+	CHECK(_exists("split/Moved Over.ini"));
+}
+
+static void _test_overflow()
+{
+	//Two names per file, more than the table takes for one directory. Short long names keep the linear scans cheap.
+	char path[128];
+	CHECK(f_mkdir("big") == FR_OK);
+	for (u32 i = 0; i < 400; i++)
+	{
+		sprintf(path, "big/Big #%03u.txt", i);
+		CHECK(_create(path));
+	}
+	for (u32 i = 0; i < FF_DCACHE_DIRS; i++)
+	{
+		sprintf(path, "d%02u", i);
+		CHECK(f_mkdir(path) == FR_OK);
+		sprintf(path, "d%02u/File In Directory.txt", i);
+		CHECK(_create(path));
+	}
+
+	//Lookups fall back to a linear scan.
+	u32 big = _sclust("big");
+	int ok = 1;
+	for (u32 i = 0; i < 400; i += 7)
+	{
+		sprintf(path, "big/BIG #%03u.TXT", i);
+		ok &= _exists(path);
+	}
+	CHECK(ok);
+	CHECK(_missing("big/Big #400.txt"));
+	CHECK(_fs.dc_skip == big);
+	CHECK(!_indexed(big));
+
+	//Fill every directory slot and roll over, the large directory stays skipped and doesn't drop the others.
+	for (u32 i = 0; i < FF_DCACHE_DIRS; i++)
+	{
+		sprintf(path, "d%02u/file in directory.txt", i);
+		CHECK(_exists(path));
+	}
+	u32 last = _sclust("d15");
+	CHECK(_indexed(last));
+	CHECK(_fs.dc_skip == big);
+	u32 ndir = _fs.dc_ndir;
+	CHECK(_exists("big/Big #123.txt"));
+	CHECK(_fs.dc_ndir >= ndir);
+	CHECK(_indexed(last));
+
+	//A change makes it worth another try.
+	CHECK(f_unlink("big/Big #000.txt") == FR_OK);
+	CHECK(_fs.dc_skip != big);
+	CHECK(_missing("big/Big #000.txt"));
+	CHECK(_exists("big/Big #399.txt"));
+	CHECK(_fs.dc_skip == big);
+}
+
+void test_main(int argc, char **argv)
+{
+	sdsim_init();
+	sdsim_card_init(&_sd_card, 1, SD_SECTORS);
+	_format(_sd_card.part[SDSIM_PART_USER]);
+	sdsim_attach(SDMMC_1, &_sd_card);
+
+	CHECK(sdmmc_storage_init_sd(&sd_storage, &_sd_sdmmc, SDMMC_1, SDMMC_BUS_WIDTH_4, 11));
+	CHECK(f_mount(&_fs, "", 1) == FR_OK);
+	CHECK(_fs.fs_type == FS_FAT32);
+
+	_test_names();
+	_test_split();
+	_test_changes();
+	_test_overflow();
+
+	//Everything made it to the card.
+	CHECK(f_mount(NULL, "", 0) == FR_OK);
+	CHECK(f_mount(&_fs, "", 1) == FR_OK);
+	CHECK(_exists("split/Moved Over.ini"));
+	CHECK(_exists("big/Big #399.txt"));
+	CHECK(_missing("dir/Renamed Again.ini"));
+}
@@ -0,0 +1,244 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "sesim.h"
+#include "sched.h"
+#include "se.h"
+
+#define LOG_MAX 256
+
+//Which task ran, in order.
+static char _log[LOG_MAX];
+static u32 _log_len;
+
+static void _log_add(char c)
+{
+	if (_log_len < LOG_MAX - 1)
+		_log[_log_len++] = c;
+}
+
+typedef struct _rr_arg_t
+{
+	char name;
+	u32 iters;
+	u32 work_us;
+} rr_arg_t;
+
+static void _rr_task(void *arg)
+{
+	rr_arg_t *rr = (rr_arg_t *)arg;
+	for (u32 i = 0; i < rr->iters; i++)
+	{
+		_log_add(rr->name);
+		host_advance(rr->work_us);
+		sched_yield();
+	}
+}
+
+static void _test_round_robin()
+{
+	rr_arg_t args[] = { { 'a', 3, 10 }, { 'b', 1, 20 }, { 'c', 2, 30 } };
+	sched_task_t *tasks[3];
+
+	sched_init();
+	_log_len = 0;
+	for (u32 i = 0; i < 3; i++)
+		tasks[i] = sched_spawn("rr", _rr_task, &args[i], SCHED_STACK_SIZE);
+
+	//Nothing runs before the spawner yields, then everyone gets a turn in spawn order.
+	CHECK(_log_len == 0);
+	_log_add('m');
+	sched_yield();
+	_log_add('m');
+	for (u32 i = 0; i < 3; i++)
+		sched_join(tasks[i]);
+	_log[_log_len] = 0;
+	CHECK(!strcmp(_log, "mabcmaca"));
+
+	//Each task ran for its work plus the timer reads of the switches, and waited while the others ran.
+	for (u32 i = 0; i < 3; i++)
+	{
+		CHECK(tasks[i]->state == SCHED_TASK_DONE && !tasks[i]->stack);
+		CHECK(tasks[i]->run_us >= args[i].iters * args[i].work_us);
+		CHECK(tasks[i]->run_us < args[i].iters * args[i].work_us + 10);
+		CHECK(tasks[i]->switches == args[i].iters + 1);
+	}
+	CHECK(tasks[0]->wait_us >= 20 + 2 * 30);
+
+	//Yielding alone doesn't switch.
+	u32 now = host_now();
+	sched_yield();
+	CHECK(host_now() == now);
+}
+
+static sched_evt_t _evt;
+
+static void _evt_waiter(void *arg)
+{
+	_log_add('w');
+	sched_evt_wait(&_evt);
+	_log_add('W');
+}
+
+static void _evt_setter(void *arg)
+{
+	_log_add('s');
+	sched_yield();
+	_log_add('s');
+	sched_evt_set(&_evt);
+	_log_add('S');
+}
+
+static void _test_events()
+{
+	sched_init();
+	_log_len = 0;
+	memset(&_evt, 0, sizeof(_evt));
+	sched_task_t *w = sched_spawn("waiter", _evt_waiter, NULL, SCHED_STACK_SIZE);
+	sched_task_t *s = sched_spawn("setter", _evt_setter, NULL, SCHED_STACK_SIZE);
+
+	//The waiter only continues on its first turn after the event is set.
+	sched_join(w);
+	sched_join(s);
+	_log[_log_len] = 0;
+	CHECK(!strcmp(_log, "wssSW"));
+}
+
+static void _nop_task(void *arg)
+{
+}
+
+static void _test_limits()
+{
+	sched_task_t *tasks[SCHED_MAX_TASKS];
+
+	//The boot task takes a slot.
+	sched_init();
+	for (u32 i = 0; i < SCHED_MAX_TASKS - 1; i++)
+		CHECK((tasks[i] = sched_spawn("nop", _nop_task, NULL, SCHED_STACK_SIZE)) != NULL);
+	CHECK(sched_spawn("nop", _nop_task, NULL, SCHED_STACK_SIZE) == NULL);
+	for (u32 i = 0; i < SCHED_MAX_TASKS - 1; i++)
+		sched_join(tasks[i]);
+	sched_join(NULL);
+}
+
+//The engine runs while its users are switched out.
+static int _se_stop;
+
+static void _se_ticker(void *arg)
+{
+	while (!_se_stop)
+	{
+		host_advance(1);
+		sched_yield();
+	}
+}
+
+#define SE_KS 10
+#define SE_BUF_SIZE 0x10000
+
+static u8 _se_key[0x10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+static u8 _se_ctr[0x10];
+static u8 *_se_src;
+static u8 *_se_dst;
+static int _se_ctr_res;
+static int _se_ecb_ok;
+
+static void _se_ctr_task(void *arg)
+{
+	//Big enough to still be running when the other task gets its turn.
+	_log_add('c');
+	_se_ctr_res = se_aes_crypt_ctr_start(SE_KS, _se_dst, _se_src, SE_BUF_SIZE, _se_ctr, 0);
+	sched_yield();
+	_log_add('c');
+	_se_ctr_res &= se_aes_crypt_ctr_wait();
+}
+
+static void _se_ecb_task(void *arg)
+{
+	u8 blk[0x10], ref[0x10], digest[0x20];
+	memset(blk, 0x5A, 0x10);
+	sesim_aes128(_se_key, 1, ref, blk);
+
+	//Every entry point has to wait for the running CTR operation instead of reprogramming the engine.
+	_log_add('e');
+	_se_ecb_ok = sesim_busy();
+	_se_ecb_ok &= se_aes_crypt_block_ecb(SE_KS, 1, blk, blk) && !memcmp(blk, ref, 0x10);
+	_se_ecb_ok &= se_calc_sha256(digest, _se_key, 0x10);
+	se_aes_key_set(SE_KS + 1, _se_key, 0x10);
+	_se_ecb_ok &= se_aes_xts_crypt_sec(SE_KS, SE_KS + 1, 1, 0, _se_src, _se_src, 0x200);
+	_log_add('e');
+}
+
+static void _test_se_lock()
+{
+	sesim_init();
+	se_aes_key_set(SE_KS, _se_key, 0x10);
+	_se_src = (u8 *)malloc(SE_BUF_SIZE);
+	_se_dst = (u8 *)malloc(SE_BUF_SIZE);
+	u8 *ref = (u8 *)malloc(SE_BUF_SIZE);
+	for (u32 i = 0; i < SE_BUF_SIZE; i++)
+		_se_src[i] = i * 7;
+
+	//Software CTR for the expected result, taken before the XTS overwrites the start of the source.
+	u8 cnt[0x10], ks[0x10];
+	memcpy(cnt, _se_ctr, 0x10);
+	for (u32 off = 0; off < SE_BUF_SIZE; off += 0x10)
+	{
+		sesim_aes128(_se_key, 1, ks, cnt);
+		for (u32 i = 0; i < 0x10; i++)
+			ref[off + i] = _se_src[off + i] ^ ks[i];
+		for (int i = 0xF; i >= 0 && !++cnt[i]; i--)
+			;
+	}
+
+	sched_init();
+	_log_len = 0;
+	_se_stop = 0;
+	sched_task_t *ticker = sched_spawn("engine", _se_ticker, NULL, SCHED_STACK_SIZE);
+	sched_task_t *ctr = sched_spawn("ctr", _se_ctr_task, NULL, SCHED_STACK_SIZE);
+	sched_task_t *ecb = sched_spawn("ecb", _se_ecb_task, NULL, SCHED_STACK_SIZE);
+	sched_join(ctr);
+	sched_join(ecb);
+	_se_stop = 1;
+	sched_join(ticker);
+
+	_log[_log_len] = 0;
+	CHECK(!strcmp(_log, "ceec") || !strcmp(_log, "cece"));
+	CHECK(_se_ctr_res && !memcmp(_se_dst, ref, SE_BUF_SIZE));
+	CHECK(_se_ecb_ok);
+
+	sesim_stats_t stats;
+	sesim_get_stats(&stats);
+	CHECK(!stats.busy_writes);
+
+	free(_se_src);
+	free(_se_dst);
+	free(ref);
+}
+
+void test_main(int argc, char **argv)
+{
+	_test_round_robin();
+	_test_events();
+	_test_limits();
+	_test_se_lock();
+}
@@ -0,0 +1,412 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "sdsim.h"
+#include "sdmmc.h"
+#include "t210.h"
+#include "pmc.h"
+#include "mmc.h"
+#include "util.h"
+
+#define EMMC_SECTORS 0x20000
+#define SD_SECTORS 0x10000
+
+static sdsim_card_t _emmc_card;
+static sdsim_card_t _sd_card;
+static sdmmc_t _emmc_sdmmc;
+static sdmmc_t _sd_sdmmc;
+static sdmmc_storage_t _emmc;
+static sdmmc_storage_t _sd;
+static sdmmc_init_t _emmc_init;
+static sdmmc_init_t _sd_init;
+
+//The SD slot's regulator sits behind I2C, which is not modelled.
+int max77620_regulator_set_voltage(u32 id, u32 mv)
+{
+	return 1;
+}
+
+int max77620_regulator_enable(u32 id, int enable)
+{
+	return 1;
+}
+
+static void _fill(sdsim_card_t *card, u32 part, u32 seed)
+{
+	u32 *p = (u32 *)card->part[part];
+	for (u32 i = 0; i < card->part_sectors[part] * 128; i++)
+		p[i] = (i * 0x9E3779B1) ^ seed;
+}
+
+//Same loop as main's, both bring-ups advance together and the host sleeps only when both wait on their card.
+static void _init_run(u32 step)
+{
+	sdmmc_init_t *jobs[] = { &_sd_init, &_emmc_init };
+
+	while (_sd_init.step < step || _emmc_init.step < step)
+	{
+		int wait = 0x7FFFFFFF;
+		for (u32 i = 0; i < sizeof(jobs) / sizeof(sdmmc_init_t *); i++)
+		{
+			if (jobs[i]->step == SDMMC_INIT_STEP_END)
+				continue;
+			sdmmc_storage_init_poll(jobs[i]);
+			if (jobs[i]->step != SDMMC_INIT_STEP_END)
+				wait = MIN(wait, (int)(jobs[i]->wake - get_tmr()));
+		}
+		if (wait != 0x7FFFFFFF && wait > 0)
+			sleep(wait);
+	}
+}
+
+static u32 _init_both()
+{
+	u32 start = host_now();
+	sdmmc_storage_init_sd_start(&_sd_init, &_sd, &_sd_sdmmc, SDMMC_1, SDMMC_BUS_WIDTH_4, 11);
+	sdmmc_storage_init_mmc_start(&_emmc_init, &_emmc, &_emmc_sdmmc, SDMMC_4, SDMMC_BUS_WIDTH_8, 4);
+	_init_run(SDMMC_INIT_STEP_END);
+	return host_now() - start;
+}
+
+static void _check_clean(u32 id)
+{
+	sdsim_stats_t stats;
+	sdsim_get_stats(id, &stats);
+	CHECK(!stats.violations);
+	CHECK(!stats.crc_errors);
+	CHECK(!stats.illegal);
+}
+
+static void _test_init()
+{
+	_fill(&_emmc_card, SDSIM_PART_USER, 0x454D4D43);
+	_fill(&_emmc_card, SDSIM_PART_BOOT0, 0x424F4F54);
+	_fill(&_sd_card, SDSIM_PART_USER, 0x53444344);
+	sdsim_attach(SDMMC_4, &_emmc_card);
+	sdsim_attach(SDMMC_1, &_sd_card);
+
+	u32 us = _init_both();
+	CHECK(_sd_init.res == SDMMC_INIT_DONE);
+	CHECK(_emmc_init.res == SDMMC_INIT_DONE);
+	printf("init: %u us\n", us);
+
+	CHECK(_emmc.sec_cnt == EMMC_SECTORS);
+	CHECK(_emmc.bus_type == 4);
+	CHECK(_emmc.ext_csd.boot_mult == SDSIM_MMC_BOOT_SECTORS / 256);
+	CHECK(_sd.sec_cnt == SD_SECTORS);
+	CHECK(_sd.bus_type == 11);
+	CHECK(_sd.is_low_voltage);
+	CHECK(_sd.ssr.speed_class == 10);
+
+	sdsim_state_t state;
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(state.timing == EXT_CSD_TIMING_HS400);
+	CHECK(state.width == 8 && state.ddr);
+	CHECK(state.khz > 100000 && state.khz <= 200000);
+	CHECK(state.tap >= SDSIM_TAP_LO && state.tap <= SDSIM_TAP_HI);
+	CHECK(state.card_state == R1_STATE_TRAN);
+	sdsim_get_state(SDMMC_1, &state);
+	CHECK(state.timing == UHS_SDR104_BUS_SPEED);
+	CHECK(state.width == 4 && !state.ddr);
+	CHECK(state.khz > 100000 && state.khz <= 208000);
+	CHECK(state.low_voltage);
+
+	//One tuning each, the taps are kept for the next boot.
+	sdsim_stats_t stats;
+	sdsim_get_stats(SDMMC_4, &stats);
+	CHECK(stats.tunings == 1);
+	sdsim_get_stats(SDMMC_1, &stats);
+	CHECK(stats.tunings == 1);
+	CHECK(PMC(APBDEV_PMC_SCRATCH118) & 0x80000000);
+	CHECK(PMC(APBDEV_PMC_SCRATCH119) & 0x80000000);
+
+	_check_clean(SDMMC_4);
+	_check_clean(SDMMC_1);
+}
+
+static void _test_rw(sdmmc_storage_t *storage, sdsim_card_t *card, u32 id)
+{
+	u8 *mem = card->part[SDSIM_PART_USER];
+	u8 *buf = (u8 *)malloc(256 * 512);
+	sdsim_stats_t before, after;
+	sdsim_get_stats(id, &before);
+
+	CHECK(sdmmc_storage_read(storage, 100, 64, buf));
+	CHECK(!memcmp(buf, mem + 100 * 512, 64 * 512));
+	CHECK(sdmmc_storage_read(storage, storage->sec_cnt - 1, 1, buf));
+	CHECK(!memcmp(buf, mem + (storage->sec_cnt - 1) * 512, 512));
+
+	//More than one 64KB descriptor.
+	for (u32 i = 0; i < 130 * 512; i++)
+		buf[i] = i * 7 + id;
+	CHECK(sdmmc_storage_write(storage, 1000, 130, buf));
+	CHECK(!memcmp(mem + 1000 * 512, buf, 130 * 512));
+	memset(buf, 0, 130 * 512);
+	CHECK(sdmmc_storage_read(storage, 1000, 130, buf));
+	CHECK(!memcmp(mem + 1000 * 512, buf, 130 * 512));
+
+	//Scattered buffers in one transfer.
+	sdmmc_iovec_t iov[3] = { { buf, 3 }, { buf + 0x10000, 17 }, { buf + 0x8000, 1 } };
+	memset(buf, 0, 256 * 512);
+	CHECK(sdmmc_storage_readv(storage, 5000, iov, 3));
+	CHECK(!memcmp(buf, mem + 5000 * 512, 3 * 512));
+	CHECK(!memcmp(buf + 0x10000, mem + 5003 * 512, 17 * 512));
+	CHECK(!memcmp(buf + 0x8000, mem + 5020 * 512, 512));
+
+	sdsim_get_stats(id, &after);
+	CHECK(after.read_blocks - before.read_blocks == 64 + 1 + 130 + 21);
+	CHECK(after.write_blocks - before.write_blocks == 130);
+	CHECK(!storage->err_stats.failed);
+	_check_clean(id);
+	free(buf);
+}
+
+static void _test_partition()
+{
+	u8 *buf = (u8 *)malloc(4 * 512);
+	sdsim_state_t state;
+
+	CHECK(sdmmc_storage_set_mmc_partition(&_emmc, 1));
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(state.partition == SDSIM_PART_BOOT0);
+	CHECK(sdmmc_storage_read(&_emmc, 0, 4, buf));
+	CHECK(!memcmp(buf, _emmc_card.part[SDSIM_PART_BOOT0], 4 * 512));
+	memset(buf, 0xA5, 512);
+	CHECK(sdmmc_storage_write(&_emmc, 0x100, 1, buf));
+	CHECK(!memcmp(_emmc_card.part[SDSIM_PART_BOOT0] + 0x100 * 512, buf, 512));
+
+	CHECK(sdmmc_storage_set_mmc_partition(&_emmc, 0));
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(state.partition == SDSIM_PART_USER);
+	CHECK(sdmmc_storage_read(&_emmc, 0x100, 1, buf));
+	CHECK(!memcmp(buf, _emmc_card.part[SDSIM_PART_USER] + 0x100 * 512, 512));
+
+	_check_clean(SDMMC_4);
+	free(buf);
+}
+
+static u32 _check_qios(const sdmmc_qio_t *ios, u32 num_ios)
+{
+	u32 bad = 0;
+	for (u32 i = 0; i < num_ios; i++)
+		if (memcmp(ios[i].buf, _emmc_card.part[SDSIM_PART_USER] + ios[i].sector * 512, ios[i].num_sectors * 512))
+			bad++;
+	return bad;
+}
+
+static void _test_queued()
+{
+	sdmmc_qio_t ios[40];
+	u8 *buf = (u8 *)malloc(40 * 64 * 512);
+	sdsim_stats_t before, after;
+	sdsim_state_t state;
+
+	//More reads than tasks, queued from the top down so the card readies them out of order.
+	for (u32 i = 0; i < 40; i++)
+	{
+		ios[i].sector = 0x10000 - i * 0x400;
+		ios[i].num_sectors = i ? 1 + i % 16 : 64;
+		ios[i].buf = buf + i * 64 * 512;
+	}
+	memset(buf, 0, 40 * 64 * 512);
+	sdsim_get_stats(SDMMC_4, &before);
+	CHECK(sdmmc_storage_read_queued(&_emmc, ios, 40));
+	sdsim_get_stats(SDMMC_4, &after);
+	CHECK(!_check_qios(ios, 40));
+	CHECK(after.cmdq_tasks - before.cmdq_tasks == 40);
+	CHECK(after.cmdq_out_of_order > before.cmdq_out_of_order);
+	CHECK(after.cmd_count[MMC_READ_MULTIPLE_BLOCK] == before.cmd_count[MMC_READ_MULTIPLE_BLOCK]);
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(!state.cmdq);
+
+	//Past the block count of a task the read takes two.
+	sdmmc_qio_t big[2] = { { 0x100, 0x10010, malloc(0x10010 * 512) }, { 0x1F000, 8, buf } };
+	sdsim_get_stats(SDMMC_4, &before);
+	CHECK(sdmmc_storage_read_queued(&_emmc, big, 2));
+	sdsim_get_stats(SDMMC_4, &after);
+	CHECK(!_check_qios(big, 2));
+	CHECK(after.cmdq_tasks - before.cmdq_tasks == 3);
+	free(big[0].buf);
+
+	//A failed batch is discarded and read again without the queue.
+	_emmc_card.cmdq_error = 1;
+	memset(buf, 0, 40 * 64 * 512);
+	sdsim_get_stats(SDMMC_4, &before);
+	CHECK(sdmmc_storage_read_queued(&_emmc, ios, 8));
+	sdsim_get_stats(SDMMC_4, &after);
+	CHECK(!_check_qios(ios, 8));
+	CHECK(after.cmd_count[MMC_CMDQ_TASK_MGMT] - before.cmd_count[MMC_CMDQ_TASK_MGMT] == 1);
+	CHECK(after.cmd_count[MMC_READ_MULTIPLE_BLOCK] - before.cmd_count[MMC_READ_MULTIPLE_BLOCK] == 8);
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(!state.cmdq);
+	CHECK(!_emmc.err_stats.failed);
+	_check_clean(SDMMC_4);
+
+	//Scattered small reads, the card reads several tasks in at once.
+	for (u32 i = 0; i < 32; i++)
+	{
+		ios[i].sector = 0x4000 + i * 0x333;
+		ios[i].num_sectors = 8;
+		ios[i].buf = buf + i * 8 * 512;
+	}
+	u32 start = host_now();
+	for (u32 i = 0; i < 32; i++)
+		sdmmc_storage_read(&_emmc, ios[i].sector, ios[i].num_sectors, ios[i].buf);
+	u32 plain_us = host_now() - start;
+	start = host_now();
+	CHECK(sdmmc_storage_read_queued(&_emmc, ios, 32));
+	u32 queued_us = host_now() - start;
+	CHECK(!_check_qios(ios, 32));
+	CHECK(queued_us < plain_us);
+	printf("emmc: 32 scattered 4KB reads, %u us plain, %u us queued\n", plain_us, queued_us);
+
+	free(buf);
+}
+
+static u32 _bench(sdmmc_storage_t *storage, const char *name)
+{
+	u32 chunk = 256;
+	u32 total = MIN(4096, storage->sec_cnt / chunk * chunk);
+	u8 *buf = (u8 *)malloc(chunk * 512);
+
+	u32 start = host_now();
+	for (u32 i = 0; i < total; i += chunk)
+		sdmmc_storage_read(storage, i, chunk, buf);
+	u32 us = host_now() - start;
+	u32 kbs = (u32)((u64)total * 512 * 1000000 / 1024 / (us ? us : 1));
+	printf("%s: %u KB/s reading %u KB chunks\n", name, kbs, chunk / 2);
+
+	free(buf);
+	return kbs;
+}
+
+static void _test_bench()
+{
+	//The bus peaks at 320MB/s in HS400 and 80MB/s in SDR104, the access time of each read takes some of that.
+	u32 emmc_kbs = _bench(&_emmc, "emmc");
+	u32 sd_kbs = _bench(&_sd, "sd");
+	CHECK(emmc_kbs > 150 * 1024 && emmc_kbs < 320 * 1024);
+	CHECK(sd_kbs > 40 * 1024 && sd_kbs < 82 * 1024);
+	CHECK(emmc_kbs > sd_kbs * 2);
+}
+
+static void _test_sd_end()
+{
+	//Unmounting the SD card must leave the eMMC controller alone.
+	u8 *buf = (u8 *)malloc(8 * 512);
+	CHECK(sdmmc_storage_end(&_sd));
+	CHECK(sdmmc_storage_read(&_emmc, 200, 8, buf));
+	CHECK(!memcmp(buf, _emmc_card.part[SDSIM_PART_USER] + 200 * 512, 8 * 512));
+	CHECK(!_emmc.err_stats.failed);
+	_check_clean(SDMMC_4);
+	free(buf);
+}
+
+static void _test_warm()
+{
+	//Power cycle both cards, the saved taps skip tuning.
+	sdmmc_storage_end(&_emmc);
+	sdsim_attach(SDMMC_4, &_emmc_card);
+	sdsim_attach(SDMMC_1, &_sd_card);
+	sdsim_clear_stats(SDMMC_4);
+	sdsim_clear_stats(SDMMC_1);
+
+	_init_both();
+	CHECK(_emmc_init.res == SDMMC_INIT_DONE && _emmc.bus_type == 4);
+	CHECK(_sd_init.res == SDMMC_INIT_DONE && _sd.bus_type == 11);
+	sdsim_stats_t stats;
+	sdsim_get_stats(SDMMC_4, &stats);
+	CHECK(!stats.tunings);
+	sdsim_get_stats(SDMMC_1, &stats);
+	CHECK(!stats.tunings);
+	_check_clean(SDMMC_4);
+	_check_clean(SDMMC_1);
+	_test_rw(&_emmc, &_emmc_card, SDMMC_4);
+
+	//The eMMC's window moved, the saved tap fails its check and tuning runs again.
+	sdmmc_storage_end(&_emmc);
+	sdmmc_storage_end(&_sd);
+	_emmc_card.tap_lo = 0x08;
+	_emmc_card.tap_hi = 0x20;
+	sdsim_attach(SDMMC_4, &_emmc_card);
+	sdsim_attach(SDMMC_1, &_sd_card);
+	sdsim_clear_stats(SDMMC_4);
+
+	_init_both();
+	CHECK(_emmc_init.res == SDMMC_INIT_DONE && _emmc.bus_type == 4);
+	sdsim_get_stats(SDMMC_4, &stats);
+	CHECK(stats.tunings == 1);
+	CHECK(!stats.violations);
+	sdsim_state_t state;
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(state.tap >= 0x08 && state.tap <= 0x20);
+	sdsim_clear_stats(SDMMC_4);
+	_test_rw(&_emmc, &_emmc_card, SDMMC_4);
+}
+
+//With image paths only bring up the cards and time reads, nothing is written to them.
+static void _run_images(int argc, char **argv)
+{
+	if (!sdsim_card_load(&_emmc_card, SDSIM_PART_USER, argv[1]))
+	{
+		printf("can't load %s\n", argv[1]);
+		CHECK(0);
+		return;
+	}
+	if (argc > 2 && !sdsim_card_load(&_sd_card, SDSIM_PART_USER, argv[2]))
+	{
+		printf("can't load %s\n", argv[2]);
+		CHECK(0);
+		return;
+	}
+	sdsim_attach(SDMMC_4, &_emmc_card);
+	sdsim_attach(SDMMC_1, &_sd_card);
+
+	printf("init: %u us\n", _init_both());
+	CHECK(_emmc_init.res == SDMMC_INIT_DONE);
+	CHECK(_sd_init.res == SDMMC_INIT_DONE);
+	if (_emmc_init.res == SDMMC_INIT_DONE)
+		_bench(&_emmc, "emmc");
+	if (_sd_init.res == SDMMC_INIT_DONE)
+		_bench(&_sd, "sd");
+}
+
+void test_main(int argc, char **argv)
+{
+	sdsim_init();
+	sdsim_card_init(&_emmc_card, 0, EMMC_SECTORS);
+	sdsim_card_init(&_sd_card, 1, SD_SECTORS);
+
+	if (argc > 1)
+	{
+		_run_images(argc, argv);
+		return;
+	}
+
+	_test_init();
+	_test_rw(&_emmc, &_emmc_card, SDMMC_4);
+	_test_rw(&_sd, &_sd_card, SDMMC_1);
+	_test_partition();
+	_test_queued();
+	_test_bench();
+	_test_sd_end();
+	_test_warm();
+}
@@ -0,0 +1,289 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "sdsim.h"
+#include "sdmmc.h"
+#include "t210.h"
+#include "mmc.h"
+#include "sd.h"
+#include "util.h"
+
+#define EMMC_SECTORS 0x20000
+#define SD_SECTORS 0x10000
+#define MAX_XFERS 64
+
+typedef struct _xfer_t
+{
+	u32 sector;
+	u32 num_sectors;
+} xfer_t;
+
+static sdsim_card_t _emmc_card;
+static sdsim_card_t _sd_card;
+static sdmmc_t _emmc_sdmmc;
+static sdmmc_t _sd_sdmmc;
+static sdmmc_storage_t _emmc;
+static sdmmc_storage_t _sd;
+
+//Transfers the driver started, the scripted faults fail the first ones and the bad sector every one covering it.
+static xfer_t _xfers[MAX_XFERS];
+static u32 _num_xfers;
+static u32 _fault;
+static u32 _num_faults;
+static u32 _bad_sector;
+static u32 _bad_fault;
+
+//The SD slot's regulator sits behind I2C, which is not modelled.
+int max77620_regulator_set_voltage(u32 id, u32 mv)
+{
+	return 1;
+}
+
+int max77620_regulator_enable(u32 id, int enable)
+{
+	return 1;
+}
+
+u32 sdmmc_fault_inject(sdmmc_storage_t *storage, u32 sector, u32 num_sectors, u32 is_write)
+{
+	if (_num_xfers < MAX_XFERS)
+	{
+		_xfers[_num_xfers].sector = sector;
+		_xfers[_num_xfers].num_sectors = num_sectors;
+	}
+	_num_xfers++;
+
+	if (_num_faults)
+	{
+		_num_faults--;
+		return _fault;
+	}
+	if (_bad_sector - sector < num_sectors)
+		return _bad_fault;
+	return 0;
+}
+
+static void _fill(sdsim_card_t *card, u32 seed)
+{
+	u32 *p = (u32 *)card->part[SDSIM_PART_USER];
+	for (u32 i = 0; i < card->part_sectors[SDSIM_PART_USER] * 128; i++)
+		p[i] = (i * 0x9E3779B1) ^ seed;
+}
+
+static void _script(sdmmc_storage_t *storage, u32 fault, u32 count)
+{
+	memset(&storage->err_stats, 0, sizeof(sdmmc_err_stats_t));
+	_num_xfers = 0;
+	_fault = fault;
+	_num_faults = count;
+	_bad_sector = 0xFFFFFFFF;
+}
+
+static int _xfer_is(u32 i, u32 sector, u32 num_sectors)
+{
+	return i < _num_xfers && _xfers[i].sector == sector && _xfers[i].num_sectors == num_sectors;
+}
+
+static int _read_ok(sdmmc_storage_t *storage, sdsim_card_t *card, u32 sector, u32 num_sectors)
+{
+	u8 *buf = (u8 *)malloc(num_sectors * 512);
+	memset(buf, 0, num_sectors * 512);
+	int res = sdmmc_storage_read(storage, sector, num_sectors, buf) &&
+		!memcmp(buf, card->part[SDSIM_PART_USER] + sector * 512, num_sectors * 512);
+	free(buf);
+	return res;
+}
+
+static u32 _tunings(u32 id)
+{
+	sdsim_stats_t stats;
+	sdsim_get_stats(id, &stats);
+	return stats.tunings;
+}
+
+static void _test_retry()
+{
+	//A CRC error on its own is retried right away, nothing else happens.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_CRC, 1);
+	u32 start = host_now();
+	CHECK(_read_ok(&_emmc, &_emmc_card, 100, 64));
+	CHECK(host_now() - start < 1000);
+	CHECK(_num_xfers == 2 && _xfer_is(1, 100, 64));
+	CHECK(_emmc.err_stats.errors[SDMMC_ERR_CRC] == 1);
+	CHECK(!_emmc.err_stats.retunes && !_emmc.err_stats.step_downs && !_emmc.err_stats.splits);
+	CHECK(!_emmc.err_stats.failed && _emmc.bus_type == 4);
+
+	//Same for writes.
+	u8 *buf = (u8 *)malloc(8 * 512);
+	for (u32 i = 0; i < 8 * 512; i++)
+		buf[i] = i * 3;
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_END_BIT, 1);
+	CHECK(sdmmc_storage_write(&_emmc, 2000, 8, buf));
+	CHECK(!memcmp(_emmc_card.part[SDSIM_PART_USER] + 2000 * 512, buf, 8 * 512));
+	CHECK(_num_xfers == 2 && _emmc.err_stats.errors[SDMMC_ERR_END_BIT] == 1);
+	free(buf);
+}
+
+static void _test_backoff()
+{
+	//Timeouts wait 1, 2 and then 4ms before the next try.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT, 3);
+	u32 start = host_now();
+	CHECK(_read_ok(&_emmc, &_emmc_card, 300, 1));
+	u32 us = host_now() - start;
+	CHECK(us >= 7000 && us < 8000);
+	CHECK(_num_xfers == 4);
+	CHECK(_emmc.err_stats.errors[SDMMC_ERR_TIMEOUT] == 3);
+	CHECK(!_emmc.err_stats.bad_sector && !_emmc.err_stats.failed);
+
+	//DMA errors back off too, the delay starts over after a transfer went through.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_ADMA_ERROR, 1);
+	start = host_now();
+	CHECK(_read_ok(&_emmc, &_emmc_card, 300, 1));
+	us = host_now() - start;
+	CHECK(us >= 1000 && us < 2000);
+	CHECK(_emmc.err_stats.errors[SDMMC_ERR_DMA] == 1);
+
+	//A card that keeps timing out is given up on without bisecting it down to single sectors.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_TIMEOUT, 100);
+	start = host_now();
+	CHECK(!_read_ok(&_emmc, &_emmc_card, 300, 64));
+	us = host_now() - start;
+	CHECK(_num_xfers == 6);
+	CHECK(us >= 1000 + 2000 + 4000 + 8000 + 16000);
+	CHECK(_emmc.err_stats.failed == 1 && !_emmc.err_stats.bad_sector);
+	CHECK(_emmc.err_stats.errors[SDMMC_ERR_TIMEOUT] == 6);
+	_num_faults = 0;
+}
+
+static void _test_retune()
+{
+	sdsim_state_t state;
+
+	//HS400 cannot be tuned, the second CRC error in a row steps down to HS200 which tunes on the way.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_CRC, 2);
+	u32 tunings = _tunings(SDMMC_4);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 400, 1));
+	CHECK(_emmc.err_stats.step_downs == 1 && !_emmc.err_stats.retunes);
+	CHECK(_emmc.bus_type == 3);
+	CHECK(_tunings(SDMMC_4) == tunings + 1);
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(state.timing == EXT_CSD_TIMING_HS200 && !state.ddr && state.width == 8);
+	CHECK(state.card_state == R1_STATE_TRAN);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 0, 256));
+
+	//HS200 re-tunes on the second one and steps down to HS on the third.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_CRC, 2);
+	tunings = _tunings(SDMMC_4);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 400, 1));
+	CHECK(_emmc.err_stats.retunes == 1 && !_emmc.err_stats.step_downs);
+	CHECK(_emmc.bus_type == 3);
+	CHECK(_tunings(SDMMC_4) == tunings + 1);
+
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_DATA_CRC, 3);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 400, 1));
+	CHECK(_emmc.err_stats.retunes == 1 && _emmc.err_stats.step_downs == 1);
+	CHECK(_emmc.err_stats.errors[SDMMC_ERR_CRC] == 3);
+	CHECK(_emmc.bus_type == 2);
+	sdsim_get_state(SDMMC_4, &state);
+	CHECK(state.timing == EXT_CSD_TIMING_HS && state.khz <= 52000);
+	CHECK(state.card_state == R1_STATE_TRAN);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 0, 256));
+
+	//SDR104 re-tunes and then steps down to SDR50.
+	_script(&_sd, TEGRA_MMC_ERRINTSTS_DATA_CRC, 3);
+	tunings = _tunings(SDMMC_1);
+	CHECK(_read_ok(&_sd, &_sd_card, 400, 1));
+	CHECK(_sd.err_stats.retunes == 1 && _sd.err_stats.step_downs == 1);
+	CHECK(_sd.bus_type == 10);
+	CHECK(_tunings(SDMMC_1) == tunings + 2);
+	sdsim_get_state(SDMMC_1, &state);
+	CHECK(state.timing == UHS_SDR50_BUS_SPEED && state.khz <= 100000);
+	CHECK(state.card_state == R1_STATE_TRAN);
+	CHECK(_read_ok(&_sd, &_sd_card, 0, 256));
+
+	sdsim_stats_t stats;
+	sdsim_get_stats(SDMMC_4, &stats);
+	CHECK(!stats.violations && !stats.illegal);
+	sdsim_get_stats(SDMMC_1, &stats);
+	CHECK(!stats.violations && !stats.illegal);
+}
+
+static void _test_split()
+{
+	//A range failing twice is halved, the sectors past it go back to full size.
+	_script(&_emmc, TEGRA_MMC_ERRINTSTS_ADMA_ERROR, 2);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 500, 64));
+	CHECK(_emmc.err_stats.splits == 1);
+	CHECK(_num_xfers == 4);
+	CHECK(_xfer_is(0, 500, 64) && _xfer_is(1, 500, 64));
+	CHECK(_xfer_is(2, 500, 32) && _xfer_is(3, 532, 32));
+	CHECK(!_emmc.err_stats.failed);
+
+	_script(&_emmc, 0, 0);
+	CHECK(_read_ok(&_emmc, &_emmc_card, 500, 64));
+	CHECK(_num_xfers == 1 && _xfer_is(0, 500, 64));
+}
+
+static void _test_bad_sector()
+{
+	//One sector that always fails, the range is bisected down to it and the sectors before it are read.
+	u8 *buf = (u8 *)malloc(64 * 512);
+	memset(buf, 0, 64 * 512);
+	_script(&_emmc, 0, 0);
+	_bad_sector = 1017;
+	_bad_fault = TEGRA_MMC_ERRINTSTS_ADMA_ERROR;
+	CHECK(!sdmmc_storage_read(&_emmc, 1000, 64, buf));
+	CHECK(_emmc.err_stats.bad_sector == 1017);
+	CHECK(_emmc.err_stats.failed == 1);
+	CHECK(_emmc.err_stats.splits == 6);
+	CHECK(_emmc.err_stats.errors[SDMMC_ERR_DMA] == 6 * 2 + 4);
+	CHECK(!memcmp(buf, _emmc_card.part[SDSIM_PART_USER] + 1000 * 512, 17 * 512));
+	CHECK(_xfer_is(_num_xfers - 1, 1017, 1));
+
+	//Reads around it are fine.
+	CHECK(_read_ok(&_emmc, &_emmc_card, 1000, 17));
+	CHECK(_read_ok(&_emmc, &_emmc_card, 1018, 46));
+	_bad_sector = 0xFFFFFFFF;
+	free(buf);
+}
+
+void test_main(int argc, char **argv)
+{
+	sdsim_init();
+	sdsim_card_init(&_emmc_card, 0, EMMC_SECTORS);
+	sdsim_card_init(&_sd_card, 1, SD_SECTORS);
+	_fill(&_emmc_card, 0x454D4D43);
+	_fill(&_sd_card, 0x53444344);
+	sdsim_attach(SDMMC_4, &_emmc_card);
+	sdsim_attach(SDMMC_1, &_sd_card);
+
+	_script(&_emmc, 0, 0);
+	CHECK(sdmmc_storage_init_mmc(&_emmc, &_emmc_sdmmc, SDMMC_4, SDMMC_BUS_WIDTH_8, 4));
+	CHECK(sdmmc_storage_init_sd(&_sd, &_sd_sdmmc, SDMMC_1, SDMMC_BUS_WIDTH_4, 11));
+	CHECK(_emmc.bus_type == 4 && _sd.bus_type == 11);
+
+	_test_retry();
+	_test_backoff();
+	_test_split();
+	_test_bad_sector();
+	_test_retune();
+}
@@ -0,0 +1,342 @@
+/*
+* Copyright (c) 2018 StevenMattera
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "sesim.h"
+#include "se.h"
+
+#define KS_DATA 12
+#define KS_TWEAK 13
+
+//IEEE 1619-2007 XTS-AES-128 vectors, Key1 encrypts the data and Key2 the tweak.
+typedef struct _xts_vec_t
+{
+	const char *key1;
+	const char *key2;
+	u64 seq;
+	const char *ptx; //NULL for 00..FF repeated.
+	const char *ctx;
+	u32 size;
+} xts_vec_t;
+
+static const xts_vec_t _xts_vecs[] = {
+	{ "00000000000000000000000000000000", "00000000000000000000000000000000", 0,
+		"0000000000000000000000000000000000000000000000000000000000000000",
+		"917cf69ebd68b2ec9b9fe9a3eadda692cd43d2f59598ed858c02c2652fbf922e", 0x20 },
+	{ "11111111111111111111111111111111", "22222222222222222222222222222222", 0x3333333333ULL,
+		"4444444444444444444444444444444444444444444444444444444444444444",
+		"c454185e6a16936e39334038acef838bfb186fff7480adc4289382ecd6d394f0", 0x20 },
+	{ "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0", "22222222222222222222222222222222", 0x3333333333ULL,
+		"4444444444444444444444444444444444444444444444444444444444444444",
+		"af85336b597afc1a900b2eb21ec949d292df4c047e0b21532186a5971a227a89", 0x20 },
+	{ "27182818284590452353602874713526", "31415926535897932384626433832795", 0, NULL,
+		"27a7479befa1d476489f308cd4cfa6e2a96e4bbe3208ff25287dd3819616e89c"
+		"c78cf7f5e543445f8333d8fa7f56000005279fa5d8b5e4ad40e736ddb4d35412"
+		"328063fd2aab53e5ea1e0a9f332500a5df9487d07a5c92cc512c8866c7e860ce"
+		"93fdf166a24912b422976146ae20ce846bb7dc9ba94a767aaef20c0d61ad0265"
+		"5ea92dc4c4e41a8952c651d33174be51a10c421110e6d81588ede82103a252d8"
+		"a750e8768defffed9122810aaeb99f9172af82b604dc4b8e51bcb08235a6f434"
+		"1332e4ca60482a4ba1a03b3e65008fc5da76b70bf1690db4eae29c5f1badd03c"
+		"5ccf2a55d705ddcd86d449511ceb7ec30bf12b1fa35b913f9f747a8afd1b130e"
+		"94bff94effd01a91735ca1726acd0b197c4e5b03393697e126826fb6bbde8ecc"
+		"1e08298516e2c9ed03ff3c1b7860f6de76d4cecd94c8119855ef5297ca67e9f3"
+		"e7ff72b1e99785ca0a7e7720c5b36dc6d72cac9574c8cbbc2f801e23e56fd344"
+		"b07f22154beba0f08ce8891e643ed995c94d9a69c9f1b5f499027a78572aeebd"
+		"74d20cc39881c213ee770b1010e4bea718846977ae119f7a023ab58cca0ad752"
+		"afe656bb3c17256a9f6e9bf19fdd5a38fc82bbe872c5539edb609ef4f79c203e"
+		"bb140f2e583cb2ad15b4aa5b655016a8449277dbd477ef2c8d6c017db738b18d"
+		"eb4a427d1923ce3ff262735779a418f20a282df920147beabe421ee5319d0568", 0x200 }
+};
+
+static void _hex(u8 *dst, const char *hex, u32 size)
+{
+	for (u32 i = 0; i < size; i++)
+		sscanf(hex + 2 * i, "%2hhx", &dst[i]);
+}
+
+static void _mul_x(u8 *t)
+{
+	u32 carry = 0;
+	for (u32 i = 0; i < 0x10; i++)
+	{
+		u8 b = t[i];
+		t[i] = (b << 1) | carry;
+		carry = b >> 7;
+	}
+	if (carry)
+		t[0] ^= 0x87;
+}
+
+//Plain per-block XTS, IEEE puts the data unit number in little endian, Nintendo in big endian.
+static void _xts_ref(const u8 *key1, const u8 *key2, int enc, int be, u64 seq, u8 *dst, const u8 *src, u32 secsize, u32 num_secs)
+{
+	for (u32 s = 0; s < num_secs; s++, seq++)
+	{
+		u8 t[0x10];
+		memset(t, 0, 0x10);
+		for (u32 i = 0; i < 8; i++)
+			t[be ? 0xF - i : i] = seq >> (8 * i);
+		sesim_aes128(key2, 1, t, t);
+
+		for (u32 off = 0; off < secsize; off += 0x10)
+		{
+			u8 blk[0x10];
+			for (u32 i = 0; i < 0x10; i++)
+				blk[i] = src[off + i] ^ t[i];
+			sesim_aes128(key1, enc, blk, blk);
+			for (u32 i = 0; i < 0x10; i++)
+				dst[off + i] = blk[i] ^ t[i];
+			_mul_x(t);
+		}
+		src += secsize;
+		dst += secsize;
+	}
+}
+
+static void _vec_load(const xts_vec_t *vec, u8 *key1, u8 *key2, u8 *ptx, u8 *ctx)
+{
+	_hex(key1, vec->key1, 0x10);
+	_hex(key2, vec->key2, 0x10);
+	for (u32 i = 0; i < vec->size; i++)
+		ptx[i] = i;
+	if (vec->ptx)
+		_hex(ptx, vec->ptx, vec->size);
+	_hex(ctx, vec->ctx, vec->size);
+}
+
+static void _test_aes()
+{
+	//FIPS-197 appendix C.1.
+	u8 key[0x10], ptx[0x10], ctx[0x10], buf[0x10];
+	_hex(key, "000102030405060708090a0b0c0d0e0f", 0x10);
+	_hex(ptx, "00112233445566778899aabbccddeeff", 0x10);
+	_hex(ctx, "69c4e0d86a7b0430d8cdb78070b4c55a", 0x10);
+	sesim_aes128(key, 1, buf, ptx);
+	CHECK(!memcmp(buf, ctx, 0x10));
+	sesim_aes128(key, 0, buf, ctx);
+	CHECK(!memcmp(buf, ptx, 0x10));
+
+	//Same through the engine.
+	se_aes_key_set(KS_DATA, key, 0x10);
+	CHECK(se_aes_crypt_block_ecb(KS_DATA, 1, buf, ptx) && !memcmp(buf, ctx, 0x10));
+	CHECK(se_aes_crypt_block_ecb(KS_DATA, 0, buf, ctx) && !memcmp(buf, ptx, 0x10));
+
+	//FIPS 180-2 "abc".
+	u8 digest[0x20], expected[0x20];
+	_hex(expected, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", 0x20);
+	CHECK(se_calc_sha256(digest, "abc", 3) && !memcmp(digest, expected, 0x20));
+}
+
+static void _test_xts_ref()
+{
+	u8 key1[0x10], key2[0x10], ptx[0x200], ctx[0x200], buf[0x200];
+
+	//The reference itself has to reproduce all vectors, including the non-zero data unit numbers.
+	for (u32 v = 0; v < sizeof(_xts_vecs) / sizeof(xts_vec_t); v++)
+	{
+		const xts_vec_t *vec = &_xts_vecs[v];
+		_vec_load(vec, key1, key2, ptx, ctx);
+		_xts_ref(key1, key2, 1, 0, vec->seq, buf, ptx, vec->size, 1);
+		CHECK(!memcmp(buf, ctx, vec->size));
+		_xts_ref(key1, key2, 0, 0, vec->seq, buf, ctx, vec->size, 1);
+		CHECK(!memcmp(buf, ptx, vec->size));
+	}
+
+	//Vector 5 is vector 4's ciphertext encrypted again as data unit 1.
+	u8 ctx5[0x20];
+	_vec_load(&_xts_vecs[3], key1, key2, ptx, ctx);
+	_hex(ctx5, "264d3ca8512194fec312c8c9891f279fefdd608d0c027b60483a3fa811d65ee5", 0x20);
+	_xts_ref(key1, key2, 1, 0, 1, buf, ctx, 0x200, 1);
+	CHECK(!memcmp(buf, ctx5, 0x20));
+}
+
+static void _test_xts_vectors()
+{
+	u8 key1[0x10], key2[0x10], ptx[0x200], ctx[0x200], buf[0x200];
+
+	//Data unit 0 reads the same in either tweak byte order.
+	for (u32 v = 0; v < sizeof(_xts_vecs) / sizeof(xts_vec_t); v++)
+	{
+		const xts_vec_t *vec = &_xts_vecs[v];
+		if (vec->seq)
+			continue;
+		_vec_load(vec, key1, key2, ptx, ctx);
+		se_aes_key_set(KS_DATA, key1, 0x10);
+		se_aes_key_set(KS_TWEAK, key2, 0x10);
+
+		CHECK(se_aes_xts_crypt_sec(KS_TWEAK, KS_DATA, 1, 0, buf, ptx, vec->size) && !memcmp(buf, ctx, vec->size));
+		CHECK(se_aes_xts_crypt_sec(KS_TWEAK, KS_DATA, 0, 0, buf, ctx, vec->size) && !memcmp(buf, ptx, vec->size));
+		//In place, as the NAND reads use it.
+		memcpy(buf, ptx, vec->size);
+		CHECK(se_aes_xts_crypt_sec(KS_TWEAK, KS_DATA, 1, 0, buf, buf, vec->size) && !memcmp(buf, ctx, vec->size));
+	}
+}
+
+static void _test_xts_batches()
+{
+	//Sector sizes around the batch size and counts that leave partial batches, against the per-block reference.
+	static const u32 secsizes[] = { 0x10, 0x200, 0x1000, 0x4000 };
+	static const u32 counts[] = { 1, 2, 31, 32, 33, 100 };
+	u8 key1[0x10], key2[0x10];
+	_hex(key1, "27182818284590452353602874713526", 0x10);
+	_hex(key2, "31415926535897932384626433832795", 0x10);
+	se_aes_key_set(KS_DATA, key1, 0x10);
+	se_aes_key_set(KS_TWEAK, key2, 0x10);
+
+	u32 max_size = 0x4000 * 100;
+	u8 *ptx = (u8 *)malloc(max_size);
+	u8 *ref = (u8 *)malloc(max_size);
+	u8 *buf = (u8 *)malloc(max_size);
+	srand(5);
+	for (u32 i = 0; i < max_size; i++)
+		ptx[i] = rand();
+
+	int ok = 1;
+	for (u32 s = 0; s < sizeof(secsizes) / sizeof(u32); s++)
+	{
+		for (u32 c = 0; c < sizeof(counts) / sizeof(u32); c++)
+		{
+			//Start right below a byte carry of the sector number.
+			u64 sec = 0x12345FFULL - counts[c] / 2;
+			u32 size = secsizes[s] * counts[c];
+			_xts_ref(key1, key2, 1, 1, sec, ref, ptx, secsizes[s], counts[c]);
+			ok &= se_aes_xts_crypt(KS_TWEAK, KS_DATA, 1, sec, buf, ptx, secsizes[s], counts[c]);
+			ok &= !memcmp(buf, ref, size);
+			ok &= se_aes_xts_crypt(KS_TWEAK, KS_DATA, 0, sec, buf, buf, secsizes[s], counts[c]);
+			ok &= !memcmp(buf, ptx, size);
+			if (!ok)
+			{
+				printf("xts mismatch: sector size %X, %u sectors\n", secsizes[s], counts[c]);
+				break;
+			}
+		}
+	}
+	CHECK(ok);
+
+	//Sectors larger than a batch aren't supported.
+	CHECK(!se_aes_xts_crypt(KS_TWEAK, KS_DATA, 1, 0, buf, ptx, 0x8000, 1));
+
+	free(ptx);
+	free(ref);
+	free(buf);
+}
+
+//Scatter-gather CTR against the plain one over the same bytes laid out contiguously.
+static int _ctr_sg_check(const u32 *sizes, const u32 *misalign, u32 num_frags, const u8 *ctr)
+{
+	u32 total = 0;
+	for (u32 i = 0; i < num_frags; i++)
+		total += sizes[i];
+
+	u8 *ptx = (u8 *)malloc(total);
+	u8 *ref = (u8 *)malloc(total + 0x10);
+	u8 *buf = (u8 *)malloc(total + 0x10);
+	u8 *pool = (u8 *)malloc(total + 4 * num_frags);
+	se_frag_t *frags = (se_frag_t *)malloc(sizeof(se_frag_t) * num_frags);
+	for (u32 i = 0; i < total; i++)
+		ptx[i] = rand();
+
+	//Each fragment in its own spot, word aligned plus the requested offset.
+	u8 *p = pool;
+	u32 off = 0;
+	for (u32 i = 0; i < num_frags; i++)
+	{
+		frags[i].src = p + misalign[i];
+		frags[i].size = sizes[i];
+		memcpy(p + misalign[i], ptx + off, sizes[i]);
+		off += sizes[i];
+		p += (misalign[i] + sizes[i] + 3) & ~3;
+	}
+
+	u8 ctr_ref[0x10];
+	memcpy(ctr_ref, ctr, 0x10);
+	memset(buf + total, 0xA5, 0x10);
+	int ok = se_aes_crypt_ctr(KS_DATA, ref, total, ptx, total, ctr_ref);
+	ok &= se_aes_crypt_ctr_sg(KS_DATA, buf, frags, num_frags, ctr);
+	ok &= !memcmp(buf, ref, total);
+	//Nothing is written past the end, a trailing partial block included.
+	for (u32 i = 0; i < 0x10; i++)
+		ok &= buf[total + i] == 0xA5;
+
+	free(ptx);
+	free(ref);
+	free(buf);
+	free(pool);
+	free(frags);
+	return ok;
+}
+
+static void _test_ctr_sg()
+{
+	u8 key[0x10], ctr[0x10];
+	_hex(key, "2b7e151628aed2a6abf7158809cf4f3c", 0x10);
+	//Low counter bytes right below a carry.
+	_hex(ctr, "f0f1f2f3f4f5f6f7f8f9fafbfcfdfffd", 0x10);
+	se_aes_key_set(KS_DATA, key, 0x10);
+	srand(7);
+
+	//Odd sizes, blocks straddling fragments and sub-block fragments stitched together over several of them.
+	static const u32 odd_sizes[] = { 0x23, 5, 3, 4, 0x3F1, 0x10, 7, 0x200, 1, 0x8F, 0x20 };
+	static const u32 odd_misalign[] = { 0, 1, 2, 3, 1, 0, 3, 2, 1, 0, 3 };
+	CHECK(_ctr_sg_check(odd_sizes, odd_misalign, sizeof(odd_sizes) / sizeof(u32), ctr));
+
+	//A single fragment below a block.
+	static const u32 tiny_sizes[] = { 0xB };
+	static const u32 tiny_misalign[] = { 2 };
+	CHECK(_ctr_sg_check(tiny_sizes, tiny_misalign, 1, ctr));
+
+	//More whole-block fragments than one linked list holds, runs are flushed and continued at their counter offset.
+	u32 sizes[100], misalign[100];
+	for (u32 i = 0; i < 40; i++)
+	{
+		sizes[i] = 0x30;
+		misalign[i] = 0;
+	}
+	CHECK(_ctr_sg_check(sizes, misalign, 40, ctr));
+
+	//Random layouts, KIP1 sizes are arbitrary and their buffers only byte aligned.
+	int ok = 1;
+	for (u32 r = 0; r < 20; r++)
+	{
+		u32 num_frags = 17 + rand() % 80;
+		for (u32 i = 0; i < num_frags; i++)
+		{
+			sizes[i] = 1 + rand() % 0x90;
+			misalign[i] = rand() % 4;
+		}
+		ok &= _ctr_sg_check(sizes, misalign, num_frags, ctr);
+	}
+	CHECK(ok);
+}
+
+void test_main(int argc, char **argv)
+{
+	sesim_init();
+
+	_test_aes();
+	_test_xts_ref();
+	_test_xts_vectors();
+	_test_xts_batches();
+	_test_ctr_sg();
+
+	sesim_stats_t stats;
+	sesim_get_stats(&stats);
+	CHECK(!stats.busy_writes);
+}